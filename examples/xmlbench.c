@@ -0,0 +1,283 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Benchmark the I/O strategies of xmlOpenOptions to pick the thresholds
+ * used by XML_IO_AUTO.
+ *
+ * For a range of file sizes a test document is generated and opened, queried
+ * and closed repeatedly using every strategy. The files stay in the page
+ * cache so the results show the cost of the system calls and page faults,
+ * not of the storage device.
+ *
+ * When the library is built with zlib opening a gzip compressed document is
+ * compared to decompressing it to a file first and opening that file.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#if HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+
+#include "xml.h"
+
+#define MIN_SIZE	1024
+#define MAX_SIZE	(64*1024*1024)
+#define MIN_TIME	0.2
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int create_file(const char *fname, long size)
+{
+  FILE *f = fopen(fname, "w");
+  long len = 0;
+  int i = 0;
+
+  if (!f) return 0;
+
+  len += fprintf(f, "<?xml version=\"1.0\"?>\n<bench>\n");
+  while (len < size-32) {
+    len += fprintf(f, "  <item n=\"%i\"><value>%i</value></item>\n", i, i);
+    i++;
+  }
+  fprintf(f, "</bench>\n");
+  fclose(f);
+
+  return 1;
+}
+
+/* average time in micro seconds to open, query and close the file */
+static double run(const char *fname, enum xmlFlags flags, int io)
+{
+  xmlOptions options;
+  double start, end;
+  int n = 0;
+
+  memset(&options, 0, sizeof(options));
+  options.flags = flags;
+  options.io.flags = io;
+  options.io.read_max = MAX_SIZE;
+
+  start = now();
+  do
+  {
+    xmlId *xid = xmlOpenOptions(fname, &options);
+    if (!xid) return -1.0;
+    xmlNodeGetInt(xid, "/bench/item/value");
+    xmlClose(xid);
+    end = now();
+    n++;
+  }
+  while (end-start < MIN_TIME);
+
+  return 1e6*(end-start)/n;
+}
+
+#if HAVE_ZLIB_H
+static int compress_file(const char *src, const char *dst)
+{
+  char buf[65536];
+  gzFile gz;
+  FILE *f;
+  size_t n;
+
+  f = fopen(src, "rb");
+  if (!f) return 0;
+  gz = gzopen(dst, "wb");
+  if (!gz) { fclose(f); return 0; }
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) gzwrite(gz, buf, (unsigned)n);
+  gzclose(gz);
+  fclose(f);
+
+  return 1;
+}
+
+/* average time in micro seconds to decompress to a file, open, query and close */
+static double run_decompress(const char *gzname, const char *fname)
+{
+  double start, end;
+  int n = 0;
+
+  start = now();
+  do
+  {
+    char buf[65536];
+    xmlId *xid;
+    gzFile gz;
+    FILE *f;
+    int len;
+
+    gz = gzopen(gzname, "rb");
+    f = fopen(fname, "wb");
+    if (!gz || !f) return -1.0;
+    while ((len = gzread(gz, buf, sizeof(buf))) > 0) fwrite(buf, 1, len, f);
+    fclose(f);
+    gzclose(gz);
+
+    xid = xmlOpenFlags(fname, XML_SCAN_NODES);
+    if (!xid) return -1.0;
+    xmlNodeGetInt(xid, "/bench/item/value");
+    xmlClose(xid);
+    remove(fname);
+    end = now();
+    n++;
+  }
+  while (end-start < MIN_TIME);
+
+  return 1e6*(end-start)/n;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+  const char *dir = (argc > 1) ? argv[1] : "/tmp";
+  char fname[1024];
+  long read_max = 0, populate_min = 0;
+  int done = 0;
+  long size;
+
+  snprintf(fname, sizeof(fname), "%s/xmlbench-%i.xml", dir, (int)getpid());
+
+  printf("XML_SCAN_NODES: open, look up the first node and close (us)\n");
+  printf("%10s %12s %12s %12s\n", "size", "read", "mmap", "populate");
+  for (size = MIN_SIZE; size <= MAX_SIZE; size *= 2)
+  {
+    double rd, mm, pop;
+
+    if (!create_file(fname, size))
+    {
+      printf("unable to create '%s'\n", fname);
+      return -1;
+    }
+
+    rd = run(fname, XML_SCAN_NODES, XML_IO_READ);
+    mm = run(fname, XML_SCAN_NODES, XML_IO_MMAP);
+    pop = run(fname, XML_SCAN_NODES, XML_IO_MMAP|XML_IO_POPULATE);
+    printf("%10li %12.1f %12.1f %12.1f\n", size, rd, mm, pop);
+
+    if (rd < mm && !done) read_max = size;
+    else done = 1;
+  }
+
+  printf("\nXML_CACHE_NODES: open, build the node cache and close (us)\n");
+  printf("%10s %12s %12s %12s %12s\n", "size", "read", "mmap", "populate",
+                                       "sequential");
+  done = 0;
+  for (size = MAX_SIZE; size >= MIN_SIZE*64; size /= 4)
+  {
+    double rd, mm, pop, seq;
+
+    create_file(fname, size);
+    rd = run(fname, XML_CACHE_NODES, XML_IO_READ);
+    mm = run(fname, XML_CACHE_NODES, XML_IO_MMAP);
+    pop = run(fname, XML_CACHE_NODES, XML_IO_MMAP|XML_IO_POPULATE);
+    seq = run(fname, XML_CACHE_NODES, XML_IO_MMAP|XML_IO_SEQUENTIAL);
+    printf("%10li %12.1f %12.1f %12.1f %12.1f\n", size, rd, mm, pop, seq);
+
+    if (pop < mm && !done) populate_min = size;
+    else done = 1;
+  }
+
+#if HAVE_ZLIB_H
+  printf("\ngzip compressed: decompress, open, look up the first node and close (us)\n");
+  printf("%10s %12s %12s\n", "size", "xmlOpen", "to a file");
+  for (size = MIN_SIZE*64; size <= MAX_SIZE; size *= 4)
+  {
+    char gzname[sizeof(fname)+4], tmpname[sizeof(fname)+4];
+    double gz, tmp;
+
+    snprintf(gzname, sizeof(gzname), "%s.gz", fname);
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", fname);
+    create_file(fname, size);
+    if (!compress_file(fname, gzname)) break;
+
+    gz = run(gzname, XML_SCAN_NODES, XML_IO_AUTO);
+    tmp = run_decompress(gzname, tmpname);
+    printf("%10li %12.1f %12.1f\n", size, gz, tmp);
+    remove(gzname);
+  }
+#endif
+  remove(fname);
+
+  printf("\nreading is faster than mapping up to %li bytes ", read_max);
+  printf("(XML_IO_READ_MAX is %i)\n", XML_IO_READ_MAX);
+  if (populate_min) {
+    printf("populating is faster than faulting from %li bytes ", populate_min);
+  } else {
+    printf("populating is never faster than faulting ");
+  }
+  printf("(XML_IO_POPULATE_MIN is %i)\n", XML_IO_POPULATE_MIN);
+
+  return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_LOCALE_H
+# include <locale.h>
+#endif
+
+#include "xml.h"
+
+void show_help()
+{
+  printf("usage: xmlcompile [options] <filename> <compiled>\n\n");
+  printf("Write a compiled document which opens without scanning the ");
+  printf("document.\n\n");
+  printf("Options:\n");
+  printf(" -i\t\tdo not store comment sections, the compiled document ");
+  printf("is then\n\t\tonly used when opened with XML_IGNORE_COMMENT\n");
+  printf(" -h\t\tshow this help message and exit\n\n");
+}
+
+int main(int argc, char **argv)
+{
+  enum xmlFlags flags = XML_CACHE_NODES;
+  const char *infile = NULL;
+  const char *outfile = NULL;
+  int i, rv = 0;
+
+#ifdef HAVE_LOCALE_H
+  setlocale(LC_CTYPE, "");
+#endif
+
+  for (i=1; i<argc; i++)
+  {
+    if (!strcmp(argv[i], "-i")) {
+      flags |= XML_IGNORE_COMMENT;
+    } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+      show_help();
+      return 0;
+    } else if (!infile) {
+      infile = argv[i];
+    } else if (!outfile) {
+      outfile = argv[i];
+    }
+  }
+
+  if (!infile || !outfile)
+  {
+    show_help();
+    rv = -1;
+  }
+  else
+  {
+    xmlId *rid = xmlOpenFlags(infile, flags);
+    if (rid)
+    {
+      if (!xmlCompile(rid, outfile))
+      {
+        printf("Error while writing '%s': %s\n", outfile,
+               xmlErrorGetString(rid, 1));
+        rv = -1;
+      }
+      xmlClose(rid);
+    }
+    else
+    {
+      printf("Error while opening file for reading: '%s': %s\n", infile,
+             xmlErrorGetString(NULL, 1));
+      rv = -1;
+    }
+  }
+
+  return rv;
+}
@@ -84,6 +84,7 @@ static char *_root = 0;
 static char *_print = 0;
 static char *_attribute = 0;
 static int print_filenames = 0;
+static int _window = 0;
 
 static void free_and_exit(int i);
 
@@ -107,7 +108,8 @@ show_help ()
     printf("\t-e <id>\t\tshow sections that contain this element\n");
     printf("\t-p <id>\t\tprint this element as the output\n");
     printf("\t-r <path>\tspecify the XML search root\n");
-    printf("\t-v <string>\tfilter sections that contain this vale\n\n");
+    printf("\t-v <string>\tfilter sections that contain this vale\n");
+    printf("\t-w <size>\tkeep at most <size> MB of the file in memory\n\n");
     printf(" To print the contents of the 'type' element of the XML section ");
     printf("that begins\n at '/printer/output' use the following command:\n\n");
     printf("\txmlgrep -r /printer/output -p type <file.xml>\n\n");
@@ -118,6 +120,8 @@ show_help ()
     printf("'generic' as\n it's value use the following command:");
     printf("\n\n\txmlgrep -r /printer/output -e driver -v generic <file.xml>");
     printf("\n\n");
+    printf(" For files larger than the available memory use a window of 64MB:\n\n");
+    printf("\txmlgrep -w 64 -r /printer -p output <file.xml>\n\n");
     free_and_exit(0);
 }
 
@@ -220,6 +224,17 @@ parse_option(char **args, int n, int max)
         memcpy(_attribute, arg, alen);
         return 2;
     }
+    else if (strncmp(opt, "-window", olen) == 0)
+    {
+        if (arg == 0) SHOW_NOVAL(opt);
+        _window = atoi(arg);
+        if (_window <= 0 || _window > 2047)
+        {
+            printf("window size must be between 1 and 2047 MB\n\n");
+            free_and_exit(-1);
+        }
+        return 2;
+    }
     else if (strncmp(opt, "-list-filenames", olen) == 0)
     { /* undocumented test argument */
         print_filenames = 1;
@@ -389,7 +404,20 @@ void grep_file(unsigned num)
 {
     xmlId *xid;
 
-    xid = xmlOpen(_filenames[num]);
+    if (_window)
+    {
+        xmlOptions options;
+
+        /* only cache the sections which are visited */
+        memset(&options, 0, sizeof(options));
+        options.flags = XML_LAZY_NODES;
+        options.io.flags = XML_IO_WINDOW;
+        options.io.window = _window*1024*1024;
+        xid = xmlOpenOptions(_filenames[num], &options);
+    }
+    else {
+        xid = xmlOpen(_filenames[num]);
+    }
     if (xid)
     {
        xmlId *xrid = xmlMarkId(xid);
@@ -0,0 +1,222 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * Benchmark the number of small messages per second which are processed
+ * with xmlInitBufferFlags and xmlClose compared to a parser context which
+ * is reset onto every message with xmlReset.
+ *
+ * Every message is a few KB in size, a value and a string are looked up
+ * for each of them. The benchmark is run on one thread and on one thread
+ * for every core, every thread has a context of its own.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "xml.h"
+
+#define NUM_MESSAGES	64
+#define MESSAGE_SIZE	2048
+#define MIN_TIME	0.5
+#define MAX_THREADS	256
+
+static char messages[NUM_MESSAGES][MESSAGE_SIZE+256];
+static int lengths[NUM_MESSAGES];
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void create_messages(void)
+{
+  int m;
+
+  for (m=0; m<NUM_MESSAGES; m++)
+  {
+    char *p = messages[m];
+    int len, i = 0;
+
+    len = sprintf(p, "<?xml version=\"1.0\"?>\n<msg id=\"%i\">\n", m);
+    len += sprintf(p+len, "  <header><seq>%i</seq><type>quote</type></header>\n", m);
+    len += sprintf(p+len, "  <body>\n");
+    while (len < MESSAGE_SIZE-64) {
+      len += sprintf(p+len, "    <field n=\"%i\">%i</field>\n", i, m*i);
+      i++;
+    }
+    len += sprintf(p+len, "  </body>\n</msg>\n");
+    lengths[m] = len;
+  }
+}
+
+static int process(const xmlId *xid)
+{
+  char type[32];
+
+  if (!xid) return 0;
+  xmlNodeCopyString(xid, "/msg/header/type", type, sizeof(type));
+  return (int)xmlNodeGetInt(xid, "/msg/header/seq");
+}
+
+/* the number of messages per second of one thread */
+static double run(int reuse)
+{
+  xmlContext *ctx = reuse ? xmlContextOpen(NULL) : NULL;
+  double start, end;
+  long n = 0;
+  int sum = 0;
+
+  start = now();
+  do
+  {
+    int i;
+
+    for (i=0; i<1000; i++)
+    {
+      int m = (int)(n++ % NUM_MESSAGES);
+      if (ctx) {
+        sum += process(xmlReset(ctx, messages[m], lengths[m]));
+      }
+      else
+      {
+        xmlId *xid = xmlInitBufferFlags(messages[m], lengths[m],
+                                        XML_CACHE_NODES);
+        sum += process(xid);
+        if (xid) xmlClose(xid);
+      }
+    }
+    end = now();
+  }
+  while (end-start < MIN_TIME);
+
+  if (ctx) xmlContextClose(ctx);
+  if (sum < 0) printf("\n");
+
+  return n/(end-start);
+}
+
+#if HAVE_PTHREAD_H
+static void *worker(void *arg)
+{
+  double *rate = arg;
+  *rate = run(rate[1] != 0.0);
+  return NULL;
+}
+
+static double run_threads(int num, int reuse)
+{
+  pthread_t threads[MAX_THREADS];
+  double rates[MAX_THREADS][2];
+  double rv = 0.0;
+  int i;
+
+  for (i=0; i<num; i++)
+  {
+    rates[i][1] = reuse;
+    pthread_create(&threads[i], NULL, worker, rates[i]);
+  }
+  for (i=0; i<num; i++)
+  {
+    pthread_join(threads[i], NULL);
+    rv += rates[i][0];
+  }
+
+  return rv;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+  int cores = 1;
+
+#if HAVE_UNISTD_H && defined(_SC_NPROCESSORS_ONLN)
+  cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (argc > 1) cores = atoi(argv[1]);
+  if (cores < 1) cores = 1;
+  if (cores > MAX_THREADS) cores = MAX_THREADS;
+
+  create_messages();
+
+  printf("%i byte messages: look up a value and a string (messages/s)\n",
+         lengths[0]);
+  printf("%10s %16s %16s\n", "threads", "xmlInitBuffer", "xmlReset");
+  printf("%10i %16.0f %16.0f\n", 1, run(0), run(1));
+#if HAVE_PTHREAD_H
+  if (cores > 1) {
+    printf("%10i %16.0f %16.0f\n", cores, run_threads(cores, 0),
+                                          run_threads(cores, 1));
+  }
+#endif
+
+  return 0;
+}
@@ -61,101 +61,23 @@
 #endif
 
 #include <stdio.h>
-#include <malloc.h>
 #ifdef HAVE_LOCALE_H
 # include <locale.h>
 #endif
 
 #include "xml.h"
 
-int print_comment(xmlId *xid)
-{
-    int rv = 1;
-    char *s;
-
-    s = xmlGetStringRaw(xid);
-    if (!s) {
-        rv = 0;
-    }
-    else
-    {
-        printf("<!-- %s --", s);
-        free(s);
-    }
-    return rv;
-}
-
-void print_xml(xmlId *id)
-{
-  static int level = 1;
-  xmlId *xid = xmlMarkId(id);
-  unsigned int num;
-
-  num = xmlNodeGetNum(xid, "*");
-  if (num == 0)
-  {
-    char *s;
-    s = xmlGetStringRaw(xid);
-    if (s)
-    {
-      printf("%s", s);
-      free(s);
-    }
-  }
-  else
-  {
-    unsigned int i, q;
-    for (i=0; i<num; i++)
-    {
-      if (xmlNodeGetPos(id, xid, "*", i) != 0)
-      {
-        char name[256];
-        unsigned int anum, a;
-
-        printf("\n");
-        for(q=0; q<level; q++) printf(" ");
-
-        if (xmlNodeTest(xid, XML_COMMENT))
-        {
-          print_comment(xid);
-          printf(">");
-          continue;
-        }
-
-        xmlNodeCopyName(xid, (char *)&name, 256);
-        printf("<%s", name);
-
-        anum = xmlAttributeGetNum(xid);
-        for (a=0; a<anum; a++)
-        {
-            char name[256], attrib[256];
-            if (xmlAttributeCopyName(xid, (char *)&name, 256, a) != 0)
-            {
-                xmlAttributeCopyString(xid, name, (char *)&attrib, 256);
-                printf(" %s=\"%s\"", name, attrib);
-            }
-        }
-        
-        printf(">");
-        level++;
-        print_xml(xid);
-        level--;
-        printf("</%s>", name);
-      }
-      else printf("error\n");
-    }
-    printf("\n");
-    for(q=1; q<level; q++) printf(" ");
-  }
-}
+#define MAX_ERRORS	64
 
 int main(int argc, char **argv)
 {
+  int rv = 0;
+
 #ifdef HAVE_LOCALE_H
   setlocale(LC_CTYPE, "");
 #endif
 
-  if (argc < 1)
+  if (argc < 2)
   {
     printf("usage: xmlvalidate <filename>\n\n");
   }
@@ -163,63 +85,37 @@ int main(int argc, char **argv)
   {
     xmlId *rid;
 
-    rid = xmlOpen(argv[1]);
-    if (xmlErrorGetNo(rid, 0) != XML_NO_ERROR)
-    {
-       printf("%s\n", xmlErrorGetString(rid, 1));
-    }
-    else if (rid)
+    /* the validator does its own scan, do not build a node cache first */
+    rid = xmlOpenFlags(argv[1], XML_SCAN_NODES);
+    if (rid)
     {
-      unsigned int i, num;
-      xmlId *xid;
+      xmlErrorInfo errors[MAX_ERRORS];
+      xmlErrorList list;
+      int i;
 
-      printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\n");
- 
-      xid = xmlMarkId(rid);
-      num = xmlNodeGetNum(xid, "*");
-      for (i=0; i<num; i++)
+      list.max_errors = MAX_ERRORS;
+      list.errors = errors;
+      if (xmlValidate(rid, &list))
       {
-        if (xmlNodeGetPos(rid, xid, "*", i) != 0)
+        for (i=0; i<list.num_errors; i++)
         {
-          unsigned int anum, a;
-          char name[256];
-
-          if (xmlNodeTest(xid, XML_COMMENT))
-          {
-            print_comment(xid);
-            printf(">\n");
-            continue;
-          }
-
-          xmlNodeCopyName(xid, (char *)&name, 256);
-          printf("<%s", name);
-
-          anum = xmlAttributeGetNum(xid);
-          for (a=0; a<anum; a++)
-          {
-              char name[256], attrib[256];
-              if (xmlAttributeCopyName(xid, (char *)&name, 256, a) != 0)
-              {
-                  xmlAttributeCopyString(xid, name, (char *)&attrib, 256);
-                  printf(" %s=\"%s\"", name, attrib);
-              }
-          }
-          printf(">");
-
-          print_xml(xid);
-          printf("</%s>\n", name);
+          printf("%s: at line %i, column %i: '%s'\n", argv[1],
+                 errors[i].line_no, errors[i].column_no, errors[i].str);
         }
+        if (list.num_errors == MAX_ERRORS) {
+          printf("%s: too many errors, stopped.\n", argv[1]);
+        }
+        rv = -1;
       }
-      free(xid);
 
       xmlClose(rid);
     }
     else
     {
       printf("Error while opening file for reading: '%s'\n", argv[1]);
+      rv = -1;
     }
   }
 
-  return 0;
+  return rv;
 }
-
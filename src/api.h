@@ -64,6 +64,8 @@
 #endif
 
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
 #if HAVE_LOCALE_H
 # include <locale.h>
 #endif
@@ -79,6 +81,9 @@
 #if HAVE_ICONV_H
 # include <iconv.h>
 #endif
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 #ifdef USE_RMALLOC
 # define USE_LOGGING    1
 # include <rmalloc.h>
@@ -114,8 +119,8 @@ typedef struct
 } SIMPLE_UNMMAP;
 
 /* map 'filename' and return a pointer to it. */
-void *simple_mmap(int, int, SIMPLE_UNMMAP *);
-void simple_unmmap(void*, int, SIMPLE_UNMMAP *);
+void *simple_mmap(int, size_t, SIMPLE_UNMMAP *);
+void simple_unmmap(void*, size_t, SIMPLE_UNMMAP *);
 
 #else
 # define simple_mmap(a, b, c)   mmap(0, (b), PROT_READ, MAP_PRIVATE, (a), 0L)
@@ -156,13 +161,161 @@ void simple_unmmap(void*, int, SIMPLE_UNMMAP *);
 
 #endif /*XML_NONVALIDATING */
 
+#if defined(__GNUC__) || defined(__clang__)
+# define ATOMIC_PTR_GET(p)	__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+# define ATOMIC_PTR_SET(p,n)	__atomic_store_n(&(p), (n), __ATOMIC_SEQ_CST)
+# define ATOMIC_PTR_CAS(p,o,n)	__atomic_compare_exchange_n(&(p), &(o), (n), 0, \
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+# define ATOMIC_INT_GET(i)	__atomic_load_n(&(i), __ATOMIC_SEQ_CST)
+# define ATOMIC_INT_SET(i,v)	__atomic_store_n(&(i), (v), __ATOMIC_SEQ_CST)
+# define ATOMIC_INT_ADD(i,v)	__atomic_add_fetch(&(i), (v), __ATOMIC_SEQ_CST)
+# define ATOMIC_SIZE_GET(i)	__atomic_load_n(&(i), __ATOMIC_SEQ_CST)
+# define ATOMIC_SIZE_ADD(i,v)	__atomic_add_fetch(&(i), (v), __ATOMIC_SEQ_CST)
+# define ATOMIC_SIZE_LOAD(i)	__atomic_load_n(&(i), __ATOMIC_ACQUIRE)
+# define ATOMIC_SIZE_STORE(i,v)	__atomic_store_n(&(i), (v), __ATOMIC_RELEASE)
+# define ATOMIC_RELAXED_GET(i)	__atomic_load_n(&(i), __ATOMIC_RELAXED)
+# define ATOMIC_RELAXED_SET(i,v) __atomic_store_n(&(i), (v), __ATOMIC_RELAXED)
+# define ATOMIC_FENCE_ACQUIRE()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+# define ATOMIC_FENCE_RELEASE()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#elif defined(WIN32)
+# define ATOMIC_PTR_GET(p)	InterlockedCompareExchangePointer((PVOID*)&(p), NULL, NULL)
+# define ATOMIC_PTR_SET(p,n)	InterlockedExchangePointer((PVOID*)&(p), (n))
+# define ATOMIC_PTR_CAS(p,o,n)	((o) == InterlockedCompareExchangePointer((PVOID*)&(p), (n), (o)))
+# define ATOMIC_INT_GET(i)	InterlockedCompareExchange((LONG*)&(i), 0, 0)
+# define ATOMIC_INT_SET(i,v)	InterlockedExchange((LONG*)&(i), (v))
+# define ATOMIC_INT_ADD(i,v)	(InterlockedExchangeAdd((LONG*)&(i), (v)) + (v))
+# define ATOMIC_SIZE_GET(i)	InterlockedExchangeAddSizeT(&(i), 0)
+# define ATOMIC_SIZE_ADD(i,v)	(InterlockedExchangeAddSizeT(&(i), (v)) + (v))
+# define ATOMIC_SIZE_LOAD(i)	InterlockedExchangeAddSizeT(&(i), 0)
+# define ATOMIC_SIZE_STORE(i,v)	(MemoryBarrier(), (i) = (v))
+# define ATOMIC_RELAXED_GET(i)	(i)
+# define ATOMIC_RELAXED_SET(i,v) ((i) = (v))
+# define ATOMIC_FENCE_ACQUIRE()	MemoryBarrier()
+# define ATOMIC_FENCE_RELEASE()	MemoryBarrier()
+#else
+# define ATOMIC_PTR_GET(p)	(p)
+# define ATOMIC_PTR_SET(p,n)	((p) = (n))
+# define ATOMIC_PTR_CAS(p,o,n)	(((p) == (o)) ? ((p) = (n), 1) : ((o) = (p), 0))
+# define ATOMIC_INT_GET(i)	(i)
+# define ATOMIC_INT_SET(i,v)	((i) = (v))
+# define ATOMIC_INT_ADD(i,v)	((i) += (v))
+# define ATOMIC_SIZE_GET(i)	(i)
+# define ATOMIC_SIZE_ADD(i,v)	((i) += (v))
+# define ATOMIC_SIZE_LOAD(i)	(i)
+# define ATOMIC_SIZE_STORE(i,v)	((i) = (v))
+# define ATOMIC_RELAXED_GET(i)	(i)
+# define ATOMIC_RELAXED_SET(i,v) ((i) = (v))
+# define ATOMIC_FENCE_ACQUIRE()
+# define ATOMIC_FENCE_RELEASE()
+#endif
+
+/* all memory is allocated with the allocator of xmlSetAllocator */
+#define MALLOC(a)		__zeroxml_malloc((a))
+#define CALLOC(a,b)		__zeroxml_calloc((a),(b))
+#define REALLOC(a,b)		__zeroxml_realloc((a),(b))
+#define STRDUP(a)		__zeroxml_strdup((a))
+#define FREE(a)			__zeroxml_dealloc((a))
+
+void *__zeroxml_malloc(size_t);
+void *__zeroxml_calloc(size_t, size_t);
+void *__zeroxml_realloc(void*, size_t);
+char *__zeroxml_strdup(const char*);
+void __zeroxml_dealloc(void*);
+
+/* the allocator and memory limit of a document */
+struct _zeroxml_memory;
+struct _zeroxml_memory *__zeroxml_memory_create(const xmlAllocator*, size_t);
+void __zeroxml_memory_ref(struct _zeroxml_memory*);
+void __zeroxml_memory_destroy(struct _zeroxml_memory*);
+int __zeroxml_memory_charge(struct _zeroxml_memory*, size_t);
+void __zeroxml_memory_uncharge(struct _zeroxml_memory*, size_t);
+int __zeroxml_memory_fits(const struct _zeroxml_memory*, size_t);
+void *__zeroxml_memory_alloc(struct _zeroxml_memory*, size_t);
+void *__zeroxml_memory_calloc(struct _zeroxml_memory*, size_t, size_t);
+void *__zeroxml_memory_realloc(struct _zeroxml_memory*, void*, size_t);
+void __zeroxml_memory_free(struct _zeroxml_memory*, void*);
+
+/* a monotonic clock in nanoseconds */
+int64_t __zeroxml_clock(void);
+
+/*
+ * Statistics of the documents for xmlGetStats, compiled in with the STATS
+ * build option. Every counter of a document is added to the process-wide
+ * counters at the same time, times are kept in microseconds.
+ */
+#if XML_USE_STATS
+struct _zeroxml_stats
+{
+    size_t bytes_scanned;
+    size_t memchr_calls;
+    size_t max_depth;
+    size_t cache_hits;
+    size_t cache_misses;
+    size_t nodes_created;
+    size_t allocations;
+    size_t bytes_allocated;
+    size_t iconv_calls;
+    size_t documents;
+    size_t open_time;
+    size_t index_time;
+};
+extern struct _zeroxml_stats __zeroxml_stats;
+void __zeroxml_stats_max(size_t*, size_t);
+
+# define STATS(r)		(((struct _root_id*)(r))->stats)
+# define STATS_ADD(r,f,n)	do { ATOMIC_SIZE_ADD(STATS(r).f, (size_t)(n)); \
+				     ATOMIC_SIZE_ADD(__zeroxml_stats.f, (size_t)(n)); \
+				} while(0)
+# define STATS_MAX(r,f,n)	do { __zeroxml_stats_max(&STATS(r).f, (size_t)(n)); \
+				     __zeroxml_stats_max(&__zeroxml_stats.f, (size_t)(n)); \
+				} while(0)
+# define STATS_ALLOC(r,n)	do { STATS_ADD(r, allocations, 1); \
+				     STATS_ADD(r, bytes_allocated, (n)); \
+				} while(0)
+# define STATS_START(t)		int64_t t = __zeroxml_clock();
+# define STATS_TIME(r,f,t)	STATS_ADD(r, f, (__zeroxml_clock()-(t))/1000)
+#else
+# define STATS_ADD(r,f,n)	((void)0)
+# define STATS_MAX(r,f,n)	((void)0)
+# define STATS_ALLOC(r,n)	((void)0)
+# define STATS_START(t)
+# define STATS_TIME(r,f,t)	((void)0)
+#endif
+
+/*
+ * Trace spans for xmlTraceExport, compiled in with the TRACE build option.
+ * TRACE_START declares the start time of a span and TRACE_SPAN records the
+ * span in the ring buffer of the calling thread.
+ */
+#if XML_USE_TRACE
+void __zeroxml_trace_span(const char*, int64_t);
+
+# define TRACE_START(t)		int64_t t = __zeroxml_clock();
+# define TRACE_SPAN(n,t)	__zeroxml_trace_span((n), (t))
+#else
+# define TRACE_START(t)
+# define TRACE_SPAN(n,t)	((void)0)
+#endif
+
 #define MEMCMP(a,b,c)		memcmp((a),(b),(c))
 #define MEMCHR(a,b,c)		memchr((a),(b),(c))
 #define CASECMP(rid,a,b)	((CASE(rid,a)) == (CASE(rid,b)))
-#define LSTRNCMP(a,b,c,d)	string_compare((a),(b),(c),(d))
+#define LSTRNCMP(rid,b,c,d)	string_compare((rid),(b),(c),(d))
 
-int string_compare(iconv_t, const char*, const char*, int*);
+int string_compare(const struct _root_id*, const char*, const char*, int*);
 int __zeroxml_iconv(const struct _root_id*, const char*, size_t, char*, size_t);
+size_t __zeroxml_iconv_length(const struct _root_id*, const char*, size_t);
+const char *__zeroxml_locale_get(void);
+#if defined(HAVE_LOCALE_H) && !defined(WIN32)
+locale_t __zeroxml_locale_object(void);
+#endif
+struct _zeroxml_converter *__zeroxml_converter_get(const char*);
+iconv_t __zeroxml_iconv_acquire(const struct _root_id*);
+void __zeroxml_iconv_release(const struct _root_id*, iconv_t);
+
+int __zeroxml_compressed(const char*, size_t);
+char *__zeroxml_decompress(struct _zeroxml_memory*, const char*, size_t, size_t*, size_t*);
+void __zeroxml_buffer_free(struct _zeroxml_memory*, char*, size_t);
 
 #if defined(HAVE_LOCALE_H) && !defined(WIN32)
 # define CASE(rid,a) (rid)->lcase ? (rid)->lcase((a),(rid)->locale) : (a)
@@ -180,6 +333,9 @@ enum _xml_flags
     __XML_VALIDATING           = 0x10,
     __XML_CACHED_NODES         = 0x20,
     __XML_LOCALIZATION         = 0x40,
+    __XML_LAZY_NODES           = 0x80,
+    __XML_BACKGROUND_NODES     = 0x100,
+    __XML_SHARED_NODES         = 0x200,
 
     __XML_DEFAULT_MODE         = (-1) /* all true */
 };
@@ -191,6 +347,9 @@ enum _xml_flags
 #define VALIDATING(a)		((a)->root->flags & __XML_VALIDATING)
 #define CACHED_NODES(a)		((a)->root->flags & __XML_CACHED_NODES)
 #define LOCALIZATION(a)		((a)->root->flags & __XML_LOCALIZATION)
+#define LAZY_NODES(a)		((a)->root->flags & __XML_LAZY_NODES)
+#define BACKGROUND_NODES(a)	((a)->root->flags & __XML_BACKGROUND_NODES)
+#define SHARED_NODES(a)		((a)->root->flags & __XML_SHARED_NODES)
 
 #define __XML_BOOL_NONE        RETURN_NONE_VALUE(xid) ? XML_BOOL_NONE : 0
 #define __XML_FPNONE           RETURN_NONE_VALUE(xid) ? XML_FPNONE : 0.0
@@ -198,6 +357,8 @@ enum _xml_flags
 
 
 #define MAX_ENCODING	32
+#define MMAP_ALIGNED	-4
+#define MMAP_DECOMPRESSED -3
 #define MMAP_FREE	-2
 #define MMAP_ERROR	-1
 #define STRIPPED	 0
@@ -218,6 +379,26 @@ struct _zeroxml_error
 };
 #endif
 
+#if HAVE_PTHREAD_H
+enum _zeroxml_build_state
+{
+    __XML_BUILD_RUNNING = 0,
+    __XML_BUILD_READY,
+    __XML_BUILD_FAILED
+};
+
+/* the thread building the node cache for XML_BACKGROUND_NODES */
+struct _zeroxml_background
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    enum _zeroxml_build_state state;
+    const char *err_pos;
+    int err_no;
+};
+#endif
+
 /*
  * It is required for both the rood node and the normal xml nodes to both
  * have 'char *name' defined as the first entry. The code tests whether
@@ -232,16 +413,30 @@ struct _root_id
     const cacheId *node;
 
     /* _root_id specifics */
+    const char *doc; /* the whole document, rid->start excludes the prolog */
+    off_t doc_len;
     int fd;
     enum _xml_flags flags;
     char *mmap;
+    size_t mmap_len; /* size of the mapping, rid->len excludes the prolog */
+    off_t window; /* resident part of the mapping, XML_IO_WINDOW only */
     char encoding[MAX_ENCODING+1];
 
-#if defined(HAVE_ICONV_H) || defined(WIN32)
-    iconv_t cd;
-#endif
+    struct _zeroxml_converter *converter; /* shared by the process */
 
     struct _zeroxml_error *info;
+    struct _zeroxml_lines *lines; /* line number index, built on first use */
+    xmlLimits limits; /* resource limits, INT_MAX if not set */
+#if HAVE_PTHREAD_H
+    struct _zeroxml_background *background; /* XML_BACKGROUND_NODES only */
+#endif
+    struct _zeroxml_registry *registry; /* XML_SHARE_DOCUMENT handles only */
+    struct _zeroxml_arena *arena; /* XML_ARENA only */
+    struct _zeroxml_arena *charged; /* memory limit without XML_ARENA only */
+    struct _zeroxml_memory *memory; /* own allocator or memory limit only */
+#if XML_USE_STATS
+    struct _zeroxml_stats stats;
+#endif
 
 #ifdef WIN32
     SIMPLE_UNMMAP un;
@@ -268,6 +463,64 @@ struct _xml_id
     off_t name_len;
 };
 
+/* the sidecar file of the node cache for XML_INDEX_FILE or the records of a
+ * compiled or a shared document */
+struct _zeroxml_index
+{
+    char *fname;	/* path of the sidecar file, NULL if compiled is set */
+    const char *compiled; /* start of a compiled document */
+    off_t size;		/* size of the document file */
+    time_t mtime;	/* modification time of the document file */
+    uint64_t hash;	/* hash of the document, valid if hashed is set */
+    int hashed;
+    int shared;		/* use the records of compiled in place */
+};
+
+int __zeroxml_index_init(struct _zeroxml_index*, const char*, const char*, off_t, time_t);
+void __zeroxml_index_done(struct _zeroxml_index*);
+const char *__zeroxml_compiled(struct _zeroxml_index*, const char*, off_t, off_t*);
+int __zeroxml_index_compile(const struct _root_id*, const char*, const char*);
+const cacheId *__zeroxml_index_load(const struct _root_id*, struct _zeroxml_index*, const char*, off_t, const char*);
+void __zeroxml_index_save(const struct _root_id*, struct _zeroxml_index*, const char*, off_t, const char*);
+int __zeroxml_index_publish(const struct _root_id*, const char*, const char*);
+
+/* the sub-second part of the modification time of a file, if available */
+#if HAVE_STRUCT_STAT_ST_MTIM
+# define STAT_MTIME_NSEC(s)	((long)(s)->st_mtim.tv_nsec)
+#else
+# define STAT_MTIME_NSEC(s)	0L
+#endif
+
+/* the registry of the documents opened with XML_SHARE_DOCUMENT */
+struct stat;
+struct _root_id *__zeroxml_registry_get(const struct stat*, const xmlOptions*);
+struct _root_id *__zeroxml_registry_add(struct _root_id*, const struct stat*, const xmlOptions*);
+void __zeroxml_registry_release(struct _root_id*);
+
+/* the mapping of a file which is processed without a document */
+char *__zeroxml_map_document(struct _root_id*, const char*, const xmlOptions*, off_t*);
+void __zeroxml_unmap_document(struct _root_id*);
+
+/* the arena of the documents opened with XML_ARENA */
+enum
+{
+    ARENA_DOCUMENT = 0,	/* released by xmlClose */
+    ARENA_SCOPED,	/* released by xmlArenaRelease or xmlClose */
+    ARENA_MAX,
+    ARENA_NONE = -1	/* allocated with MALLOC, even with an arena */
+};
+
+struct _zeroxml_arena;
+struct _zeroxml_arena *__zeroxml_arena_create(struct _zeroxml_memory*, int);
+void __zeroxml_arena_destroy(struct _zeroxml_arena*);
+void *__zeroxml_arena_alloc(struct _zeroxml_arena*, size_t, int);
+size_t __zeroxml_arena_mark(struct _zeroxml_arena*);
+void __zeroxml_arena_release(struct _zeroxml_arena*, size_t);
+void __zeroxml_arena_reset(struct _zeroxml_arena*);
+void *__zeroxml_alloc(const struct _root_id*, size_t, int);
+void __zeroxml_release(void*);
+void __zeroxml_free(const struct _root_id*, void*);
+
 #define PRINT(s, b, c) { \
   int l1 = (b), l2 = (c); \
   if (s) { \
@@ -170,7 +170,7 @@ processXML(xmlId *rid, XMLVisitor &visitor)
                 }
             }
         }
-        free(xid);
+        xmlFree(xid);
     }
     else /* data */
     {
@@ -178,7 +178,7 @@ processXML(xmlId *rid, XMLVisitor &visitor)
         if (s)
         {
             visitor.data(s, strlen(s));
-            free(s);
+            xmlFree(s);
         }
     }
 }
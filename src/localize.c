@@ -75,6 +75,60 @@
 #include "xml.h"
 #include "api.h"
 
+/*
+ * The locale and the character set converters are shared by all documents
+ * of the process.
+ *
+ * The locale is detected once, when the first document is opened. The
+ * iconv descriptors are kept in a pool for every pair of character sets.
+ * A descriptor holds the state of a conversion so it is checked out by a
+ * thread for every conversion and returned afterwards. The last descriptor
+ * a thread used stays with the thread, which makes checking it out again
+ * free of locks. The pool lives as long as the process and is allocated
+ * with malloc, like the descriptors themselves, instead of the allocator
+ * of xmlSetAllocator.
+ */
+#define CHARSET_MAX	64
+
+struct _zeroxml_converter
+{
+    struct _zeroxml_converter *next;
+    char to[CHARSET_MAX];
+    char from[MAX_ENCODING+1];
+    int valid; /* XML_FALSE if iconv can not convert between the two */
+    iconv_t *idle; /* the descriptors which are not checked out */
+    int num_idle;
+    int max_idle;
+};
+
+/* the descriptor which stays with a thread */
+struct _zeroxml_slot
+{
+    struct _zeroxml_converter *converter;
+    iconv_t cd;
+};
+
+static struct _zeroxml_converter *__zeroxml_converters = NULL;
+static char __zeroxml_locale_name[CHARSET_MAX];
+static int __zeroxml_locale_detected = XML_FALSE;
+#if defined(HAVE_LOCALE_H) && !defined(WIN32)
+static locale_t __zeroxml_locale = (locale_t)0;
+#endif
+
+#if HAVE_PTHREAD_H
+static pthread_mutex_t __zeroxml_converters_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t __zeroxml_slot_once = PTHREAD_ONCE_INIT;
+static pthread_key_t __zeroxml_slot_key;
+# define CONVERTERS_LOCK()	pthread_mutex_lock(&__zeroxml_converters_mutex)
+# define CONVERTERS_UNLOCK()	pthread_mutex_unlock(&__zeroxml_converters_mutex)
+#else
+static struct _zeroxml_slot __zeroxml_slot = { NULL, (iconv_t)-1 };
+# define CONVERTERS_LOCK()
+# define CONVERTERS_UNLOCK()
+#endif
+
+static void __zeroxml_converter_put(struct _zeroxml_converter*, iconv_t);
+
 /*
  * A Unicode string comparison function that handles strings with different
  * character encodings.
@@ -87,9 +141,10 @@
  */
 #define BUFSIZE		1024
 int
-string_compare(const iconv_t cd, const char *s1, const char *s2, int *s2len)
+string_compare(const struct _root_id *rid, const char *s1, const char *s2, int *s2len)
 {
 #if defined(HAVE_ICONV_H) || defined(WIN32)
+    iconv_t cd = __zeroxml_iconv_acquire(rid);
     size_t s1len = strlen(s1);
     int rv = -1;
 
@@ -112,9 +167,10 @@ string_compare(const iconv_t cd, const char *s1, const char *s2, int *s2len)
             }
         }
     }
+    __zeroxml_iconv_release(rid, cd);
     return rv;
 #else
-    return STRNCMP(s1, s2, *slen);
+    return STRNCMP(rid, s1, s2, *s2len);
 #endif
 }
 
@@ -133,18 +189,21 @@ __zeroxml_iconv(const struct _root_id *rid,
                 const char *inbuf, size_t inbytesleft,
                 char *outbuf, size_t outbytesleft)
 {
-    iconv_t cd = rid->cd;
     char cvt = XML_FALSE;
     int rv = XML_NO_ERROR;
 
 #if (defined(HAVE_ICONV_H) || defined(WIN32))
     if (LOCALIZATION(rid))
     {
+        iconv_t cd = __zeroxml_iconv_acquire(rid);
+
         outbuf[0] = 0;
         if (cd != (iconv_t)-1)
         {
             char *ptr = (char*)inbuf;
             size_t nconv;
+            TRACE_START(ts)
+
             iconv(cd, NULL, NULL, NULL, NULL);
             nconv = iconv(cd, &ptr, &inbytesleft, &outbuf, &outbytesleft);
             if (nconv != (size_t)-1)
@@ -171,7 +230,9 @@ __zeroxml_iconv(const struct _root_id *rid,
                     break;
                 }
             }
+            TRACE_SPAN("convert", ts);
         }
+        __zeroxml_iconv_release(rid, cd);
     } /* LOCALIZED(rid) */
 #endif
 
@@ -184,6 +245,289 @@ __zeroxml_iconv(const struct _root_id *rid,
     return rv;
 }
 
+/*
+ * Get the exact number of bytes __zeroxml_iconv writes for a string,
+ * excluding the terminating zero.
+ *
+ * The string is converted in blocks into a buffer on the stack, so the
+ * result can be allocated at its exact size instead of the worst case of
+ * six bytes for every input byte. When the string can not be converted
+ * __zeroxml_iconv copies the input unchanged and the length of the input
+ * is returned.
+ *
+ * @param rid XML-id of the document
+ * @param inbuf the string to convert
+ * @param inbytesleft the length of the string
+ * @return the length of the converted string
+ */
+size_t
+__zeroxml_iconv_length(const struct _root_id *rid,
+                       const char *inbuf, size_t inbytesleft)
+{
+    size_t rv = inbytesleft;
+
+#if (defined(HAVE_ICONV_H) || defined(WIN32))
+    iconv_t cd = LOCALIZATION(rid) ? __zeroxml_iconv_acquire(rid) : (iconv_t)-1;
+    if (cd != (iconv_t)-1)
+    {
+        char buffer[BUFSIZE];
+        char *ptr = (char*)inbuf;
+        size_t len = 0;
+
+        iconv(cd, NULL, NULL, NULL, NULL);
+        do
+        {
+            char *outbuf = buffer;
+            size_t outbytesleft = BUFSIZE;
+            size_t nconv;
+
+            nconv = iconv(cd, &ptr, &inbytesleft, &outbuf, &outbytesleft);
+            len += BUFSIZE - outbytesleft;
+            if (nconv != (size_t)-1)
+            {
+                outbuf = buffer;
+                outbytesleft = BUFSIZE;
+                iconv(cd, NULL, NULL, &outbuf, &outbytesleft);
+                rv = len + BUFSIZE - outbytesleft;
+                break;
+            }
+
+            /* no progress: the block does not fit the buffer */
+            if (outbytesleft == BUFSIZE) break;
+        }
+        while (errno == E2BIG);
+    }
+    __zeroxml_iconv_release(rid, cd);
+#endif
+
+    return rv;
+}
+
+/*
+ * Detect the locale of the process, only done for the first document.
+ *
+ * @return the name of the locale
+ */
+const char*
+__zeroxml_locale_get(void)
+{
+    CONVERTERS_LOCK();
+    if (!__zeroxml_locale_detected)
+    {
+#ifdef HAVE_LOCALE_H
+        const char *current = setlocale(LC_CTYPE, "");
+        if (current && strlen(current) < CHARSET_MAX) {
+            strcpy(__zeroxml_locale_name, current);
+        }
+# ifndef WIN32
+        __zeroxml_locale = newlocale(LC_CTYPE_MASK, __zeroxml_locale_name, 0);
+# endif
+#endif
+        __zeroxml_locale_detected = XML_TRUE;
+    }
+    CONVERTERS_UNLOCK();
+
+    return __zeroxml_locale_name;
+}
+
+#if defined(HAVE_LOCALE_H) && !defined(WIN32)
+/*
+ * Get the locale object of the process for the *_l functions.
+ *
+ * @return the locale object, (locale_t)0 if it could not be created
+ */
+locale_t
+__zeroxml_locale_object(void)
+{
+    __zeroxml_locale_get();
+    return __zeroxml_locale;
+}
+#endif
+
+/*
+ * Get the pool of descriptors which convert from the character set of a
+ * document to the character set of the locale, the pool is created when it
+ * is used for the first time.
+ *
+ * @param from the character set of the document
+ * @return the pool or NULL if it could not be allocated
+ */
+struct _zeroxml_converter*
+__zeroxml_converter_get(const char *from)
+{
+    struct _zeroxml_converter *rv;
+    const char *to = __zeroxml_locale_get();
+    const char *ptr = strrchr(to, '.');
+
+    if (ptr) to = ptr+1;
+    if (strlen(from) > MAX_ENCODING) return NULL;
+
+    CONVERTERS_LOCK();
+    for (rv = __zeroxml_converters; rv; rv = rv->next)
+    {
+        if (!strcmp(rv->to, to) && !strcmp(rv->from, from)) break;
+    }
+
+    if (!rv && (rv = calloc(1, sizeof(struct _zeroxml_converter))) != NULL)
+    {
+        iconv_t cd;
+
+        strcpy(rv->to, to);
+        strcpy(rv->from, from);
+#if defined(HAVE_ICONV_H) || defined(WIN32)
+        cd = iconv_open(rv->to, rv->from);
+#else
+        cd = (iconv_t)-1;
+#endif
+        rv->valid = (cd != (iconv_t)-1) ? XML_TRUE : XML_FALSE;
+        rv->next = __zeroxml_converters;
+        __zeroxml_converters = rv;
+        CONVERTERS_UNLOCK();
+
+        if (rv->valid) __zeroxml_converter_put(rv, cd);
+        return rv;
+    }
+    CONVERTERS_UNLOCK();
+
+    return rv;
+}
+
+/* return a descriptor to the pool */
+static void
+__zeroxml_converter_put(struct _zeroxml_converter *converter, iconv_t cd)
+{
+    CONVERTERS_LOCK();
+    if (converter->num_idle == converter->max_idle)
+    {
+        int max = converter->max_idle ? 2*converter->max_idle : 4;
+        iconv_t *idle = realloc(converter->idle, max*sizeof(iconv_t));
+        if (idle)
+        {
+            converter->idle = idle;
+            converter->max_idle = max;
+        }
+    }
+
+    if (converter->num_idle < converter->max_idle)
+    {
+        converter->idle[converter->num_idle++] = cd;
+        cd = (iconv_t)-1;
+    }
+    CONVERTERS_UNLOCK();
+
+#if defined(HAVE_ICONV_H) || defined(WIN32)
+    if (cd != (iconv_t)-1) iconv_close(cd);
+#endif
+}
+
+#if HAVE_PTHREAD_H
+/* return the descriptor of a thread which exits to the pool */
+static void
+__zeroxml_slot_destroy(void *ptr)
+{
+    struct _zeroxml_slot *slot = ptr;
+
+    if (slot->converter) {
+        __zeroxml_converter_put(slot->converter, slot->cd);
+    }
+    free(slot);
+}
+
+static void
+__zeroxml_slot_init(void)
+{
+    pthread_key_create(&__zeroxml_slot_key, __zeroxml_slot_destroy);
+}
+
+static struct _zeroxml_slot*
+__zeroxml_slot_get(void)
+{
+    struct _zeroxml_slot *rv;
+
+    pthread_once(&__zeroxml_slot_once, __zeroxml_slot_init);
+    rv = pthread_getspecific(__zeroxml_slot_key);
+    if (!rv && (rv = calloc(1, sizeof(struct _zeroxml_slot))) != NULL)
+    {
+        if (pthread_setspecific(__zeroxml_slot_key, rv) != 0)
+        {
+            free(rv);
+            rv = NULL;
+        }
+    }
+    return rv;
+}
+#else
+# define __zeroxml_slot_get()	(&__zeroxml_slot)
+#endif
+
+/*
+ * Check out a descriptor which converts from the character set of the
+ * document to the one of the locale. Every descriptor must be returned
+ * with __zeroxml_iconv_release.
+ *
+ * @param rid XML-id of the document
+ * @return the descriptor or (iconv_t)-1 if there is no conversion
+ */
+iconv_t
+__zeroxml_iconv_acquire(const struct _root_id *rid)
+{
+    struct _zeroxml_converter *converter = rid->converter;
+    struct _zeroxml_slot *slot;
+    iconv_t rv = (iconv_t)-1;
+
+    if (!converter || !converter->valid) return rv;
+    STATS_ADD(rid, iconv_calls, 1);
+
+    slot = __zeroxml_slot_get();
+    if (slot && slot->converter == converter)
+    {
+        slot->converter = NULL;
+        return slot->cd;
+    }
+
+    CONVERTERS_LOCK();
+    if (converter->num_idle) {
+        rv = converter->idle[--converter->num_idle];
+    }
+    CONVERTERS_UNLOCK();
+
+#if defined(HAVE_ICONV_H) || defined(WIN32)
+    if (rv == (iconv_t)-1) {
+        rv = iconv_open(converter->to, converter->from);
+    }
+#endif
+
+    return rv;
+}
+
+/*
+ * Return a descriptor of __zeroxml_iconv_acquire.
+ *
+ * @param rid XML-id of the document
+ * @param cd the descriptor
+ */
+void
+__zeroxml_iconv_release(const struct _root_id *rid, iconv_t cd)
+{
+    struct _zeroxml_converter *converter = rid->converter;
+    struct _zeroxml_slot *slot;
+
+    if (cd == (iconv_t)-1) return;
+
+    slot = __zeroxml_slot_get();
+    if (slot)
+    {
+        if (slot->converter) {
+            __zeroxml_converter_put(slot->converter, slot->cd);
+        }
+        slot->converter = converter;
+        slot->cd = cd;
+    }
+    else {
+        __zeroxml_converter_put(converter, cd);
+    }
+}
+
 #ifdef WIN32
 /*
  * A basic implementation of the iconv function for Windows in C:
@@ -245,18 +589,18 @@ iconv(iconv_t cd, char **inbuf, size_t *inbytesleft,
             return -1;
         }
 
-        wbuf = (wchar_t*)malloc(res*sizeof(wchar_t));
+        wbuf = (wchar_t*)MALLOC(res*sizeof(wchar_t));
         res =MultiByteToWideChar(code_page, 0, *inbuf, *inbytesleft, wbuf, res);
         if (res <= 0)
         {
-            free(wbuf);
+            FREE(wbuf);
             return -1;
         }
 
         *inbuf += res;
         res = WideCharToMultiByte(CP_1252, 0, wbuf, res,
                                   *outbuf, *outbytesleft, NULL, NULL);
-        free(wbuf);
+        FREE(wbuf);
         if (res <= 0)
         {
             // call GetLastError
@@ -82,24 +82,90 @@
 #include <wchar.h>
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 #include <xml.h>
 
 #include "types.h"
 #include "api.h"
 
+/* resource usage of a single scan, checked against the limits of the root */
+struct _zeroxml_scan
+{
+    int depth;
+    int nodes;
+    int steps;
+    int levels; /* number of levels to add to the node cache */
+    const char *released; /* the mapping up to here is released, if windowed */
+    int siblings; /* elements of the section itself, for xmlNodeGetExplain */
+    int skipped; /* of which the child elements were scanned over */
+#if XML_USE_STATS
+    size_t bytes; /* bytes covered by the searches for the next tag */
+    size_t searches;
+    int max_depth;
+#endif
+};
+
+#if XML_USE_STATS
+static const char*
+__zeroxml_scan_memchr(struct _zeroxml_scan *scan, const char *s, int c, off_t n)
+{
+    const char *rv = MEMCHR(s, c, n);
+
+    scan->searches++;
+    scan->bytes += rv ? (size_t)(rv-s)+1 : (size_t)n;
+    return rv;
+}
+
+static void
+__zeroxml_scan_stats(const struct _root_id *rid, const struct _zeroxml_scan *scan)
+{
+    STATS_ADD(rid, bytes_scanned, scan->bytes);
+    STATS_ADD(rid, memchr_calls, scan->searches);
+    STATS_MAX(rid, max_depth, scan->max_depth);
+}
+# define SCAN_MEMCHR(s,a,b,c)	__zeroxml_scan_memchr((s),(a),(b),(c))
+# define SCAN_STATS_INIT(s)	{ (s).bytes = 0; (s).searches = 0; (s).max_depth = 0; }
+#else
+# define SCAN_MEMCHR(s,a,b,c)	MEMCHR((a),(b),(c))
+# define SCAN_STATS_INIT(s)
+#endif
+
 static double __zeroxml_strtod(const char*, char**, double);
 static long __zeroxml_strtol(const char*, char**, int, long);
 static int __zeroxml_strtob(const struct _root_id*, const char*, const char*, int);
-static void __zeroxml_prepare_data(const struct _root_id*, const char**, int*, char);
-static char *__zeroxml_get_string(const xmlId*, char);
+static void __zeroxml_prepare_data(const struct _root_id*, const char**, off_t*, char);
+static char *__zeroxml_get_string(const xmlId*, char, int);
+static char *__zeroxml_convert(const struct _xml_id*, const char*, size_t, int);
 static int __zeroxml_node_get_num(const xmlId*, const char*, char);
-static const char *__zeroxml_process_declaration(const struct _root_id*, const char*, int, char*);
-static const char *__zeroxml_node_get_path(const struct _xml_id*, const cacheId**, const char*, int*,  const char**, int*);
-static const char *__zeroxml_get_node(const struct _xml_id*, const cacheId*, const char**, int*,  const char**, int*, int*, char);
+static const char *__zeroxml_process_declaration(const struct _root_id*, const char*, off_t, char*);
+static const char *__zeroxml_node_get_path(const struct _xml_id*, const cacheId**, const char*, off_t*,  const char**, int*, xmlExplain*);
+static const char *__zeroxml_get_node(const struct _xml_id*, const cacheId*, const char**, off_t*,  const char**, int*, int*, char, xmlExplainStep*);
+static const char *__zeroxml_scan_node(struct _zeroxml_scan*, const struct _xml_id*, const cacheId*, const char**, off_t*,  const char**, int*, int*, char);
+static int __zeroxml_cache_children(const struct _xml_id*, const cacheId*, const char*, off_t, int, const char**, int*);
+static const char *__zeroxml_get_cached_node(const struct _xml_id*, const cacheId**, const char**, off_t*,  const char**, int*, int*);
 static xmlId *__zeroxml_get_node_pos(const xmlId*, xmlId*, const char*, int, char);
 static const char *__zeroxml_get_attribute_data_ptr(const struct _xml_id*, const char *, int*);
 static void __zeroxml_set_error(const struct _xml_id*, const char*, const char*, int);
+static int __zeroxml_validate(const struct _xml_id*, const char*, off_t, xmlErrorList*);
+static void __zeroxml_get_location(const struct _root_id*, const char*, int*, int*);
+static int __zeroxml_init_root(struct _root_id*, const char*, off_t, const xmlOptions*, struct _zeroxml_index*);
+static int __zeroxml_init_options(struct _root_id*, const xmlOptions*);
+static int __zeroxml_init_memory(struct _root_id*, const xmlOptions*);
+static int __zeroxml_init_document(struct _root_id*, const char*, off_t, struct _zeroxml_index*);
+static struct _root_id *__zeroxml_copy_buffer(const struct _root_id*, char*);
+static int __zeroxml_reindex(struct _root_id*, const struct _root_id*);
+#if HAVE_PTHREAD_H
+static int __zeroxml_background_start(struct _root_id*);
+#endif
+static int __zeroxml_io_policy(const xmlOptions*, off_t);
+static char *__zeroxml_map_file(struct _root_id*, int, off_t, int);
+static char *__zeroxml_decompress_file(struct _root_id*, char*, off_t*);
+static void __zeroxml_unmap_file(struct _root_id*);
+static void __zeroxml_release_window(const struct _root_id*, const char**, const char*);
 
 static const char *comment = XML_COMMENT;
 static struct _zeroxml_error __zeroxml_info = { NULL, 0 };
@@ -119,8 +185,21 @@ xmlOpen(const char *filename)
 
 XML_API xmlId* XML_APIENTRY
 xmlOpenFlags(const char *filename, enum xmlFlags flags)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    return xmlOpenOptions(filename, &options);
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlOpenOptions(const char *filename, const xmlOptions *options)
 {
     struct _root_id *rid = 0;
+    STATS_START(t0)
+    TRACE_START(ts)
 
 # ifndef NDEBUG
     snprintf(__zeroxml_filename, FILENAME_LEN, "%s", filename);
@@ -131,97 +210,243 @@ xmlOpenFlags(const char *filename, enum xmlFlags flags)
         int fd = open(filename, O_RDONLY);
         if (fd >= 0)
         {
-            rid = calloc(1, sizeof(struct _root_id));
-            if (rid)
+            struct stat statbuf;
+            int share = 0;
+
+            fstat(fd, &statbuf);
+            if (options && options->flags != XML_DEFAULT_FLAGS &&
+                (options->flags & XML_SHARE_DOCUMENT))
             {
-                struct stat statbuf;
+                share = 1;
+                rid = __zeroxml_registry_get(&statbuf, options);
+            }
+
+            if (rid) {
+                close(fd); /* a handle of a registered document */
+            }
+            else if ((rid = CALLOC(1, sizeof(struct _root_id))) != NULL)
+            {
+                struct _zeroxml_index index, compiled, *idx = NULL;
+                const char *start;
+                off_t len;
                 char *mm;
+                int io;
 
-#ifdef HAVE_LOCALE_H
-                char *locale;
-                locale = strdup(setlocale(LC_CTYPE, ""));
-#endif
-                rid->root = rid;
-                xmlSetFlags(rid, XML_DEFAULT_FLAGS);
-                if (flags != XML_DEFAULT_FLAGS) {
-                    xmlSetFlags(rid, flags);
+                if (options && options->flags != XML_DEFAULT_FLAGS &&
+                    (options->flags & XML_INDEX_FILE) &&
+                    __zeroxml_index_init(&index, filename, options->index,
+                                         statbuf.st_size, statbuf.st_mtime))
+                {
+                    idx = &index;
+                }
+
+                /* the document in memory counts against the memory limit */
+                len = statbuf.st_size;
+                io = __zeroxml_io_policy(options, len);
+                mm = NULL;
+                if (__zeroxml_init_memory(rid, options)) {
+                    mm = __zeroxml_map_file(rid, fd, len, io);
+                }
+                if (mm && __zeroxml_compressed(mm, (size_t)len)) {
+                    mm = __zeroxml_decompress_file(rid, mm, &len);
                 }
 
-                fstat(fd, &statbuf);
-                mm = simple_mmap(fd, (int)statbuf.st_size, &rid->un);
-                if (mm == (void *)MMAP_ERROR)
+                /* the records of a compiled document replace a sidecar */
+                if (mm)
                 {
-#ifdef HAVE_LOCALE_H
-                    free(locale);
-#endif
-                    free(rid);
+                    const char *doc;
+                    off_t dlen;
+
+                    start = mm;
+                    doc = __zeroxml_compiled(&compiled, mm, len, &dlen);
+                    if (doc)
+                    {
+                        if (idx) __zeroxml_index_done(idx);
+                        idx = &compiled;
+                        start = doc;
+                        len = dlen;
+                    }
+                }
+
+                if (mm && (io & XML_IO_WINDOW) && rid->fd >= 0)
+                {
+                    rid->window = XML_IO_WINDOW_SIZE;
+                    if (options->io.window > 0) {
+                        rid->window = options->io.window;
+                    }
+                }
+
+                if (!mm)
+                {
+                    __zeroxml_memory_destroy(rid->memory);
+                    FREE(rid);
                     rid = 0;
                 }
-                else
+                else if (!__zeroxml_init_root(rid, start, len, options, idx))
                 {
-                    int blocklen = statbuf.st_size;
-                    char *encoding = (char*)&rid->encoding;
-                    const char *start;
-#if defined(HAVE_LOCALE_H) && !defined(WIN32)
-                    rid->locale = newlocale(LC_CTYPE_MASK, locale, 0);
-#endif
-                    encoding[0] = 0;
-                    start = __zeroxml_process_declaration(rid, mm, blocklen,
-                                                          encoding);
-                    blocklen -= start-mm;
+                    __zeroxml_unmap_file(rid);
+                    __zeroxml_memory_destroy(rid->memory);
+                    FREE(rid);
+                    rid = 0;
+                }
+                else if (rid->fd < 0) {
+                    close(fd); /* the document is in memory */
+                }
 
-                    __zeroxml_prepare_data(rid, &start, &blocklen, RAW);
+                if (idx && idx != &compiled) {
+                    __zeroxml_index_done(idx);
+                }
+            }
 
-                    if (CACHED_NODES(rid))
-                    {
-                        const char *n = "*";
-                        int num = -1, nlen = 1;
-                        const char *ret, *new = start;
-                        int len = blocklen;
-
-                        rid->node = cacheInit(rid);
-                        ret = __zeroxml_get_node((struct _xml_id*)rid,
-                                                 rid->node, &new, &len,
-                                                 &n, &nlen, &num, RAW);
-                        if (!ret)
-                        {
-                            __zeroxml_set_error((struct _xml_id*)rid, start, new, len);
-//                          SET_ERROR((struct _xml_id*)rid, rid->start = start, new, len);
-                            simple_unmmap(mm, len, &rid->un);
-                            close(fd);
-
-                            cacheFree(rid->node);
-                            free(rid->info);
-                            free(rid);
-                            rid = 0;
-
-                            free(locale);
-                        }
-                    }
+            if (!rid) {
+                close(fd);
+            }
+            else if (share && !rid->registry) {
+                rid = __zeroxml_registry_add(rid, &statbuf, options);
+            }
+        }
+    }
 
-                    if (rid)
-                    {
-                        rid->fd = fd;
-                        rid->mmap = mm;
-                        rid->start = start;
-                        rid->len = blocklen;
-#ifdef HAVE_LOCALE_H
-# if defined(HAVE_ICONV_H) || defined(WIN32)
-                        do
-                        {
-                            const char *ptr = strrchr(locale, '.');
-                            if (!ptr) ptr = locale;
-                            else ++ptr;
-                            rid->cd = iconv_open(ptr, rid->encoding);
-                            free(locale);
-                        }
-                        while(0);
-# else
-                        free(locale);
-# endif
+    if (rid) {
+        STATS_TIME(rid, open_time, t0);
+    }
+    TRACE_SPAN("xmlOpen", ts);
+
+    return (void *)rid;
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlOpenShared(const char *name, const xmlOptions *options)
+{
+    struct _root_id *rid = 0;
+    STATS_START(t0)
+
+# ifndef NDEBUG
+    snprintf(__zeroxml_filename, FILENAME_LEN, "%s", name);
 #endif
-                    }
+
+#if HAVE_SHM_OPEN
+    if (name)
+    {
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd >= 0)
+        {
+            rid = CALLOC(1, sizeof(struct _root_id));
+            if (rid)
+            {
+                struct _zeroxml_index shared;
+                struct stat statbuf;
+                const char *doc = NULL;
+                off_t len = 0;
+                char *mm = NULL;
+
+                if (fstat(fd, &statbuf) == 0) {
+                    mm = __zeroxml_map_file(rid, fd, statbuf.st_size,
+                                            XML_IO_MMAP);
+                }
+                if (mm) {
+                    doc = __zeroxml_compiled(&shared, mm, statbuf.st_size,
+                                             &len);
+                }
+
+                /* the records are used in place, all processes share them */
+                if (doc) {
+                    shared.shared = XML_TRUE;
                 }
+
+                if (!doc || !__zeroxml_init_root(rid, doc, len, options,
+                                                 &shared))
+                {
+                    if (mm) __zeroxml_unmap_file(rid);
+                    __zeroxml_memory_destroy(rid->memory);
+                    FREE(rid);
+                    rid = 0;
+                }
+            }
+
+            if (!rid) {
+                close(fd);
+            }
+        }
+    }
+#endif
+
+    if (rid) {
+        STATS_TIME(rid, open_time, t0);
+    }
+
+    return (void *)rid;
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlReopen(const xmlId *id, const char *filename, const xmlOptions *options)
+{
+    const struct _root_id *prev = (const struct _root_id *)id;
+    enum xmlFlags flags = options ? options->flags : XML_DEFAULT_FLAGS;
+    struct _root_id *rid = 0;
+    xmlOptions scan;
+
+    /* only a complete node cache of its own can be copied */
+    if (!prev || prev->root != prev || !prev->node ||
+        (prev->flags & (__XML_CACHED_NODES | __XML_LAZY_NODES |
+                        __XML_BACKGROUND_NODES | __XML_SHARED_NODES))
+             != __XML_CACHED_NODES)
+    {
+        return xmlOpenOptions(filename, options);
+    }
+
+    if ((!(flags & XML_CACHE_NODES) &&
+         (flags & (XML_LAZY_NODES | XML_BACKGROUND_NODES | XML_SCAN_NODES))) ||
+        (flags != XML_DEFAULT_FLAGS &&
+         (flags & (XML_INDEX_FILE | XML_SHARE_DOCUMENT))))
+    {
+        return xmlOpenOptions(filename, options);
+    }
+
+    /* a file which is mapped by prev and changed in place changed prev too */
+    if (prev->fd >= 0)
+    {
+        struct stat pstat, nstat;
+
+        if (fstat(prev->fd, &pstat) || stat(filename, &nstat) ||
+            (pstat.st_dev == nstat.st_dev && pstat.st_ino == nstat.st_ino))
+        {
+            return xmlOpenOptions(filename, options);
+        }
+    }
+
+    /* open the new version without node cache */
+    memset(&scan, 0, sizeof(scan));
+    if (options) scan = *options;
+    scan.flags = flags & ~(XML_CACHE_NODES | XML_LAZY_NODES |
+                           XML_BACKGROUND_NODES | XML_INDEX_FILE |
+                           XML_SHARE_DOCUMENT);
+    scan.flags |= XML_SCAN_NODES;
+
+    rid = xmlOpenOptions(filename, &scan);
+    if (rid)
+    {
+        if ((rid->flags | __XML_CACHED_NODES) != prev->flags ||
+            memcmp(&rid->limits, &prev->limits, sizeof(xmlLimits)) ||
+            rid->limits.max_depth != INT_MAX ||
+            rid->limits.max_nodes != INT_MAX ||
+            rid->limits.max_steps != INT_MAX)
+        {
+            xmlClose(rid);
+            rid = xmlOpenOptions(filename, options);
+        }
+        else
+        {
+            STATS_START(t0)
+            TRACE_START(ts)
+            int res = __zeroxml_reindex(rid, prev);
+
+            STATS_TIME(rid, index_time, t0);
+            TRACE_SPAN("cache", ts);
+            if (!res)
+            {
+                xmlClose(rid);
+                rid = xmlOpenOptions(filename, options);
             }
         }
     }
@@ -237,8 +462,39 @@ xmlInitBuffer(const char *buffer, int blocklen)
 
 XML_API xmlId* XML_APIENTRY
 xmlInitBufferFlags(const char *buffer, int blocklen, enum xmlFlags flags)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    return xmlInitBufferOptions(buffer, blocklen, &options);
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlInitBufferOptions(const char *buffer, int blocklen, const xmlOptions *options)
+{
+    if (blocklen <= 0) return NULL;
+    return xmlInitBufferOptions64(buffer, (size_t)blocklen, options);
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlInitBuffer64(const char *buffer, size_t blocklen)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = XML_DEFAULT_FLAGS;
+
+    return xmlInitBufferOptions64(buffer, blocklen, &options);
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlInitBufferOptions64(const char *buffer, size_t blocklen, const xmlOptions *options)
 {
     struct _root_id *rid = 0;
+    STATS_START(t0)
+    TRACE_START(ts)
 
 # ifndef NDEBUG
     snprintf(__zeroxml_filename, FILENAME_LEN, "XML buffer");
@@ -246,116 +502,180 @@ xmlInitBufferFlags(const char *buffer, int blocklen, enum xmlFlags flags)
 
     if (buffer && (blocklen > 0))
     {
-        rid = calloc(1, sizeof(struct _root_id));
+        rid = CALLOC(1, sizeof(struct _root_id));
         if (rid)
         {
-            char *encoding = (char*)&rid->encoding;
-            const char *start;
-
-#ifdef HAVE_LOCALE_H
-            char *locale;
-            locale = strdup(setlocale(LC_CTYPE, ""));
-#endif
-            rid->root = rid;
-            xmlSetFlags(rid, XML_DEFAULT_FLAGS);
-            if (flags != XML_DEFAULT_FLAGS) {
-                xmlSetFlags(rid, flags);
+            rid->fd = MMAP_ERROR;
+            rid->mmap = (char*)buffer;
+            if (!__zeroxml_init_root(rid, buffer, (off_t)blocklen, options, NULL))
+            {
+                __zeroxml_memory_destroy(rid->memory);
+                FREE(rid);
+                rid = 0;
+            }
+            else {
+                STATS_TIME(rid, open_time, t0);
             }
+        }
+    }
+    TRACE_SPAN("xmlInitBuffer", ts);
 
-#if defined(HAVE_LOCALE_H) && !defined(WIN32)
-            rid->locale = newlocale(LC_CTYPE_MASK, locale, 0);
-#endif
+    return (void *)rid;
+}
 
-            encoding[0] = 0;
-            start = __zeroxml_process_declaration(rid, buffer, blocklen,
-                                                  encoding);
-            blocklen -= start-buffer;
+/* the root XML-id which is reused for every document of a context */
+struct _zeroxml_context
+{
+    struct _root_id *rid;
+};
 
-            __zeroxml_prepare_data(rid, &start, &blocklen, RAW);
+XML_API xmlContext* XML_APIENTRY
+xmlContextOpen(const xmlOptions *options)
+{
+    struct _zeroxml_context *rv;
+    xmlOptions opts;
 
-            if (CACHED_NODES(rid))
-            {
-                const char *n = "*";
-                int num = -1, nlen = 1;
-                const char *ret, *new = start;
-                int len = blocklen;
-
-                rid->node = cacheInit(rid);
-                ret = __zeroxml_get_node((struct _xml_id*)rid,
-                                         rid->node, &new, &len, &n, &nlen,
-                                         &num, RAW);
-                if (!ret)
-                {
-                    __zeroxml_set_error((struct _xml_id*)rid, start, new, len);
-//                  SET_ERROR((struct _xml_id*)rid, rid->start = start, new, len);
-                    cacheFree(rid->node);
-                    free(rid->info);
-                    free(rid);
-                    rid = 0;
+    if (options) {
+        opts = *options;
+    } else {
+        memset(&opts, 0, sizeof(opts));
+    }
 
-                    free(locale);
-                }
-            }
+    /* the arena keeps the memory of the node cache between documents */
+    if (opts.flags == XML_DEFAULT_FLAGS) {
+        opts.flags = XML_ARENA;
+    }
+    else if (opts.flags & XML_BACKGROUND_NODES) {
+        opts.flags &= ~XML_BACKGROUND_NODES;
+        opts.flags |= XML_CACHE_NODES;
+    }
+    opts.flags |= XML_ARENA;
 
-            if (rid)
+    rv = CALLOC(1, sizeof(struct _zeroxml_context));
+    if (rv)
+    {
+        rv->rid = CALLOC(1, sizeof(struct _root_id));
+        if (rv->rid)
+        {
+            rv->rid->fd = MMAP_ERROR;
+            if (!__zeroxml_init_options(rv->rid, &opts))
             {
-                rid->fd = MMAP_ERROR;
-                rid->mmap = (char*)buffer;
-                rid->start = start;
-                rid->len = blocklen;
-#ifdef HAVE_LOCALE_H
-# if defined(HAVE_ICONV_H) || defined(WIN32)
-                do
-                {
-                    const char *ptr = strrchr(locale, '.');
-                    if (!ptr) ptr = locale;
-                    else ++ptr;
-                    rid->cd = iconv_open(ptr, rid->encoding);
-                    free(locale);
-                }
-                while(0);
-# else
-                free(locale);
-# endif
-#endif
+                __zeroxml_memory_destroy(rv->rid->memory);
+                FREE(rv->rid);
+                rv->rid = NULL;
             }
         }
+
+        if (!rv->rid)
+        {
+            FREE(rv);
+            rv = NULL;
+        }
     }
 
-    return (void *)rid;
+    return rv;
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlReset(xmlContext *ctx, const char *buffer, int blocklen)
+{
+    return xmlReset64(ctx, buffer, (blocklen > 0) ? (size_t)blocklen : 0);
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlReset64(xmlContext *ctx, const char *buffer, size_t blocklen)
+{
+    struct _zeroxml_context *context = ctx;
+    struct _root_id *rid;
+    STATS_START(t0)
+    TRACE_START(ts)
+
+    assert(context != 0);
+
+    rid = context->rid;
+
+    /* the node cache and the error information live in the arena */
+    __zeroxml_memory_free(rid->memory, rid->lines);
+    rid->lines = NULL;
+    rid->info = NULL;
+    rid->node = NULL;
+    rid->mmap = NULL;
+    __zeroxml_arena_reset(rid->arena);
+#if XML_USE_STATS
+    memset(&rid->stats, 0, sizeof(rid->stats));
+#endif
+
+# ifndef NDEBUG
+    snprintf(__zeroxml_filename, FILENAME_LEN, "XML buffer");
+#endif
+
+    if (!buffer || !blocklen) return NULL;
+
+    rid->mmap = (char*)buffer;
+    if (!__zeroxml_init_document(rid, buffer, (off_t)blocklen, NULL))
+    {
+        rid->node = NULL;
+        TRACE_SPAN("xmlReset", ts);
+        return NULL;
+    }
+    STATS_TIME(rid, open_time, t0);
+    TRACE_SPAN("xmlReset", ts);
+
+    return (void*)rid;
+}
+
+XML_API void XML_APIENTRY
+xmlContextClose(xmlContext *ctx)
+{
+    struct _zeroxml_context *context = ctx;
+
+    if (context)
+    {
+        xmlClose(context->rid);
+        FREE(context);
+    }
 }
 
 XML_API void XML_APIENTRY
 xmlClose(xmlId *id)
 {
     struct _root_id *rid = (struct _root_id *)id;
+    TRACE_START(ts)
 
-    if (rid && rid->root == rid)
+    if (rid && rid->root == rid && rid->registry) {
+        /* the document is closed with the last handle */
+        __zeroxml_registry_release(rid);
+    }
+    else if (rid && rid->root == rid)
     {
-        if (rid->fd == MMAP_FREE) {
-           free(rid->mmap);
-        }
-        else if (rid->fd != MMAP_ERROR)
+#if HAVE_PTHREAD_H
+        /* wait for the background thread, it still uses the document */
+        if (rid->background)
         {
-            simple_unmmap(rid->mmap, (int)rid->len, &rid->un);
-            close(rid->fd);
+            pthread_join(rid->background->thread, NULL);
+            pthread_cond_destroy(&rid->background->cond);
+            pthread_mutex_destroy(&rid->background->mutex);
+            FREE(rid->background);
         }
+#endif
 
-        cacheFree(rid->node);
-
-        if (rid->info) free(rid->info);
-#if defined(HAVE_ICONV_H) || defined(WIN32)
-        if (rid->cd != (iconv_t)-1) {
-            iconv_close(rid->cd);
+        __zeroxml_unmap_file(rid);
+        if (rid->fd >= 0) {
+            close(rid->fd);
         }
-#endif
-#ifndef WIN32
-        if (rid->locale) {
-            freelocale(rid->locale);
+
+        if (!SHARED_NODES(rid)) {
+            cacheFree(rid, rid->node);
         }
-#endif
-        free(rid);
+
+        __zeroxml_memory_free(rid->memory, rid->lines);
+        if (rid->info) __zeroxml_free(rid, rid->info);
+        __zeroxml_arena_destroy(rid->arena);
+        __zeroxml_arena_destroy(rid->charged);
+        __zeroxml_memory_destroy(rid->memory);
+        FREE(rid);
         id = 0;
+        TRACE_SPAN("xmlClose", ts);
     }
 }
 
@@ -408,8 +728,16 @@ xmlSetFlags(const xmlId *id, enum xmlFlags flags)
 
     if (flags & XML_CACHE_NODES) {
         rid->flags |= __XML_CACHED_NODES;
+        rid->flags &= ~(__XML_LAZY_NODES | __XML_BACKGROUND_NODES);
+    } else if (flags & XML_LAZY_NODES) {
+        rid->flags |= (__XML_CACHED_NODES | __XML_LAZY_NODES);
+        rid->flags &= ~__XML_BACKGROUND_NODES;
+    } else if (flags & XML_BACKGROUND_NODES) {
+        rid->flags |= (__XML_CACHED_NODES | __XML_BACKGROUND_NODES);
+        rid->flags &= ~__XML_LAZY_NODES;
     } else if (flags & XML_SCAN_NODES) {
-        rid->flags &= ~__XML_CACHED_NODES;
+        rid->flags &= ~(__XML_CACHED_NODES | __XML_LAZY_NODES |
+                        __XML_BACKGROUND_NODES);
     }
 
     if (flags & XML_LOCALIZATION) {
@@ -432,7 +760,8 @@ xmlNodeTest(const xmlId *id, const char *path)
     const struct _xml_id *xid = (const struct _xml_id *)id;
     const cacheId *nc, *nnc;
     const char *node;
-    int len, slen;
+    off_t len;
+    int slen;
     int rv;
 
     assert(id != 0);
@@ -440,14 +769,14 @@ xmlNodeTest(const xmlId *id, const char *path)
 
     node = ( const char *)path;
     len = xid->len;
-    slen = strlen(path);
+    slen = (int)strlen(path);
 
     nnc = nc = cacheNodeGet(id);
 
     if (!strcoll(path, XML_COMMENT)) {
         rv = (xid->name == comment) ? XML_TRUE : XML_FALSE;
     } else {
-        if (__zeroxml_node_get_path(xid, &nnc, xid->start, &len, &node, &slen)) {
+        if (__zeroxml_node_get_path(xid, &nnc, xid->start, &len, &node, &slen, NULL)) {
             rv  = XML_TRUE;
         } else {
             rv = XML_FALSE;
@@ -457,92 +786,153 @@ xmlNodeTest(const xmlId *id, const char *path)
     return rv;
 }
 
-XML_API xmlId* XML_APIENTRY
-xmlNodeGet(const xmlId *id, const char *path)
+/* xmlNodeStorage has to be large enough to hold an XML-id */
+typedef char __zeroxml_storage_size[(sizeof(xmlNodeStorage) >= sizeof(struct _xml_id)) ? 1 : -1];
+
+/*
+ * Locate the node of path and store its XML-id in xsid.
+ *
+ * @param id XML-id of the parent node
+ * @param path path to the node
+ * @param xsid the XML-id to store the node in
+ * @param explain if not NULL, the work done for every step is stored in it
+ * @return XML_TRUE if the node was found, XML_FALSE otherwise
+ */
+static int
+__zeroxml_node_get(const xmlId *id, const char *path, struct _xml_id *xsid, xmlExplain *explain)
 {
     const struct _xml_id *xid = (const struct _xml_id *)id;
-    struct _xml_id *xsid = NULL;
     const  cacheId *nc, *nnc;
     const char *ptr, *node;
-    int len, slen;
+    off_t len;
+    int slen;
 
     assert(id != 0);
     assert(path != 0);
 
     node = ( const char *)path;
     len = xid->len;
-    slen = strlen(path);
+    slen = (int)strlen(path);
 
     nnc = nc = cacheNodeGet(id);
-    ptr = __zeroxml_node_get_path(xid, &nnc, xid->start, &len, &node, &slen);
+    ptr = __zeroxml_node_get_path(xid, &nnc, xid->start, &len, &node, &slen,
+                                  explain);
     if (ptr)
     {
-        xsid = malloc(sizeof(struct _xml_id));
-        if (xsid)
-        {
-            xsid->name = node;
-            xsid->name_len = slen;
-            xsid->start = (char*)ptr;
-            xsid->len = len;
-            if (xid->name) {
-                xsid->root = xid->root;
-            } else {
-                xsid->root = (struct _root_id *)xid;
-            }
-
-            xsid->node = nnc;
-        }
-        else {
-            SET_ERROR(xid, 0, 0, XML_OUT_OF_MEMORY);
+        xsid->name = node;
+        xsid->name_len = slen;
+        xsid->start = (char*)ptr;
+        xsid->len = len;
+        if (xid->name) {
+            xsid->root = xid->root;
+        } else {
+            xsid->root = (struct _root_id *)xid;
         }
+
+        xsid->node = nnc;
     }
     else if (slen == 0) {
-        SET_ERROR(xid, node, node, len);
+        SET_ERROR(xid, node, node, (int)len);
     }
 
-    return (void *)xsid;
+    return ptr ? XML_TRUE : XML_FALSE;
 }
 
 XML_API xmlId* XML_APIENTRY
-xmlNodeCopy(const xmlId *id, const char *path)
+xmlNodeGet(const xmlId *id, const char *path)
 {
-    struct _root_id *rv = NULL;
-    xmlId *xid;
+    const struct _xml_id *xid = (const struct _xml_id *)id;
+    struct _xml_id *xsid = NULL;
+    struct _xml_id node;
 
-    if ((xid = xmlNodeGet(id, path)) != NULL)
+    if (__zeroxml_node_get(id, path, &node, NULL))
     {
-        char *ptr;
-        if ((ptr = xmlGetString(xid)) != NULL)
-        {
-            rv = xmlInitBufferFlags(ptr, strlen(ptr), xid->root->flags);
-            rv->fd = MMAP_FREE; /* let xmlClose free ptr */
+        xsid = __zeroxml_alloc(xid->root, sizeof(struct _xml_id),
+                               ARENA_SCOPED);
+        if (xsid) {
+            memcpy(xsid, &node, sizeof(struct _xml_id));
+        }
+        else {
+            SET_ERROR(xid, 0, 0, XML_OUT_OF_MEMORY);
         }
-        xmlFree(xid);
     }
 
-    return (xmlId*)rv;
+    return (void *)xsid;
 }
 
-XML_API char* XML_APIENTRY
-xmlNodeGetName(const xmlId *id)
+XML_API xmlId* XML_APIENTRY
+xmlNodeGetExplain(const xmlId *id, const char *path, xmlExplain *explain)
 {
     const struct _xml_id *xid = (const struct _xml_id *)id;
-    const struct _root_id *rid = xid->root;
-    int len;
-    char *rv;
+    struct _xml_id *xsid = NULL;
+    struct _xml_id node;
 
-    assert(xid != 0);
+    assert(explain != 0);
 
-    len = xid->name_len;
-    if ((rv = malloc(6*len+1)) != NULL)
+    explain->num_steps = 0;
+    if (__zeroxml_node_get(id, path, &node, explain))
     {
-        int res = __zeroxml_iconv(rid, xid->name, len, rv, 6*len);
-        if (res) SET_ERROR(xid, 0, 0, res);
+        xsid = __zeroxml_alloc(xid->root, sizeof(struct _xml_id),
+                               ARENA_SCOPED);
+        if (xsid) {
+            memcpy(xsid, &node, sizeof(struct _xml_id));
+        }
+        else {
+            SET_ERROR(xid, 0, 0, XML_OUT_OF_MEMORY);
+        }
     }
-    else {
-        SET_ERROR(xid, 0, 0, XML_OUT_OF_MEMORY);
+
+    return (void *)xsid;
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlNodeGetInto(const xmlId *id, const char *path, xmlNodeStorage *storage)
+{
+    struct _xml_id *xsid = (struct _xml_id *)storage;
+
+    assert(storage != 0);
+
+    if (!__zeroxml_node_get(id, path, xsid, NULL)) {
+        xsid = NULL;
+    }
+
+    return (void *)xsid;
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlNodeCopy(const xmlId *id, const char *path)
+{
+    struct _root_id *rv = NULL;
+    xmlId *xid;
+
+    if ((xid = xmlNodeGet(id, path)) != NULL)
+    {
+        char *ptr;
+
+        /* the copy takes ownership of the string */
+        ptr = __zeroxml_get_string(xid, STRIPPED, ARENA_NONE);
+        if (ptr != NULL)
+        {
+            rv = __zeroxml_copy_buffer(xid->root, ptr);
+        }
+        xmlFree(xid);
     }
 
+    return (xmlId*)rv;
+}
+
+XML_API char* XML_APIENTRY
+xmlNodeGetName(const xmlId *id)
+{
+    const struct _xml_id *xid = (const struct _xml_id *)id;
+    int len;
+    char *rv;
+
+    assert(xid != 0);
+
+    len = xid->name_len;
+    rv = __zeroxml_convert(xid, xid->name, len, ARENA_SCOPED);
+
     return rv;
 }
 
@@ -573,14 +963,13 @@ XML_API int XML_APIENTRY
 xmlNodeCompareName(const xmlId *id, const char *str)
 {
     struct _xml_id *xid = (struct _xml_id *)id;
-    int slen = str ? strlen(str) : 0;
+    int slen = str ? (int)strlen(str) : 0;
     int nlen, rv = XML_TRUE;
 
-    nlen = xid->name_len;
+    nlen = (int)xid->name_len;
     if (nlen >= slen)
     {
-        iconv_t cd = xid->root->cd;
-        rv = LSTRNCMP(cd, str, xid->name, &nlen);
+        rv = LSTRNCMP(xid->root, str, xid->name, &nlen);
     }
 
     return rv;
@@ -619,7 +1008,7 @@ xmlAttributeCopyName(const xmlId *id, char *buf, int buflen, int pos)
             {
                 pe = new-1;
                 while ((pe>ps) && isspace(*pe)) pe--;
-                slen = (pe-ps)+1;
+                slen = (int)(pe-ps)+1;
 
                 if (slen >= buflen)
                 {
@@ -646,7 +1035,6 @@ XML_API char* XML_APIENTRY
 xmlAttributeGetName(const xmlId *id, int pos)
 {
     const struct _xml_id *xid = (const struct _xml_id *)id;
-    const struct _root_id *rid = xid->root;
     char buf[4096];
     char *rv;
     int len;
@@ -654,14 +1042,7 @@ xmlAttributeGetName(const xmlId *id, int pos)
     assert(xid != 0);
 
     len = xmlAttributeCopyName(id, buf, 4096, pos);
-    if ((rv = malloc(6*len+1)) != NULL)
-    {
-        int res = __zeroxml_iconv(rid, buf, len, rv, 6*len);
-        if (res) SET_ERROR(xid, 0, 0, res);
-    }
-    else {
-        SET_ERROR(xid, 0, 0, XML_OUT_OF_MEMORY);
-    }
+    rv = __zeroxml_convert(xid, buf, len, ARENA_SCOPED);
 
     return rv;
 }
@@ -693,9 +1074,8 @@ xmlAttributeCompareName(const xmlId *id, int pos, const char *str)
 
             if (num++ == pos)
             {
-                iconv_t cd = xid->root->cd;
-                int slen = new-ps;
-                rv = LSTRNCMP(cd, str, ps, &slen);
+                int slen = (int)(new-ps);
+                rv = LSTRNCMP(xid->root, str, ps, &slen);
                 break;
             }
 
@@ -770,11 +1150,11 @@ xmlNodeCopyPos(const xmlId *pid, xmlId *id, const char *element, int num)
     xid = xmlMarkId(id);
     if ((nid = __zeroxml_get_node_pos(id, xid, element, num, RAW)) != NULL)
     {
-        if ((ptr = xmlGetString(nid)) != NULL)
+        ptr = __zeroxml_get_string(nid, STRIPPED, ARENA_NONE);
+        if (ptr != NULL)
         {
             struct _xml_id *xfid = (struct _xml_id *)nid;
-            rv = xmlInitBufferFlags(ptr, strlen(ptr), xfid->root->flags);
-            rv->fd = MMAP_FREE; /* let xmlClose free ptr */
+            rv = __zeroxml_copy_buffer(xfid->root, ptr);
         }
     }
     xmlFree(xid);
@@ -785,13 +1165,36 @@ xmlNodeCopyPos(const xmlId *pid, xmlId *id, const char *element, int num)
 XML_API char* XML_APIENTRY
 xmlGetString(const xmlId *id)
 {
-   return __zeroxml_get_string(id, STRIPPED);
+   return __zeroxml_get_string(id, STRIPPED, ARENA_SCOPED);
 }
 
 XML_API char* XML_APIENTRY
 xmlGetStringRaw(const xmlId *id)
 {
-   return __zeroxml_get_string(id, RAW);
+   return __zeroxml_get_string(id, RAW, ARENA_SCOPED);
+}
+
+XML_API size_t XML_APIENTRY
+xmlGetStringLength(const xmlId *id)
+{
+    const struct _xml_id *xid = (const struct _xml_id *)id;
+    const struct _root_id *rid = xid->root;
+    size_t rv = 0;
+
+    assert(xid != 0);
+
+    if (xid->len)
+    {
+        const char *ps = xid->start;
+        off_t len = xid->len;
+
+        __zeroxml_prepare_data(rid, &ps, &len, STRIPPED);
+        if (len) {
+            rv = __zeroxml_iconv_length(rid, ps, (size_t)len);
+        }
+    }
+
+    return rv;
 }
 
 XML_API int XML_APIENTRY
@@ -809,22 +1212,25 @@ xmlCopyString(const xmlId *id, char *buf, int buflen)
     if (xid->len)
     {
         const char *ps;
-        int res, len;
+        size_t size;
+        off_t len;
+        int res;
 
         ps = xid->start;
         len = xid->len;
         __zeroxml_prepare_data(rid, &ps, &len, STRIPPED);
         if (len)
         {
-            if (len >= buflen)
+            size = __zeroxml_iconv_length(rid, ps, (size_t)len);
+            if (size >= (size_t)buflen)
             {
-                len = buflen-1;
+                if (len >= buflen) len = buflen-1;
                 SET_ERROR(xid, 0, 0, XML_TRUNCATE_RESULT);
             }
-            res = __zeroxml_iconv(rid, ps, len, buf, buflen);
-            if (res) SET_ERROR(xid, 0, 0, res);
+            res = __zeroxml_iconv(rid, ps, len, buf, buflen-1);
+            if (res && res != XML_TRUNCATE_RESULT) SET_ERROR(xid, 0, 0, res);
+            rv = (size < (size_t)buflen) ? (int)size : (int)strlen(buf);
         }
-        rv = len;
     }
 
     return rv;
@@ -842,14 +1248,15 @@ xmlCompareString(const xmlId *id, const char *s)
 
     if (xid->len && (strlen(s) > 0))
     {
-        iconv_t cd = xid->root->cd;
         const char *ps;
-        int len;
+        off_t len;
+        int clen;
 
         ps = xid->start;
         len = xid->len;
         __zeroxml_prepare_data(rid, &ps, &len, STRIPPED);
-        rv = LSTRNCMP(cd, s, ps, &len) ? XML_TRUE : XML_FALSE;
+        clen = (len < INT_MAX) ? (int)len : INT_MAX;
+        rv = LSTRNCMP(xid->root, s, ps, &clen) ? XML_TRUE : XML_FALSE;
     }
 
     return rv;
@@ -869,28 +1276,22 @@ xmlNodeGetString(const xmlId *id, const char *path)
     {
         const char *node, *str;
         const cacheId *nc;
-        int len, slen;
+        off_t len;
+        int slen;
 
         len = xid->len;
-        slen = strlen(path);
+        slen = (int)strlen(path);
         node = (const char *)path;
         nc = cacheNodeGet(id);
-        str = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen);
+        str = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen, NULL);
         if (str && len)
         {
             const char *ps = str;
             __zeroxml_prepare_data(rid, &ps, &len, STRIPPED);
-            if ((rv = malloc(6*len+1)) != NULL)
-            {
-                int res = __zeroxml_iconv(rid, ps, len, rv, 6*len);
-                if (res) SET_ERROR(xid, 0, 0, res);
-            }
-            else {
-                SET_ERROR(xid, 0, 0, XML_OUT_OF_MEMORY);
-            }
+            rv = __zeroxml_convert(xid, ps, (size_t)len, ARENA_SCOPED);
         }
         else if (slen == 0) {
-            SET_ERROR(xid, node, node, len);
+            SET_ERROR(xid, node, node, (int)len);
         }
     }
 
@@ -913,12 +1314,12 @@ xmlNodeCopyString(const xmlId *id, const char *path, char *buf, int buflen)
     if (xid->len)
     {
         const char *ptr, *node = (const char *)path;
-        int res, slen = strlen(node);
-        int len = xid->len;
+        int res, slen = (int)strlen(node);
+        off_t len = xid->len;
         const cacheId *nc;
 
         nc = cacheNodeGet(id);
-        ptr = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen);
+        ptr = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen, NULL);
         if (ptr)
         {
             __zeroxml_prepare_data(rid, &ptr, &len, STRIPPED);
@@ -933,10 +1334,10 @@ xmlNodeCopyString(const xmlId *id, const char *path, char *buf, int buflen)
                 res = __zeroxml_iconv(rid, ptr, len, buf, buflen);
                 if (res) SET_ERROR(xid, 0, 0, res);
             }
-            rv = len;
+            rv = (int)len;
         }
         else if (slen == 0) {
-            SET_ERROR(xid, node, node, len);
+            SET_ERROR(xid, node, node, (int)len);
         }
     }
 
@@ -958,22 +1359,25 @@ xmlNodeCompareString(const xmlId *id, const char *path, const char *s)
     {
         const char *node, *str;
         const cacheId *nc;
-        int len, slen;
+        off_t len;
+        int slen;
 
         len = xid->len;
-        slen = strlen(path);
+        slen = (int)strlen(path);
         node = (const char *)path;
         nc = cacheNodeGet(id);
-        str = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen);
+        str = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen, NULL);
         if (str && len)
         {
-            iconv_t cd = xid->root->cd;
             const char *ps = str;
+            int clen;
+
             __zeroxml_prepare_data(rid, &ps, &len, STRIPPED);
-            rv = LSTRNCMP(cd, s, ps, &len);
+            clen = (len < INT_MAX) ? (int)len : INT_MAX;
+            rv = LSTRNCMP(xid->root, s, ps, &clen);
         }
         else if (slen == 0) {
-            SET_ERROR(xid, node, node, len);
+            SET_ERROR(xid, node, node, (int)len);
         }
     }
 
@@ -1012,20 +1416,21 @@ xmlNodeGetBool(const xmlId *id, const char *path)
     {
         const char *str, *node;
         const cacheId *nc;
-        int len, slen;
+        off_t len;
+        int slen;
 
         len = xid->len;
-        slen = strlen(path);
+        slen = (int)strlen(path);
         node = (const char *)path;
         nc = cacheNodeGet(id);
-        str = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen);
+        str = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen, NULL);
         if (str)
         {
             const char *end = str+len;
             rv = __zeroxml_strtob(rid, str, end, __XML_BOOL_NONE);
         }
         else if (slen == 0) {
-            SET_ERROR(xid, node, node, len);
+            SET_ERROR(xid, node, node, (int)len);
         }
     }
 
@@ -1062,20 +1467,21 @@ xmlNodeGetInt(const xmlId *id, const char *path)
     {
         const char *str, *node;
         const cacheId *nc;
-        int len, slen;
+        off_t len;
+        int slen;
 
         len = xid->len;
-        slen = strlen(path);
+        slen = (int)strlen(path);
         node = (const char *)path;
         nc = cacheNodeGet(id);
-        str = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen);
+        str = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen, NULL);
         if (str)
         {
             char *end = (char*)str+len;
             rv = __zeroxml_strtol(str, &end, 10, __XML_NONE);
         }
         else if (slen == 0) {
-            SET_ERROR(xid, node, node, len);
+            SET_ERROR(xid, node, node, (int)len);
         }
     }
 
@@ -1113,26 +1519,47 @@ xmlNodeGetDouble(const xmlId *id, const char *path)
     {
         const char *ptr, *node;
         const cacheId *nc;
-        int len, slen;
+        off_t len;
+        int slen;
 
         len = xid->len;
-        slen = strlen(path);
+        slen = (int)strlen(path);
         node = (const char *)path;
         nc = cacheNodeGet(id);
-        ptr = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen);
+        ptr = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen, NULL);
         if (ptr)
         {
             char *end = (char*)ptr+len;
             rv = __zeroxml_strtod(ptr, &end, __XML_FPNONE);
         }
         else if (slen == 0) {
-            SET_ERROR(xid, node, node, len);
+            SET_ERROR(xid, node, node, (int)len);
         }
     }
 
     return rv;
 }
 
+/* store a marker XML-id for id in xmid */
+static void
+__zeroxml_mark_id(const xmlId *id, struct _xml_id *xmid)
+{
+    struct _root_id *xrid = (struct _root_id *)id;
+
+    if (xrid->root == xrid)
+    {
+        xmid->name = "";
+        xmid->name_len = 0;
+        xmid->start = xrid->start;
+        xmid->len = xrid->len;
+        xmid->root = xrid;
+        xmid->node = cacheNodeGet(id);
+    }
+    else {
+        memcpy(xmid, id, sizeof(struct _xml_id));
+    }
+}
+
 XML_API xmlId* XML_APIENTRY
 xmlMarkId(const xmlId *id)
 {
@@ -1140,22 +1567,10 @@ xmlMarkId(const xmlId *id)
 
     assert(id != 0);
 
-    xmid = malloc(sizeof(struct _xml_id));
-    if (xmid)
-    {
-        struct _root_id *xrid = (struct _root_id *)id;
-        if (xrid->root == xrid)
-        {
-            xmid->name = "";
-            xmid->name_len = 0;
-            xmid->start = xrid->start;
-            xmid->len = xrid->len;
-            xmid->root = xrid;
-            xmid->node = xrid->node;
-        }
-        else {
-            memcpy(xmid, id, sizeof(struct _xml_id));
-        }
+    xmid = __zeroxml_alloc(((struct _xml_id*)id)->root,
+                           sizeof(struct _xml_id), ARENA_SCOPED);
+    if (xmid) {
+        __zeroxml_mark_id(id, xmid);
     }
     else {
         SET_ERROR((struct _xml_id*)id, 0, 0, XML_OUT_OF_MEMORY);
@@ -1164,10 +1579,50 @@ xmlMarkId(const xmlId *id)
     return (void *)xmid;
 }
 
+XML_API xmlId* XML_APIENTRY
+xmlMarkIdInto(const xmlId *id, xmlNodeStorage *storage)
+{
+    struct _xml_id *xmid = (struct _xml_id *)storage;
+
+    assert(id != 0);
+    assert(storage != 0);
+
+    __zeroxml_mark_id(id, xmid);
+
+    return (void *)xmid;
+}
+
 XML_API void XML_APIENTRY
 xmlFree(void *id)
 {
-    if (id) free(id);
+    __zeroxml_release(id);
+}
+
+XML_API size_t XML_APIENTRY
+xmlArenaMark(const xmlId *id)
+{
+    const struct _xml_id *xid = (const struct _xml_id *)id;
+    size_t rv = 0;
+
+    assert(xid != 0);
+
+    if (xid->root->arena) {
+        rv = __zeroxml_arena_mark(xid->root->arena);
+    }
+
+    return rv;
+}
+
+XML_API void XML_APIENTRY
+xmlArenaRelease(const xmlId *id, size_t mark)
+{
+    const struct _xml_id *xid = (const struct _xml_id *)id;
+
+    assert(xid != 0);
+
+    if (xid->root->arena) {
+        __zeroxml_arena_release(xid->root->arena, mark);
+    }
 }
 
 XML_API int XML_APIENTRY
@@ -1252,7 +1707,6 @@ XML_API char * XML_APIENTRY
 xmlAttributeGetString(const xmlId *id, const char *name)
 {
     const struct _xml_id *xid = (const struct _xml_id *)id;
-    const struct _root_id *rid = xid->root;
     char *rv = NULL;
 
     if (xid->name_len && xid->name != comment)
@@ -1261,16 +1715,8 @@ xmlAttributeGetString(const xmlId *id, const char *name)
         const char *ptr;
 
         ptr = __zeroxml_get_attribute_data_ptr(xid, name, &len);
-        if (ptr)
-        {
-            if ((rv = malloc(6*len+1)) != NULL)
-            {
-                int res = __zeroxml_iconv(rid, ptr, len, rv, 6*len);
-                if (res) SET_ERROR(xid, 0, 0, res);
-            }
-            else {
-                SET_ERROR(xid, 0, 0, XML_OUT_OF_MEMORY);
-            }
+        if (ptr) {
+            rv = __zeroxml_convert(xid, ptr, len, ARENA_SCOPED);
         }
     }
     return rv;
@@ -1327,8 +1773,7 @@ xmlAttributeCompareString(const xmlId *id, const char *name, const char *s)
         ptr = __zeroxml_get_attribute_data_ptr(xid, name, &len);
         if (ptr && (len == strlen(s)))
         {
-            iconv_t cd = xid->root->cd;
-            rv = LSTRNCMP(cd, s, ptr, &len);
+            rv = LSTRNCMP(xid->root, s, ptr, &len);
         }
     }
     return rv;
@@ -1380,18 +1825,9 @@ xmlErrorGetLineNo(const xmlId *id, int clear)
         if (rid->info)
         {
             struct _zeroxml_error *err = rid->info;
-            const char *ps = rid->start;
-            const char *pe = err->pos;
-            const char *new;
+            int column;
 
-            rv++;
-            while (ps<pe)
-            {
-                new = MEMCHR(ps, '\n', pe-ps);
-                if (new) rv++;
-                else break;
-                ps = new+1;
-            }
+            __zeroxml_get_location(rid, err->pos, &rv, &column);
 
             if (clear) {
                 err->err_no = __zeroxml_info.err_no = 0;
@@ -1418,100 +1854,1029 @@ xmlErrorGetColumnNo(const xmlId *id, int clear)
         if (xid->name) rid = xid->root;
         else rid = (struct _root_id *)xid;
 
-        assert(rid != 0);
+        assert(rid != 0);
+
+        if (rid->info)
+        {
+            struct _zeroxml_error *err = rid->info;
+            int line;
+
+            __zeroxml_get_location(rid, err->pos, &line, &rv);
+
+            if (clear) {
+                err->err_no = __zeroxml_info.err_no = 0;
+            }
+        }
+    }
+    else if (!id) {
+        rv = __zeroxml_info.column;
+    }
+
+    return rv;
+}
+
+XML_API const char* XML_APIENTRY
+xmlErrorGetString(const xmlId *id, int clear)
+{
+    char *rv = "error detection was not enabled.";
+
+    if (id && VALIDATING(id))
+    {
+        struct _xml_id *xid = (struct _xml_id *)id;
+        struct _root_id *rid;
+
+        if (xid->name) rid = xid->root;
+        else rid = (struct _root_id *)xid;
+
+        assert(rid != 0);
+
+        if (rid->info)
+        {
+            struct _zeroxml_error *err = rid->info;
+            if (XML_NO_ERROR <= err->err_no && err->err_no < XML_MAX_ERROR) {
+                rv = (char*)__zeroxml_error_str[err->err_no];
+            } else {
+                rv = "unknown error number.";
+            }
+
+            if (clear) {
+                err->err_no = __zeroxml_info.err_no = 0;
+            }
+        }
+    }
+    else if (!id) {
+       rv = (char*)__zeroxml_error_str[__zeroxml_info.err_no];
+    }
+
+#ifndef NDEBUG
+    printf("\tdetected in %s at line %i\n",
+            __zeroxml_info.func, __zeroxml_info.line_no);
+#endif
+
+    return rv;
+}
+
+XML_API int XML_APIENTRY
+xmlValidate(const xmlId *id, xmlErrorList *list)
+{
+    const struct _xml_id *xid = (const struct _xml_id *)id;
+    int rv = 0;
+
+    assert(xid != 0);
+
+    if (list)
+    {
+        assert(list->max_errors == 0 || list->errors != 0);
+        list->num_errors = 0;
+    }
+
+    if (xid->len) {
+        rv = __zeroxml_validate(xid, xid->start, xid->len, list);
+    }
+
+    return rv;
+}
+
+XML_API int XML_APIENTRY
+xmlIsIndexed(const xmlId *id)
+{
+    const struct _xml_id *xid = (const struct _xml_id *)id;
+    int rv = XML_FALSE;
+
+    assert(xid != 0);
+
+    if (CACHED_NODES(xid->root) && ATOMIC_PTR_GET(xid->root->node)) {
+        rv = XML_TRUE;
+    }
+
+    return rv;
+}
+
+XML_API int XML_APIENTRY
+xmlWaitIndexed(const xmlId *id)
+{
+    const struct _xml_id *xid = (const struct _xml_id *)id;
+
+    assert(xid != 0);
+
+#if HAVE_PTHREAD_H
+    if (xid->root->background)
+    {
+        struct _root_id *rid = xid->root;
+        struct _zeroxml_background *bg = rid->background;
+
+        pthread_mutex_lock(&bg->mutex);
+        while (bg->state == __XML_BUILD_RUNNING) {
+            pthread_cond_wait(&bg->cond, &bg->mutex);
+        }
+        pthread_mutex_unlock(&bg->mutex);
+
+        if (bg->state == __XML_BUILD_FAILED) {
+            __zeroxml_set_error(xid, rid->start, bg->err_pos, bg->err_no);
+        }
+    }
+#endif
+
+    return xmlIsIndexed(id);
+}
+
+XML_API int XML_APIENTRY
+xmlCompile(const xmlId *id, const char *fname)
+{
+    const struct _xml_id *xid = (const struct _xml_id *)id;
+    struct _root_id *rid;
+    int rv = XML_FALSE;
+
+    assert(xid != 0);
+    assert(fname != 0);
+
+    rid = xid->root;
+    if (!xmlWaitIndexed(id) || LAZY_NODES(rid)) {
+        SET_ERROR(xid, 0, 0, XML_NODE_NOT_FOUND);
+    }
+    else if (!__zeroxml_index_compile(rid, fname, comment)) {
+        SET_ERROR(xid, 0, 0, XML_FILE_NOT_FOUND);
+    }
+    else {
+        rv = XML_TRUE;
+    }
+
+    return rv;
+}
+
+XML_API int XML_APIENTRY
+xmlPublish(const xmlId *id, const char *name)
+{
+    const struct _xml_id *xid = (const struct _xml_id *)id;
+    struct _root_id *rid;
+    int rv = XML_FALSE;
+
+    assert(xid != 0);
+    assert(name != 0);
+
+    rid = xid->root;
+    if (!xmlWaitIndexed(id) || LAZY_NODES(rid)) {
+        SET_ERROR(xid, 0, 0, XML_NODE_NOT_FOUND);
+    }
+    else if (!__zeroxml_index_publish(rid, name, comment)) {
+        SET_ERROR(xid, 0, 0, XML_FILE_NOT_FOUND);
+    }
+    else {
+        rv = XML_TRUE;
+    }
+
+    return rv;
+}
+
+XML_API int XML_APIENTRY
+xmlUnpublish(const char *name)
+{
+    int rv = XML_FALSE;
+
+    assert(name != 0);
+
+#if HAVE_SHM_OPEN
+    if (shm_unlink(name) == 0) {
+        rv = XML_TRUE;
+    }
+#endif
+
+    return rv;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static const char *__zeroxmlProcessCDATA(const char**, off_t*, char);
+
+static const char *__zeroxml_memmem(const char*, off_t, const char*, int);
+static const char *__zeroxml_memncasestr(const struct _root_id*, const char*, off_t, const char*);
+static const char *__zeroxml_memncasecmp(const struct _root_id*, const char**, off_t*, const char**, int*);
+
+static const char *__zeroxml_error_str[XML_MAX_ERROR] =
+{
+    "no error",
+    "unable to allocate enough memory",
+    "unable to open file for reading",
+    "node is not found",
+    "unexpected end of section",
+    "buffer too small to hold all data, truncating",
+    "incorrect comment section",
+    "bad declaration block",
+    "incompatible opening tag for element",
+    "missing or invalid closing tag for element",
+    "missing or invalid opening quote for attribute",
+    "missing or invalid closing quote for attribute",
+    "invalid multibyte sequence.",
+    "invalid element or attribute name",
+    "document exceeds a resource limit"
+};
+
+/*
+ * Initialize a new root XML-id for the document in buffer.
+ *
+ * Process the XML declaration, set the flags and resource limits and build
+ * the node cache when required. The caller is responsible for the buffer
+ * and in case of an error for destroying the memory of the document, after
+ * the buffer is released, and for freeing rid itself.
+ *
+ * @param rid the root XML-id to initialize
+ * @param buffer pointer to the start of the document
+ * @param blocklen length of the document
+ * @param options the options for processing the document, may be NULL
+ * @param index the sidecar file of the node cache, NULL if there is none
+ * @return XML_TRUE if successful, XML_FALSE in case of an error
+ */
+static int
+__zeroxml_init_root(struct _root_id *rid, const char *buffer, off_t blocklen, const xmlOptions *options, struct _zeroxml_index *index)
+{
+    int rv = __zeroxml_init_options(rid, options);
+
+    if (rv)
+    {
+        rv = __zeroxml_init_document(rid, buffer, blocklen, index);
+        if (!rv)
+        {
+            __zeroxml_arena_destroy(rid->arena);
+            __zeroxml_arena_destroy(rid->charged);
+        }
+    }
+
+    return rv;
+}
+
+/*
+ * Create the allocator and the memory limit of the options, unless the
+ * root XML-id has them already.
+ *
+ * @param rid the root XML-id to initialize
+ * @param options the options for processing the document, may be NULL
+ * @return XML_TRUE if successful, XML_FALSE in case of an error
+ */
+static int
+__zeroxml_init_memory(struct _root_id *rid, const xmlOptions *options)
+{
+    if (!rid->memory && options &&
+        (options->allocator || options->limits.max_memory))
+    {
+        rid->memory = __zeroxml_memory_create(options->allocator,
+                                              options->limits.max_memory);
+        if (!rid->memory) return XML_FALSE;
+    }
+    return XML_TRUE;
+}
+
+/*
+ * Set up the parts of a root XML-id which do not depend on the document:
+ * the allocator, the arena, the flags, the limits and the locale. In case
+ * of an error the caller destroys the memory of the document.
+ *
+ * @param rid the root XML-id to initialize
+ * @param options the options for processing the document, may be NULL
+ * @return XML_TRUE if successful, XML_FALSE in case of an error
+ */
+static int
+__zeroxml_init_options(struct _root_id *rid, const xmlOptions *options)
+{
+    const xmlLimits *limits = options ? &options->limits : NULL;
+
+    if (!__zeroxml_init_memory(rid, options)) return XML_FALSE;
+
+    if (options && options->flags != XML_DEFAULT_FLAGS &&
+        (options->flags & XML_ARENA))
+    {
+        rid->arena = __zeroxml_arena_create(rid->memory, XML_FALSE);
+        if (!rid->arena) return XML_FALSE;
+    }
+    else if (limits && limits->max_memory)
+    {
+        /* charge the XML-ids and strings until they are freed */
+        rid->charged = __zeroxml_arena_create(rid->memory, XML_TRUE);
+        if (!rid->charged) return XML_FALSE;
+    }
+
+    rid->root = rid;
+    xmlSetFlags(rid, XML_DEFAULT_FLAGS);
+    if (options && options->flags != XML_DEFAULT_FLAGS) {
+        xmlSetFlags(rid, options->flags);
+    }
+
+    /* a limit of zero means no limit, avoid testing for it in the scanner */
+    rid->limits.max_depth = INT_MAX;
+    rid->limits.max_name_len = INT_MAX;
+    rid->limits.max_attributes = INT_MAX;
+    rid->limits.max_nodes = INT_MAX;
+    rid->limits.max_steps = INT_MAX;
+    if (limits)
+    {
+        if (limits->max_depth > 0) {
+            rid->limits.max_depth = limits->max_depth;
+        }
+        if (limits->max_name_len > 0) {
+            rid->limits.max_name_len = limits->max_name_len;
+        }
+        if (limits->max_attributes > 0) {
+            rid->limits.max_attributes = limits->max_attributes;
+        }
+        if (limits->max_nodes > 0) {
+            rid->limits.max_nodes = limits->max_nodes;
+        }
+        if (limits->max_steps > 0) {
+            rid->limits.max_steps = limits->max_steps;
+        }
+        rid->limits.max_memory = limits->max_memory;
+    }
+
+#if defined(HAVE_LOCALE_H) && !defined(WIN32)
+    rid->locale = __zeroxml_locale_object();
+#endif
+
+    return XML_TRUE;
+}
+
+/*
+ * Process the XML declaration of a document and build the node cache for
+ * the node cache mode of the root XML-id.
+ *
+ * On failure the node cache, the line number index and the error
+ * information are released but the arena and the allocator are kept.
+ *
+ * @param rid the root XML-id, set up by __zeroxml_init_options
+ * @param buffer pointer to the start of the document
+ * @param blocklen length of the document
+ * @param index the sidecar file of the node cache, NULL if there is none
+ * @return XML_TRUE if successful, XML_FALSE in case of an error
+ */
+static int
+__zeroxml_init_document(struct _root_id *rid, const char *buffer, off_t blocklen, struct _zeroxml_index *index)
+{
+    char *encoding = (char*)&rid->encoding;
+    off_t doclen = blocklen;
+    const char *start;
+    int rv = XML_TRUE;
+    TRACE_START(ts)
+
+    rid->doc = buffer;
+    rid->doc_len = blocklen;
+
+    encoding[0] = 0;
+    start = __zeroxml_process_declaration(rid, buffer, blocklen, encoding);
+    blocklen -= start-buffer;
+
+    __zeroxml_prepare_data(rid, &start, &blocklen, RAW);
+    rid->start = start;
+    rid->len = blocklen;
+    TRACE_SPAN("declaration", ts);
+
+    if (LAZY_NODES(rid))
+    {
+        if ((rid->node = cacheInit(rid)) == NULL)
+        {
+            __zeroxml_set_error((struct _xml_id*)rid, start, start,
+                                XML_OUT_OF_MEMORY);
+            __zeroxml_get_location(rid, start, &__zeroxml_info.line,
+                                   &__zeroxml_info.column);
+            __zeroxml_memory_free(rid->memory, rid->lines);
+            __zeroxml_free(rid, rid->info);
+            rid->lines = NULL;
+            rid->info = NULL;
+            rv = XML_FALSE;
+        }
+    }
+#if HAVE_PTHREAD_H
+    else if (BACKGROUND_NODES(rid) && __zeroxml_background_start(rid)) {
+        /* rid->node is published by the background thread when ready */
+    }
+#endif
+    else if (CACHED_NODES(rid))
+    {
+        const char *n = "*";
+        int num = -1, nlen = 1;
+        const char *ret, *new = start;
+        off_t len = blocklen;
+
+        /* a current sidecar file replaces scanning the document */
+        if (index) {
+            rid->node = __zeroxml_index_load(rid, index, buffer, doclen,
+                                             comment);
+        }
+
+        if (rid->node)
+        {
+            if (index->shared) {
+                rid->flags |= __XML_SHARED_NODES;
+            }
+            ret = start;
+        }
+        else if ((rid->node = cacheInit(rid)) == NULL)
+        {
+            len = XML_OUT_OF_MEMORY;
+            ret = NULL;
+        }
+        else
+        {
+            STATS_START(t0)
+            TRACE_START(tc)
+
+            ret = __zeroxml_get_node((struct _xml_id*)rid, rid->node, &new,
+                                     &len, &n, &nlen, &num, RAW, NULL);
+            STATS_TIME(rid, index_time, t0);
+            TRACE_SPAN("cache", tc);
+            if (ret && index) {
+                __zeroxml_index_save(rid, index, buffer, doclen, comment);
+            }
+        }
+
+        if (!ret)
+        {
+            __zeroxml_set_error((struct _xml_id*)rid, start, new, (int)len);
+            __zeroxml_get_location(rid, new, &__zeroxml_info.line,
+                                   &__zeroxml_info.column);
+            cacheFree(rid, rid->node);
+            __zeroxml_memory_free(rid->memory, rid->lines);
+            __zeroxml_free(rid, rid->info);
+            rid->lines = NULL;
+            rid->info = NULL;
+            rv = XML_FALSE;
+        }
+    }
+
+    if (rv)
+    {
+        rid->converter = __zeroxml_converter_get(rid->encoding);
+        STATS_ADD(rid, documents, 1);
+    }
+
+    return rv;
+}
+
+/* compare the versions of a document in blocks of this size first */
+#define REINDEX_BLOCKSIZE	4096
+
+/* the length of the common start and end of two buffers */
+static off_t
+__zeroxml_common_start(const char *s1, const char *s2, off_t len)
+{
+    off_t rv = 0;
+
+    while (len-rv >= REINDEX_BLOCKSIZE &&
+           !memcmp(s1+rv, s2+rv, REINDEX_BLOCKSIZE))
+    {
+        rv += REINDEX_BLOCKSIZE;
+    }
+    while (rv < len && s1[rv] == s2[rv]) rv++;
+
+    return rv;
+}
+
+static off_t
+__zeroxml_common_end(const char *e1, const char *e2, off_t len)
+{
+    off_t rv = 0;
+
+    while (len-rv >= REINDEX_BLOCKSIZE &&
+           !memcmp(e1-rv-REINDEX_BLOCKSIZE, e2-rv-REINDEX_BLOCKSIZE,
+                   REINDEX_BLOCKSIZE))
+    {
+        rv += REINDEX_BLOCKSIZE;
+    }
+    while (rv < len && e1[-rv-1] == e2[-rv-1]) rv++;
+
+    return rv;
+}
+
+/*
+ * Create the node cache of a new version of a document from the node cache
+ * of the previous version.
+ *
+ * The range which differs between both versions is found by comparing them
+ * from the start and from the end. The node cache of the deepest element
+ * which holds the range is built again and the rest of the node cache is
+ * copied, with the names and data sections after the range moved.
+ *
+ * @param rid the root XML-id of the new version, opened without node cache
+ * @param prev the root XML-id of the previous version
+ * @return XML_TRUE if successful, XML_FALSE if the node cache has to be
+ *         built from scratch
+ */
+static int
+__zeroxml_reindex(struct _root_id *rid, const struct _root_id *prev)
+{
+    const char *old = prev->doc;
+    const char *doc = rid->doc;
+    const cacheId *changed = NULL;
+    const cacheId *node, *copy;
+    off_t from, to, delta, len;
+
+    len = (prev->doc_len < rid->doc_len) ? prev->doc_len : rid->doc_len;
+    from = __zeroxml_common_start(old, doc, len);
+    to = prev->doc_len - __zeroxml_common_end(old + prev->doc_len,
+                                              doc + rid->doc_len, len-from);
+    delta = rid->doc_len - prev->doc_len;
+
+    if (to > from || delta)
+    {
+        changed = cacheNodeFind(prev->node, old+from, old+to, comment);
+        if (!changed) return XML_FALSE;
+    }
+
+    rid->flags |= __XML_CACHED_NODES;
+    node = cacheCopy(rid, prev->node, changed, old, prev->doc_len, doc, to, delta,
+                     &copy);
+    if (node && copy)
+    {
+        const char *name, *data, *pos;
+        off_t datalen;
+        int namelen, err_no;
+
+        cacheDataGet(copy, &name, &namelen, &data, &datalen);
+        if (!__zeroxml_cache_children((struct _xml_id*)rid, copy, data,
+                                      datalen, INT_MAX, &pos, &err_no))
+        {
+            cacheFree(rid, node);
+            node = NULL;
+        }
+    }
+
+    if (!node)
+    {
+        rid->flags &= ~__XML_CACHED_NODES;
+        return XML_FALSE;
+    }
+    rid->node = node;
+
+    return XML_TRUE;
+}
+
+/*
+ * Create a new document from a copy of a node made by xmlGetString.
+ * The new document takes ownership of the copy and frees it on xmlClose.
+ *
+ * @param rid the root XML-id of the original document
+ * @param ptr the copy of the node, freed in case of an error
+ * @return the root XML-id of the new document or NULL in case of an error
+ */
+static struct _root_id*
+__zeroxml_copy_buffer(const struct _root_id *rid, char *ptr)
+{
+    struct _root_id *rv;
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = rid->flags;
+
+    rv = xmlInitBufferOptions64(ptr, strlen(ptr), &options);
+    if (rv) {
+        rv->fd = MMAP_FREE; /* let xmlClose free ptr */
+    } else {
+        FREE(ptr);
+    }
+
+    return rv;
+}
+
+/*
+ * Decide how to read a file of size bytes.
+ *
+ * Small files are read into memory since a single read is cheaper than
+ * setting up and tearing down a mapping and faulting in its pages. Larger
+ * files are mapped. A large mapping which is scanned completely at open time
+ * is populated right away, for XML_BACKGROUND_NODES the kernel is asked to
+ * read ahead instead so opening the document does not have to wait for it.
+ *
+ * @param options the options for processing the document, may be NULL
+ * @param size size of the file
+ * @return the enum xmlIOFlags to use
+ */
+static int
+__zeroxml_io_policy(const xmlOptions *options, off_t size)
+{
+    enum xmlFlags flags = XML_DEFAULT_FLAGS;
+    int populate_min = XML_IO_POPULATE_MIN;
+    int read_max = XML_IO_READ_MAX;
+    int rv = XML_IO_AUTO;
+
+    if (options)
+    {
+        if (options->flags) flags = options->flags;
+        if (options->io.read_max > 0) read_max = options->io.read_max;
+        if (options->io.populate_min > 0) {
+            populate_min = options->io.populate_min;
+        }
+        rv = options->io.flags;
+    }
+
+    /* only the pages of a mapping can be released and read again */
+    if (rv & XML_IO_WINDOW)
+    {
+        rv &= ~(XML_IO_READ | XML_IO_POPULATE);
+        rv |= XML_IO_MMAP;
+    }
+
+    if (!(rv & (XML_IO_READ | XML_IO_MMAP))) {
+        rv |= (size <= read_max) ? XML_IO_READ : XML_IO_MMAP;
+    }
+
+    if ((rv & XML_IO_MMAP) && !(rv & (XML_IO_POPULATE | XML_IO_SEQUENTIAL)))
+    {
+        /* same precedence as xmlSetFlags */
+        if (flags & XML_CACHE_NODES) {
+            if (size >= populate_min) rv |= XML_IO_POPULATE;
+        } else if (!(flags & XML_LAZY_NODES) && (flags & XML_BACKGROUND_NODES)) {
+            rv |= XML_IO_SEQUENTIAL;
+        }
+    }
+
+    return rv;
+}
+
+/*
+ * Read or map a file according to the I/O strategy.
+ *
+ * For a file which is read into memory rid->fd is set to MMAP_FREE, or to
+ * MMAP_ALIGNED for a buffer of huge pages, to let xmlClose free the buffer
+ * and the caller has to close fd. Otherwise rid->fd is set to fd. The hints
+ * to the kernel are only advisory and failing to apply them is not an error.
+ *
+ * @param rid the root XML-id of the document
+ * @param fd file descriptor of the opened file
+ * @param size size of the file
+ * @param io the enum xmlIOFlags to use
+ * @return a pointer to the document or NULL in case of an error
+ */
+static char*
+__zeroxml_map_file(struct _root_id *rid, int fd, off_t size, int io)
+{
+    char *rv = NULL;
+
+    if (size <= 0) return rv;
+
+    if (io & XML_IO_READ)
+    {
+        int tag = MMAP_FREE;
+        off_t pos = 0;
+
+#if defined(MADV_HUGEPAGE) && !defined(WIN32)
+# define HUGE_PAGE_SIZE		(2*1024*1024)
+        if ((io & XML_IO_HUGE_PAGES) && size >= HUGE_PAGE_SIZE)
+        {
+            void *p;
+            if (posix_memalign(&p, HUGE_PAGE_SIZE, size) == 0)
+            {
+                /* not from MALLOC, it has to be released with free() */
+                madvise(p, size, MADV_HUGEPAGE);
+                tag = MMAP_ALIGNED;
+                rv = p;
+            }
+        }
+        if (!rv)
+#endif
+        rv = MALLOC(size);
+
+        /* the buffer counts against the memory limit of the document */
+        if (rv && !__zeroxml_memory_charge(rid->memory, (size_t)size))
+        {
+            if (tag == MMAP_ALIGNED) free(rv);
+            else FREE(rv);
+            rv = NULL;
+        }
+        if (!rv) {
+            __zeroxml_set_error(NULL, NULL, NULL, XML_OUT_OF_MEMORY);
+        }
+
+        while (rv && pos < size)
+        {
+            ssize_t res = read(fd, rv+pos, size-pos);
+            if (res > 0) {
+                pos += res;
+            }
+            else if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            else
+            {
+                if (tag == MMAP_ALIGNED) free(rv);
+                else FREE(rv);
+                __zeroxml_memory_uncharge(rid->memory, (size_t)size);
+                rv = NULL;
+            }
+        }
+
+        if (rv)
+        {
+            rid->fd = tag;
+            rid->mmap = rv;
+            rid->mmap_len = (size_t)size;
+        }
+    }
+    else
+    {
+#if defined(MAP_POPULATE) && !defined(WIN32)
+        if (io & XML_IO_POPULATE) {
+            rv = mmap(0, size, PROT_READ, MAP_PRIVATE|MAP_POPULATE, fd, 0L);
+        } else
+#endif
+        rv = simple_mmap(fd, (size_t)size, &rid->un);
+
+        if (rv == (void *)MMAP_ERROR) {
+            rv = NULL;
+        }
+        else
+        {
+#ifndef WIN32
+# ifdef MADV_SEQUENTIAL
+            if (io & (XML_IO_POPULATE | XML_IO_SEQUENTIAL | XML_IO_WINDOW)) {
+                madvise(rv, size, MADV_SEQUENTIAL);
+            }
+# endif
+# if defined(MADV_WILLNEED) && !defined(MAP_POPULATE)
+            if (io & XML_IO_POPULATE) {
+                madvise(rv, size, MADV_WILLNEED);
+            }
+# endif
+# ifdef MADV_WILLNEED
+            /* reading ahead the whole file would defeat XML_IO_WINDOW */
+            if ((io & XML_IO_SEQUENTIAL) && !(io & XML_IO_WINDOW)) {
+                madvise(rv, size, MADV_WILLNEED);
+            }
+# endif
+# ifdef MADV_HUGEPAGE
+            if (io & XML_IO_HUGE_PAGES) {
+                madvise(rv, size, MADV_HUGEPAGE);
+            }
+# endif
+#endif
+            rid->fd = fd;
+            rid->mmap = rv;
+            rid->mmap_len = (size_t)size;
+        }
+    }
+
+    return rv;
+}
+
+/*
+ * Replace the compressed document of __zeroxml_map_file by the decompressed
+ * document, which is charged to the memory of the document.
+ *
+ * @param rid the root XML-id of the document
+ * @param buf the compressed document
+ * @param len the size of the compressed document, set to the size of the
+ *            decompressed document
+ * @return the decompressed document or NULL in case of an error
+ */
+static char*
+__zeroxml_decompress_file(struct _root_id *rid, char *buf, off_t *len)
+{
+    size_t dlen, buflen;
+    char *rv;
+
+    rv = __zeroxml_decompress(rid->memory, buf, (size_t)*len, &dlen, &buflen);
+    if (!rv && errno == ENOMEM) {
+        __zeroxml_set_error(NULL, NULL, NULL, XML_OUT_OF_MEMORY);
+    }
+
+    __zeroxml_unmap_file(rid); /* the compressed file */
+    if (rv)
+    {
+        rid->fd = MMAP_DECOMPRESSED;
+        rid->mmap = rv;
+        rid->mmap_len = buflen;
+        *len = (off_t)dlen;
+    }
+
+    return rv;
+}
+
+/*
+ * Release the memory of the document, the file descriptor is left open.
+ *
+ * @param rid the root XML-id of the document
+ */
+static void
+__zeroxml_unmap_file(struct _root_id *rid)
+{
+    if (rid->fd == MMAP_FREE)
+    {
+        FREE(rid->mmap);
+        __zeroxml_memory_uncharge(rid->memory, rid->mmap_len);
+    }
+    else if (rid->fd == MMAP_ALIGNED)
+    {
+        free(rid->mmap);
+        __zeroxml_memory_uncharge(rid->memory, rid->mmap_len);
+    }
+    else if (rid->fd == MMAP_DECOMPRESSED) {
+        __zeroxml_buffer_free(rid->memory, rid->mmap, rid->mmap_len);
+    }
+    else if (rid->fd != MMAP_ERROR) {
+        simple_unmmap(rid->mmap, rid->mmap_len, &rid->un);
+    }
+    rid->mmap = NULL;
+}
+
+/*
+ * Map or read a file like xmlOpenOptions does, without processing
+ * the document. Compressed files are decompressed. The document in memory
+ * counts against the memory limit of the options.
+ *
+ * @param rid holds the mapping, the file descriptor and the memory of it
+ * @param filename path to the file
+ * @param options the I/O strategy and memory limit to use, may be NULL
+ * @param len set to the size of the document
+ * @return a pointer to the document or NULL in case of an error
+ */
+char*
+__zeroxml_map_document(struct _root_id *rid, const char *filename, const xmlOptions *options, off_t *len)
+{
+    char *rv = NULL;
+    int fd;
+
+    rid->fd = MMAP_ERROR;
+    fd = open(filename, O_RDONLY);
+    if (fd >= 0)
+    {
+        struct stat statbuf;
 
-        if (rid->info)
+        if (__zeroxml_init_memory(rid, options) && fstat(fd, &statbuf) == 0)
         {
-            struct _zeroxml_error *err = rid->info;
-            const char *ps = rid->start;
-            const char *pe = err->pos;
-            const char *new;
+            /* the caller scans the document from the start to the end */
+            int io = __zeroxml_io_policy(options, statbuf.st_size);
+            if (io & XML_IO_MMAP) io |= XML_IO_SEQUENTIAL;
 
-            while (ps<pe)
-            {
-                new = MEMCHR(ps, '\n', pe-ps);
-                if (new) { ps = new+1; }
-                else break;
-            }
-            rv = pe-ps;
+            *len = statbuf.st_size;
+            rv = __zeroxml_map_file(rid, fd, *len, io);
+        }
+        if (rv && __zeroxml_compressed(rv, (size_t)*len)) {
+            rv = __zeroxml_decompress_file(rid, rv, len);
+        }
 
-            if (clear) {
-                err->err_no = __zeroxml_info.err_no = 0;
-            }
+        if (!rv || rid->fd < 0) {
+            close(fd); /* the document is in memory */
+        }
+        if (!rv)
+        {
+            __zeroxml_memory_destroy(rid->memory);
+            rid->memory = NULL;
+            rid->fd = MMAP_ERROR;
         }
-    }
-    else if (!id) {
-        rv = __zeroxml_info.column;
     }
 
     return rv;
 }
 
-XML_API const char* XML_APIENTRY
-xmlErrorGetString(const xmlId *id, int clear)
+/*
+ * Release the document of __zeroxml_map_document and its memory and close
+ * the file.
+ *
+ * @param rid the mapping of the file
+ */
+void
+__zeroxml_unmap_document(struct _root_id *rid)
 {
-    char *rv = "error detection was not enabled.";
+    __zeroxml_unmap_file(rid);
+    if (rid->fd >= 0) {
+        close(rid->fd);
+    }
+    rid->fd = MMAP_ERROR;
+    __zeroxml_memory_destroy(rid->memory);
+    rid->memory = NULL;
+}
 
-    if (id && VALIDATING(id))
-    {
-        struct _xml_id *xid = (struct _xml_id *)id;
-        struct _root_id *rid;
+/*
+ * Release the pages of the mapping of an XML_IO_WINDOW document which are
+ * behind the position of a scan.
+ *
+ * The mapping itself stays in place, so pointers into the document remain
+ * valid and a page which is accessed again is read from the file again. The
+ * pages of the last WINDOW_LOOKBACK bytes are kept since the scanner may
+ * still look back at the start of the current tag.
+ *
+ * @param rid the root XML-id of the document
+ * @param released start of the part of the mapping which is not released yet
+ * @param pos the current position of the scan
+ */
+#define WINDOW_LOOKBACK		(64*1024)
+static void
+__zeroxml_release_window(const struct _root_id *rid, const char **released, const char *pos)
+{
+#if defined(MADV_DONTNEED) && !defined(WIN32)
+    off_t page_size = sysconf(_SC_PAGESIZE);
+    off_t from, to;
 
-        if (xid->name) rid = xid->root;
-        else rid = (struct _root_id *)xid;
+    from = *released - rid->mmap;
+    to = pos - rid->mmap - WINDOW_LOOKBACK;
 
-        assert(rid != 0);
+    /* only release whole pages */
+    from = (from + page_size-1)/page_size*page_size;
+    to = to/page_size*page_size;
+    if (to > from)
+    {
+        madvise(rid->mmap+from, (size_t)(to-from), MADV_DONTNEED);
+# ifdef POSIX_FADV_DONTNEED
+        /* drop them from the page cache too */
+        posix_fadvise(rid->fd, from, to-from, POSIX_FADV_DONTNEED);
+# endif
+        *released = rid->mmap+to;
+    }
+#endif
+}
 
-        if (rid->info)
-        {
-            struct _zeroxml_error *err = rid->info;
-            if (XML_NO_ERROR <= err->err_no && err->err_no < XML_MAX_ERROR) {
-                rv = (char*)__zeroxml_error_str[err->err_no];
-            } else {
-                rv = "unknown error number.";
-            }
+#if HAVE_PTHREAD_H
+/*
+ * Build the node cache of the document for XML_BACKGROUND_NODES.
+ *
+ * The node cache is built completely before it is published in rid->node
+ * so lookups either scan the document or use the finished node cache.
+ * The thread does not touch the error information of the root XML-id, a
+ * failure is reported by xmlWaitIndexed instead.
+ *
+ * @param arg the root XML-id of the document
+ * @return NULL
+ */
+static void*
+__zeroxml_build_cache(void *arg)
+{
+    struct _root_id *rid = (struct _root_id *)arg;
+    struct _zeroxml_background *bg = rid->background;
+    enum _zeroxml_build_state state = __XML_BUILD_FAILED;
+    const cacheId *nc, *empty = NULL;
+    const char *n = "*", *new = rid->start;
+    int num = -1, nlen = 1;
+    off_t len = rid->len;
+    STATS_START(t0)
+    TRACE_START(ts)
+
+    nc = cacheInit(rid);
+    if (nc)
+    {
+        const char *ret = __zeroxml_get_node((struct _xml_id*)rid, nc, &new,
+                                             &len, &n, &nlen, &num, RAW,
+                                             NULL);
 
-            if (clear) {
-                err->err_no = __zeroxml_info.err_no = 0;
-            }
+        STATS_TIME(rid, index_time, t0);
+        TRACE_SPAN("cache", ts);
+        if (ret)
+        {
+            ATOMIC_PTR_CAS(rid->node, empty, nc);
+            state = __XML_BUILD_READY;
+        }
+        else
+        {
+            bg->err_pos = new;
+            bg->err_no = (int)len;
+            cacheFree(rid, nc);
         }
     }
-    else if (!id) {
-       rv = (char*)__zeroxml_error_str[__zeroxml_info.err_no];
+    else
+    {
+        bg->err_pos = rid->start;
+        bg->err_no = XML_OUT_OF_MEMORY;
     }
 
-#ifndef NDEBUG
-    printf("\tdetected in %s at line %i\n",
-            __zeroxml_info.func, __zeroxml_info.line_no);
-#endif
+    pthread_mutex_lock(&bg->mutex);
+    bg->state = state;
+    pthread_cond_broadcast(&bg->cond);
+    pthread_mutex_unlock(&bg->mutex);
 
-    return rv;
+    return NULL;
 }
 
-/* -------------------------------------------------------------------------- */
+/*
+ * Start the thread which builds the node cache for XML_BACKGROUND_NODES.
+ *
+ * @param rid the root XML-id of the document
+ * @return XML_TRUE if the thread was started, XML_FALSE if the node cache
+ *         has to be built right away instead
+ */
+static int
+__zeroxml_background_start(struct _root_id *rid)
+{
+    struct _zeroxml_background *bg;
+    int rv = XML_FALSE;
 
-static const char *__zeroxmlProcessCDATA(const char**, int*, char);
+    bg = CALLOC(1, sizeof(struct _zeroxml_background));
+    if (bg)
+    {
+        pthread_mutex_init(&bg->mutex, NULL);
+        pthread_cond_init(&bg->cond, NULL);
+        bg->state = __XML_BUILD_RUNNING;
 
-static const char *__zeroxml_memmem(const char*, int, const char*, int);
-static const char *__zeroxml_memncasestr(const struct _root_id*, const char*, int, const char*);
-static const char *__zeroxml_memncasecmp(const struct _root_id*, const char**, int*, const char**, int*);
+        rid->background = bg;
+        if (pthread_create(&bg->thread, NULL, __zeroxml_build_cache, rid) == 0) {
+            rv = XML_TRUE;
+        }
+        else
+        {
+            pthread_cond_destroy(&bg->cond);
+            pthread_mutex_destroy(&bg->mutex);
+            rid->background = NULL;
+            FREE(bg);
+        }
+    }
 
-static const char *__zeroxml_error_str[XML_MAX_ERROR] =
-{
-    "no error",
-    "unable to allocate enough memory",
-    "unable to open file for reading",
-    "node is not found",
-    "unexpected end of section",
-    "buffer too small to hold all data, truncating",
-    "incorrect comment section",
-    "bad declaration block",
-    "incompatible opening tag for element",
-    "missing or invalid closing tag for element",
-    "missing or invalid opening quote for attribute",
-    "missing or invalid closing quote for attribute",
-    "invalid multibyte sequence."
-};
+    return rv;
+}
+#endif
 
 /*
  * Get a pointer to the value section of an attribute.
@@ -1538,7 +2903,6 @@ __zeroxml_get_attribute_data_ptr(const struct _xml_id *id, const char *name, int
     *len = 0;
     if (xid->name && xid->name_len > 0)
     {
-        iconv_t cd = xid->root->cd;
         const char *ps, *pe;
 
         assert(xid->start > xid->name);
@@ -1550,7 +2914,7 @@ __zeroxml_get_attribute_data_ptr(const struct _xml_id *id, const char *name, int
             int slen = (int)(pe-ps);
             while ((ps<pe) && isspace(*ps)) ps++;
 
-            if (!LSTRNCMP(cd, name, ps, &slen))
+            if (!LSTRNCMP(xid->root, name, ps, &slen))
             {
                 const char *ptr = ps+slen;
                 if (ptr[0] != '=') {
@@ -1632,10 +2996,11 @@ __zeroxml_get_attribute_data_ptr(const struct _xml_id *id, const char *name, int
  * @param *len length of the current section
  * @param *name a pointer to the path to walk
  * @param *nlen length of the path string
+ * @param explain if not NULL, the work done for every step is added to it
  * @retrun a pointer to the section containing the last node in the path
  */
 const char*
-__zeroxml_node_get_path(const struct _xml_id *xid, const cacheId **nc, const char *start, int *len, const char **name, int *nlen)
+__zeroxml_node_get_path(const struct _xml_id *xid, const cacheId **nc, const char *start, off_t *len, const char **name, int *nlen, xmlExplain *explain)
 {
     const char *path, *end;
     const char *rv = NULL;
@@ -1661,8 +3026,11 @@ __zeroxml_node_get_path(const struct _xml_id *xid, const cacheId **nc, const cha
 
     if (path < end)
     {
-        int num, blocklen, nodelen;
+        int num, nodelen;
         const char *new, *node, *p;
+        xmlExplainStep *step = NULL;
+        int64_t t0 = 0;
+        off_t blocklen;
 
         node = path;
         nodelen = end - node;
@@ -1686,14 +3054,54 @@ __zeroxml_node_get_path(const struct _xml_id *xid, const cacheId **nc, const cha
             if (path == end) path = NULL;
         }
 
+        if (explain && explain->num_steps < explain->max_steps)
+        {
+            step = &explain->steps[explain->num_steps++];
+            memset(step, 0, sizeof(xmlExplainStep));
+            step->name = node;
+            step->name_len = nodelen;
+            step->num = num;
+            t0 = __zeroxml_clock();
+        }
+
         rv = start;
         blocklen = *len;
-        if (CACHED_NODES(xid->root)) {
-            new = __zeroxml_get_node_from_cache(nc, &rv, &blocklen,
-                                                &node, &nodelen, &num);
-        } else {
+        if (CACHED_NODES(xid->root) && *nc)
+        {
+            /* a level of XML_LAZY_NODES is built by scanning the section */
+            if (step)
+            {
+                step->cached = XML_TRUE;
+                if (LAZY_NODES(xid) && !cacheLevelGet(*nc)) {
+                    step->bytes_scanned = *len;
+                }
+            }
+            new = __zeroxml_get_cached_node(xid, nc, &rv, &blocklen,
+                                            &node, &nodelen, &num);
+        }
+        else
+        {
+            TRACE_START(ts)
+
+            STATS_ADD(xid->root, cache_misses, 1);
             new = __zeroxml_get_node(xid, *nc, &rv, &blocklen,
-                                     &node, &nodelen, &num,STRIPPED);
+                                     &node, &nodelen, &num,STRIPPED, step);
+            TRACE_SPAN("path", ts);
+            if (step)
+            {
+                /* the scan stops at the end of the requested node */
+                if (new) {
+                    step->bytes_scanned = rv + blocklen - start;
+                } else {
+                    step->bytes_scanned = *len;
+                }
+            }
+        }
+
+        if (step)
+        {
+            step->found = new ? XML_TRUE : XML_FALSE;
+            step->elapsed_ns = (size_t)(__zeroxml_clock() - t0);
         }
 
         if (new)
@@ -1701,7 +3109,8 @@ __zeroxml_node_get_path(const struct _xml_id *xid, const cacheId **nc, const cha
             if (path)
             {
                 pathlen = end - path;
-                rv = __zeroxml_node_get_path(xid, nc, rv, &blocklen, &path, &pathlen);
+                rv = __zeroxml_node_get_path(xid, nc, rv, &blocklen, &path, &pathlen,
+                                             explain);
                 *name = path;
                 *nlen = pathlen;
                 *len = blocklen;
@@ -1725,6 +3134,282 @@ __zeroxml_node_get_path(const struct _xml_id *xid, const cacheId **nc, const cha
     return rv;
 }
 
+/*
+ * Count the number of attributes of an element.
+ *
+ * @param ps pointer right after the element name
+ * @param pe pointer to the end of the opening tag
+ * @return the number of attributes
+ */
+static int
+__zeroxml_count_attributes(const char *ps, const char *pe)
+{
+    int rv = 0;
+
+    while (ps < pe && (ps = MEMCHR(ps, '=', pe-ps)) != NULL)
+    {
+        rv++;
+        ps++;
+        while (ps < pe && isspace(*ps)) ps++;
+        if (ps < pe && (*ps == '"' || *ps == '\''))
+        {
+            const char *new = MEMCHR(ps+1, *ps, pe-ps-1);
+            if (!new) break;
+            ps = new+1;
+        }
+    }
+
+    return rv;
+}
+
+/*
+ * Walk the node tree to get te section with the '*name' name.
+ *
+ * This starts a new scan of the section, see __zeroxml_scan_node for a
+ * description of the parameters. If step is not NULL the number of elements
+ * of the section which were examined and skipped are stored in it.
+ */
+static const char*
+__zeroxml_get_node(const struct _xml_id *xid, const cacheId *nc, const char **buf, off_t *len, const char **name, int *rlen, int *nodenum, char mode, xmlExplainStep *step)
+{
+    struct _zeroxml_scan scan;
+    const char *rv;
+
+    scan.depth = 0;
+    scan.nodes = 0;
+    scan.steps = 0;
+    scan.levels = INT_MAX;
+    scan.released = *buf;
+    scan.siblings = 0;
+    scan.skipped = 0;
+    SCAN_STATS_INIT(scan);
+
+    rv = __zeroxml_scan_node(&scan, xid, nc, buf, len, name, rlen, nodenum,
+                             mode);
+#if XML_USE_STATS
+    __zeroxml_scan_stats(xid->root, &scan);
+#endif
+    if (step)
+    {
+        step->siblings = scan.siblings;
+        step->subtrees_skipped = scan.skipped;
+    }
+
+    return rv;
+}
+
+/*
+ * Cache the child nodes of nc up to the requested number of levels deep.
+ *
+ * nc is an element node of which the name and data section are set, or a
+ * node without a name for the document itself.
+ *
+ * In case of an error *pos will point to the location of the error and
+ * *err_no will contain the error code.
+ *
+ * @param xid XML-id we work on (necessary for the root_id info)
+ * @param nc the node to add the child nodes to
+ * @param data the data section of the node
+ * @param datalen the length of the data section
+ * @param levels the number of levels to cache
+ * @param pos set to the location of the error
+ * @param err_no set to the error code
+ * @return XML_TRUE if successful, XML_FALSE otherwise
+ */
+static int
+__zeroxml_cache_children(const struct _xml_id *xid, const cacheId *nc, const char *data, off_t datalen, int levels, const char **pos, int *err_no)
+{
+    struct _zeroxml_scan scan;
+    const char *n = "*";
+    int num = -1, nlen = 1;
+    const char *new = data;
+    off_t len = datalen;
+    const char *name, *ndata;
+    off_t ndatalen;
+    int namelen;
+    char mode = RAW;
+
+    scan.depth = 0;
+    scan.nodes = 0;
+    scan.steps = 0;
+    scan.levels = levels;
+    scan.released = data;
+    scan.siblings = 0;
+    scan.skipped = 0;
+    SCAN_STATS_INIT(scan);
+
+    cacheDataGet(nc, &name, &namelen, &ndata, &ndatalen);
+    if (name)
+    {
+        const char *end = data + datalen;
+        const char *ps;
+
+        /*
+         * Comment and CDATA sections right after the opening tag are
+         * skipped by the scanner of the parent node without adding them
+         * to the node cache. Do the same here.
+         */
+        mode = STRIPPED;
+        while ((ps = MEMCHR(new, '<', len)) != NULL && ps[1] == '!')
+        {
+            const char *start = ps+1;
+            off_t blocklen = end-start;
+
+            ps = __zeroxmlProcessCDATA(&start, &blocklen, mode);
+            if (!ps) break;
+
+            len -= ps-new;
+            new = ps;
+        }
+    }
+
+    /* the scanner sets up the node list, unless there is nothing to scan */
+    if (!len)
+    {
+        if (!cacheInitLevel(xid->root, nc))
+        {
+            *pos = data;
+            *err_no = XML_OUT_OF_MEMORY;
+            return XML_FALSE;
+        }
+    }
+    else
+    {
+        const char *ret = __zeroxml_scan_node(&scan, xid, nc, &new, &len,
+                                              &n, &nlen, &num, mode);
+#if XML_USE_STATS
+        __zeroxml_scan_stats(xid->root, &scan);
+#endif
+        if (!ret && nlen == 0)
+        {
+            *pos = n;
+            *err_no = (int)len;
+            return XML_FALSE;
+        }
+    }
+
+    return XML_TRUE;
+}
+
+/*
+ * Cache the child nodes of a node which was not visited before.
+ *
+ * Only the child nodes of the node are added to the node cache, the rest of
+ * the subtree is scanned without caching it. The document itself usually
+ * has just one child node, the root element, which spans the whole document.
+ * For the document the child nodes of the root element are cached in the
+ * same pass which prevents the whole document from being scanned twice.
+ *
+ * In case of an error *pos will point to the location of the error and
+ * *err_no will contain the error code.
+ *
+ * @param xid XML-id we work on (necessary for the root_id info)
+ * @param nc the node to cache the child nodes for
+ * @param pos set to the location of the error
+ * @param err_no set to the error code
+ * @return the Cache-id holding the child nodes or NULL in case of an error
+ */
+static const cacheId*
+__zeroxml_cache_level(const struct _xml_id *xid, const cacheId *nc, const char **pos, int *err_no)
+{
+    const struct _root_id *rid = xid->root;
+    const cacheId *rv;
+    const char *name, *data;
+    off_t datalen;
+    int namelen;
+    int levels = 1;
+    STATS_START(t0)
+    TRACE_START(ts)
+
+    if (nc == rid->node)
+    {
+        name = NULL;
+        data = rid->start;
+        datalen = rid->len;
+        levels = 2;
+    }
+    else {
+        cacheDataGet(nc, &name, &namelen, &data, &datalen);
+    }
+
+    rv = cacheInit(rid);
+    if (rv)
+    {
+        if (name) {
+            cacheDataSet(rv, name, namelen, data, datalen);
+        }
+
+        int res = __zeroxml_cache_children(xid, rv, data, datalen, levels,
+                                           pos, err_no);
+
+        STATS_TIME(rid, index_time, t0);
+        TRACE_SPAN("cache", ts);
+        if (!res)
+        {
+            cacheFree(rid, rv);
+            return NULL;
+        }
+        rv = cacheLevelSet(rid, nc, rv);
+    }
+    else
+    {
+        *pos = data;
+        *err_no = XML_OUT_OF_MEMORY;
+    }
+
+    return rv;
+}
+
+/*
+ * Get the data from a cached node, see __zeroxml_get_node_from_cache.
+ *
+ * For a shared document the records are walked in place. For XML_LAZY_NODES
+ * the child nodes of *nc are cached first if this is the first time the node
+ * is visited.
+ */
+static const char*
+__zeroxml_get_cached_node(const struct _xml_id *xid, const cacheId **nc, const char **buf, off_t *len, const char **name, int *rlen, int *nodenum)
+{
+    if (SHARED_NODES(xid))
+    {
+        const struct _root_id *rid = xid->root;
+
+        STATS_ADD(rid, cache_hits, 1);
+        return __zeroxml_get_node_from_records((const cacheRecord*)rid->node,
+                                               rid->doc, comment, nc, buf,
+                                               len, name, rlen, nodenum);
+    }
+
+    if (LAZY_NODES(xid))
+    {
+        const cacheId *level = cacheLevelGet(*nc);
+        if (!level)
+        {
+            const char *pos = *buf;
+            int err_no = XML_NO_ERROR;
+
+            STATS_ADD(xid->root, cache_misses, 1);
+            level = __zeroxml_cache_level(xid, *nc, &pos, &err_no);
+            if (!level)
+            {
+                *name = pos;
+                *rlen = 0;
+                *len = err_no;
+                return NULL;
+            }
+        }
+        else {
+            STATS_ADD(xid->root, cache_hits, 1);
+        }
+        *nc = level;
+    }
+    else {
+        STATS_ADD(xid->root, cache_hits, 1);
+    }
+
+    return __zeroxml_get_node_from_cache(nc, buf, len, name, rlen, nodenum);
+}
+
 /*
  * Recursively walk the node tree to get te section with the '*name' name.
  *
@@ -1738,6 +3423,11 @@ __zeroxml_node_get_path(const struct _xml_id *xid, const cacheId **nc, const cha
  * buffer, *len will contain the error code and *nodenum the line in the source
  * code where the error happens.
  *
+ * The resources used by the scan are tracked in *scan and when one of the
+ * limits of the document is exceeded the scan is aborted with the
+ * XML_LIMIT_EXCEEDED error.
+ *
+ * @param scan resources used by the scan so far
  * @param xid XML-id we work on (necessary for the root_id info)
  * @param nc node from the node-cache
  * @param *buf starting pointer for this section
@@ -1769,19 +3459,20 @@ __zeroxml_node_get_path(const struct _xml_id *xid, const cacheId **nc, const cha
  }
 #endif
 
- const char*
-__zeroxml_get_node(const struct _xml_id *xid, const cacheId *nc, const char **buf, int *len, const char **name, int *rlen, int *nodenum, char mode)
+static const char*
+__zeroxml_scan_node(struct _zeroxml_scan *scan, const struct _xml_id *xid, const cacheId *nc, const char **buf, off_t *len, const char **name, int *rlen, int *nodenum, char mode)
 {
-static int level = 0;
 #ifndef NDEBUG
     const char *end = *buf + *len;
 #endif
     const struct _root_id *rid = xid->root;
+    const xmlLimits *limits = &rid->limits;
     const char *open_element = *name;
     const char *element, *start_tag = 0;
     const char *rptr, *start;
     const char *new, *cur;
-    int restlen, elementlen;
+    off_t restlen;
+    int elementlen;
     int open_len = *rlen;
     const cacheId *nnc = NULL;
     const char *rv = NULL;
@@ -1795,7 +3486,6 @@ static int level = 0;
     assert(rlen != 0);
     assert(nodenum != 0);
 
-++level;
     start = *buf;
     if (open_len == 0 || *name == 0) {
         SET_ERROR_AND_RETURN(start, XML_NO_ERROR);
@@ -1810,7 +3500,9 @@ static int level = 0;
     *len = 0;
     cur = start;
 
-    cacheInitLevel(nc);
+    if (!cacheInitLevel(xid->root, nc)) {
+        SET_ERROR_AND_RETURN(start, XML_OUT_OF_MEMORY);
+    }
 
     /* search for an opening tag */
     rptr = start;
@@ -1818,8 +3510,15 @@ static int level = 0;
     elementlen = *rlen;
 
     assert(cur+restlen == end);
-    while ((new = MEMCHR(cur, '<', restlen)) != 0)
+    while ((new = SCAN_MEMCHR(scan, cur, '<', restlen)) != 0)
     {
+        if (++scan->steps > limits->max_steps) {
+            SET_ERROR_AND_RETURN(new, XML_LIMIT_EXCEEDED);
+        }
+
+        if (rid->window && new - scan->released > rid->window) {
+            __zeroxml_release_window(rid, &scan->released, new);
+        }
 
         new++; /* skip '<' */
         DECR_LEN(restlen, new, cur);
@@ -1860,7 +3559,7 @@ static int level = 0;
         if (cur[0] == '!' || cur[0] == '?')
         {
             const char *start = cur;
-            int blocklen = restlen;
+            off_t blocklen = restlen;
             assert(cur+restlen == end);
             new = __zeroxmlProcessCDATA(&start, &blocklen, mode);
             if (!new && start && open_len) { /* CDATA */
@@ -1870,7 +3569,10 @@ static int level = 0;
             /* Create a new leaf node for the current branch */
             if (COMMENT_AS_NODE(xid))
             {
-                nnc = cacheNodeNew(nc);
+                nnc = cacheNodeNew(xid->root, nc);
+                if (nc && !nnc) {
+                    SET_ERROR_AND_RETURN(start, XML_OUT_OF_MEMORY);
+                }
                 cacheDataSet(nnc, comment, strlen(comment), start, blocklen);
             }
 
@@ -1890,6 +3592,24 @@ static int level = 0;
             assert(restlen >= 0);
             if (!restlen) break;
 
+            if (elementlen)
+            {
+                if (elementlen > limits->max_name_len ||
+                    ++scan->nodes > limits->max_nodes)
+                {
+                    SET_ERROR_AND_RETURN(element, XML_LIMIT_EXCEEDED);
+                }
+                if (!scan->depth) scan->siblings++;
+
+                /* only count the attributes if there is a limit */
+                if (limits->max_attributes != INT_MAX &&
+                    __zeroxml_count_attributes(element+elementlen, cur) >
+                        limits->max_attributes)
+                {
+                    SET_ERROR_AND_RETURN(element, XML_LIMIT_EXCEEDED);
+                }
+            }
+
             assert(!rptr || rptr+restlen == end);
             if (rptr) /* the requested element name was found */
             {
@@ -1913,7 +3633,10 @@ static int level = 0;
                 assert(cur+restlen == end);
 
                 /* Create a new sub-branch/leaf node for the current branch */
-                nnc = cacheNodeNew(nc);
+                nnc = cacheNodeNew(xid->root, nc);
+                if (nc && !nnc) {
+                    SET_ERROR_AND_RETURN(element, XML_OUT_OF_MEMORY);
+                }
 
                 if (restlen < 2) break;
 
@@ -1966,7 +3689,7 @@ static int level = 0;
                 }
             }
 
-            if ((new = MEMCHR(cur, '<', restlen)) == 0) {
+            if ((new = SCAN_MEMCHR(scan, cur, '<', restlen)) == 0) {
                 SET_ERROR_AND_RETURN(cur, XML_ELEMENT_NO_OPENING_TAG);
             }
 
@@ -1979,7 +3702,7 @@ static int level = 0;
             while (cur[0] == '!')
             {
                 const char *start = cur;
-                int blocklen = restlen;
+                off_t blocklen = restlen;
                 new = __zeroxmlProcessCDATA(&start, &blocklen, mode);
                 if (!new && start && open_len) { /* CDATA */
                     SET_ERROR_AND_RETURN(start, XML_INVALID_COMMENT);
@@ -1992,7 +3715,7 @@ static int level = 0;
                 /*
                  * Skip the value of the node and get the next XML tag.
                  */
-                if ((new = MEMCHR(cur, '<', restlen)) == 0) {
+                if ((new = SCAN_MEMCHR(scan, cur, '<', restlen)) == 0) {
                     SET_ERROR_AND_RETURN(cur, XML_ELEMENT_NO_CLOSING_TAG);
                 }
 
@@ -2051,7 +3774,7 @@ static int level = 0;
                 }
                 else
                 {
-                    if ((new = MEMCHR(cur, '>', restlen)) == 0) {
+                    if ((new = SCAN_MEMCHR(scan, cur, '>', restlen)) == 0) {
                         SET_ERROR_AND_RETURN(cur, XML_ELEMENT_NO_OPENING_TAG);
                     }
 
@@ -2069,8 +3792,8 @@ static int level = 0;
         do
         {
             /* No leaf node, continue */
-            const char *node = "*";
-            int slen = restlen+1; /* due to cur-1 below*/
+            const char *ret, *node = "*";
+            off_t slen = restlen+1; /* due to cur-1 below*/
             int nlen = 1;
             int pos = -1;
 
@@ -2091,23 +3814,39 @@ static int level = 0;
              * returns a pointer to the data section of the node with the
              * requested name or NULL in case of an error.
              */
+            /* the child elements are one level deeper than this one */
+            if (++scan->depth >= limits->max_depth) {
+                SET_ERROR_AND_RETURN(cur, XML_LIMIT_EXCEEDED);
+            }
+#if XML_USE_STATS
+            if (scan->depth > scan->max_depth) scan->max_depth = scan->depth;
+#endif
+
+            /* only cache the requested number of levels */
             new = cur-1;
-            if (!__zeroxml_get_node(xid, nnc, &new, &slen, &node, &nlen, &pos, STRIPPED))
+            ret = __zeroxml_scan_node(scan, xid,
+                                      (scan->depth < scan->levels) ? nnc : NULL,
+                                      &new, &slen, &node, &nlen, &pos, STRIPPED);
+            scan->depth--;
+            if (!ret)
             {
                 if (nlen == 0) /* error upstream */
                 {
                     *rlen = nlen;
-                    SET_ERROR_AND_RETURN(node, slen);
+                    SET_ERROR_AND_RETURN(node, (int)slen);
                 }
 
                 if (slen == restlen) {
                     SET_ERROR_AND_RETURN(cur, XML_UNEXPECTED_EOF);
                 }
                 *nodenum = pos;
-                SET_ERROR_AND_RETURN(node, slen);
+                SET_ERROR_AND_RETURN(node, (int)slen);
             }
             cur += slen;
             DECR_LEN(restlen, slen, 0);
+
+            /* the child elements of a node which is not requested */
+            if (!scan->depth && !start_tag) scan->skipped++;
          }
          while(0);
     } /* while */
@@ -2125,7 +3864,6 @@ __zeroxml_get_nodeExit:
         *rlen = open_len;
         *name = open_element;
         *nodenum = found;
---level;
     }
     return rv;
 }
@@ -2149,7 +3887,8 @@ __zeroxml_get_node_pos(const xmlId *pid, xmlId *id, const char *name, int nodenu
     struct _xml_id *xid = (struct _xml_id *)id;
     const char *ptr, *new;
     const cacheId *nc;
-    int len, slen;
+    off_t len;
+    int slen;
     xmlId *rv = NULL;
 
     assert(xpid != 0);
@@ -2160,15 +3899,18 @@ __zeroxml_get_node_pos(const xmlId *pid, xmlId *id, const char *name, int nodenu
 
     len = xpid->len;
     ptr = xpid->start;
-    slen = strlen(name);
+    slen = (int)strlen(name);
     nc = cacheNodeGet(pid);
 
-    if (CACHED_NODES(xid->root)) {
-        new = __zeroxml_get_node_from_cache(&nc, &ptr, &len, &name, &slen,
-                                            &nodenum);
-    } else {
+    if (CACHED_NODES(xid->root) && nc) {
+        new = __zeroxml_get_cached_node(xid, &nc, &ptr, &len, &name, &slen,
+                                        &nodenum);
+    }
+    else
+    {
+        STATS_ADD(xid->root, cache_misses, 1);
         new = __zeroxml_get_node(xid, nc, &ptr, &len, &name, &slen, &nodenum,
-                                 mode);
+                                 mode, NULL);
     }
 
     if (new)
@@ -2181,7 +3923,7 @@ __zeroxml_get_node_pos(const xmlId *pid, xmlId *id, const char *name, int nodenu
         rv = (xmlId*)xid;
     }
     else if (slen == 0) {
-        SET_ERROR(xpid, name, name, len);
+        SET_ERROR(xpid, name, name, (int)len);
     }
 
     return rv;
@@ -2209,7 +3951,8 @@ __zeroxml_node_get_num(const xmlId *id, const char *path, char mode)
     {
         const char *nodename = (*path == '/') ? path+1 : path;
         const char *end = path + strlen(path);
-        int len, slen = end-nodename;
+        int slen = (int)(end-nodename);
+        off_t len;
         const char *pathname, *ptr;
         const cacheId *nc;
 
@@ -2218,10 +3961,10 @@ __zeroxml_node_get_num(const xmlId *id, const char *path, char mode)
         {
             const char *node = ++pathname;
             len = xid->len;
-            slen = end-node;
-            ptr = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen);
+            slen = (int)(end-node);
+            ptr = __zeroxml_node_get_path(xid, &nc, xid->start, &len, &node, &slen, NULL);
             if (ptr == NULL && slen == 0) {
-                SET_ERROR(xid, node, node, len);
+                SET_ERROR(xid, node, node, (int)len);
             }
             nodename = pathname; /* leaf name for the count call below */
         }
@@ -2237,17 +3980,20 @@ __zeroxml_node_get_num(const xmlId *id, const char *path, char mode)
             const char *new;
             rv = -1; /* get all nodes with the same name */
 
-            if (CACHED_NODES(xid->root)) {
-                new = __zeroxml_get_node_from_cache(&nc, &ptr, &len,
-                                                    &node, &slen, &rv);
-            } else {
+            if (CACHED_NODES(xid->root) && nc) {
+                new = __zeroxml_get_cached_node(xid, &nc, &ptr, &len,
+                                                &node, &slen, &rv);
+            }
+            else
+            {
+                STATS_ADD(xid->root, cache_misses, 1);
                 new = __zeroxml_get_node(xid, nc, &ptr, &len, &node, &slen, &rv,
-                                         mode);
+                                         mode, NULL);
             }
 
             if (new == NULL && len != 0)
             {
-                SET_ERROR(xid, node, node, len);
+                SET_ERROR(xid, node, node, (int)len);
                 rv = 0;
             }
         }
@@ -2265,7 +4011,7 @@ __zeroxml_node_get_num(const xmlId *id, const char *path, char mode)
  * @return a pointer right after the XML comment or CDATA section
  */
 static char*
-__zeroxml_get_string(const xmlId *id, char mode)
+__zeroxml_get_string(const xmlId *id, char mode, int pool)
 {
     const struct _xml_id *xid = (const struct _xml_id *)id;
     const struct _root_id *rid = xid->root;
@@ -2276,27 +4022,49 @@ __zeroxml_get_string(const xmlId *id, char mode)
     if (xid->len)
     {
         const char *ps = xid->start;
-        int len = xid->len;
+        off_t len = xid->len;
 
         if (mode == STRIPPED) {
              __zeroxml_prepare_data(rid, &ps, &len, mode);
         }
-        if (len)
-        {
-            if ((rv = malloc(6*len+1)) != NULL)
-            {
-                int res = __zeroxml_iconv(rid, ps, len, rv, 6*len);
-                if (res) SET_ERROR(xid, 0, 0, res);
-            }
-            else {
-                SET_ERROR(xid, 0, 0, XML_OUT_OF_MEMORY);
-            }
+        if (len) {
+            rv = __zeroxml_convert(xid, ps, (size_t)len, pool);
         }
     }
 
     return rv;
 }
 
+/*
+ * Convert a string to the local character encoding in a new string.
+ * The string is allocated at the exact size of the converted string.
+ *
+ * @param xid XML-id of the node the string belongs to
+ * @param ps the string to convert
+ * @param len the length of the string
+ * @param pool the arena pool to allocate the string from
+ * @return the converted string or NULL on failure
+ */
+static char*
+__zeroxml_convert(const struct _xml_id *xid, const char *ps, size_t len, int pool)
+{
+    const struct _root_id *rid = xid->root;
+    size_t size;
+    char *rv;
+
+    size = __zeroxml_iconv_length(rid, ps, len);
+    if ((rv = __zeroxml_alloc(rid, size+1, pool)) != NULL)
+    {
+        int res = __zeroxml_iconv(rid, ps, len, rv, size);
+        if (res) SET_ERROR(xid, 0, 0, res);
+    }
+    else {
+        SET_ERROR(xid, 0, 0, XML_OUT_OF_MEMORY);
+    }
+
+    return rv;
+}
+
 /*
  * Skip processing instructions, doctype declarations, XML comment sections
  * or CDATA sections.
@@ -2314,11 +4082,11 @@ __zeroxml_get_string(const xmlId *id, char mode)
  * @return a pointer right after the XML comment or CDATA section
  */
 const char*
-__zeroxmlProcessCDATA(const char **start, int *len, char mode)
+__zeroxmlProcessCDATA(const char **start, off_t *len, char mode)
 {
     const char *new = *start;
     const char *cur = new;
-    int restlen = *len;
+    off_t restlen = *len;
 
     /* comment: "<!---->" */
     if ((restlen >= 7) && (MEMCMP(cur, "!--", 3) == 0))
@@ -2419,7 +4187,7 @@ __zeroxmlProcessCDATA(const char **start, int *len, char mode)
  * @return a pointer to the memory location right after the declaration
  */
 static const char*
-__zeroxml_process_byte_order_mark(const struct _root_id *rid, const char *start, int len, char *locale)
+__zeroxml_process_byte_order_mark(const struct _root_id *rid, const char *start, off_t len, char *locale)
 {
     const char *rv = start;
 
@@ -2495,7 +4263,7 @@ __zeroxml_process_byte_order_mark(const struct _root_id *rid, const char *start,
  * @return a pointer to the memory location right after the declaration
  */
 const char*
-__zeroxml_process_declaration(const struct _root_id *rid, const char *start, int len, char *locale)
+__zeroxml_process_declaration(const struct _root_id *rid, const char *start, off_t len, char *locale)
 {
     const char *cur = start;
     const char *rv = start;
@@ -2562,9 +4330,9 @@ __zeroxml_process_declaration(const struct _root_id *rid, const char *start, int
    or not (STRIPPED)
  */
 static void
-__zeroxml_prepare_data(const struct _root_id *rid, const char **start, int *blocklen, char mode)
+__zeroxml_prepare_data(const struct _root_id *rid, const char **start, off_t *blocklen, char mode)
 {
-    int restlen = *blocklen;
+    off_t restlen = *blocklen;
     const char *ps = *start;
     const char *pe = ps + restlen;
 
@@ -2633,22 +4401,14 @@ __zeroxml_set_error(const struct _xml_id *id, const char *start, const char *pos
     if (xid)
     {
         struct _root_id *rid = xid->root;
-        const char *ps = start;
-        const char *pe = pos;
-        const char *new;
-
-        __zeroxml_info.line = 1;
-        while (ps<pe)
-        {
-            new = MEMCHR(ps, '\n', pe-ps);
-            if (new) __zeroxml_info.line++;
-            else break;
-            ps = new+1;
-        }
-        __zeroxml_info.column = pe-ps;
 
+        /*
+         * The line and column number are not calculated here but only when
+         * requested, using the line number index of the document.
+         */
         if (rid->info == 0) {
-            rid->info = malloc(sizeof(struct _zeroxml_error));
+            rid->info = __zeroxml_alloc(rid, sizeof(struct _zeroxml_error),
+                                        ARENA_DOCUMENT);
         }
 
         if (rid->info)
@@ -2696,7 +4456,7 @@ __zeroxml_set_error_debug(const struct _xml_id *id, const char *start, const cha
 static long
 __zeroxml_strtol(const char *str, char **end, int base, long rv)
 {
-    int len = *end - str;
+    off_t len = *end - str;
     long val;
 
     if (len >= 2)
@@ -2763,7 +4523,7 @@ __zeroxml_strtob(const struct _root_id *rid, const char *start, const char *end,
     val = __zeroxml_strtol(start, &ptr, 10, rv) ? XML_TRUE : XML_FALSE;
     if (ptr == start)
     {
-        int len = end-start;
+        size_t len = (size_t)(end-start);
         if (!STRNCMP(rid, start, "off", len)
             || !STRNCMP(rid, start, "no", len)
             || !STRNCMP(rid, start, "false", len))
@@ -2795,7 +4555,7 @@ __zeroxml_strtob(const struct _root_id *rid, const char *start, const char *end,
  * @return a pointer to the located sub‐string, or NULL if not found
  */
 static const char*
-__zeroxml_memmem(const char *haystack, int haystacklen, const char *needle, int needlelen)
+__zeroxml_memmem(const char *haystack, off_t haystacklen, const char *needle, int needlelen)
 {
     const char *rv = NULL;
     int first;
@@ -2836,7 +4596,7 @@ __zeroxml_memmem(const char *haystack, int haystacklen, const char *needle, int
  * @return a pointer to the located sub‐string, or NULL if not found
  */
 static const char*
-__zeroxml_memncasestr(const struct _root_id *rid, const char *haystack, int haystacklen, const char *needle)
+__zeroxml_memncasestr(const struct _root_id *rid, const char *haystack, off_t haystacklen, const char *needle)
 {
     const char *rv = NULL;
     int needlelen;
@@ -2896,7 +4656,7 @@ __zeroxml_memncasestr(const struct _root_id *rid, const char *haystack, int hays
 #define ISNUM(a)	(isdigit(a))
 static const char*
 __zeroxml_memncasecmp(const struct _root_id *rid,
-                      const char **haystack_ptr, int *haystacklen,
+                      const char **haystack_ptr, off_t *haystacklen,
                       const char **needle, int *needlelen)
 {
     const char *haystack;
@@ -3012,6 +4772,498 @@ __zeroxml_memncasecmp(const struct _root_id *rid,
     return rptr;
 }
 
+/*
+ * Test whether a character may be part of an element or attribute name.
+ *
+ * This is the set of characters accepted by VALIDNAME except that the colon
+ * of namespace prefixes is allowed while white-space and control characters
+ * are rejected. Using a switch statement instead of strchr makes the compiler
+ * generate a lookup table which keeps the cost per character to a minimum.
+ *
+ * @param c the character to test
+ * @return XML_TRUE if the character is valid for a name, XML_FALSE otherwise
+ */
+static inline int
+__zeroxml_namechar(unsigned char c)
+{
+    switch(c)
+    {
+    case ' ': case '~': case '/': case '\\': case ';': case '$':
+    case '&': case '%': case '@': case '^': case '=': case '*': case '+':
+    case '(': case ')': case '|': case '"': case '{': case '}': case '[':
+    case ']': case '<': case '>': case '\'': case 0x7F:
+        return XML_FALSE;
+    default:
+        break;
+    }
+    return (c > ' ') ? XML_TRUE : XML_FALSE;
+}
+
+/*
+ * Line number index.
+ *
+ * The document is divided in blocks of LINES_BLOCKSIZE bytes and for every
+ * block the line number of its first character and the start of that line
+ * are stored. Looking up the line and column number for a position then only
+ * requires the newlines from the start of its block to be counted.
+ *
+ * The index is built on first use, which is usually when the first error is
+ * reported, and is shared by all XML-ids of the document.
+ */
+#define LINES_BLOCKSIZE		4096
+struct _zeroxml_lines
+{
+    const char *base;
+    off_t len;
+    size_t no_blocks;
+    struct {
+        int line;		/* line number of the first character */
+        off_t line_start;	/* offset of the start of that line */
+    } block[1];
+};
+
+/*
+ * Count the number of newlines in a section.
+ *
+ * @param ps start of the section
+ * @param pe end of the section
+ * @param last set to the position right after the last newline, if any
+ * @return the number of newlines in the section
+ */
+static int
+__zeroxml_count_lines(const char *ps, const char *pe, const char **last)
+{
+    const char *new;
+    int rv = 0;
+
+#if defined(__SSE2__) && defined(__GNUC__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (pe-ps >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)ps);
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask)
+        {
+            rv += __builtin_popcount(mask);
+            *last = ps + (31 - __builtin_clz(mask)) + 1;
+        }
+        ps += 16;
+    }
+#endif
+
+    while (ps < pe && (new = MEMCHR(ps, '\n', pe-ps)) != NULL)
+    {
+        rv++;
+        ps = *last = new+1;
+    }
+
+    return rv;
+}
+
+static const struct _zeroxml_lines*
+__zeroxml_get_lines(const struct _root_id *rid)
+{
+    struct _root_id *r = (struct _root_id*)rid;
+    struct _zeroxml_lines *rv = ATOMIC_PTR_GET(r->lines);
+
+    if (!rv)
+    {
+        size_t no_blocks = (size_t)(rid->len/LINES_BLOCKSIZE) + 1;
+        size_t size = sizeof(struct _zeroxml_lines);
+
+        size += (no_blocks-1)*sizeof(rv->block[0]);
+        if ((rv = __zeroxml_memory_alloc(r->memory, size)) != NULL)
+        {
+            struct _zeroxml_lines *expected = NULL;
+            const char *ps = rid->start;
+            const char *line_start = ps;
+            int line = 1;
+            size_t i;
+
+            rv->base = rid->start;
+            rv->len = rid->len;
+            rv->no_blocks = no_blocks;
+            for (i=0; i<no_blocks; i++)
+            {
+                const char *pe = ps + LINES_BLOCKSIZE;
+                if (pe > rid->start + rid->len) pe = rid->start + rid->len;
+
+                rv->block[i].line = line;
+                rv->block[i].line_start = line_start - rid->start;
+                line += __zeroxml_count_lines(ps, pe, &line_start);
+                ps = pe;
+            }
+
+            /* another thread might have been faster */
+            if (!ATOMIC_PTR_CAS(r->lines, expected, rv))
+            {
+                __zeroxml_memory_free(r->memory, rv);
+                rv = expected;
+            }
+        }
+    }
+
+    return rv;
+}
+
+/*
+ * Get the line and column number of a position within the document.
+ *
+ * Line numbers start at one, column numbers start at zero.
+ *
+ * @param rid the root XML-id of the document
+ * @param pos the position to get the line and column number for
+ * @param line set to the line number of the position
+ * @param column set to the column number of the position
+ */
+static void
+__zeroxml_get_location(const struct _root_id *rid, const char *pos, int *line, int *column)
+{
+    const struct _zeroxml_lines *lines = NULL;
+
+    *line = 1;
+    *column = 0;
+    if (rid->start && pos >= rid->start && pos <= rid->start+rid->len) {
+        lines = __zeroxml_get_lines(rid);
+    }
+
+    if (lines)
+    {
+        size_t i = (size_t)((pos - lines->base)/LINES_BLOCKSIZE);
+        const char *ps = lines->base + i*LINES_BLOCKSIZE;
+        const char *line_start = lines->base + lines->block[i].line_start;
+
+        *line = lines->block[i].line;
+        *line += __zeroxml_count_lines(ps, pos, &line_start);
+        *column = (int)(pos - line_start);
+    }
+}
+
+/*
+ * Register an error detected by the validator.
+ *
+ * @return XML_TRUE if the validator should stop scanning, XML_FALSE otherwise
+ */
+static int
+__zeroxml_validate_error(const struct _xml_id *xid, xmlErrorList *list, int *errors, const char *pos, int err_no)
+{
+    int rv = XML_TRUE;
+
+    if ((*errors)++ == 0) {
+        __zeroxml_set_error(xid, xid->root->start, pos, err_no);
+    }
+
+    if (list && list->num_errors < list->max_errors)
+    {
+        xmlErrorInfo *err = &list->errors[list->num_errors++];
+
+        err->err_no = err_no;
+        err->str = __zeroxml_error_str[err_no];
+        __zeroxml_get_location(xid->root, pos, &err->line_no, &err->column_no);
+
+        rv = (list->num_errors == list->max_errors) ? XML_TRUE : XML_FALSE;
+    }
+
+    return rv;
+}
+
+/*
+ * Check the well-formedness of an XML section in one linear pass.
+ *
+ * Text sections are skipped using MEMCHR, only the markup itself is
+ * inspected. Opened elements are kept on a stack to test whether every
+ * closing tag matches the last opened element.
+ *
+ * After an error the scanner tries to resynchronize on the next tag so
+ * multiple errors can be reported for the same document.
+ *
+ * @param xid XML-id to report the first error for
+ * @param start a pointer to the start of the XML section
+ * @param len the length of the XML section
+ * @param list the list to store the detected errors in, or NULL
+ * @return the number of detected errors
+ */
+#define VALIDATE_ERROR(p, e) do { \
+  if (__zeroxml_validate_error(xid, list, &rv, (p), (e))) \
+    goto __zeroxml_validateExit; \
+} while(0)
+#define LIMIT_ERROR(p) do { \
+  __zeroxml_validate_error(xid, list, &rv, (p), XML_LIMIT_EXCEEDED); \
+  goto __zeroxml_validateExit; \
+} while(0)
+#define SKIP_SPACES(p, e)	while ((p) < (e) && isspace(*(p))) (p)++
+#define SKIP_NAME(p, e)		while ((p) < (e) && __zeroxml_namechar(*(p))) (p)++
+static int
+__zeroxml_validate(const struct _xml_id *xid, const char *start, off_t len, xmlErrorList *list)
+{
+    const struct _root_id *rid = xid->root;
+    const xmlLimits *limits = &rid->limits;
+    const char *end = start + len;
+    const char *cur = start;
+    struct
+    {
+        const char *name;
+        int len;
+    } *stack = NULL;
+    const char *released = start;
+    int depth = 0, max_depth = 0;
+    int nodes = 0, steps = 0;
+    int rv = 0;
+
+    while (cur < end)
+    {
+        const char *tag, *ptr, *name;
+        int namelen, num_attributes;
+
+        if ((tag = MEMCHR(cur, '<', end-cur)) == NULL) break;
+        if (++steps > limits->max_steps) LIMIT_ERROR(tag);
+
+        if (rid->window && tag - released > rid->window) {
+            __zeroxml_release_window(rid, &released, tag);
+        }
+
+        cur = tag+1;
+        if (cur == end) {
+            VALIDATE_ERROR(tag, XML_UNEXPECTED_EOF);
+            break;
+        }
+
+        /* comment: "<!---->", CDATA: "<![CDATA[]]>" or "<!DOCTYPE element []>" */
+        if (*cur == '!')
+        {
+            if (end-cur >= 3 && !MEMCMP(cur, "!--", 3))
+            {
+                ptr = __zeroxml_memmem(cur+3, end-cur-3, "-->", 3);
+                if (!ptr)
+                {
+                    VALIDATE_ERROR(tag, XML_INVALID_COMMENT);
+                    break;
+                }
+                cur = ptr+3;
+            }
+            else if (end-cur >= 8 && !MEMCMP(cur, "![CDATA[", 8))
+            {
+                ptr = __zeroxml_memmem(cur+8, end-cur-8, "]]>", 3);
+                if (!ptr)
+                {
+                    VALIDATE_ERROR(tag, XML_INVALID_COMMENT);
+                    break;
+                }
+                cur = ptr+3;
+            }
+            else if (end-cur >= 8 && !MEMCMP(cur, "!DOCTYPE", 8))
+            {
+                const char *subset;
+
+                ptr = MEMCHR(cur, '>', end-cur);
+                subset = MEMCHR(cur, '[', ptr ? ptr-cur : end-cur);
+                while (subset)
+                {
+                    /* skip "]]>" of conditional sections */
+                    ptr = __zeroxml_memmem(subset, end-subset, "]>", 2);
+                    if (ptr && *(ptr-1) == ']') {
+                        subset = ptr+2;
+                    } else {
+                        if (ptr) ptr++;
+                        break;
+                    }
+                }
+                if (!ptr)
+                {
+                    VALIDATE_ERROR(tag, XML_INVALID_INFO_BLOCK);
+                    break;
+                }
+                cur = ptr+1;
+            }
+            else
+            {
+                VALIDATE_ERROR(tag, XML_INVALID_COMMENT);
+            }
+            continue;
+        }
+
+        /* processing instructions: "<?target ?>" */
+        if (*cur == '?')
+        {
+            ptr = __zeroxml_memmem(cur+1, end-cur-1, "?>", 2);
+            if (!ptr)
+            {
+                VALIDATE_ERROR(tag, XML_INVALID_INFO_BLOCK);
+                break;
+            }
+            cur = ptr+2;
+            continue;
+        }
+
+        /* closing tag: "</name>" */
+        if (*cur == '/')
+        {
+            name = ++cur;
+            SKIP_NAME(cur, end);
+            namelen = cur-name;
+            SKIP_SPACES(cur, end);
+            if (!namelen || cur == end || *cur != '>')
+            {
+                VALIDATE_ERROR(name, cur == end ? XML_UNEXPECTED_EOF
+                                                : XML_INVALID_NAME);
+                continue;
+            }
+            cur++;
+
+            if (depth && stack[depth-1].len == namelen &&
+                !STRNCMP(rid, stack[depth-1].name, name, namelen))
+            {
+                depth--;
+            }
+            else
+            {
+                int i = depth-1;
+                while (i >= 0 && (stack[i].len != namelen ||
+                                  STRNCMP(rid, stack[i].name, name, namelen)))
+                {
+                    i--;
+                }
+
+                if (i >= 0)
+                {
+                    /* skip the elements which were not closed */
+                    depth = i;
+                    VALIDATE_ERROR(tag, XML_ELEMENT_NO_CLOSING_TAG);
+                }
+                else {
+                    VALIDATE_ERROR(tag, XML_ELEMENT_NO_OPENING_TAG);
+                }
+            }
+            continue;
+        }
+
+        /* opening tag: "<name attribute="value">" or "<name/>" */
+        name = cur;
+        if (!ISNUM(*cur)) SKIP_NAME(cur, end);
+        namelen = cur-name;
+        if (!namelen || (cur < end && !ISSEPARATOR(*cur)))
+        {
+            VALIDATE_ERROR(cur, XML_INVALID_NAME);
+            continue;
+        }
+        if (namelen > limits->max_name_len || ++nodes > limits->max_nodes ||
+            depth >= limits->max_depth)
+        {
+            LIMIT_ERROR(name);
+        }
+
+        num_attributes = 0;
+        while (cur < end)
+        {
+            const char *attr;
+            char quote;
+
+            SKIP_SPACES(cur, end);
+            if (cur == end) break;
+
+            if (*cur == '>') break;
+
+            if (*cur == '/')
+            {
+                if (cur+1 == end || cur[1] != '>') {
+                    VALIDATE_ERROR(cur, XML_INVALID_NAME);
+                }
+                cur++;
+                break;
+            }
+
+            /* attribute name */
+            attr = cur;
+            if (!ISNUM(*cur)) SKIP_NAME(cur, end);
+            if (cur == attr)
+            {
+                VALIDATE_ERROR(cur, XML_INVALID_NAME);
+                break;
+            }
+            if (cur-attr > limits->max_name_len ||
+                ++num_attributes > limits->max_attributes)
+            {
+                LIMIT_ERROR(attr);
+            }
+
+            SKIP_SPACES(cur, end);
+            if (cur == end) break;
+            if (*cur != '=')
+            {
+                VALIDATE_ERROR(cur, XML_ATTRIB_NO_OPENING_QUOTE);
+                break;
+            }
+
+            cur++;
+            SKIP_SPACES(cur, end);
+            if (cur == end) break;
+
+            /* attribute value */
+            quote = *cur;
+            if (quote != '"' && quote != '\'')
+            {
+                VALIDATE_ERROR(cur, XML_ATTRIB_NO_OPENING_QUOTE);
+                break;
+            }
+
+            attr = ++cur;
+            ptr = MEMCHR(cur, quote, end-cur);
+            if (!ptr || MEMCHR(attr, '<', ptr-attr))
+            {
+                VALIDATE_ERROR(attr-1, XML_ATTRIB_NO_CLOSING_QUOTE);
+                break;
+            }
+            cur = ptr+1;
+        }
+
+        if (cur < end && *cur != '>')
+        {
+            /* resynchronize on the end of the tag */
+            ptr = MEMCHR(cur, '>', end-cur);
+            cur = ptr ? ptr : end;
+        }
+
+        if (cur == end)
+        {
+            VALIDATE_ERROR(tag, XML_UNEXPECTED_EOF);
+            break;
+        }
+
+        if (*(cur-1) != '/')
+        {
+            if (depth == max_depth)
+            {
+                int size = (max_depth + 16)*sizeof(*stack);
+                void *p = REALLOC(stack, size);
+                if (!p)
+                {
+                    VALIDATE_ERROR(tag, XML_OUT_OF_MEMORY);
+                    break;
+                }
+                stack = p;
+                max_depth += 16;
+            }
+            stack[depth].name = name;
+            stack[depth].len = namelen;
+            depth++;
+        }
+        cur++;
+    }
+
+    if (depth) {
+        VALIDATE_ERROR(stack[depth-1].name-1, XML_ELEMENT_NO_CLOSING_TAG);
+    }
+
+__zeroxml_validateExit:
+    FREE(stack);
+
+    return rv;
+}
+#undef VALIDATE_ERROR
+#undef LIMIT_ERROR
+#undef SKIP_SPACES
+#undef SKIP_NAME
+
 #ifdef WIN32
 /*
  * Simple mmap and munmap functions for Windows which behave the same as the
@@ -3035,7 +5287,7 @@ __zeroxml_memncasecmp(const struct _root_id *rid,
  *         (void *) MMAP_ERROR) is returned.
  */
 void*
-simple_mmap(int fd, int length, SIMPLE_UNMMAP *un)
+simple_mmap(int fd, size_t length, SIMPLE_UNMMAP *un)
 {
     HANDLE f;
     HANDLE m;
@@ -3072,7 +5324,7 @@ simple_mmap(int fd, int length, SIMPLE_UNMMAP *un)
  * @param un a structure to hold some Windows specific parameters
  */
 void
-simple_unmmap(void *addr, int length, SIMPLE_UNMMAP *un)
+simple_unmmap(void *addr, size_t length, SIMPLE_UNMMAP *un)
 {
     UnmapViewOfFile(un->p);
     CloseHandle(un->m);
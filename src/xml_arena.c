@@ -0,0 +1,501 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Arena of the documents opened with XML_ARENA.
+ *
+ * Allocations are served from chunks which are allocated with a growing
+ * size and released as a whole when the document is closed. The node cache
+ * and the error information of the document are allocated from the document
+ * pool which lives as long as the document. The XML-ids and strings returned
+ * to the caller are allocated from the scoped pool which can be rewound to a
+ * position taken earlier with xmlArenaMark.
+ *
+ * xmlFree has to tell allocations from an arena apart from those made by
+ * malloc. The chunks of the scoped pool start and end at a page boundary and
+ * their pages are marked in a page map, which xmlFree reads without a lock.
+ * Strings made by malloc stay without a header so they may still be passed
+ * to free.
+ *
+ * A document with a memory limit but without XML_ARENA charges its XML-ids
+ * and strings to the limit with a charged arena. Its chunks are counted
+ * references, xmlFree drops one and the last one releases the chunk and its
+ * charge, also after the document was closed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "api.h"
+
+/* the size of the first chunk of a pool and the maximum chunk size */
+#define ARENA_CHUNK_MIN		(64*1024)
+#define ARENA_CHUNK_MAX		(16*1024*1024)
+
+/* small chunks, one live string keeps its whole chunk charged */
+#define ARENA_CHUNK_CHARGED	(8*1024)
+
+/* the alignment of every allocation */
+#define ARENA_ALIGN		16
+#define ARENA_ROUND(a)		(((a)+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1))
+
+/* the page map has three levels which cover addresses of 48 bits */
+#define ARENA_PAGE_SHIFT	12
+#define ARENA_PAGE_SIZE		((size_t)1 << ARENA_PAGE_SHIFT)
+#define ARENA_MAP_BITS		12
+#define ARENA_MAP_SIZE		(1 << ARENA_MAP_BITS)
+#define ARENA_MAP_MASK		(ARENA_MAP_SIZE-1)
+
+struct _zeroxml_chunk
+{
+    struct _zeroxml_chunk *prev;
+    char *data;		/* page aligned for the scoped pool */
+    size_t size;	/* the number of bytes of the data section */
+    size_t used;
+    size_t base;	/* the position of the data section in the pool */
+    struct _zeroxml_memory *memory; /* charged chunks only */
+    int refs;		/* the allocations and the pool, charged chunks only */
+};
+#define CHUNK_HEADER		ARENA_ROUND(sizeof(struct _zeroxml_chunk))
+
+struct _zeroxml_pool
+{
+    struct _zeroxml_chunk *chunk;
+    size_t next_size;
+};
+
+struct _zeroxml_arena
+{
+    struct _zeroxml_memory *memory; /* the memory of the document */
+    int charged;
+    struct _zeroxml_pool pool[ARENA_MAX];
+#if HAVE_PTHREAD_H
+    pthread_mutex_t mutex;
+#endif
+};
+
+/*
+ * The levels of the page map are created once and never released, they are
+ * made by calloc since they outlive any allocator set by xmlSetAllocator.
+ */
+struct _zeroxml_map_leaf
+{
+    struct _zeroxml_chunk *page[ARENA_MAP_SIZE]; /* NULL without an arena */
+};
+
+struct _zeroxml_map_node
+{
+    struct _zeroxml_map_leaf *leaf[ARENA_MAP_SIZE];
+};
+
+static struct _zeroxml_map_node *__zeroxml_arena_map[ARENA_MAP_SIZE];
+
+#if HAVE_PTHREAD_H
+# define ARENA_LOCK(a)		pthread_mutex_lock(&(a)->mutex)
+# define ARENA_UNLOCK(a)	pthread_mutex_unlock(&(a)->mutex)
+#else
+# define ARENA_LOCK(a)
+# define ARENA_UNLOCK(a)
+#endif
+
+/* get the leaf of the page map for a page, create it if requested */
+static struct _zeroxml_map_leaf*
+__zeroxml_map_leaf(uintptr_t page, int create)
+{
+    struct _zeroxml_map_node *node, *new_node;
+    struct _zeroxml_map_leaf *leaf, *new_leaf;
+    size_t i = (size_t)(page >> ARENA_MAP_BITS >> ARENA_MAP_BITS);
+    size_t j = (size_t)(page >> ARENA_MAP_BITS) & ARENA_MAP_MASK;
+
+    if (i >= ARENA_MAP_SIZE) return NULL;
+
+    node = ATOMIC_PTR_GET(__zeroxml_arena_map[i]);
+    if (!node)
+    {
+        if (!create) return NULL;
+        if ((new_node = calloc(1, sizeof(struct _zeroxml_map_node))) == NULL) {
+            return NULL;
+        }
+        if (ATOMIC_PTR_CAS(__zeroxml_arena_map[i], node, new_node)) {
+            node = new_node;
+        }
+        else
+        {
+            free(new_node);
+            node = ATOMIC_PTR_GET(__zeroxml_arena_map[i]);
+        }
+    }
+
+    leaf = ATOMIC_PTR_GET(node->leaf[j]);
+    if (!leaf)
+    {
+        if (!create) return NULL;
+        if ((new_leaf = calloc(1, sizeof(struct _zeroxml_map_leaf))) == NULL) {
+            return NULL;
+        }
+        if (ATOMIC_PTR_CAS(node->leaf[j], leaf, new_leaf)) {
+            leaf = new_leaf;
+        }
+        else
+        {
+            free(new_leaf);
+            leaf = ATOMIC_PTR_GET(node->leaf[j]);
+        }
+    }
+
+    return leaf;
+}
+
+/* mark the pages of the data section of a chunk of the scoped pool */
+static int
+__zeroxml_map_chunk(struct _zeroxml_chunk *chunk, struct _zeroxml_chunk *owner)
+{
+    uintptr_t page = (uintptr_t)chunk->data >> ARENA_PAGE_SHIFT;
+    uintptr_t end = page + (chunk->size >> ARENA_PAGE_SHIFT);
+
+    for (; page < end; ++page)
+    {
+        struct _zeroxml_map_leaf *leaf = __zeroxml_map_leaf(page, owner != NULL);
+
+        if (leaf) {
+            ATOMIC_PTR_SET(leaf->page[page & ARENA_MAP_MASK], owner);
+        } else if (owner) {
+            return XML_FALSE;
+        }
+    }
+    return XML_TRUE;
+}
+
+static void
+__zeroxml_chunk_free(struct _zeroxml_arena *arena, int pool, struct _zeroxml_chunk *chunk)
+{
+    if (pool == ARENA_SCOPED) {
+        __zeroxml_map_chunk(chunk, NULL);
+    }
+    __zeroxml_memory_free(arena->memory, chunk);
+}
+
+/* drop a reference to a charged chunk, the last one frees it */
+static void
+__zeroxml_chunk_unref(struct _zeroxml_chunk *chunk)
+{
+    if (ATOMIC_INT_ADD(chunk->refs, -1) == 0)
+    {
+        struct _zeroxml_memory *memory = chunk->memory;
+
+        __zeroxml_map_chunk(chunk, NULL);
+        __zeroxml_memory_free(memory, chunk);
+        __zeroxml_memory_destroy(memory);
+    }
+}
+
+struct _zeroxml_arena*
+__zeroxml_arena_create(struct _zeroxml_memory *memory, int charged)
+{
+    struct _zeroxml_arena *rv;
+
+    rv = __zeroxml_memory_calloc(memory, 1, sizeof(struct _zeroxml_arena));
+    if (rv)
+    {
+        int i;
+
+        rv->memory = memory;
+        rv->charged = charged;
+        for (i=0; i<ARENA_MAX; i++) {
+            rv->pool[i].next_size = charged ? ARENA_CHUNK_CHARGED
+                                            : ARENA_CHUNK_MIN;
+        }
+#if HAVE_PTHREAD_H
+        pthread_mutex_init(&rv->mutex, NULL);
+#endif
+    }
+
+    return rv;
+}
+
+void
+__zeroxml_arena_destroy(struct _zeroxml_arena *arena)
+{
+    int i;
+
+    if (!arena) return;
+
+    for (i=0; i<ARENA_MAX; i++)
+    {
+        struct _zeroxml_chunk *chunk = arena->pool[i].chunk;
+
+        /* the chunks of a charged arena live on with their allocations */
+        if (arena->charged && chunk) {
+            __zeroxml_chunk_unref(chunk);
+        }
+        else while (chunk)
+        {
+            struct _zeroxml_chunk *prev = chunk->prev;
+
+            __zeroxml_chunk_free(arena, i, chunk);
+            chunk = prev;
+        }
+    }
+#if HAVE_PTHREAD_H
+    pthread_mutex_destroy(&arena->mutex);
+#endif
+    __zeroxml_memory_free(arena->memory, arena);
+}
+
+void*
+__zeroxml_arena_alloc(struct _zeroxml_arena *arena, size_t size, int pool)
+{
+    struct _zeroxml_pool *p = &arena->pool[pool];
+    struct _zeroxml_chunk *chunk;
+    void *rv = NULL;
+
+    size = ARENA_ROUND(size);
+
+    ARENA_LOCK(arena);
+    chunk = p->chunk;
+    if (!chunk || chunk->size - chunk->used < size)
+    {
+        size_t csize = (size > p->next_size) ? size : p->next_size;
+        size_t align = 0;
+
+        /* whole pages, so no page is shared with memory made by malloc */
+        if (pool == ARENA_SCOPED)
+        {
+            align = ARENA_PAGE_SIZE-1;
+            csize = (csize + align) & ~align;
+        }
+
+        chunk = __zeroxml_memory_alloc(arena->memory, CHUNK_HEADER+align+csize);
+        if (chunk)
+        {
+            uintptr_t data = (uintptr_t)chunk + CHUNK_HEADER;
+
+            chunk->prev = p->chunk;
+            chunk->data = (char*)((data + align) & ~(uintptr_t)align);
+            chunk->size = csize;
+            chunk->used = 0;
+            chunk->base = 0;
+            chunk->memory = NULL;
+            chunk->refs = 0;
+            if (p->chunk) {
+                chunk->base = p->chunk->base + p->chunk->used;
+            }
+
+            if (pool == ARENA_SCOPED && !__zeroxml_map_chunk(chunk, chunk))
+            {
+                __zeroxml_chunk_free(arena, pool, chunk);
+                chunk = NULL;
+            }
+        }
+
+        if (chunk && arena->charged)
+        {
+            /* the pool holds a reference until the chunk is full */
+            chunk->prev = NULL;
+            chunk->memory = arena->memory;
+            chunk->refs = 1;
+            __zeroxml_memory_ref(arena->memory);
+            if (p->chunk) __zeroxml_chunk_unref(p->chunk);
+            p->chunk = chunk;
+        }
+        else if (chunk)
+        {
+            p->chunk = chunk;
+            if (p->next_size < ARENA_CHUNK_MAX) {
+                p->next_size *= 2;
+            }
+        }
+    }
+
+    if (chunk)
+    {
+        if (arena->charged) ATOMIC_INT_ADD(chunk->refs, 1);
+        rv = chunk->data + chunk->used;
+        chunk->used += size;
+    }
+    ARENA_UNLOCK(arena);
+
+    return rv;
+}
+
+size_t
+__zeroxml_arena_mark(struct _zeroxml_arena *arena)
+{
+    struct _zeroxml_chunk *chunk;
+    size_t rv = 0;
+
+    ARENA_LOCK(arena);
+    chunk = arena->pool[ARENA_SCOPED].chunk;
+    if (chunk) {
+        rv = chunk->base + chunk->used;
+    }
+    ARENA_UNLOCK(arena);
+
+    return rv;
+}
+
+void
+__zeroxml_arena_release(struct _zeroxml_arena *arena, size_t pos)
+{
+    struct _zeroxml_pool *p = &arena->pool[ARENA_SCOPED];
+
+    ARENA_LOCK(arena);
+    while (p->chunk && p->chunk->base > pos)
+    {
+        struct _zeroxml_chunk *prev = p->chunk->prev;
+
+        __zeroxml_chunk_free(arena, ARENA_SCOPED, p->chunk);
+        p->chunk = prev;
+    }
+    if (p->chunk && p->chunk->base + p->chunk->used > pos) {
+        p->chunk->used = pos - p->chunk->base;
+    }
+    ARENA_UNLOCK(arena);
+}
+
+/*
+ * Rewind both pools to the start for the next document of an xmlContext.
+ * Only the last and largest chunk of every pool is kept, so after a few
+ * documents every allocation is served without growing the arena.
+ */
+void
+__zeroxml_arena_reset(struct _zeroxml_arena *arena)
+{
+    int i;
+
+    ARENA_LOCK(arena);
+    for (i=0; i<ARENA_MAX; i++)
+    {
+        struct _zeroxml_chunk *chunk = arena->pool[i].chunk;
+
+        if (chunk)
+        {
+            struct _zeroxml_chunk *prev = chunk->prev;
+
+            while (prev)
+            {
+                struct _zeroxml_chunk *next = prev->prev;
+
+                __zeroxml_chunk_free(arena, i, prev);
+                prev = next;
+            }
+            chunk->prev = NULL;
+            chunk->used = 0;
+            chunk->base = 0;
+        }
+    }
+    ARENA_UNLOCK(arena);
+}
+
+void*
+__zeroxml_alloc(const struct _root_id *rid, size_t size, int pool)
+{
+    STATS_ALLOC(rid, size);
+    if (rid->arena && pool != ARENA_NONE) {
+        return __zeroxml_arena_alloc(rid->arena, size, pool);
+    }
+    if (pool == ARENA_DOCUMENT) {
+        return __zeroxml_memory_alloc(rid->memory, size);
+    }
+    if (rid->charged && pool == ARENA_SCOPED) {
+        return __zeroxml_arena_alloc(rid->charged, size, pool);
+    }
+
+    /* freed by xmlFree, only checked against the memory limit */
+    if (!__zeroxml_memory_fits(rid->memory, size)) {
+        return NULL;
+    }
+    return MALLOC(size);
+}
+
+void
+__zeroxml_release(void *ptr)
+{
+    uintptr_t page = (uintptr_t)ptr >> ARENA_PAGE_SHIFT;
+    struct _zeroxml_map_leaf *leaf;
+    struct _zeroxml_chunk *chunk = NULL;
+
+    if (!ptr) return;
+
+    /* a page is unmarked before its chunk is freed */
+    leaf = __zeroxml_map_leaf(page, XML_FALSE);
+    if (leaf) {
+        chunk = ATOMIC_PTR_GET(leaf->page[page & ARENA_MAP_MASK]);
+    }
+
+    /* allocations from an arena are released by xmlClose */
+    if (!chunk) {
+        FREE(ptr);
+    } else if (chunk->memory) {
+        __zeroxml_chunk_unref(chunk);
+    }
+}
+
+void
+__zeroxml_free(const struct _root_id *rid, void *ptr)
+{
+    /* the document allocations of an arena are released with the arena */
+    if (!rid->arena) {
+        __zeroxml_memory_free(rid->memory, ptr);
+    }
+}
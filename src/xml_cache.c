@@ -61,6 +61,9 @@
 #endif
 
 #include <sys/types.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #include "xml.h"
@@ -69,46 +72,125 @@
 /* number of pointers to allocate for every block increase */
 # define NODE_BLOCKSIZE		16
 
+/* the parts of a node which are allocated from the arena of the document */
+# define ARENA_NODE		0x01
+# define ARENA_LIST		0x02
+
+/* max_nodes of the nodes of a tree created by cacheLoad or cacheCopy */
+# define BULK_NODES		(-1)
+
+/* the name offset of a record for the name of comment nodes */
+# define RECORD_COMMENT		(-2)
+# define RECORD_NAME(r,b,c)	(((r)->name == RECORD_COMMENT) ? (c) : \
+				 ((r)->name >= 0) ? (b) + (r)->name : NULL)
+# define RECORD_DATA(r,b)	(((r)->data >= 0) ? (b) + (r)->data : NULL)
+
 struct _xml_node
 {
     /* Cache node information */
     const struct _xml_node *parent; /* parent node */
     const cacheId **node; /* list of child nodes */
-    short int max_nodes; /* maximum number of child nodes */
-    short int no_nodes; /* available number of nodes */
+    int max_nodes; /* maximum number of child nodes */
+    int no_nodes; /* available number of nodes */
 
     /* XML node information */
-    short int name_len;	/* lenght of the name of the XML node */
+    int name_len;	/* lenght of the name of the XML node */
+    int arena;		/* ARENA_NODE and ARENA_LIST */
     const char *name;	/* name of the XML node */
-    int data_len;	/* lenght of the  data section of the XML node */
+    off_t data_len;	/* lenght of the  data section of the XML node */
     const char *data;	/* data section of the XML node */
+
+    /* child nodes, if they were cached on demand */
+    struct _xml_node *level;
 };
 
+/* nodes of a document opened with XML_ARENA live as long as the document */
+static struct _xml_node*
+__zeroxml_node_alloc(const struct _root_id *rid)
+{
+    struct _xml_node *rv;
+
+    if (rid->arena)
+    {
+        rv = __zeroxml_arena_alloc(rid->arena, sizeof(struct _xml_node),
+                                   ARENA_DOCUMENT);
+        if (rv)
+        {
+            memset(rv, 0, sizeof(struct _xml_node));
+            rv->arena = ARENA_NODE;
+        }
+    }
+    else {
+        rv = __zeroxml_memory_calloc(rid->memory, 1, sizeof(struct _xml_node));
+    }
+    if (rv) {
+        STATS_ALLOC(rid, sizeof(struct _xml_node));
+    }
+
+    return rv;
+}
+
+static const cacheId**
+__zeroxml_list_alloc(const struct _root_id *rid, int num)
+{
+    size_t size = num*sizeof(struct _xml_node *);
+    const cacheId **rv;
+
+    if (rid->arena)
+    {
+        rv = __zeroxml_arena_alloc(rid->arena, size, ARENA_DOCUMENT);
+        if (rv) memset(rv, 0, size);
+    }
+    else {
+        rv = __zeroxml_memory_calloc(rid->memory, num,
+                                     sizeof(struct _xml_node *));
+    }
+    if (rv) {
+        STATS_ALLOC(rid, size);
+    }
+
+    return rv;
+}
+
 const cacheId*
 cacheInit(const struct _root_id *rid)
 {
-    return CACHED_NODES(rid) ? calloc(1, sizeof(struct _xml_node))
-                             : NULL;
+    return CACHED_NODES(rid) ? __zeroxml_node_alloc(rid) : NULL;
 }
 
-void
-cacheInitLevel(const cacheId *nc)
+int
+cacheInitLevel(const struct _root_id *rid, const cacheId *nc)
 {
     struct _xml_node *cache = (struct _xml_node *)nc;
     if (cache)
     {
         assert(cache->node == 0);
 
-        cache->node = calloc(NODE_BLOCKSIZE, sizeof(struct _xml_node *));
+        cache->node = __zeroxml_list_alloc(rid, NODE_BLOCKSIZE);
+        if (!cache->node) return XML_FALSE;
+
         cache->max_nodes = NODE_BLOCKSIZE;
+        if (rid->arena) {
+            cache->arena |= ARENA_LIST;
+        }
     }
+    return XML_TRUE;
 }
 
 void
-cacheFree(const cacheId *nc)
+cacheFree(const struct _root_id *rid, const cacheId *nc)
 {
     struct _xml_node *cache = (struct _xml_node *)nc;
-    if (cache)
+    if (cache && cache->max_nodes == BULK_NODES)
+    {
+        /* the root node holds the allocation for the whole tree */
+        if (!cache->parent)
+        {
+            cacheFree(rid, cache->level);
+            __zeroxml_memory_free(rid->memory, cache);
+        }
+    }
+    else if (cache)
     {
         if (cache->no_nodes)
         {
@@ -116,11 +198,16 @@ cacheFree(const cacheId *nc)
             int i = 0;
 
             while(i < cache->no_nodes) {
-                cacheFree((cacheId*)node[i++]);
+                cacheFree(rid, (cacheId*)node[i++]);
             }
         }
-        free(cache->node);
-        free(cache);
+        cacheFree(rid, cache->level);
+        if (!(cache->arena & ARENA_LIST)) {
+            __zeroxml_memory_free(rid->memory, cache->node);
+        }
+        if (!(cache->arena & ARENA_NODE)) {
+            __zeroxml_memory_free(rid->memory, cache);
+        }
     }
 }
 
@@ -133,7 +220,8 @@ cacheNodeGet(const xmlId *id)
     assert(rid != 0);
 
     if (rid->root == rid) {
-        cache = rid->node;
+        /* set by the background thread for XML_BACKGROUND_NODES */
+        cache = ATOMIC_PTR_GET(rid->node);
     }
     else
     {
@@ -145,7 +233,7 @@ cacheNodeGet(const xmlId *id)
 }
 
 const cacheId*
-cacheNodeNew(const cacheId *nc)
+cacheNodeNew(const struct _root_id *rid, const cacheId *nc)
 {
     struct _xml_node *cache = (struct _xml_node *)nc;
     struct _xml_node *rv = NULL;
@@ -153,25 +241,43 @@ cacheNodeNew(const cacheId *nc)
     if (cache)
     {
         int i = cache->no_nodes;
-        if (i == cache->max_nodes)
+        if (i == cache->max_nodes && (cache->arena & ARENA_LIST))
+        {
+            /* the previous list stays in the arena, double the size */
+            int max_nodes = 2*cache->max_nodes;
+            const cacheId **p;
+
+            if ((p = __zeroxml_list_alloc(rid, max_nodes)) == NULL) {
+                return rv;
+            }
+            memcpy(p, cache->node, i*sizeof(struct _xml_node*));
+
+            cache->node = p;
+            cache->max_nodes = max_nodes;
+        }
+        else if (i == cache->max_nodes)
         {
-            int size, max_nodes;
+            size_t size;
+            int max_nodes;
             void *p;
 
             max_nodes = cache->max_nodes + NODE_BLOCKSIZE;
             size = max_nodes * sizeof(struct _xml_node*);
-            if ((p = realloc(cache->node, size)) == NULL) {
+            p = __zeroxml_memory_realloc(rid->memory, cache->node, size);
+            if (p == NULL) {
                 return rv;
             }
+            STATS_ALLOC(rid, size);
 
             cache->node = p;
             cache->max_nodes = max_nodes;
         }
 
-        if ((rv = calloc(1, sizeof(struct _xml_node))) != NULL)
+        if ((rv = __zeroxml_node_alloc(rid)) != NULL)
         {
             rv->parent = cache;
             cache->no_nodes++;
+            STATS_ADD(rid, nodes_created, 1);
         }
         cache->node[i] = rv;
     }
@@ -180,7 +286,7 @@ cacheNodeNew(const cacheId *nc)
 }
 
 void
-cacheDataSet(const cacheId *nc, const char *name, int namelen, const char *data, int datalen)
+cacheDataSet(const cacheId *nc, const char *name, int namelen, const char *data, off_t datalen)
 {
     struct _xml_node *cache = (struct _xml_node *)nc;
     if (cache)
@@ -197,9 +303,54 @@ cacheDataSet(const cacheId *nc, const char *name, int namelen, const char *data,
 }
 
 void
-cacheNodeAdd(const cacheId *n, const char *name, int namelen, const char *data, int datalen)
+cacheDataGet(const cacheId *nc, const char **name, int *namelen, const char **data, off_t *datalen)
+{
+    const struct _xml_node *cache = (const struct _xml_node *)nc;
+
+    assert(cache != 0);
+
+    *name = cache->name;
+    *namelen = cache->name_len;
+    *data = cache->data;
+    *datalen = cache->data_len;
+}
+
+const cacheId*
+cacheLevelGet(const cacheId *nc)
+{
+    struct _xml_node *cache = (struct _xml_node *)nc;
+
+    assert(cache != 0);
+
+    /* a node list is only allocated when the child nodes are cached */
+    if (cache->node) {
+        return cache;
+    }
+    return ATOMIC_PTR_GET(cache->level);
+}
+
+const cacheId*
+cacheLevelSet(const struct _root_id *rid, const cacheId *nc, const cacheId *level)
+{
+    struct _xml_node *cache = (struct _xml_node *)nc;
+    struct _xml_node *expected = NULL;
+
+    assert(cache != 0);
+    assert(level != 0);
+
+    if (!ATOMIC_PTR_CAS(cache->level, expected, (struct _xml_node*)level))
+    {
+        cacheFree(rid, level);
+        level = expected;
+    }
+
+    return level;
+}
+
+void
+cacheNodeAdd(const struct _root_id *rid, const cacheId *n, const char *name, int namelen, const char *data, off_t datalen)
 {
-    const cacheId *nc = cacheNodeNew(n);
+    const cacheId *nc = cacheNodeNew(rid, n);
     cacheDataSet(nc, name, namelen, data, datalen);
 }
 
@@ -226,7 +377,7 @@ cacheNodeAdd(const cacheId *n, const char *name, int namelen, const char *data,
            of an error
  */
 const char*
-__zeroxml_get_node_from_cache(const cacheId **nc, const char **buf, int *len,
+__zeroxml_get_node_from_cache(const cacheId **nc, const char **buf, off_t *len,
                       const char **element, int *elementlen, int *nodenum)
 {
     struct _xml_node *cache;
@@ -310,3 +461,458 @@ __zeroxml_get_node_from_cache(const cacheId **nc, const char **buf, int *len,
     return rv;
 }
 
+
+/*
+ * Count the nodes of the XML-tree, the node itself included.
+ */
+static size_t
+__zeroxml_cache_count(const struct _xml_node *cache)
+{
+    size_t rv = 1;
+    int i;
+
+    for (i=0; i<cache->no_nodes; i++) {
+        rv += __zeroxml_cache_count(cache->node[i]);
+    }
+    return rv;
+}
+
+cacheRecord*
+cacheSave(const cacheId *nc, const char *base, const char *comment, size_t *num)
+{
+    const struct _xml_node *cache = (const struct _xml_node *)nc;
+    const struct _xml_node **order;
+    cacheRecord *rv = NULL;
+    size_t no_nodes;
+
+    assert(cache != 0);
+    assert(num != 0);
+
+    no_nodes = __zeroxml_cache_count(cache);
+    order = MALLOC(no_nodes*sizeof(struct _xml_node*));
+    if (order) {
+        rv = MALLOC(no_nodes*sizeof(cacheRecord));
+    }
+
+    if (rv)
+    {
+        size_t i, next = 1;
+
+        /* breadth first: the child nodes of a node are stored in sequence */
+        order[0] = cache;
+        for (i=0; i<no_nodes; i++)
+        {
+            const struct _xml_node *node = order[i];
+            cacheRecord *rec = &rv[i];
+            int j;
+
+            assert(node->level == 0 || node->max_nodes == BULK_NODES);
+
+            if (node->name == comment) {
+                rec->name = RECORD_COMMENT;
+            } else {
+                rec->name = node->name ? (int64_t)(node->name - base) : -1;
+            }
+            rec->data = node->data ? (int64_t)(node->data - base) : -1;
+            rec->data_len = (int64_t)node->data_len;
+            rec->node = node->node ? (int64_t)next : -1;
+            rec->name_len = node->name_len;
+            rec->no_nodes = node->no_nodes;
+
+            for (j=0; j<node->no_nodes; j++) {
+                order[next++] = node->node[j];
+            }
+        }
+        assert(next == no_nodes);
+        *num = no_nodes;
+    }
+    FREE(order);
+
+    return rv;
+}
+
+/*
+ * Test whether a record points inside the document and whether its child
+ * nodes start at record number *next, which makes every record the child
+ * node of exactly one record before it. *next is advanced past the child
+ * nodes of the record.
+ */
+static int
+__zeroxml_record_check(const cacheRecord *r, size_t num, size_t *next, off_t len, int comment_len)
+{
+    if ((r->name_len < 0) || (r->no_nodes < 0) || (r->data_len < 0) ||
+        (r->name < RECORD_COMMENT) || (r->data < -1) ||
+        (r->name == RECORD_COMMENT && r->name_len != comment_len) ||
+        (r->name >= 0 && r->name + r->name_len > (int64_t)len) ||
+        (r->data >= 0 && r->data + r->data_len > (int64_t)len) ||
+        (r->data < 0 && r->data_len) || (r->name == -1 && r->name_len))
+    {
+        return 0;
+    }
+
+    if (r->node < 0) {
+        return (r->no_nodes == 0);
+    }
+    if ((size_t)r->node != *next || (size_t)r->no_nodes > num-*next) {
+        return 0;
+    }
+    *next += (size_t)r->no_nodes;
+
+    return 1;
+}
+
+int
+cacheCheck(const cacheRecord *rec, size_t num, off_t len, const char *comment)
+{
+    int comment_len = (int)strlen(comment);
+    size_t i, next = 1;
+
+    assert(rec != 0);
+
+    for (i=0; i<num; i++)
+    {
+        if (!__zeroxml_record_check(&rec[i], num, &next, len, comment_len)) {
+            break;
+        }
+    }
+
+    return (num > 0 && i == num && next == num);
+}
+
+const cacheId*
+cacheLoad(const struct _root_id *rid, const cacheRecord *rec, size_t num, const char *base, off_t len, const char *comment)
+{
+    int comment_len = (int)strlen(comment);
+    struct _xml_node *rv = NULL;
+    struct _xml_node **ptrs;
+    size_t i, next = 1;
+    size_t size;
+
+    assert(rec != 0);
+
+    if (num == 0 || num > ((size_t)-1)/(sizeof(*rv)+sizeof(rv))) {
+        return rv;
+    }
+
+    /* all nodes and the lists of child nodes in a single allocation */
+    size = num*sizeof(struct _xml_node) + num*sizeof(struct _xml_node*);
+    rv = __zeroxml_memory_alloc(rid->memory, size);
+    if (!rv) return rv;
+
+    ptrs = (struct _xml_node **)(rv + num);
+    for (i=0; i<num; i++) {
+        ptrs[i] = &rv[i];
+    }
+
+    rv[0].parent = NULL;
+    for (i=0; i<num; i++)
+    {
+        struct _xml_node *node = &rv[i];
+        const cacheRecord *r = &rec[i];
+        size_t j = next;
+
+        if (!__zeroxml_record_check(r, num, &next, len, comment_len)) {
+            break;
+        }
+
+        node->node = NULL;
+        if (r->node >= 0)
+        {
+            node->node = (const cacheId**)&ptrs[j];
+            for (; j<next; j++) {
+                rv[j].parent = node;
+            }
+        }
+
+        node->max_nodes = BULK_NODES;
+        node->arena = 0;
+        node->no_nodes = r->no_nodes;
+        node->name_len = r->name_len;
+        node->name = RECORD_NAME(r, base, comment);
+        node->data_len = (off_t)r->data_len;
+        node->data = RECORD_DATA(r, base);
+        node->level = NULL;
+    }
+
+    if (i != num || next != num)
+    {
+        __zeroxml_memory_free(rid->memory, rv);
+        rv = NULL;
+    }
+
+    return rv;
+}
+
+const cacheId*
+cacheNodeFind(const cacheId *nc, const char *from, const char *to, const char *comment)
+{
+    const struct _xml_node *cache = (const struct _xml_node *)nc;
+    const struct _xml_node *rv = NULL;
+    int i = 0;
+
+    assert(cache != 0);
+    assert(from <= to);
+
+    /* the data section of an element starts right after its opening tag */
+    while (i < cache->no_nodes)
+    {
+        const struct _xml_node *node = cache->node[i++];
+
+        if (node->name && node->name != comment && node->data &&
+            node->data[-1] == '>' && node->data <= from &&
+            node->data + node->data_len >= to)
+        {
+            rv = node;
+            cache = node;
+            i = 0;
+        }
+    }
+
+    return rv;
+}
+
+struct _zeroxml_copy
+{
+    const struct _root_id *rid;
+    const struct _xml_node *changed;
+    struct _xml_node *copy;
+    struct _xml_node *nodes;
+    struct _xml_node **ptrs;
+    size_t next_node, next_ptr;
+    const char *base;
+    off_t len;
+    const char *rebase;
+    off_t to, delta;
+};
+
+/*
+ * Count the nodes of the XML-tree which are copied, changed and its child
+ * nodes excluded.
+ */
+static size_t
+__zeroxml_copy_count(const struct _zeroxml_copy *c, const struct _xml_node *cache)
+{
+    size_t rv = 0;
+    int i;
+
+    if (cache != c->changed)
+    {
+        rv = 1;
+        for (i=0; i<cache->no_nodes; i++) {
+            rv += __zeroxml_copy_count(c, cache->node[i]);
+        }
+    }
+    return rv;
+}
+
+static const char*
+__zeroxml_copy_ptr(const struct _zeroxml_copy *c, const char *ptr)
+{
+    if (ptr && ptr >= c->base && ptr <= c->base + c->len)
+    {
+        off_t offs = ptr - c->base;
+
+        /* the data of changed may start at to, text is inserted after it */
+        if (offs > c->to) offs += c->delta;
+        ptr = c->rebase + offs;
+    }
+    return ptr;
+}
+
+static struct _xml_node*
+__zeroxml_copy_node(struct _zeroxml_copy *c, const struct _xml_node *cache, const struct _xml_node *parent)
+{
+    struct _xml_node *rv;
+    int copied, i;
+
+    /* changed gets an allocation of its own to cache its child nodes */
+    if (cache == c->changed)
+    {
+        rv = __zeroxml_memory_calloc(c->rid->memory, 1,
+                                     sizeof(struct _xml_node));
+        if (!rv) return rv;
+
+        c->copy = rv;
+    }
+    else
+    {
+        rv = &c->nodes[c->next_node++];
+        rv->node = NULL;
+        if (cache->node)
+        {
+            rv->node = (const cacheId**)&c->ptrs[c->next_ptr];
+            c->next_ptr += cache->no_nodes;
+        }
+        rv->max_nodes = BULK_NODES;
+        rv->arena = 0;
+        rv->no_nodes = cache->no_nodes;
+        rv->level = NULL;
+    }
+
+    rv->parent = parent;
+    rv->name_len = cache->name_len;
+    rv->name = __zeroxml_copy_ptr(c, cache->name);
+    rv->data_len = cache->data_len;
+    rv->data = __zeroxml_copy_ptr(c, cache->data);
+    if (rv == c->copy)
+    {
+        rv->data_len += c->delta;
+        return rv;
+    }
+
+    /* only the data sections of changed and its parent nodes grow */
+    copied = (c->copy != NULL);
+    for (i=0; i<cache->no_nodes; i++)
+    {
+        struct _xml_node *node = __zeroxml_copy_node(c, cache->node[i], rv);
+        if (!node) return node;
+
+        rv->node[i] = node;
+    }
+
+    if (!copied && c->copy && rv->data) {
+        rv->data_len += c->delta;
+    }
+
+    return rv;
+}
+
+const cacheId*
+cacheCopy(const struct _root_id *rid, const cacheId *nc, const cacheId *changed, const char *base, off_t len, const char *rebase, off_t to, off_t delta, const cacheId **copy)
+{
+    struct _zeroxml_copy c;
+    struct _xml_node *rv = NULL;
+    size_t num;
+
+    assert(nc != 0);
+    assert(nc != changed);
+    assert(copy != 0);
+
+    c.rid = rid;
+    c.changed = changed;
+    c.copy = NULL;
+    c.next_node = 0;
+    c.next_ptr = 0;
+    c.base = base;
+    c.len = len;
+    c.rebase = rebase;
+    c.to = to;
+    c.delta = delta;
+
+    /* all nodes and the lists of child nodes in a single allocation */
+    num = __zeroxml_copy_count(&c, nc);
+    if (num < ((size_t)-1)/(sizeof(*rv)+sizeof(rv)) - 1) {
+        rv = __zeroxml_memory_alloc(rid->memory,
+                                    num*sizeof(struct _xml_node) +
+                                    (num+1)*sizeof(struct _xml_node*));
+    }
+
+    if (rv)
+    {
+        c.nodes = rv;
+        c.ptrs = (struct _xml_node **)(rv + num);
+        if (__zeroxml_copy_node(&c, nc, NULL))
+        {
+            /* the root node also holds the allocation of changed */
+            rv->level = c.copy;
+        }
+        else
+        {
+            __zeroxml_memory_free(rid->memory, c.copy);
+            __zeroxml_memory_free(rid->memory, rv);
+            rv = NULL;
+        }
+    }
+    *copy = rv ? c.copy : NULL;
+
+    return rv;
+}
+
+/*
+ * Walk the records of a shared document, see __zeroxml_get_node_from_cache.
+ *
+ * The Cache-ids of a shared document point to its records, which are only
+ * valid after cacheCheck approved them.
+ */
+const char*
+__zeroxml_get_node_from_records(const cacheRecord *rec, const char *base, const char *comment, const cacheId **nc, const char **buf, off_t *len, const char **element, int *elementlen, int *nodenum)
+{
+    const cacheRecord *cache, *node;
+    const char *name = *element;
+    const char *rv = NULL;
+    int found = 0;
+    int num;
+
+    assert(rec != 0);
+    assert(buf != 0);
+    assert(*buf != 0);
+    assert(len != 0);
+    assert(element != 0);
+    assert(elementlen != 0);
+    assert(nodenum != 0);
+
+    cache = (const cacheRecord*)*nc;
+    assert(cache != 0);
+
+    num = *nodenum;
+    if (cache->no_nodes == 0) /* leaf node */
+    {
+        rv = *buf = RECORD_DATA(cache, base);
+        *len = (off_t)cache->data_len;
+        *element = RECORD_NAME(cache, base, comment);
+        *elementlen = cache->name_len;
+    }
+    else if (num < cache->no_nodes)
+    {
+        if (*name == '*') /* everything goes */
+        {
+            node = &rec[cache->node + ((num > 0) ? num : 0)];
+            *nc = (const cacheId*)node;
+            rv = *buf = RECORD_DATA(node, base);
+            *len = (off_t)node->data_len;
+            *element = RECORD_NAME(node, base, comment);
+            *elementlen = node->name_len;
+            found = cache->no_nodes;
+        }
+        else
+        {
+            int namelen = *elementlen;
+            int i;
+
+            for (i=0; i<cache->no_nodes; i++)
+            {
+                 const char *nname;
+
+                 node = &rec[cache->node + i];
+                 nname = RECORD_NAME(node, base, comment);
+                 if ((node->name_len == namelen) && nname &&
+                     (!strncasecmp(nname, name, namelen)))
+                 {
+                      if (found == num || num == -1)
+                      {
+                           *nc = (const cacheId*)node;
+                           rv = *buf = RECORD_DATA(node, base);
+                           *len = (off_t)node->data_len;
+                           *element = nname;
+                           *elementlen = node->name_len;
+                           if (num != -1) {
+                               break;
+                           }
+                      }
+                      found++;
+                 }
+            }
+        }
+    }
+
+    if (!rv)
+    {
+       *element = *buf;
+       *elementlen = XML_NO_ERROR;
+       *len = XML_NODE_NOT_FOUND;
+       return rv;
+    }
+    *nodenum = found;
+
+    return rv;
+}
@@ -63,13 +63,38 @@
 extern "C" {
 #endif
 
+#include <sys/types.h>
+#include <stdint.h>
+
 #include <xml.h> 
 
 typedef struct _xml_node cacheId;
 
+/*
+ * Position independent representation of a node of the XML-tree.
+ *
+ * Names and data sections are stored as offsets from the start of the
+ * document and child nodes as the record number of the first child node,
+ * the child nodes of a node are stored in sequence. An offset of -1 is used
+ * for a NULL pointer and a name offset of -2 for the name of comment nodes.
+ */
+typedef struct
+{
+    int64_t name;	/* offset of the name of the XML node */
+    int64_t data;	/* offset of the data section of the XML node */
+    int64_t data_len;	/* length of the data section of the XML node */
+    int64_t node;	/* record number of the first child node */
+    int32_t name_len;	/* length of the name of the XML node */
+    int32_t no_nodes;	/* number of child nodes */
+} cacheRecord;
+
 /**
  * Initialize a new cacheId structure.
  *
+ * The nodes of a document opened with XML_ARENA are allocated from the arena
+ * of the document.
+ *
+ * @param rid the root XML-id of the document
  * @return cacheId which is used for further processing
  */
 const cacheId *cacheInit(const struct _root_id*);
@@ -79,26 +104,31 @@ const cacheId *cacheInit(const struct _root_id*);
  *
  * This is required to be able to assign new XML sub-nodes.
  *
+ * @param rid the root XML-id of the document
  * @param cid Cache-id
+ * @return false if there is not enough memory, true otherwise
  */
-void cacheInitLevel(const cacheId *cid);
+int cacheInitLevel(const struct _root_id *rid, const cacheId *cid);
 
 /**
  * Free a Cache-id.
  *
  * All allocations of the XML-tree will be freed.
  *
+ * @param rid the root XML-id of the document
  * @param xid Cache-id to be freed.
  */
-void cacheFree(const cacheId *cid);
+void cacheFree(const struct _root_id *rid, const cacheId *cid);
 
 /**
  * Allocate a new XML-node in the XML-tree.
  *
+ * @param rid the root XML-id of the document
  * @param cid Cache-id
- * @return a pointer to the the newly created Cache-id
+ * @return a pointer to the the newly created Cache-id or NULL if there is not
+ *         enough memory
  */
-const cacheId *cacheNodeNew(const cacheId *cid);
+const cacheId *cacheNodeNew(const struct _root_id *rid, const cacheId *cid);
 
 /**
  * Return the Cache-id which is associated with the XML-id.
@@ -117,20 +147,57 @@ const cacheId *cacheNodeGet(const xmlId *xid);
  * @param data a pointer to the node data section
  * @param datalen the length of the node data section
  */
-void cacheDataSet(const cacheId *cid, const char *name, int namelen, const char *data, int datalen);
+void cacheDataSet(const cacheId *cid, const char *name, int namelen, const char *data, off_t datalen);
 
 /**
  * Allocate a new XML-node in the XML-tree and set all data for the Cache-id.
  *
  * This function combined cacheNodeNew and cacheDataSet.
  *
+ * @param rid the root XML-id of the document
  * @param cid Cache-id
  * @param name a pointer to the name-string
  * @param namelen the length of the name-string
  * @param data a pointer to the node data section
  * @param datalen the length of the node data section
  */
-void cacheNodeAdd(const cacheId *cid, const char *name, int namelen, const char *data, int datalen);
+void cacheNodeAdd(const struct _root_id *rid, const cacheId *cid, const char *name, int namelen, const char *data, off_t datalen);
+
+/**
+ * Get the data of a Cache-id.
+ *
+ * @param cid Cache-id
+ * @param name set to a pointer to the name-string
+ * @param namelen set to the length of the name-string
+ * @param data set to a pointer to the node data section
+ * @param datalen set to the length of the node data section
+ */
+void cacheDataGet(const cacheId *cid, const char **name, int *namelen, const char **data, off_t *datalen);
+
+/**
+ * Get the Cache-id which holds the child nodes of a Cache-id.
+ *
+ * For a node of which the child nodes are cached this is the Cache-id itself.
+ * For a node of which the child nodes are not cached yet this is the Cache-id
+ * which was published using cacheLevelSet, or NULL if there is none.
+ *
+ * @param cid Cache-id
+ * @return the Cache-id holding the child nodes or NULL
+ */
+const cacheId *cacheLevelGet(const cacheId *cid);
+
+/**
+ * Publish the Cache-id which holds the child nodes of a Cache-id.
+ *
+ * The child nodes are published atomically. If another thread published
+ * them first level will be freed and the published Cache-id is returned.
+ *
+ * @param rid the root XML-id of the document
+ * @param cid Cache-id
+ * @param level the Cache-id holding the child nodes of cid
+ * @return the Cache-id holding the child nodes
+ */
+const cacheId *cacheLevelSet(const struct _root_id *rid, const cacheId *cid, const cacheId *level);
 
 /**
  * Get the data from a cached node.
@@ -150,7 +217,104 @@ void cacheNodeAdd(const cacheId *cid, const char *name, int namelen, const char
  * @param nodenum which occurence of the node name to look for
  * @return a pointer right after the section or NULL in case of an error
  */
-const char* __zeroxml_get_node_from_cache(const cacheId **cid, const char **start, int *len, const char **name, int *rlen , int *nodenum);
+const char* __zeroxml_get_node_from_cache(const cacheId **cid, const char **start, off_t *len, const char **name, int *rlen , int *nodenum);
+
+/**
+ * Store the XML-tree as an array of position independent records.
+ *
+ * The first record holds the Cache-id itself.
+ *
+ * @param cid Cache-id
+ * @param base the start of the document
+ * @param comment the name of comment nodes
+ * @param num set to the number of records
+ * @return an allocated array of records or NULL in case of an error
+ */
+cacheRecord *cacheSave(const cacheId *cid, const char *base, const char *comment, size_t *num);
+
+/**
+ * Create a new XML-tree from an array of records created by cacheSave.
+ *
+ * The records are validated: every name and data section has to be inside
+ * the document and every node has to be the child node of exactly one node.
+ * The whole tree is allocated at once and can not be extended.
+ *
+ * @param rid the root XML-id of the document
+ * @param rec the array of records
+ * @param num the number of records
+ * @param base the start of the document
+ * @param len the length of the document
+ * @param comment the name of comment nodes
+ * @return the Cache-id of the first record or NULL if the records are invalid
+ */
+const cacheId *cacheLoad(const struct _root_id *rid, const cacheRecord *rec, size_t num, const char *base, off_t len, const char *comment);
+
+/**
+ * Validate an array of records created by cacheSave without creating a new
+ * XML-tree, for records which are used in place.
+ *
+ * @param rec the array of records
+ * @param num the number of records
+ * @param len the length of the document
+ * @param comment the name of comment nodes
+ * @return true if the records are valid, false otherwise
+ */
+int cacheCheck(const cacheRecord *rec, size_t num, off_t len, const char *comment);
+
+/**
+ * Find the deepest element node of which the data section holds the range
+ * from up to to. Comment nodes and elements without a data section of their
+ * own, such as <node/>, are never returned.
+ *
+ * @param cid Cache-id
+ * @param from the start of the range
+ * @param to the end of the range
+ * @param comment the name of comment nodes
+ * @return the Cache-id of the node or NULL if no element holds the range
+ */
+const cacheId *cacheNodeFind(const cacheId *cid, const char *from, const char *to, const char *comment);
+
+/**
+ * Copy the XML-tree of a document to a new version of the document which
+ * only differs from it in a range of which the length changed by delta
+ * bytes. Names and data sections after the range are moved by delta bytes
+ * and the data sections of changed and its parent nodes grow by delta bytes.
+ * Pointers outside of the document, such as the name of comment nodes, are
+ * copied as they are.
+ *
+ * The whole tree is allocated at once and can not be extended, except for
+ * the node changed. It holds the range and is copied without its child
+ * nodes, which the caller caches again using the copy returned in *copy.
+ *
+ * @param rid the root XML-id of the new version of the document
+ * @param cid Cache-id
+ * @param changed the node which holds the range or NULL if there is none
+ * @param base the start of the document
+ * @param len the length of the document
+ * @param rebase the start of the new version of the document
+ * @param to the offset of the end of the range
+ * @param delta the change of the length of the document
+ * @param copy set to the copy of changed
+ * @return the Cache-id of the new XML-tree or NULL in case of an error
+ */
+const cacheId *cacheCopy(const struct _root_id *rid, const cacheId *cid, const cacheId *changed, const char *base, off_t len, const char *rebase, off_t to, off_t delta, const cacheId **copy);
+
+/**
+ * Get the data from a node of an array of records which is used in place,
+ * see __zeroxml_get_node_from_cache.
+ *
+ * @param rec the array of records, validated by cacheCheck
+ * @param base the start of the document
+ * @param comment the name of comment nodes
+ * @param cid the record of the parent node cast to a Cache-id
+ * @param start starting pointer for this section
+ * @param len length to the end of the buffer
+ * @param *name name of the node to look for
+ * @param rlen length of the name of the node to look for
+ * @param nodenum which occurence of the node name to look for
+ * @return a pointer right after the section or NULL in case of an error
+ */
+const char* __zeroxml_get_node_from_records(const cacheRecord *rec, const char *base, const char *comment, const cacheId **cid, const char **start, off_t *len, const char **name, int *rlen , int *nodenum);
 
 #ifdef __cplusplus
 }
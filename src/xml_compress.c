@@ -0,0 +1,460 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Transparent decompression of gzip and zstd compressed documents.
+ *
+ * The document is decompressed into an anonymous mapping which is resized
+ * to the decompressed size, so the memory is returned to the system when
+ * the document is closed. The buffer counts against the memory limit of the
+ * document, it is charged before every time it grows.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE	/* mremap */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifndef WIN32
+# include <sys/mman.h>
+#endif
+#if HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+#if HAVE_ZSTD_H
+# include <zstd.h>
+#endif
+
+#include "xml.h"
+#include "api.h"
+
+#if HAVE_ZLIB_H || HAVE_ZSTD_H
+/*
+ * Allocate, resize and free the buffer for the decompressed document.
+ * An anonymous mapping is used where available, malloc otherwise.
+ * errno is set to ENOMEM when the memory limit would be exceeded.
+ */
+static char*
+__zeroxml_buffer_alloc(struct _zeroxml_memory *mem, size_t size)
+{
+    char *rv;
+
+    if (!__zeroxml_memory_charge(mem, size))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+#ifndef WIN32
+    rv = mmap(NULL, size, PROT_READ|PROT_WRITE,
+              MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (rv == MAP_FAILED) rv = NULL;
+#else
+    rv = MALLOC(size);
+#endif
+    if (!rv) __zeroxml_memory_uncharge(mem, size);
+
+    return rv;
+}
+
+static char*
+__zeroxml_buffer_resize(struct _zeroxml_memory *mem, char *buf, size_t size, size_t new_size)
+{
+    char *rv;
+
+    if (new_size > size && !__zeroxml_memory_charge(mem, new_size - size))
+    {
+        __zeroxml_buffer_free(mem, buf, size);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+#ifndef WIN32
+# ifdef MREMAP_MAYMOVE
+    rv = mremap(buf, size, new_size, MREMAP_MAYMOVE);
+    if (rv == MAP_FAILED) rv = NULL;
+# else
+    rv = mmap(NULL, new_size, PROT_READ|PROT_WRITE,
+              MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (rv == MAP_FAILED) rv = NULL;
+    if (rv) memcpy(rv, buf, (size < new_size) ? size : new_size);
+# endif
+    if (!rv) munmap(buf, size);
+# ifndef MREMAP_MAYMOVE
+    else munmap(buf, size);
+# endif
+#else
+    rv = REALLOC(buf, new_size);
+    if (!rv) FREE(buf);
+#endif
+
+    if (!rv) {
+        __zeroxml_memory_uncharge(mem, (new_size > size) ? new_size : size);
+    } else if (new_size < size) {
+        __zeroxml_memory_uncharge(mem, size - new_size);
+    }
+
+    return rv;
+}
+
+/*
+ * Shrink the buffer to the decompressed size and make it read-only.
+ */
+static char*
+__zeroxml_buffer_finish(struct _zeroxml_memory *mem, char *buf, size_t size, size_t len, size_t *buflen)
+{
+#ifndef WIN32
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t new_size = (len + page_size-1)/page_size*page_size;
+
+    /* size is page aligned, mprotect may not pass the end of the buffer */
+    assert(new_size <= size);
+    if (new_size < size)
+    {
+        munmap(buf+new_size, size-new_size);
+        __zeroxml_memory_uncharge(mem, size-new_size);
+    }
+    mprotect(buf, new_size, PROT_READ);
+    *buflen = new_size;
+    return buf;
+#else
+    *buflen = len;
+    return __zeroxml_buffer_resize(mem, buf, size, len);
+#endif
+}
+
+/*
+ * Start with the expected size, or four times the compressed size.
+ * The size is a multiple of the page size so the memory which is charged
+ * equals the memory which is mapped, and unmapped by __zeroxml_buffer_free.
+ */
+static size_t
+__zeroxml_buffer_size(size_t expected, size_t len)
+{
+#ifndef WIN32
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+
+    if (expected < len) expected = 4*len;
+    if (!expected) expected = 4096;
+#ifndef WIN32
+    expected = (expected + page_size-1)/page_size*page_size;
+#endif
+    return expected;
+}
+#endif
+
+#if HAVE_ZLIB_H
+static char*
+__zeroxml_gunzip(struct _zeroxml_memory *mem, const char *buf, size_t len, size_t *rlen, size_t *buflen)
+{
+    const unsigned char *isize = (const unsigned char*)buf + len - 4;
+    size_t size, pos = 0, in = 0;
+    z_stream zs;
+    char *rv;
+    int res;
+
+    /* the trailer holds the size modulo 4GB of the last member */
+    size = (size_t)isize[0] | (size_t)isize[1] << 8 |
+           (size_t)isize[2] << 16 | (size_t)isize[3] << 24;
+    size = __zeroxml_buffer_size(size, len);
+
+    rv = __zeroxml_buffer_alloc(mem, size);
+    if (!rv) return NULL;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15+32) != Z_OK) /* gzip or zlib header */
+    {
+        __zeroxml_buffer_free(mem, rv, size);
+        return NULL;
+    }
+
+    do
+    {
+        if (pos == size)
+        {
+            rv = __zeroxml_buffer_resize(mem, rv, size, 2*size);
+            if (!rv) break;
+            size *= 2;
+        }
+
+        /* avail_in and avail_out are limited to 32-bit */
+        zs.next_in = (Bytef*)buf + in;
+        zs.avail_in = (uInt)((len-in < UINT_MAX) ? len-in : UINT_MAX);
+        zs.next_out = (Bytef*)rv + pos;
+        zs.avail_out = (uInt)((size-pos < UINT_MAX) ? size-pos : UINT_MAX);
+
+        res = inflate(&zs, Z_NO_FLUSH);
+        in = (size_t)((const char*)zs.next_in - buf);
+        pos = (size_t)((char*)zs.next_out - rv);
+
+        /* concatenated gzip members */
+        if (res == Z_STREAM_END && in < len) {
+            res = (inflateReset(&zs) == Z_OK) ? Z_OK : Z_DATA_ERROR;
+        }
+        else if (res == Z_BUF_ERROR && pos < size) {
+            res = Z_DATA_ERROR; /* truncated */
+        }
+    }
+    while (res == Z_OK || res == Z_BUF_ERROR);
+    inflateEnd(&zs);
+
+    if (rv && (res != Z_STREAM_END || !pos))
+    {
+        __zeroxml_buffer_free(mem, rv, size);
+        rv = NULL;
+    }
+
+    if (rv)
+    {
+        *rlen = pos;
+        rv = __zeroxml_buffer_finish(mem, rv, size, pos, buflen);
+    }
+
+    return rv;
+}
+#endif
+
+#if HAVE_ZSTD_H
+/*
+ * Add up the decompressed sizes in the frame headers with the stable API,
+ * ZSTD_findDecompressedSize is only declared for static linking.
+ */
+static unsigned long long
+__zeroxml_zstd_size(const char *buf, size_t len)
+{
+    unsigned long long rv = 0;
+
+    while (len > 0)
+    {
+        unsigned long long size = ZSTD_getFrameContentSize(buf, len);
+        size_t frame;
+
+        if (size == ZSTD_CONTENTSIZE_ERROR ||
+            size == ZSTD_CONTENTSIZE_UNKNOWN) {
+            return size;
+        }
+
+        frame = ZSTD_findFrameCompressedSize(buf, len);
+        if (ZSTD_isError(frame) || rv + size < rv) {
+            return ZSTD_CONTENTSIZE_ERROR;
+        }
+
+        rv += size;
+        buf += frame;
+        len -= frame;
+    }
+
+    return rv;
+}
+
+static char*
+__zeroxml_unzstd(struct _zeroxml_memory *mem, const char *buf, size_t len, size_t *rlen, size_t *buflen)
+{
+    unsigned long long expected;
+    ZSTD_inBuffer input;
+    ZSTD_outBuffer output;
+    ZSTD_DCtx *dctx;
+    size_t size, res = 0;
+    char *rv;
+
+    /* the frame headers usually hold the decompressed size */
+    expected = __zeroxml_zstd_size(buf, len);
+    if (expected == ZSTD_CONTENTSIZE_ERROR) return NULL;
+    if (expected == ZSTD_CONTENTSIZE_UNKNOWN || expected > SIZE_MAX) {
+        expected = 0;
+    }
+    size = __zeroxml_buffer_size((size_t)expected, len);
+
+    rv = __zeroxml_buffer_alloc(mem, size);
+    if (!rv) return NULL;
+
+    dctx = ZSTD_createDCtx();
+    if (!dctx)
+    {
+        __zeroxml_buffer_free(mem, rv, size);
+        return NULL;
+    }
+
+    input.src = buf;
+    input.size = len;
+    input.pos = 0;
+    output.dst = rv;
+    output.size = size;
+    output.pos = 0;
+    do
+    {
+        if (output.pos == output.size)
+        {
+            rv = __zeroxml_buffer_resize(mem, rv, size, 2*size);
+            if (!rv) break;
+            size *= 2;
+            output.dst = rv;
+            output.size = size;
+        }
+
+        res = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(res)) break;
+    }
+    /* a full output buffer may still hold data to flush */
+    while (input.pos < input.size || (res != 0 && output.pos == output.size));
+    ZSTD_freeDCtx(dctx);
+
+    /* res is zero when the last frame is complete */
+    if (rv && (res != 0 || !output.pos))
+    {
+        __zeroxml_buffer_free(mem, rv, size);
+        rv = NULL;
+    }
+
+    if (rv)
+    {
+        *rlen = output.pos;
+        rv = __zeroxml_buffer_finish(mem, rv, size, output.pos, buflen);
+    }
+
+    return rv;
+}
+#endif
+
+/*
+ * Detect whether a document is compressed by its magic bytes.
+ *
+ * Only the formats which are supported by this build are detected, any
+ * other document is processed as is.
+ *
+ * @param buf the contents of the file
+ * @param len the size of the file
+ * @return XML_TRUE if the document can be decompressed, XML_FALSE otherwise
+ */
+int
+__zeroxml_compressed(const char *buf, size_t len)
+{
+    const unsigned char *magic = (const unsigned char*)buf;
+    int rv = XML_FALSE;
+
+    (void)magic;
+#if HAVE_ZLIB_H
+    if (len > 18 && magic[0] == 0x1f && magic[1] == 0x8b) rv = XML_TRUE;
+#endif
+#if HAVE_ZSTD_H
+    if (len > 4 && magic[0] == 0x28 && magic[1] == 0xb5 &&
+                   magic[2] == 0x2f && magic[3] == 0xfd) rv = XML_TRUE;
+#endif
+
+    return rv;
+}
+
+/*
+ * Decompress a compressed document.
+ *
+ * The returned buffer has to be freed using __zeroxml_buffer_free. When the
+ * memory runs out or the memory limit would be exceeded NULL is returned
+ * with errno set to ENOMEM.
+ *
+ * @param mem the memory of the document the buffer is charged to, may be NULL
+ * @param buf the compressed document
+ * @param len the size of the compressed document
+ * @param rlen set to the size of the decompressed document
+ * @param buflen set to the size of the returned buffer
+ * @return the decompressed document or NULL in case of an error
+ */
+char*
+__zeroxml_decompress(struct _zeroxml_memory *mem, const char *buf, size_t len, size_t *rlen, size_t *buflen)
+{
+    const unsigned char *magic = (const unsigned char*)buf;
+    char *rv = NULL;
+
+    (void)magic;
+    (void)mem;
+    errno = 0;
+#if HAVE_ZLIB_H
+    if (magic[0] == 0x1f) {
+        rv = __zeroxml_gunzip(mem, buf, len, rlen, buflen);
+    }
+#endif
+#if HAVE_ZSTD_H
+    if (magic[0] == 0x28) {
+        rv = __zeroxml_unzstd(mem, buf, len, rlen, buflen);
+    }
+#endif
+
+    return rv;
+}
+
+void
+__zeroxml_buffer_free(struct _zeroxml_memory *mem, char *buf, size_t buflen)
+{
+#ifndef WIN32
+    munmap(buf, buflen);
+#else
+    FREE(buf);
+#endif
+    __zeroxml_memory_uncharge(mem, buflen);
+}
@@ -0,0 +1,553 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Persistent sidecar file of the node cache for XML_INDEX_FILE and
+ * compiled documents.
+ *
+ * The sidecar holds the node cache as position independent records (see
+ * cacheSave) after a header which ties it to the document: the size and the
+ * modification time of the file and a hash of the contents. The records
+ * are protected by a hash as well. A sidecar which does not match the
+ * document is ignored and replaced by a new one after the node cache is
+ * built again.
+ *
+ * A compiled document uses the same header and records, followed by the
+ * document itself. Since the records and the document can not get out of
+ * sync the document is not hashed.
+ *
+ * A published document is a compiled document in a named shared memory
+ * object. Processes which attach to it use the records in place instead of
+ * creating a node cache from them, so all of them share the same pages.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifndef WIN32
+# include <sys/mman.h>
+#endif
+
+#include "xml.h"
+#include "api.h"
+
+#define INDEX_MAGIC		"ZXMLIDX"
+#define COMPILED_MAGIC		"ZXMLBIN"
+#define INDEX_VERSION		1
+#define INDEX_BYTE_ORDER	0x01020304
+#define INDEX_SUFFIX		".idx"
+
+/* the flags which change the node cache for the same document */
+#define INDEX_FLAGS		(__XML_COMMENT_AS_NODE | __XML_VALIDATING)
+
+struct _zeroxml_index_header
+{
+    char magic[8];
+    int32_t version;
+    uint32_t byte_order;	/* detects a sidecar of another architecture */
+    int32_t record_size;
+    int32_t flags;		/* INDEX_FLAGS of the document */
+    int32_t limits[5];		/* resource limits of the document */
+    int32_t reserved;
+    int64_t file_size;		/* size of the document file, sidecar only */
+    int64_t mtime;		/* modification time of the file, sidecar only */
+    int64_t doc_len;		/* length of the (decompressed) document */
+    uint64_t hash;		/* hash of the document, sidecar only */
+    int64_t no_nodes;		/* number of records after the header */
+    uint64_t check;		/* hash of the records */
+};
+
+/*
+ * Hash the document eight bytes at a time. This is not a cryptographic hash,
+ * it only has to detect a document which was changed without changing the
+ * size or the modification time of the file.
+ */
+static uint64_t
+__zeroxml_index_hash(const char *buf, off_t len)
+{
+    const uint64_t k = 0x9e3779b97f4a7c15ULL;
+    uint64_t rv = k ^ (uint64_t)len;
+    uint64_t w;
+
+    while (len >= 8)
+    {
+        memcpy(&w, buf, 8);
+        rv = (rv ^ w) * k;
+        rv ^= rv >> 32;
+        buf += 8;
+        len -= 8;
+    }
+
+    w = 0;
+    memcpy(&w, buf, (size_t)len);
+    rv = (rv ^ w) * k;
+    rv ^= rv >> 29;
+
+    return rv;
+}
+
+static void
+__zeroxml_index_header(const struct _root_id *rid, const struct _zeroxml_index *index, struct _zeroxml_index_header *hdr, off_t len)
+{
+    memset(hdr, 0, sizeof(struct _zeroxml_index_header));
+    if (index->compiled) {
+        memcpy(hdr->magic, COMPILED_MAGIC, sizeof(hdr->magic));
+    }
+    else
+    {
+        memcpy(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic));
+        hdr->file_size = (int64_t)index->size;
+        hdr->mtime = (int64_t)index->mtime;
+        hdr->hash = index->hash;
+    }
+    hdr->version = INDEX_VERSION;
+    hdr->byte_order = INDEX_BYTE_ORDER;
+    hdr->record_size = (int32_t)sizeof(cacheRecord);
+    hdr->flags = (int32_t)(rid->flags & INDEX_FLAGS);
+    hdr->limits[0] = rid->limits.max_depth;
+    hdr->limits[1] = rid->limits.max_name_len;
+    hdr->limits[2] = rid->limits.max_attributes;
+    hdr->limits[3] = rid->limits.max_nodes;
+    hdr->limits[4] = rid->limits.max_steps;
+    hdr->doc_len = (int64_t)len;
+}
+
+int
+__zeroxml_index_init(struct _zeroxml_index *index, const char *filename, const char *fname, off_t size, time_t mtime)
+{
+    memset(index, 0, sizeof(struct _zeroxml_index));
+    if (fname) {
+        index->fname = STRDUP(fname);
+    }
+    else if ((index->fname = MALLOC(strlen(filename)+sizeof(INDEX_SUFFIX))) != NULL)
+    {
+        strcpy(index->fname, filename);
+        strcat(index->fname, INDEX_SUFFIX);
+    }
+    index->size = size;
+    index->mtime = mtime;
+
+    return (index->fname != NULL);
+}
+
+void
+__zeroxml_index_done(struct _zeroxml_index *index)
+{
+    FREE(index->fname);
+    index->fname = NULL;
+}
+
+const char*
+__zeroxml_compiled(struct _zeroxml_index *index, const char *buf, off_t size, off_t *len)
+{
+    struct _zeroxml_index_header hdr;
+    const char *rv = NULL;
+
+    if (size > (off_t)sizeof(hdr) && !memcmp(buf, COMPILED_MAGIC, 8))
+    {
+        off_t offs;
+
+        memcpy(&hdr, buf, sizeof(hdr));
+
+        /* the header is not trusted, compare without overflowing off_t */
+        if (hdr.no_nodes > 0 && hdr.doc_len > 0 &&
+            hdr.no_nodes < (int64_t)(size/(off_t)sizeof(cacheRecord)) &&
+            (offs = (off_t)sizeof(hdr) +
+                    (off_t)hdr.no_nodes*(off_t)sizeof(cacheRecord)) <= size &&
+            hdr.doc_len <= (int64_t)(size - offs) &&
+            offs + (off_t)hdr.doc_len == size)
+        {
+            memset(index, 0, sizeof(struct _zeroxml_index));
+            index->compiled = buf;
+            *len = (off_t)hdr.doc_len;
+            rv = buf + offs;
+        }
+    }
+
+    return rv;
+}
+
+/*
+ * Validate the header and the records of a sidecar or a compiled document
+ * and create the node cache from them. The records of a shared document are
+ * returned as the node cache instead.
+ */
+static const cacheId*
+__zeroxml_index_records(const struct _root_id *rid, struct _zeroxml_index *index, const char *mm, size_t size, const char *buf, off_t len, const char *comment)
+{
+    struct _zeroxml_index_header hdr, expected;
+    const cacheRecord *rec;
+    const cacheId *rv = NULL;
+    size_t num, rsize;
+
+    if (size < sizeof(hdr)) return rv;
+
+    /* the cheap tests first, the document is hashed last */
+    memcpy(&hdr, mm, sizeof(hdr));
+    __zeroxml_index_header(rid, index, &expected, len);
+    expected.hash = hdr.hash;
+    expected.no_nodes = hdr.no_nodes;
+    expected.check = hdr.check;
+    if (memcmp(&hdr, &expected, sizeof(hdr)) || hdr.no_nodes <= 0) {
+        return rv;
+    }
+
+    num = (size_t)hdr.no_nodes;
+    if (num > (size - sizeof(hdr))/sizeof(cacheRecord)) return rv;
+
+    rsize = num*sizeof(cacheRecord);
+    if (index->compiled) {
+        if (size != sizeof(hdr) + rsize + (size_t)len) return rv;
+    } else if (size != sizeof(hdr) + rsize) {
+        return rv;
+    }
+
+    rec = (const cacheRecord*)(mm + sizeof(hdr));
+    if (index->shared)
+    {
+        /* the records are used in place, only test them for validity */
+        if (cacheCheck(rec, num, len, comment)) {
+            rv = (const cacheId*)rec;
+        }
+        return rv;
+    }
+
+    if (hdr.check != __zeroxml_index_hash((const char*)rec, (off_t)rsize)) {
+        return rv;
+    }
+
+    if (!index->compiled)
+    {
+        index->hash = __zeroxml_index_hash(buf, len);
+        index->hashed = 1;
+        if (hdr.hash != index->hash) return rv;
+    }
+
+    return cacheLoad(rid, rec, num, buf, len, comment);
+}
+
+const cacheId*
+__zeroxml_index_load(const struct _root_id *rid, struct _zeroxml_index *index, const char *buf, off_t len, const char *comment)
+{
+    const cacheId *rv = NULL;
+    struct stat statbuf;
+    int fd;
+
+    if (index->compiled)
+    {
+        size_t size = (size_t)(buf + len - index->compiled);
+        return __zeroxml_index_records(rid, index, index->compiled, size,
+                                       buf, len, comment);
+    }
+
+    fd = open(index->fname, O_RDONLY);
+    if (fd < 0) return rv;
+
+    if (fstat(fd, &statbuf) == 0 &&
+        statbuf.st_size >= (off_t)sizeof(struct _zeroxml_index_header))
+    {
+#ifdef WIN32
+        SIMPLE_UNMMAP un;
+#endif
+        size_t size = (size_t)statbuf.st_size;
+        char *mm = simple_mmap(fd, size, &un);
+
+        if (mm != (void *)MMAP_ERROR)
+        {
+            rv = __zeroxml_index_records(rid, index, mm, size, buf, len,
+                                         comment);
+            simple_unmmap(mm, size, &un);
+        }
+    }
+    close(fd);
+
+    return rv;
+}
+
+/*
+ * Write the header, the records and the document, if there is one, to a
+ * temporary file and rename it, so other processes never see a partially
+ * written file.
+ */
+static int
+__zeroxml_index_write(const char *fname, const struct _zeroxml_index_header *hdr, const cacheRecord *rec, const char *doc)
+{
+    size_t tlen = strlen(fname)+8;
+    char *tmp = MALLOC(tlen);
+    int rv = XML_FALSE;
+    int fd = -1;
+
+    if (!tmp) return rv;
+
+#ifndef WIN32
+    snprintf(tmp, tlen, "%s.XXXXXX", fname);
+    fd = mkstemp(tmp);
+#else
+    snprintf(tmp, tlen, "%s.tmp", fname);
+    fd = open(tmp, O_CREAT|O_TRUNC|O_WRONLY|O_BINARY, 0644);
+#endif
+    if (fd >= 0)
+    {
+        const char *part[3];
+        size_t len[3];
+        int i;
+
+        part[0] = (const char*)hdr;
+        len[0] = sizeof(*hdr);
+        part[1] = (const char*)rec;
+        len[1] = (size_t)hdr->no_nodes*sizeof(cacheRecord);
+        part[2] = doc;
+        len[2] = doc ? (size_t)hdr->doc_len : 0;
+
+        rv = XML_TRUE;
+        for (i=0; i<3 && rv; i++)
+        {
+            const char *p = part[i];
+            size_t l = len[i];
+
+            while (rv && l)
+            {
+                ssize_t res = write(fd, p, l);
+                if (res <= 0) {
+                    rv = XML_FALSE;
+                }
+                else
+                {
+                    p += res;
+                    l -= (size_t)res;
+                }
+            }
+        }
+#ifndef WIN32
+        if (rv) fchmod(fd, 0644);
+#endif
+        if (close(fd) != 0) rv = XML_FALSE;
+
+#ifdef WIN32
+        if (rv) remove(fname);
+#endif
+        if (!rv || rename(tmp, fname) != 0)
+        {
+            remove(tmp);
+            rv = XML_FALSE;
+        }
+    }
+    FREE(tmp);
+
+    return rv;
+}
+
+void
+__zeroxml_index_save(const struct _root_id *rid, struct _zeroxml_index *index, const char *buf, off_t len, const char *comment)
+{
+    struct _zeroxml_index_header hdr;
+    cacheRecord *rec;
+    size_t num;
+
+    /* a compiled document is never rewritten */
+    if (!index->fname) return;
+
+    rec = cacheSave(rid->node, buf, comment, &num);
+    if (rec)
+    {
+        if (!index->hashed)
+        {
+            index->hash = __zeroxml_index_hash(buf, len);
+            index->hashed = 1;
+        }
+        __zeroxml_index_header(rid, index, &hdr, len);
+        hdr.no_nodes = (int64_t)num;
+        hdr.check = __zeroxml_index_hash((const char*)rec,
+                                         (off_t)(num*sizeof(cacheRecord)));
+
+        __zeroxml_index_write(index->fname, &hdr, rec, NULL);
+        FREE(rec);
+    }
+}
+
+/*
+ * Get the records of the node cache of a document. The records of a shared
+ * document are returned as they are and must not be freed.
+ */
+static cacheRecord*
+__zeroxml_index_get_records(const struct _root_id *rid, const char *comment, size_t *num)
+{
+    if (SHARED_NODES(rid))
+    {
+        struct _zeroxml_index_header hdr;
+
+        /* the header of a shared document is at the start of the mapping */
+        memcpy(&hdr, rid->mmap, sizeof(hdr));
+        *num = (size_t)hdr.no_nodes;
+        return (cacheRecord*)rid->node;
+    }
+    return cacheSave(rid->node, rid->doc, comment, num);
+}
+
+static void
+__zeroxml_index_compiled_header(const struct _root_id *rid, struct _zeroxml_index_header *hdr, const cacheRecord *rec, size_t num)
+{
+    struct _zeroxml_index index;
+
+    memset(&index, 0, sizeof(index));
+    index.compiled = rid->doc;
+
+    __zeroxml_index_header(rid, &index, hdr, rid->doc_len);
+    hdr->no_nodes = (int64_t)num;
+    hdr->check = __zeroxml_index_hash((const char*)rec,
+                                      (off_t)(num*sizeof(cacheRecord)));
+}
+
+int
+__zeroxml_index_compile(const struct _root_id *rid, const char *fname, const char *comment)
+{
+    struct _zeroxml_index_header hdr;
+    int rv = XML_FALSE;
+    cacheRecord *rec;
+    size_t num;
+
+    rec = __zeroxml_index_get_records(rid, comment, &num);
+    if (rec)
+    {
+        __zeroxml_index_compiled_header(rid, &hdr, rec, num);
+        rv = __zeroxml_index_write(fname, &hdr, rec, rid->doc);
+        if (!SHARED_NODES(rid)) FREE(rec);
+    }
+
+    return rv;
+}
+
+#if HAVE_SHM_OPEN
+static int
+__zeroxml_index_pwrite(int fd, const char *p, size_t l, off_t offs)
+{
+    while (l)
+    {
+        ssize_t res = pwrite(fd, p, l, offs);
+        if (res <= 0) return XML_FALSE;
+
+        p += res;
+        l -= (size_t)res;
+        offs += res;
+    }
+    return XML_TRUE;
+}
+#endif
+
+/*
+ * Publish a compiled document in a named shared memory object.
+ *
+ * An object which is still mapped by other processes is never changed, a
+ * previously published object is unlinked and a new one is created
+ * instead. The header is written last: until then the object is not
+ * recognized as a compiled document and attaching to it fails.
+ */
+int
+__zeroxml_index_publish(const struct _root_id *rid, const char *name, const char *comment)
+{
+    int rv = XML_FALSE;
+#if HAVE_SHM_OPEN
+    struct _zeroxml_index_header hdr;
+    cacheRecord *rec;
+    size_t num;
+
+    rec = __zeroxml_index_get_records(rid, comment, &num);
+    if (rec)
+    {
+        int fd;
+
+        __zeroxml_index_compiled_header(rid, &hdr, rec, num);
+
+        /* the object holds the whole document, only the owner reads it */
+        shm_unlink(name);
+        fd = shm_open(name, O_CREAT|O_EXCL|O_RDWR, 0600);
+        if (fd >= 0)
+        {
+            off_t rsize = (off_t)(num*sizeof(cacheRecord));
+            off_t offs = (off_t)sizeof(hdr);
+
+            rv = (ftruncate(fd, offs + rsize + rid->doc_len) == 0 &&
+                  __zeroxml_index_pwrite(fd, (const char*)rec, (size_t)rsize,
+                                         offs) &&
+                  __zeroxml_index_pwrite(fd, rid->doc, (size_t)rid->doc_len,
+                                         offs + rsize) &&
+                  __zeroxml_index_pwrite(fd, (const char*)&hdr, sizeof(hdr),
+                                         0));
+            close(fd);
+
+            if (!rv) shm_unlink(name);
+        }
+        if (!SHARED_NODES(rid)) FREE(rec);
+    }
+#else
+    (void)rid;
+    (void)name;
+    (void)comment;
+#endif
+
+    return rv;
+}
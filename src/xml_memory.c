@@ -0,0 +1,355 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Memory allocation.
+ *
+ * Every allocation of the library is made with the allocator which is set
+ * by xmlSetAllocator, malloc by default. A document opened with its own
+ * allocator or a memory limit allocates the memory it owns, the node cache,
+ * the arena, the error information and the line number index, with that
+ * allocator instead. These allocations are preceded by a header holding
+ * their size, so the memory in use by the document is known when they are
+ * freed. XML-ids and strings are freed by xmlFree which does not know the
+ * document and are allocated with the allocator of xmlSetAllocator, except
+ * for a document with a memory limit. Those are allocated from chunks which
+ * are charged to the document and may outlive it, the memory of the document
+ * is released together with the last of them.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "api.h"
+
+struct _zeroxml_memory
+{
+    xmlAllocator allocator;
+    size_t max_memory;	/* 0 for no limit */
+    size_t used;	/* the number of bytes allocated for the document */
+    int refs;		/* the document and the chunks which outlive it */
+};
+
+/* the header of the allocations of a document, it keeps the alignment */
+typedef union
+{
+    size_t size;
+    void *ptr;
+    double dbl;
+    char align[16];
+} __zeroxml_header;
+
+static void*
+__zeroxml_default_alloc(size_t size, void *context)
+{
+    (void)context;
+    return malloc(size);
+}
+
+static void*
+__zeroxml_default_resize(void *ptr, size_t size, void *context)
+{
+    (void)context;
+    return realloc(ptr, size);
+}
+
+static void
+__zeroxml_default_release(void *ptr, void *context)
+{
+    (void)context;
+    free(ptr);
+}
+
+static xmlAllocator __zeroxml_allocator = {
+    __zeroxml_default_alloc,
+    __zeroxml_default_resize,
+    __zeroxml_default_release,
+    NULL
+};
+
+XML_API void XML_APIENTRY
+xmlSetAllocator(const xmlAllocator *allocator)
+{
+    if (allocator && allocator->alloc && allocator->resize &&
+        allocator->release)
+    {
+        __zeroxml_allocator = *allocator;
+    }
+    else
+    {
+        __zeroxml_allocator.alloc = __zeroxml_default_alloc;
+        __zeroxml_allocator.resize = __zeroxml_default_resize;
+        __zeroxml_allocator.release = __zeroxml_default_release;
+        __zeroxml_allocator.context = NULL;
+    }
+}
+
+void*
+__zeroxml_malloc(size_t size)
+{
+    return __zeroxml_allocator.alloc(size, __zeroxml_allocator.context);
+}
+
+void*
+__zeroxml_calloc(size_t num, size_t size)
+{
+    void *rv = NULL;
+
+    if (!size || num <= (size_t)-1/size)
+    {
+        rv = __zeroxml_malloc(num*size);
+        if (rv) memset(rv, 0, num*size);
+    }
+
+    return rv;
+}
+
+void*
+__zeroxml_realloc(void *ptr, size_t size)
+{
+    return __zeroxml_allocator.resize(ptr, size, __zeroxml_allocator.context);
+}
+
+char*
+__zeroxml_strdup(const char *str)
+{
+    size_t len = strlen(str)+1;
+    char *rv = __zeroxml_malloc(len);
+
+    if (rv) memcpy(rv, str, len);
+
+    return rv;
+}
+
+void
+__zeroxml_dealloc(void *ptr)
+{
+    if (ptr) {
+        __zeroxml_allocator.release(ptr, __zeroxml_allocator.context);
+    }
+}
+
+struct _zeroxml_memory*
+__zeroxml_memory_create(const xmlAllocator *allocator, size_t max_memory)
+{
+    struct _zeroxml_memory *rv = MALLOC(sizeof(struct _zeroxml_memory));
+
+    if (rv)
+    {
+        if (allocator && allocator->alloc && allocator->resize &&
+            allocator->release)
+        {
+            rv->allocator = *allocator;
+        } else {
+            rv->allocator = __zeroxml_allocator;
+        }
+        rv->max_memory = max_memory;
+        rv->used = 0;
+        rv->refs = 1;
+    }
+
+    return rv;
+}
+
+void
+__zeroxml_memory_ref(struct _zeroxml_memory *mem)
+{
+    if (mem) ATOMIC_INT_ADD(mem->refs, 1);
+}
+
+void
+__zeroxml_memory_destroy(struct _zeroxml_memory *mem)
+{
+    if (mem && ATOMIC_INT_ADD(mem->refs, -1) == 0) {
+        FREE(mem);
+    }
+}
+
+/* account for size more bytes, fails when the limit would be exceeded */
+static int
+__zeroxml_memory_reserve(struct _zeroxml_memory *mem, size_t size)
+{
+    size_t used = ATOMIC_SIZE_ADD(mem->used, size);
+
+    if (mem->max_memory && (used > mem->max_memory || used < size))
+    {
+        ATOMIC_SIZE_ADD(mem->used, (size_t)0 - size);
+        return XML_FALSE;
+    }
+    return XML_TRUE;
+}
+
+/*
+ * Charge and release memory of the document which is not allocated with
+ * its allocator, like the buffer of a document which is read or
+ * decompressed. Charging fails when the limit would be exceeded.
+ */
+int
+__zeroxml_memory_charge(struct _zeroxml_memory *mem, size_t size)
+{
+    return mem ? __zeroxml_memory_reserve(mem, size) : XML_TRUE;
+}
+
+void
+__zeroxml_memory_uncharge(struct _zeroxml_memory *mem, size_t size)
+{
+    if (mem) ATOMIC_SIZE_ADD(mem->used, (size_t)0 - size);
+}
+
+int
+__zeroxml_memory_fits(const struct _zeroxml_memory *mem, size_t size)
+{
+    if (mem && mem->max_memory)
+    {
+        size_t used = ATOMIC_SIZE_GET(((struct _zeroxml_memory*)mem)->used);
+        return (size <= mem->max_memory && used <= mem->max_memory - size);
+    }
+    return XML_TRUE;
+}
+
+void*
+__zeroxml_memory_alloc(struct _zeroxml_memory *mem, size_t size)
+{
+    size_t total = sizeof(__zeroxml_header) + size;
+    __zeroxml_header *hdr;
+
+    if (!mem) {
+        return MALLOC(size);
+    }
+
+    if (total < size || !__zeroxml_memory_reserve(mem, total)) {
+        return NULL;
+    }
+
+    hdr = mem->allocator.alloc(total, mem->allocator.context);
+    if (!hdr)
+    {
+        ATOMIC_SIZE_ADD(mem->used, (size_t)0 - total);
+        return NULL;
+    }
+    hdr->size = total;
+
+    return hdr+1;
+}
+
+void*
+__zeroxml_memory_calloc(struct _zeroxml_memory *mem, size_t num, size_t size)
+{
+    void *rv = NULL;
+
+    if (!size || num <= (size_t)-1/size)
+    {
+        rv = __zeroxml_memory_alloc(mem, num*size);
+        if (rv) memset(rv, 0, num*size);
+    }
+
+    return rv;
+}
+
+void*
+__zeroxml_memory_realloc(struct _zeroxml_memory *mem, void *ptr, size_t size)
+{
+    size_t total = sizeof(__zeroxml_header) + size;
+    __zeroxml_header *hdr, *rv;
+    size_t prev;
+
+    if (!mem) {
+        return REALLOC(ptr, size);
+    }
+    if (!ptr) {
+        return __zeroxml_memory_alloc(mem, size);
+    }
+
+    hdr = (__zeroxml_header*)ptr - 1;
+    prev = hdr->size;
+    if (total < size) return NULL;
+    if (total > prev && !__zeroxml_memory_reserve(mem, total - prev)) {
+        return NULL;
+    }
+
+    rv = mem->allocator.resize(hdr, total, mem->allocator.context);
+    if (!rv)
+    {
+        if (total > prev) ATOMIC_SIZE_ADD(mem->used, prev - total);
+        return NULL;
+    }
+    if (total < prev) ATOMIC_SIZE_ADD(mem->used, total - prev);
+    rv->size = total;
+
+    return rv+1;
+}
+
+void
+__zeroxml_memory_free(struct _zeroxml_memory *mem, void *ptr)
+{
+    if (!mem) {
+        FREE(ptr);
+    }
+    else if (ptr)
+    {
+        __zeroxml_header *hdr = (__zeroxml_header*)ptr - 1;
+
+        ATOMIC_SIZE_ADD(mem->used, (size_t)0 - hdr->size);
+        mem->allocator.release(hdr, mem->allocator.context);
+    }
+}
@@ -0,0 +1,283 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Registry of the documents opened with XML_SHARE_DOCUMENT.
+ *
+ * The first open of a file creates the document as usual and registers it
+ * as the master of an entry. Every open, the first one included, gets a
+ * handle: a copy of the root XML-id of the master which shares its mapping,
+ * node cache, locale and character set conversion but has its own error
+ * state. The entry counts the handles and the master is closed when the
+ * last handle is closed.
+ *
+ * An entry is found by the device and inode number of the file and by the
+ * flags and resource limits of the document. When the size or modification
+ * time of the file changed the entry is removed from the registry, handles
+ * which are still open keep using the previous document.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "xml.h"
+#include "api.h"
+
+struct _zeroxml_registry
+{
+    struct _zeroxml_registry *next;
+    struct _root_id *master;
+    int refcount;
+    int listed; /* the entry can be found by new opens */
+
+    /* the key */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+    int flags;
+    xmlLimits limits;
+};
+
+static struct _zeroxml_registry *__zeroxml_registry = NULL;
+#if HAVE_PTHREAD_H
+static pthread_mutex_t __zeroxml_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+# define REGISTRY_LOCK()	pthread_mutex_lock(&__zeroxml_registry_mutex)
+# define REGISTRY_UNLOCK()	pthread_mutex_unlock(&__zeroxml_registry_mutex)
+#else
+# define REGISTRY_LOCK()
+# define REGISTRY_UNLOCK()
+#endif
+
+static void
+__zeroxml_registry_unlist(struct _zeroxml_registry *entry)
+{
+    struct _zeroxml_registry **p = &__zeroxml_registry;
+
+    while (*p && *p != entry) {
+        p = &(*p)->next;
+    }
+    if (*p) *p = entry->next;
+    entry->listed = 0;
+}
+
+/*
+ * Find the entry of a file, an entry of a file which has changed since it
+ * was registered is removed from the registry. The registry must be locked.
+ */
+static struct _zeroxml_registry*
+__zeroxml_registry_find(const struct stat *statbuf, const xmlOptions *options)
+{
+    struct _zeroxml_registry *entry = __zeroxml_registry;
+
+    while (entry)
+    {
+        struct _zeroxml_registry *next = entry->next;
+
+        if (entry->dev == statbuf->st_dev && entry->ino == statbuf->st_ino)
+        {
+            if (entry->size != statbuf->st_size ||
+                entry->mtime != statbuf->st_mtime ||
+                entry->mtime_nsec != STAT_MTIME_NSEC(statbuf))
+            {
+                __zeroxml_registry_unlist(entry);
+            }
+            else if (entry->flags == options->flags &&
+                     !memcmp(&entry->limits, &options->limits,
+                             sizeof(xmlLimits)))
+            {
+                return entry;
+            }
+        }
+        entry = next;
+    }
+
+    return entry;
+}
+
+/*
+ * Create a new handle for an entry. The registry must be locked.
+ */
+static struct _root_id*
+__zeroxml_registry_handle(struct _zeroxml_registry *entry)
+{
+    struct _root_id *rv = MALLOC(sizeof(struct _root_id));
+
+    if (rv)
+    {
+        memcpy(rv, entry->master, sizeof(struct _root_id));
+        rv->root = rv;
+        rv->info = NULL;
+        rv->lines = NULL;
+#if HAVE_PTHREAD_H
+        rv->background = NULL;
+#endif
+        rv->registry = entry;
+        entry->refcount++;
+    }
+
+    return rv;
+}
+
+struct _root_id*
+__zeroxml_registry_get(const struct stat *statbuf, const xmlOptions *options)
+{
+    struct _zeroxml_registry *entry;
+    struct _root_id *rv = NULL;
+
+    REGISTRY_LOCK();
+    entry = __zeroxml_registry_find(statbuf, options);
+    if (entry) {
+        rv = __zeroxml_registry_handle(entry);
+    }
+    REGISTRY_UNLOCK();
+
+    return rv;
+}
+
+struct _root_id*
+__zeroxml_registry_add(struct _root_id *rid, const struct stat *statbuf, const xmlOptions *options)
+{
+    struct _zeroxml_registry *entry, *found;
+    struct _root_id *rv = NULL;
+
+    /* handles copy rid->node, it has to be complete */
+    xmlWaitIndexed(rid);
+
+    entry = CALLOC(1, sizeof(struct _zeroxml_registry));
+    if (!entry) return rid;
+
+    entry->master = rid;
+    entry->listed = 1;
+    entry->dev = statbuf->st_dev;
+    entry->ino = statbuf->st_ino;
+    entry->size = statbuf->st_size;
+    entry->mtime = statbuf->st_mtime;
+    entry->mtime_nsec = STAT_MTIME_NSEC(statbuf);
+    entry->flags = options->flags;
+    entry->limits = options->limits;
+
+    REGISTRY_LOCK();
+
+    /* another thread may have opened the same file in the meantime */
+    found = __zeroxml_registry_find(statbuf, options);
+    if (found)
+    {
+        rv = __zeroxml_registry_handle(found);
+        if (rv)
+        {
+            FREE(entry);
+            entry = NULL;
+        }
+    }
+
+    if (entry)
+    {
+        rv = __zeroxml_registry_handle(entry);
+        if (rv)
+        {
+            entry->next = __zeroxml_registry;
+            __zeroxml_registry = entry;
+        }
+    }
+    REGISTRY_UNLOCK();
+
+    if (!rv)
+    {
+        /* not shared */
+        FREE(entry);
+        rv = rid;
+    }
+    else if (!entry) {
+        xmlClose(rid);
+    }
+
+    return rv;
+}
+
+void
+__zeroxml_registry_release(struct _root_id *rid)
+{
+    struct _zeroxml_registry *entry = rid->registry;
+    int refcount;
+
+    /* the arena is shared with the master and released when it is closed */
+    __zeroxml_free(rid, rid->info);
+    __zeroxml_memory_free(rid->memory, rid->lines);
+    FREE(rid);
+
+    REGISTRY_LOCK();
+    refcount = --entry->refcount;
+    if (refcount == 0 && entry->listed) {
+        __zeroxml_registry_unlist(entry);
+    }
+    REGISTRY_UNLOCK();
+
+    if (refcount == 0)
+    {
+        xmlClose(entry->master);
+        FREE(entry);
+    }
+}
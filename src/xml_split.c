@@ -0,0 +1,488 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Splitting files of concatenated documents.
+ *
+ * Audit logs and message dumps hold many documents one after the other,
+ * separated by nothing or by newlines. The splitter finds the boundaries of
+ * the documents in one pass over the mapping: it jumps from one '<' to the
+ * next, skipping the text in between sixteen bytes at a time, and keeps
+ * track of the nesting depth of the elements. Comments, processing
+ * instructions, CDATA sections and quoted attribute values are skipped as a
+ * whole so markup inside of them does not count. A document ends where the
+ * depth of its root element returns to zero, anything in front of the root
+ * element such as the XML declaration belongs to the document.
+ *
+ * Records are processed by pointing an XML-id at the mapping of the file,
+ * nothing is copied. xmlSplitDispatch processes them with a pool of threads
+ * with a parser context each, the threads take the next records from the
+ * splitter in batches.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#include "xml.h"
+#include "api.h"
+
+#define SPLIT_BATCH		16
+#define SPLIT_MAX_THREADS	256
+
+struct _zeroxml_splitter
+{
+    struct _root_id *map; /* the mapping of the file, NULL for a buffer */
+    const char *start;
+    size_t len;
+    const char *pos; /* start of the part which is not split yet */
+    xmlOptions options;
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_t mutex; /* serializes xmlSplitRecords */
+#endif
+};
+
+/*
+ * Find the first occurence of a character.
+ *
+ * @param ps start of the section
+ * @param pe end of the section
+ * @param c the character to look for
+ * @return a pointer to the character or NULL if it was not found
+ */
+static const char*
+__zeroxml_split_find(const char *ps, const char *pe, char c)
+{
+#if defined(__SSE2__) && defined(__GNUC__)
+    const __m128i v_c = _mm_set1_epi8(c);
+    while (pe-ps >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)ps);
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, v_c));
+        if (mask) {
+            return ps + __builtin_ctz(mask);
+        }
+        ps += 16;
+    }
+#endif
+
+    return (ps < pe) ? MEMCHR(ps, c, pe-ps) : NULL;
+}
+
+/*
+ * Find the end of a section which is terminated by a sequence of characters
+ * ending in '>', such as "-->" for a comment.
+ *
+ * @param ps start of the contents of the section
+ * @param pe end of the document
+ * @param term the terminating sequence
+ * @param len length of the terminating sequence
+ * @return a pointer to the closing '>' or NULL if there is none
+ */
+static const char*
+__zeroxml_split_end(const char *ps, const char *pe, const char *term, int len)
+{
+    const char *rv = ps;
+
+    while ((rv = __zeroxml_split_find(rv, pe, '>')) != NULL)
+    {
+        if (rv-ps >= len-1 && !memcmp(rv-(len-1), term, len-1)) break;
+        rv++;
+    }
+
+    return rv;
+}
+
+/*
+ * Find the closing '>' of a tag, skipping quoted attribute values and the
+ * internal subset of a DOCTYPE declaration.
+ *
+ * @param ps the position after the opening '<'
+ * @param pe end of the document
+ * @return a pointer to the closing '>' or NULL if there is none
+ */
+static const char*
+__zeroxml_split_tag_end(const char *ps, const char *pe)
+{
+    int subset = 0;
+
+    while (ps < pe)
+    {
+        char c = *ps;
+
+        if (c == '>' && !subset) {
+            return ps;
+        }
+        else if (c == '"' || c == '\'')
+        {
+            ps = MEMCHR(ps+1, c, pe-ps-1);
+            if (!ps) break;
+        }
+        else if (c == '[') subset++;
+        else if (c == ']' && subset) subset--;
+        ps++;
+    }
+
+    return NULL;
+}
+
+/*
+ * Find the next document.
+ *
+ * Text outside of the documents is skipped. A document which is not
+ * terminated at the end of the file is returned as it is, processing it
+ * reports the error. Comments and processing instructions after the last
+ * document are ignored.
+ *
+ * @param sid the splitter
+ * @param record set to the position of the document
+ * @return XML_TRUE if a document was found, XML_FALSE at the end
+ */
+static int
+__zeroxml_split_next(struct _zeroxml_splitter *sid, xmlRecord *record)
+{
+    const char *pe = sid->start + sid->len;
+    const char *ps = sid->pos;
+    const char *start = NULL;
+    int depth = 0, element = 0, rv = XML_FALSE;
+
+    while ((ps = __zeroxml_split_find(ps, pe, '<')) != NULL)
+    {
+        const char *end = NULL;
+
+        if (!start) start = ps;
+        if (pe-ps < 2) break;
+
+        if (ps[1] == '?') {
+            end = __zeroxml_split_end(ps+2, pe, "?>", 2);
+        }
+        else if (ps[1] == '!')
+        {
+            if (pe-ps >= 4 && !memcmp(ps, "<!--", 4)) {
+                end = __zeroxml_split_end(ps+4, pe, "-->", 3);
+            } else if (pe-ps >= 9 && !memcmp(ps, "<![CDATA[", 9)) {
+                end = __zeroxml_split_end(ps+9, pe, "]]>", 3);
+            } else {
+                end = __zeroxml_split_tag_end(ps+2, pe);
+            }
+        }
+        else if ((end = __zeroxml_split_tag_end(ps+1, pe)) != NULL)
+        {
+            if (ps[1] == '/') depth--;
+            else if (end[-1] != '/') depth++;
+            element = XML_TRUE;
+        }
+
+        if (!end)
+        {
+            element = XML_TRUE; /* an unterminated section */
+            break;
+        }
+
+        ps = end+1;
+        if (element && depth <= 0)
+        {
+            pe = ps;
+            break;
+        }
+    }
+
+    if (start && element)
+    {
+        record->offset = (size_t)(start - sid->start);
+        record->length = (size_t)(pe - start);
+        rv = XML_TRUE;
+    }
+    sid->pos = pe;
+
+    return rv;
+}
+
+static struct _zeroxml_splitter*
+__zeroxml_split_create(const xmlOptions *options)
+{
+    struct _zeroxml_splitter *rv;
+
+    rv = CALLOC(1, sizeof(struct _zeroxml_splitter));
+    if (rv)
+    {
+        if (options) {
+            rv->options = *options;
+        } else {
+            rv->options.flags = XML_DEFAULT_FLAGS;
+        }
+        rv->options.index = NULL; /* records have no sidecar file */
+#if HAVE_PTHREAD_H
+        pthread_mutex_init(&rv->mutex, NULL);
+#endif
+    }
+
+    return rv;
+}
+
+XML_API xmlSplitter* XML_APIENTRY
+xmlSplitOpen(const char *fname, const xmlOptions *options)
+{
+    struct _zeroxml_splitter *rv = NULL;
+
+    if (fname && (rv = __zeroxml_split_create(options)) != NULL)
+    {
+        off_t len = 0;
+
+        rv->map = CALLOC(1, sizeof(struct _root_id));
+        if (rv->map) {
+            rv->start = __zeroxml_map_document(rv->map, fname, options, &len);
+        }
+        if (!rv->start)
+        {
+            xmlSplitClose(rv);
+            rv = NULL;
+        }
+        else
+        {
+            rv->len = (size_t)len;
+            rv->pos = rv->start;
+        }
+    }
+
+    return rv;
+}
+
+XML_API xmlSplitter* XML_APIENTRY
+xmlSplitInitBuffer(const char *buffer, size_t size, const xmlOptions *options)
+{
+    struct _zeroxml_splitter *rv = NULL;
+
+    if (buffer && (rv = __zeroxml_split_create(options)) != NULL)
+    {
+        rv->start = buffer;
+        rv->len = size;
+        rv->pos = buffer;
+    }
+
+    return rv;
+}
+
+XML_API void XML_APIENTRY
+xmlSplitClose(xmlSplitter *sid)
+{
+    if (sid)
+    {
+        if (sid->map)
+        {
+            if (sid->start) __zeroxml_unmap_document(sid->map);
+            FREE(sid->map);
+        }
+#if HAVE_PTHREAD_H
+        pthread_mutex_destroy(&sid->mutex);
+#endif
+        FREE(sid);
+    }
+}
+
+XML_API int XML_APIENTRY
+xmlSplitRecords(xmlSplitter *sid, xmlRecord *records, int max)
+{
+    int rv = 0;
+
+    assert(sid != 0);
+    assert(records != 0 || max <= 0);
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&sid->mutex);
+#endif
+    while (rv < max && __zeroxml_split_next(sid, &records[rv])) {
+        rv++;
+    }
+#if HAVE_PTHREAD_H
+    pthread_mutex_unlock(&sid->mutex);
+#endif
+
+    return rv;
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlSplitGet(const xmlSplitter *sid, const xmlRecord *record)
+{
+    xmlId *rv = NULL;
+
+    assert(sid != 0);
+    assert(record != 0);
+
+    if (record->offset < sid->len && record->length <= sid->len-record->offset)
+    {
+        rv = xmlInitBufferOptions64(sid->start + record->offset,
+                                    record->length, &sid->options);
+    }
+
+    return rv;
+}
+
+/* the state shared by the threads of xmlSplitDispatch */
+struct _zeroxml_dispatch
+{
+    struct _zeroxml_splitter *sid;
+    xmlRecordCallback callback;
+    void *user;
+    size_t processed;
+    int stop;
+    int error;
+};
+
+/*
+ * Process records until all of them are done or the callback asks to stop.
+ */
+static void*
+__zeroxml_dispatch_thread(void *arg)
+{
+    struct _zeroxml_dispatch *dp = arg;
+    struct _zeroxml_splitter *sid = dp->sid;
+    xmlContext *ctx = xmlContextOpen(&sid->options);
+
+    if (!ctx)
+    {
+        ATOMIC_INT_SET(dp->error, XML_TRUE);
+        return NULL;
+    }
+
+    while (!ATOMIC_INT_GET(dp->stop))
+    {
+        xmlRecord records[SPLIT_BATCH];
+        int i, num;
+
+        num = xmlSplitRecords(sid, records, SPLIT_BATCH);
+        if (!num) break;
+
+        for (i=0; i<num && !ATOMIC_INT_GET(dp->stop); i++)
+        {
+            const char *doc = sid->start + records[i].offset;
+            xmlId *xid = xmlReset64(ctx, doc, (size_t)records[i].length);
+
+            if (dp->callback(xid, &records[i], dp->user)) {
+                ATOMIC_INT_SET(dp->stop, XML_TRUE);
+            }
+            ATOMIC_SIZE_ADD(dp->processed, 1);
+        }
+    }
+    xmlContextClose(ctx);
+
+    return NULL;
+}
+
+XML_API long XML_APIENTRY
+xmlSplitDispatch(xmlSplitter *sid, int threads, xmlRecordCallback callback, void *user)
+{
+    struct _zeroxml_dispatch dp;
+
+    assert(sid != 0);
+    assert(callback != 0);
+
+    memset(&dp, 0, sizeof(dp));
+    dp.sid = sid;
+    dp.callback = callback;
+    dp.user = user;
+
+#if HAVE_PTHREAD_H
+    if (threads <= 0)
+    {
+# if HAVE_UNISTD_H && defined(_SC_NPROCESSORS_ONLN)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+# endif
+        if (threads <= 0) threads = 1;
+    }
+    if (threads > SPLIT_MAX_THREADS) threads = SPLIT_MAX_THREADS;
+
+    if (threads > 1)
+    {
+        pthread_t thread[SPLIT_MAX_THREADS];
+        int i, num = 0;
+
+        for (i=0; i<threads; i++)
+        {
+            if (pthread_create(&thread[num], NULL, __zeroxml_dispatch_thread,
+                               &dp) == 0) {
+                num++;
+            }
+        }
+
+        /* the calling thread processes the records if none could start */
+        if (!num) {
+            __zeroxml_dispatch_thread(&dp);
+        }
+        for (i=0; i<num; i++) {
+            pthread_join(thread[i], NULL);
+        }
+    }
+    else
+#endif
+    __zeroxml_dispatch_thread(&dp);
+
+    return (dp.error && !dp.processed) ? -1 : (long)dp.processed;
+}
@@ -0,0 +1,160 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Statistics of the documents.
+ *
+ * With the STATS build option the scanner, the node cache, the allocation
+ * functions and the character set conversion count their work in the root
+ * XML-id of the document and in the process-wide counters. The scanner
+ * keeps its counters in the state of a scan and adds them once the scan is
+ * done. Without the option the counting macros are empty.
+ *
+ * The clock is always available, xmlNodeGetExplain uses it too.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string.h>
+#include <time.h>
+#ifdef WIN32
+# include <windows.h>
+#endif
+
+#include "xml.h"
+#include "api.h"
+
+/* a monotonic clock in nanoseconds */
+int64_t
+__zeroxml_clock(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (int64_t)(count.QuadPart/freq.QuadPart*1000000000 +
+                     count.QuadPart%freq.QuadPart*1000000000/freq.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+}
+
+#if XML_USE_STATS
+struct _zeroxml_stats __zeroxml_stats;
+
+/* raise the counter to value */
+void
+__zeroxml_stats_max(size_t *counter, size_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    size_t prev = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+    while (prev < value &&
+           !__atomic_compare_exchange_n(counter, &prev, value, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#else
+    if (*counter < value) *counter = value;
+#endif
+}
+
+static void
+__zeroxml_stats_get(struct _zeroxml_stats *from, xmlStats *stats)
+{
+    stats->bytes_scanned = ATOMIC_SIZE_GET(from->bytes_scanned);
+    stats->memchr_calls = ATOMIC_SIZE_GET(from->memchr_calls);
+    stats->max_depth = ATOMIC_SIZE_GET(from->max_depth);
+    stats->cache_hits = ATOMIC_SIZE_GET(from->cache_hits);
+    stats->cache_misses = ATOMIC_SIZE_GET(from->cache_misses);
+    stats->nodes_created = ATOMIC_SIZE_GET(from->nodes_created);
+    stats->allocations = ATOMIC_SIZE_GET(from->allocations);
+    stats->bytes_allocated = ATOMIC_SIZE_GET(from->bytes_allocated);
+    stats->iconv_calls = ATOMIC_SIZE_GET(from->iconv_calls);
+    stats->documents = ATOMIC_SIZE_GET(from->documents);
+    stats->open_time = ATOMIC_SIZE_GET(from->open_time)*1e-6;
+    stats->index_time = ATOMIC_SIZE_GET(from->index_time)*1e-6;
+}
+#endif
+
+XML_API int XML_APIENTRY
+xmlGetStats(const xmlId *id, xmlStats *stats)
+{
+    int rv = XML_FALSE;
+
+    if (stats)
+    {
+        memset(stats, 0, sizeof(xmlStats));
+#if XML_USE_STATS
+        if (id) {
+            __zeroxml_stats_get(&STATS(id->root), stats);
+        } else {
+            __zeroxml_stats_get(&__zeroxml_stats, stats);
+        }
+        rv = XML_TRUE;
+#else
+        (void)id;
+#endif
+    }
+
+    return rv;
+}
@@ -0,0 +1,308 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Trace spans of the library in the Chrome trace_event format.
+ *
+ * With the TRACE build option the phases of opening, indexing, querying and
+ * closing a document record a span in a ring buffer of the calling thread,
+ * older spans are overwritten once it is full. xmlTraceExport writes the
+ * spans of all threads as complete ("X") events which can be loaded in
+ * Perfetto or chrome://tracing next to the spans of the application. The
+ * timestamps are those of the monotonic clock. Without the option the
+ * tracing macros are empty and xmlTraceExport writes nothing.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef WIN32
+# include <windows.h>
+#endif
+
+#include "xml.h"
+#include "api.h"
+
+#if XML_USE_TRACE
+#define TRACE_EVENTS	4096
+
+struct _zeroxml_trace_event
+{
+    const char *name;
+    int64_t start;
+    int64_t end;
+    int tid; /* the thread which recorded the span */
+};
+
+/*
+ * The spans of a thread, reused by a new thread once the thread exits.
+ *
+ * Only the thread itself writes the events and head, head is published with
+ * a release store once an event is written. An export reads the events
+ * before head and drops those which the thread overwrote in the meantime.
+ * xmlTraceClear moves tail instead of head which only the thread changes.
+ */
+struct _zeroxml_trace_buffer
+{
+    struct _zeroxml_trace_buffer *next;
+    int tid;
+    int in_use;
+    size_t head; /* number of spans recorded */
+    size_t tail; /* spans before tail were cleared */
+    struct _zeroxml_trace_event event[TRACE_EVENTS];
+};
+
+static struct _zeroxml_trace_buffer *__zeroxml_trace_buffers = NULL;
+static int __zeroxml_trace_threads = 0;
+
+#if HAVE_PTHREAD_H
+static pthread_mutex_t __zeroxml_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t __zeroxml_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t __zeroxml_trace_key;
+# define TRACE_LOCK()		pthread_mutex_lock(&__zeroxml_trace_mutex)
+# define TRACE_UNLOCK()		pthread_mutex_unlock(&__zeroxml_trace_mutex)
+#else
+static struct _zeroxml_trace_buffer *__zeroxml_trace_buffer = NULL;
+# define TRACE_LOCK()
+# define TRACE_UNLOCK()
+#endif
+
+/* get a buffer which is not used by another thread */
+static struct _zeroxml_trace_buffer*
+__zeroxml_trace_new(void)
+{
+    struct _zeroxml_trace_buffer *rv;
+
+    TRACE_LOCK();
+    rv = __zeroxml_trace_buffers;
+    while (rv && rv->in_use) rv = rv->next;
+    if (!rv && (rv = calloc(1, sizeof(struct _zeroxml_trace_buffer))) != NULL)
+    {
+        rv->next = __zeroxml_trace_buffers;
+        __zeroxml_trace_buffers = rv;
+    }
+    if (rv)
+    {
+        /* the spans of a thread which exited keep their own thread id */
+        rv->tid = ++__zeroxml_trace_threads;
+        rv->in_use = XML_TRUE;
+    }
+    TRACE_UNLOCK();
+
+    return rv;
+}
+
+#if HAVE_PTHREAD_H
+/* the spans of a thread which exits stay until the buffer is reused */
+static void
+__zeroxml_trace_destroy(void *ptr)
+{
+    struct _zeroxml_trace_buffer *buffer = ptr;
+
+    TRACE_LOCK();
+    buffer->in_use = XML_FALSE;
+    TRACE_UNLOCK();
+}
+
+static void
+__zeroxml_trace_init(void)
+{
+    pthread_key_create(&__zeroxml_trace_key, __zeroxml_trace_destroy);
+}
+
+static struct _zeroxml_trace_buffer*
+__zeroxml_trace_get(void)
+{
+    struct _zeroxml_trace_buffer *rv;
+
+    pthread_once(&__zeroxml_trace_once, __zeroxml_trace_init);
+    rv = pthread_getspecific(__zeroxml_trace_key);
+    if (!rv && (rv = __zeroxml_trace_new()) != NULL)
+    {
+        if (pthread_setspecific(__zeroxml_trace_key, rv) != 0)
+        {
+            __zeroxml_trace_destroy(rv);
+            rv = NULL;
+        }
+    }
+    return rv;
+}
+#else
+static struct _zeroxml_trace_buffer*
+__zeroxml_trace_get(void)
+{
+    if (!__zeroxml_trace_buffer) {
+        __zeroxml_trace_buffer = __zeroxml_trace_new();
+    }
+    return __zeroxml_trace_buffer;
+}
+#endif
+
+/*
+ * Record a span from start until now.
+ *
+ * @param name name of the span, a string constant
+ * @param start the start of the span from __zeroxml_clock
+ */
+void
+__zeroxml_trace_span(const char *name, int64_t start)
+{
+    int64_t end = __zeroxml_clock();
+    struct _zeroxml_trace_buffer *buffer = __zeroxml_trace_get();
+
+    if (buffer)
+    {
+        size_t head = ATOMIC_RELAXED_GET(buffer->head);
+        struct _zeroxml_trace_event *event;
+
+        /* an export which reads these stores also reads the previous head */
+        ATOMIC_FENCE_RELEASE();
+        event = &buffer->event[head % TRACE_EVENTS];
+        ATOMIC_RELAXED_SET(event->name, name);
+        ATOMIC_RELAXED_SET(event->start, start);
+        ATOMIC_RELAXED_SET(event->end, end);
+        ATOMIC_RELAXED_SET(event->tid, buffer->tid);
+        ATOMIC_SIZE_STORE(buffer->head, head+1);
+    }
+}
+#endif
+
+XML_API int XML_APIENTRY
+xmlTraceExport(const char *fname)
+{
+    int rv = 0;
+
+#if XML_USE_TRACE
+    struct _zeroxml_trace_buffer *buffer;
+    FILE *fp;
+    int pid;
+
+    if (!fname || (fp = fopen(fname, "w")) == NULL) {
+        return -1;
+    }
+
+#ifdef WIN32
+    pid = (int)GetCurrentProcessId();
+#else
+    pid = (int)getpid();
+#endif
+
+    fprintf(fp, "{\"traceEvents\":[");
+    TRACE_LOCK();
+    for (buffer = __zeroxml_trace_buffers; buffer; buffer = buffer->next)
+    {
+        size_t head = ATOMIC_SIZE_LOAD(buffer->head);
+        size_t i = (head > TRACE_EVENTS) ? head-TRACE_EVENTS : 0;
+
+        if (i < buffer->tail) i = buffer->tail;
+        for (; i<head; ++i)
+        {
+            struct _zeroxml_trace_event *event, span;
+
+            event = &buffer->event[i % TRACE_EVENTS];
+            span.name = ATOMIC_RELAXED_GET(event->name);
+            span.start = ATOMIC_RELAXED_GET(event->start);
+            span.end = ATOMIC_RELAXED_GET(event->end);
+            span.tid = ATOMIC_RELAXED_GET(event->tid);
+
+            /* skip the span if the thread overwrote it while reading */
+            ATOMIC_FENCE_ACQUIRE();
+            if (ATOMIC_RELAXED_GET(buffer->head) - i >= TRACE_EVENTS) {
+                continue;
+            }
+
+            fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"zeroxml\",\"ph\":\"X\","
+                        "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%i,\"tid\":%i}",
+                    rv ? "," : "", span.name, span.start*1e-3,
+                    (span.end-span.start)*1e-3, pid, span.tid);
+            rv++;
+        }
+    }
+    TRACE_UNLOCK();
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    if (fclose(fp) != 0) {
+        rv = -1;
+    }
+#else
+    (void)fname;
+#endif
+
+    return rv;
+}
+
+XML_API void XML_APIENTRY
+xmlTraceClear(void)
+{
+#if XML_USE_TRACE
+    struct _zeroxml_trace_buffer *buffer;
+
+    TRACE_LOCK();
+    for (buffer = __zeroxml_trace_buffers; buffer; buffer = buffer->next) {
+        buffer->tail = ATOMIC_SIZE_LOAD(buffer->head);
+    }
+    TRACE_UNLOCK();
+#endif
+}
@@ -0,0 +1,430 @@
+/*
+ * This software is available under 2 licenses -- choose whichever you prefer.
+ *
+ * ALTERNATIVE A - Modified BSD license
+ *
+ * Copyright (C) 2008-2023 by Erik Hofman.
+ * Copyright (C) 2009-2023 by Adalin B.V.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *        this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ADALIN B.V. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL ADALIN B.V. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUTOF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Adalin B.V.
+ *
+ * -----------------------------------------------------------------------------
+ * ALTERNATIVE B - Public Domain (www.unlicense.org)
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to
+ * the public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all
+ * present and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Hot reload of watched documents.
+ *
+ * The current document of a watched file is published in wid->current.
+ * Readers pin it with an epoch guard: they count themselves in one of two
+ * reader counters, selected by the parity of the epoch, and read
+ * wid->current. A reload opens the new document next to the current one,
+ * publishes it, advances the epoch and waits until the readers of the old
+ * parity are gone before the previous document is closed. Readers which
+ * arrive after the epoch was advanced can only see the new document, so
+ * the wait always ends and readers never wait for anything themselves.
+ *
+ * The file is watched using inotify on the directory of the file, so files
+ * which are replaced by renaming a new file into place are noticed too. On
+ * platforms without inotify the file is polled every WATCH_INTERVAL ms.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_PTHREAD_H
+# include <poll.h>
+#endif
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+#include "xml.h"
+#include "api.h"
+
+#define WATCH_INTERVAL		1000
+#if HAVE_SYS_INOTIFY_H
+# define WATCH_EVENTS		(IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | \
+				 IN_ATTRIB)
+#endif
+
+struct _zeroxml_watch
+{
+    struct _root_id *current;
+    int epoch;
+    int readers[2]; /* readers per parity of the epoch */
+
+    char *fname;
+    char *index; /* copy of options.index */
+    xmlOptions options;
+
+    /* the file of the current document */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_t mutex; /* serializes reloads */
+    pthread_t thread;
+    int running;
+    int stop[2]; /* pipe to wake up the thread for xmlWatchClose */
+#endif
+    int notify; /* inotify file descriptor, -1 if none */
+};
+
+static void
+__zeroxml_watch_pause(void)
+{
+#ifdef WIN32
+    Sleep(1);
+#else
+    struct timespec ts;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/*
+ * Test whether the file differs from the file of the current document.
+ */
+static int
+__zeroxml_watch_changed(const struct _zeroxml_watch *wid, struct stat *statbuf)
+{
+    int rv = XML_FALSE;
+
+    if (stat(wid->fname, statbuf) == 0 &&
+        (statbuf->st_dev != wid->dev || statbuf->st_ino != wid->ino ||
+         statbuf->st_size != wid->size || statbuf->st_mtime != wid->mtime ||
+         STAT_MTIME_NSEC(statbuf) != wid->mtime_nsec))
+    {
+        rv = XML_TRUE;
+    }
+
+    return rv;
+}
+
+static void
+__zeroxml_watch_key(struct _zeroxml_watch *wid, const struct stat *statbuf)
+{
+    wid->dev = statbuf->st_dev;
+    wid->ino = statbuf->st_ino;
+    wid->size = statbuf->st_size;
+    wid->mtime = statbuf->st_mtime;
+    wid->mtime_nsec = STAT_MTIME_NSEC(statbuf);
+}
+
+/*
+ * Open the file again if it has changed and publish the new document.
+ */
+static int
+__zeroxml_watch_reload(struct _zeroxml_watch *wid)
+{
+    struct _root_id *rid, *old;
+    struct stat statbuf;
+    int epoch;
+
+    if (!__zeroxml_watch_changed(wid, &statbuf)) {
+        return XML_FALSE;
+    }
+
+    /*
+     * A document which can not be opened is retried on the next change.
+     * Only the changed part of the node cache of the current document is
+     * built again.
+     */
+    rid = xmlReopen(wid->current, wid->fname, &wid->options);
+    if (!rid) return XML_FALSE;
+
+    __zeroxml_watch_key(wid, &statbuf);
+
+    old = wid->current;
+    ATOMIC_PTR_SET(wid->current, rid);
+
+    /* wait for the readers which might still use the previous document */
+    epoch = ATOMIC_INT_GET(wid->epoch);
+    ATOMIC_INT_SET(wid->epoch, epoch+1);
+    while (ATOMIC_INT_GET(wid->readers[epoch & 1]) > 0) {
+        __zeroxml_watch_pause();
+    }
+    xmlClose(old);
+
+    return XML_TRUE;
+}
+
+#if HAVE_PTHREAD_H
+static void*
+__zeroxml_watch_thread(void *arg)
+{
+    struct _zeroxml_watch *wid = arg;
+    struct pollfd fds[2];
+    int timeout = WATCH_INTERVAL;
+    int nfds = 1;
+
+    fds[0].fd = wid->stop[0];
+    fds[0].events = POLLIN;
+    if (wid->notify >= 0)
+    {
+        fds[1].fd = wid->notify;
+        fds[1].events = POLLIN;
+        timeout = -1;
+        nfds = 2;
+    }
+
+    for(;;)
+    {
+        int res = poll(fds, nfds, timeout);
+
+        if (res < 0 && errno != EINTR) break;
+        if (res > 0 && fds[0].revents) break;
+
+        if (res > 0 && nfds > 1 && fds[1].revents)
+        {
+            /* only the file itself matters, which is tested by stat */
+            char buf[4096];
+            while (read(wid->notify, buf, sizeof(buf)) > 0);
+        }
+
+        pthread_mutex_lock(&wid->mutex);
+        __zeroxml_watch_reload(wid);
+        pthread_mutex_unlock(&wid->mutex);
+    }
+
+    return NULL;
+}
+
+/*
+ * Watch the directory of the file for files which are written or renamed.
+ */
+static int
+__zeroxml_watch_notify(const char *fname)
+{
+    int rv = -1;
+#if HAVE_SYS_INOTIFY_H
+    const char *slash = strrchr(fname, '/');
+    char *dir;
+
+    if (!slash) {
+        dir = STRDUP(".");
+    } else if (slash == fname) {
+        dir = STRDUP("/");
+    }
+    else if ((dir = MALLOC((size_t)(slash-fname)+1)) != NULL)
+    {
+        memcpy(dir, fname, (size_t)(slash-fname));
+        dir[slash-fname] = 0;
+    }
+
+    if (dir)
+    {
+        rv = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (rv >= 0 && inotify_add_watch(rv, dir, WATCH_EVENTS) < 0)
+        {
+            close(rv);
+            rv = -1;
+        }
+        FREE(dir);
+    }
+#else
+    (void)fname;
+#endif
+
+    return rv;
+}
+#endif
+
+XML_API xmlWatch* XML_APIENTRY
+xmlWatchOpen(const char *fname, const xmlOptions *options)
+{
+    struct _zeroxml_watch *rv = NULL;
+    struct stat statbuf;
+
+    if (!fname || stat(fname, &statbuf) != 0) return rv;
+
+    rv = CALLOC(1, sizeof(struct _zeroxml_watch));
+    if (rv)
+    {
+        rv->notify = -1;
+        if (options) {
+            rv->options = *options;
+        } else {
+            rv->options.flags = XML_DEFAULT_FLAGS;
+        }
+        if (rv->options.index) {
+            rv->index = STRDUP(rv->options.index);
+            rv->options.index = rv->index;
+        }
+
+        rv->fname = STRDUP(fname);
+        if (rv->fname) {
+            rv->current = xmlOpenOptions(fname, &rv->options);
+        }
+        if (!rv->current)
+        {
+            FREE(rv->fname);
+            FREE(rv->index);
+            FREE(rv);
+            rv = NULL;
+        }
+    }
+
+    if (rv)
+    {
+        __zeroxml_watch_key(rv, &statbuf);
+
+#if HAVE_PTHREAD_H
+        pthread_mutex_init(&rv->mutex, NULL);
+        if (pipe(rv->stop) == 0)
+        {
+            rv->notify = __zeroxml_watch_notify(fname);
+            if (pthread_create(&rv->thread, NULL, __zeroxml_watch_thread,
+                               rv) == 0)
+            {
+                rv->running = 1;
+            }
+            else
+            {
+                if (rv->notify >= 0) close(rv->notify);
+                close(rv->stop[0]);
+                close(rv->stop[1]);
+                rv->notify = -1;
+            }
+        }
+#endif
+    }
+
+    return rv;
+}
+
+XML_API void XML_APIENTRY
+xmlWatchClose(xmlWatch *wid)
+{
+    if (wid)
+    {
+#if HAVE_PTHREAD_H
+        if (wid->running)
+        {
+            char c = 0;
+
+            if (write(wid->stop[1], &c, 1) == 1) {
+                pthread_join(wid->thread, NULL);
+            }
+            close(wid->stop[0]);
+            close(wid->stop[1]);
+            if (wid->notify >= 0) close(wid->notify);
+        }
+        pthread_mutex_destroy(&wid->mutex);
+#endif
+
+        xmlClose(wid->current);
+        FREE(wid->fname);
+        FREE(wid->index);
+        FREE(wid);
+    }
+}
+
+XML_API xmlId* XML_APIENTRY
+xmlWatchAcquire(xmlWatch *wid, int *guard)
+{
+    int epoch;
+
+    assert(wid != 0);
+    assert(guard != 0);
+
+    /* a reload may advance the epoch in the meantime, try again */
+    for(;;)
+    {
+        epoch = ATOMIC_INT_GET(wid->epoch);
+        ATOMIC_INT_ADD(wid->readers[epoch & 1], 1);
+        if (ATOMIC_INT_GET(wid->epoch) == epoch) break;
+        ATOMIC_INT_ADD(wid->readers[epoch & 1], -1);
+    }
+    *guard = epoch & 1;
+
+    return ATOMIC_PTR_GET(wid->current);
+}
+
+XML_API void XML_APIENTRY
+xmlWatchRelease(xmlWatch *wid, int guard)
+{
+    assert(wid != 0);
+    assert(guard == 0 || guard == 1);
+
+    ATOMIC_INT_ADD(wid->readers[guard], -1);
+}
+
+XML_API int XML_APIENTRY
+xmlWatchReload(xmlWatch *wid)
+{
+    int rv;
+
+    assert(wid != 0);
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&wid->mutex);
+#endif
+    rv = __zeroxml_watch_reload(wid);
+#if HAVE_PTHREAD_H
+    pthread_mutex_unlock(&wid->mutex);
+#endif
+
+    return rv;
+}
@@ -0,0 +1,330 @@
+/*
+ * test_allocator.c
+ *
+ * Tests for the allocator hooks and the memory limit of documents.
+ *
+ * Coverage
+ * --------
+ *  1. xmlSetAllocator routes all allocations to the allocator, every
+ *     allocation is freed again
+ *  2. A document allocator receives its context and all of its
+ *     allocations are freed by xmlClose
+ *  3. A node cache which exceeds the memory limit fails with
+ *     XML_OUT_OF_MEMORY, for XML_CACHE_NODES at open and for XML_LAZY_NODES
+ *     at lookup
+ *  4. A string which exceeds the memory limit fails with XML_OUT_OF_MEMORY
+ *  5. The memory limit applies to the arena of XML_ARENA
+ *  6. Strings which are kept count against the memory limit until they
+ *     are freed, also after xmlClose
+ *  7. The buffer of a document which is read counts against the limit
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define NUM_ITEMS	2000
+#define NUM_STRINGS	10000
+
+static char fname[1024];
+
+/* the number of outstanding allocations of an allocator */
+typedef struct
+{
+    long allocs;
+    long outstanding;
+} counter;
+
+static void *counted_alloc(size_t size, void *context)
+{
+    counter *c = (counter*)context;
+    void *rv = malloc(size);
+
+    if (!c) return rv;
+    if (rv) { c->allocs++; c->outstanding++; }
+    return rv;
+}
+
+static void *counted_resize(void *ptr, size_t size, void *context)
+{
+    counter *c = (counter*)context;
+    void *rv = realloc(ptr, size);
+
+    if (!c) return rv;
+    if (!ptr && rv) { c->allocs++; c->outstanding++; }
+    return rv;
+}
+
+static void counted_release(void *ptr, void *context)
+{
+    counter *c = (counter*)context;
+
+    if (c && ptr) c->outstanding--;
+    free(ptr);
+}
+
+static void write_doc(void)
+{
+    FILE *f = fopen(fname, "wb");
+    int i;
+
+    if (!f) return;
+
+    fprintf(f, "<?xml version=\"1.0\"?>\n<root>\n  <items>\n");
+    for (i=0; i<NUM_ITEMS; i++) {
+        fprintf(f, "    <item><value>%i</value><name>item</name></item>\n", i);
+    }
+    fprintf(f, "  </items>\n  <last>end</last>\n</root>\n");
+    fclose(f);
+}
+
+static xmlId *open_file(enum xmlFlags flags, const xmlAllocator *allocator, size_t max_memory)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+    options.allocator = allocator;
+    options.limits.max_memory = max_memory;
+
+    return xmlOpenOptions(fname, &options);
+}
+
+static void lookups(const xmlId *id)
+{
+    xmlId *xid = xmlNodeGet(id, "/root/items/item[10]");
+    char *s = xid ? xmlNodeGetString(xid, "name") : NULL;
+
+    xmlFree(s);
+    xmlFree(xid);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_global(void)
+{
+    xmlAllocator allocator;
+    xmlId *id, *arena;
+    counter c;
+
+    memset(&c, 0, sizeof(c));
+    allocator.alloc = counted_alloc;
+    allocator.resize = counted_resize;
+    allocator.release = counted_release;
+    allocator.context = &c;
+    xmlSetAllocator(&allocator);
+
+    /* the strings made by malloc are freed while an arena exists */
+    arena = open_file(XML_LAZY_NODES|XML_ARENA, NULL, 0);
+    if (arena) lookups(arena);
+
+    id = open_file(XML_CACHE_NODES, NULL, 0);
+    CHECK("open with the allocator", id != NULL, 1);
+    if (id)
+    {
+        lookups(id);
+        xmlClose(id);
+    }
+    if (arena) xmlClose(arena);
+    xmlSetAllocator(NULL);
+
+    CHECK("allocations use the allocator", c.allocs > NUM_ITEMS, 1);
+    CHECK("all allocations are freed", c.outstanding, 0);
+}
+
+static void test_document(void)
+{
+    xmlAllocator allocator;
+    counter c;
+    xmlId *id;
+
+    memset(&c, 0, sizeof(c));
+    allocator.alloc = counted_alloc;
+    allocator.resize = counted_resize;
+    allocator.release = counted_release;
+    allocator.context = &c;
+
+    id = open_file(XML_CACHE_NODES, &allocator, 0);
+    CHECK("open with a document allocator", id != NULL, 1);
+    CHECK("the node cache uses the document allocator", c.allocs > NUM_ITEMS,
+          1);
+    if (id)
+    {
+        CHECK("lookup", xmlNodeGetInt(id, "/root/items/item[100]/value"), 99);
+        lookups(id);
+        xmlClose(id);
+    }
+    CHECK("xmlClose frees the document allocations", c.outstanding, 0);
+}
+
+static void test_limit(void)
+{
+    xmlId *id;
+    char *s;
+
+    xmlErrorGetNo(NULL, 1);
+    id = open_file(XML_CACHE_NODES, NULL, 64*1024);
+    CHECK("node cache exceeds the limit", id == NULL, 1);
+    CHECK("node cache error", xmlErrorGetNo(NULL, 1), XML_OUT_OF_MEMORY);
+    if (id) xmlClose(id);
+
+    id = open_file(XML_CACHE_NODES, NULL, 16*1024*1024);
+    CHECK("node cache within the limit", id != NULL, 1);
+    if (id) xmlClose(id);
+
+    id = open_file(XML_LAZY_NODES, NULL, 64*1024);
+    CHECK("lazy open within the limit", id != NULL, 1);
+    if (id)
+    {
+        CHECK("lookup of a few nodes", xmlNodeGetInt(id, "/root/last"), 0);
+        xmlErrorGetNo(id, 1);
+        xmlNodeGetInt(id, "/root/items/item[1500]/value");
+        CHECK("lookup exceeds the limit", xmlErrorGetNo(id, 1),
+              XML_OUT_OF_MEMORY);
+        xmlClose(id);
+    }
+
+    id = open_file(XML_SCAN_NODES, NULL, 16*1024);
+    if (id)
+    {
+        xmlId *xid = xmlNodeGet(id, "/root/items/item[5]");
+
+        s = xid ? xmlGetString(xid) : NULL;
+        CHECK("small string within the limit", s != NULL, 1);
+        xmlFree(s);
+        xmlFree(xid);
+
+        xmlErrorGetNo(id, 1);
+        xid = xmlNodeGet(id, "/root/items");
+        s = xid ? xmlGetString(xid) : NULL;
+        CHECK("string exceeds the limit", s == NULL, 1);
+        CHECK("string error", xmlErrorGetNo(xid, 1), XML_OUT_OF_MEMORY);
+        xmlFree(s);
+        xmlFree(xid);
+        xmlClose(id);
+    }
+}
+
+static void test_arena(void)
+{
+    xmlId *id;
+
+    xmlErrorGetNo(NULL, 1);
+    id = open_file(XML_CACHE_NODES|XML_ARENA, NULL, 32*1024);
+    CHECK("arena exceeds the limit", id == NULL, 1);
+    if (id) xmlClose(id);
+
+    id = open_file(XML_CACHE_NODES|XML_ARENA, NULL, 16*1024*1024);
+    CHECK("arena within the limit", id != NULL, 1);
+    if (id)
+    {
+        CHECK("lookup", xmlNodeGetInt(id, "/root/items/item[1500]/value"),
+              1499);
+        xmlClose(id);
+    }
+}
+
+static void test_kept_strings(void)
+{
+    static char *s[NUM_STRINGS];
+    xmlAllocator allocator;
+    counter c;
+    xmlId *id;
+    int i, n;
+
+    id = open_file(XML_SCAN_NODES, NULL, 64*1024);
+    if (id)
+    {
+        for (n=0; n<NUM_STRINGS; n++)
+        {
+            s[n] = xmlNodeGetString(id, "/root/last");
+            if (!s[n]) break;
+        }
+        CHECK("kept strings exceed the limit", n > 0 && n < NUM_STRINGS, 1);
+        CHECK("kept strings error", xmlErrorGetNo(id, 1), XML_OUT_OF_MEMORY);
+
+        for (i=0; i<n; i++) {
+            xmlFree(s[i]);
+        }
+        s[0] = xmlNodeGetString(id, "/root/last");
+        CHECK("freed strings release the limit", s[0] != NULL, 1);
+        xmlFree(s[0]);
+        xmlClose(id);
+    }
+
+    memset(&c, 0, sizeof(c));
+    allocator.alloc = counted_alloc;
+    allocator.resize = counted_resize;
+    allocator.release = counted_release;
+    allocator.context = &c;
+
+    id = open_file(XML_SCAN_NODES, &allocator, 1024*1024);
+    if (id)
+    {
+        s[0] = xmlNodeGetString(id, "/root/last");
+        xmlClose(id);
+        CHECK("a string outlives xmlClose", c.outstanding > 0, 1);
+        CHECK("string value after xmlClose", s[0] && !strcmp(s[0], "end"), 1);
+        xmlFree(s[0]);
+        CHECK("xmlFree releases the last allocation", c.outstanding, 0);
+    }
+}
+
+static void test_read(void)
+{
+    xmlOptions options;
+    xmlId *id;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = XML_SCAN_NODES;
+    options.io.flags = XML_IO_READ;
+    options.limits.max_memory = 64*1024;
+
+    xmlErrorGetNo(NULL, 1);
+    id = xmlOpenOptions(fname, &options);
+    CHECK("read buffer exceeds the limit", id == NULL, 1);
+    CHECK("read buffer error", xmlErrorGetNo(NULL, 1), XML_OUT_OF_MEMORY);
+    if (id) xmlClose(id);
+
+    options.limits.max_memory = 1024*1024;
+    id = xmlOpenOptions(fname, &options);
+    CHECK("read buffer within the limit", id != NULL, 1);
+    if (id) xmlClose(id);
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_allocator: allocator and memory limit tests ===\n\n");
+
+    snprintf(fname, sizeof(fname), "/tmp/test_allocator-%i.xml", (int)getpid());
+    write_doc();
+
+    test_global();
+    test_document();
+    test_limit();
+    test_arena();
+    test_kept_strings();
+    test_read();
+
+    remove(fname);
+
+    return test_results();
+}
@@ -0,0 +1,383 @@
+/*
+ * test_arena.c
+ *
+ * Tests for documents opened with XML_ARENA.
+ *
+ * Coverage
+ * --------
+ *  1. Lookups give the same nodes as a document without an arena
+ *  2. xmlFree does not release XML-ids and strings from the arena
+ *  3. xmlArenaRelease rewinds the arena to the position of xmlArenaMark,
+ *     also when the arena grew by more than one chunk
+ *  4. The lazy and background node caches, shared documents and xmlReopen
+ *  5. xmlNodeCopy of a node of a document with an arena
+ *  6. Documents without an arena
+ *  7. Lookups from several threads, also while other documents with and
+ *     without an arena are opened and closed
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define NUM_ITEMS	200
+#define NUM_LOOKUPS	10000
+#define NUM_THREADS	4
+
+static char fname[1024];
+
+static void write_doc(int offset)
+{
+    FILE *f = fopen(fname, "wb");
+    int i;
+
+    if (!f) return;
+
+    fprintf(f, "<?xml version=\"1.0\"?>\n<root>\n  <!-- items -->\n");
+    fprintf(f, "  <items>\n");
+    for (i=0; i<NUM_ITEMS; i++)
+    {
+        fprintf(f, "    <item id=\"%i\"><value>%i</value>", i, i+offset);
+        fprintf(f, "<name>item number %i</name></item>\n", i);
+    }
+    fprintf(f, "  </items>\n  <last>end</last>\n</root>\n");
+    fclose(f);
+}
+
+static xmlId *open_file(enum xmlFlags flags)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    return xmlOpenOptions(fname, &options);
+}
+
+static int item_value(const xmlId *id, int item)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/root/items/item[%i]/value", item+1);
+    return id ? (int)xmlNodeGetInt(id, path) : -1;
+}
+
+/*
+ * Compare the nodes of two documents, the number of differences is
+ * returned.
+ */
+static int compare(const xmlId *a, const xmlId *b)
+{
+    int num = xmlNodeGetNum(a, "*");
+    int rv = 0;
+    int i;
+
+    if (num != xmlNodeGetNum(b, "*")) return 1;
+
+    for (i=0; i<num; i++)
+    {
+        xmlId *xa = xmlMarkId(a);
+        xmlId *xb = xmlMarkId(b);
+
+        if (xmlNodeGetPos(a, xa, "*", i) && xmlNodeGetPos(b, xb, "*", i))
+        {
+            char *na = xmlNodeGetName(xa);
+            char *nb = xmlNodeGetName(xb);
+            char *sa = xmlGetString(xa);
+            char *sb = xmlGetString(xb);
+
+            if (!na || !nb || strcmp(na, nb)) rv++;
+            if ((sa || sb) && (!sa || !sb || strcmp(sa, sb))) rv++;
+            rv += compare(xa, xb);
+
+            xmlFree(na);
+            xmlFree(nb);
+            xmlFree(sa);
+            xmlFree(sb);
+        }
+        else {
+            rv++;
+        }
+        xmlFree(xa);
+        xmlFree(xb);
+    }
+
+    return rv;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_lookups(void)
+{
+    xmlId *id, *ref, *xid;
+
+    write_doc(0);
+    id = open_file(XML_CACHE_NODES|XML_ARENA);
+    ref = open_file(XML_CACHE_NODES);
+    CHECK("open with an arena", id != NULL, 1);
+    if (id && ref)
+    {
+        char *s;
+
+        CHECK("same nodes as without an arena", compare(id, ref), 0);
+        CHECK("node value", item_value(id, 150), 150);
+
+        s = xmlNodeGetString(id, "/root/items/item[3]/name");
+        CHECK("node string", s && !strcmp(s, "item number 2"), 1);
+        xmlFree(s);
+
+        xid = xmlNodeGet(id, "/root/items/item[3]/name");
+        s = xid ? xmlNodeGetName(xid) : NULL;
+        CHECK("node name", s && !strcmp(s, "name"), 1);
+        xmlFree(s);
+        xmlFree(xid);
+    }
+    if (ref) xmlClose(ref);
+    if (id) xmlClose(id);
+}
+
+static void test_free(void)
+{
+    xmlId *id = open_file(XML_CACHE_NODES|XML_ARENA);
+
+    if (id)
+    {
+        size_t mark = xmlArenaMark(id);
+        xmlId *xid = xmlNodeGet(id, "/root/last");
+        char *s = xmlGetString(xid);
+
+        xmlFree(s);
+        xmlFree(xid);
+        CHECK("xmlFree keeps the allocations", xmlArenaMark(id) > mark, 1);
+        CHECK("string after xmlFree", s && !strcmp(s, "end"), 1);
+
+        xmlArenaRelease(id, mark);
+        CHECK("xmlArenaRelease", xmlArenaMark(id) == mark, 1);
+        xmlClose(id);
+    }
+}
+
+static void test_release(void)
+{
+    xmlId *id = open_file(XML_CACHE_NODES|XML_ARENA);
+
+    if (id)
+    {
+        size_t mark = xmlArenaMark(id);
+        int errors = 0;
+        size_t pos;
+        int i, j;
+
+        for (i=0; i<NUM_LOOKUPS; i++)
+        {
+            size_t scope = xmlArenaMark(id);
+            xmlId *xid = xmlNodeGet(id, "/root/items");
+            char *s = xmlGetString(xid);
+
+            if (!s || !strstr(s, "item number 199")) errors++;
+            if (item_value(id, i % NUM_ITEMS) != i % NUM_ITEMS) errors++;
+            xmlArenaRelease(id, scope);
+        }
+        CHECK("lookups in a scope", errors, 0);
+        CHECK("scopes leave the arena as it was", xmlArenaMark(id) == mark, 1);
+
+        /* strings of the whole document grow the arena by many chunks */
+        for (i=0; i<3; i++)
+        {
+            xmlId *xid = xmlNodeGet(id, "/root");
+
+            for (j=0; j<100; j++) {
+                xmlGetString(xid);
+            }
+            pos = xmlArenaMark(id);
+            xmlArenaRelease(id, mark);
+            if (xmlArenaMark(id) != mark) errors++;
+        }
+        CHECK("arena grew", pos > 1000000, 1);
+        CHECK("release of several chunks", errors, 0);
+        CHECK("lookup after a release", item_value(id, 42), 42);
+
+        xmlArenaRelease(id, 0);
+        CHECK("release of everything", xmlArenaMark(id), 0);
+        CHECK("lookup after releasing everything", item_value(id, 7), 7);
+        xmlClose(id);
+    }
+}
+
+static void test_modes(void)
+{
+    xmlId *id, *xid;
+
+    write_doc(0);
+    id = open_file(XML_LAZY_NODES|XML_ARENA);
+    CHECK("lazy node cache", item_value(id, 99), 99);
+    if (id) xmlClose(id);
+
+    id = open_file(XML_BACKGROUND_NODES|XML_ARENA);
+    if (id) xmlWaitIndexed(id);
+    CHECK("background node cache", item_value(id, 99), 99);
+    if (id) xmlClose(id);
+
+    id = open_file(XML_SCAN_NODES|XML_ARENA);
+    CHECK("no node cache", item_value(id, 99), 99);
+    if (id) xmlClose(id);
+
+    id = open_file(XML_CACHE_NODES|XML_SHARE_DOCUMENT|XML_ARENA);
+    xid = open_file(XML_CACHE_NODES|XML_SHARE_DOCUMENT|XML_ARENA);
+    CHECK("shared document", item_value(xid, 10), 10);
+    if (id) xmlClose(id);
+    CHECK("shared document after closing the first open",
+          item_value(xid, 11), 11);
+    if (xid) xmlClose(xid);
+
+    id = open_file(XML_CACHE_NODES|XML_ARENA);
+    write_doc(1000);
+    if (id)
+    {
+        xmlOptions options;
+
+        memset(&options, 0, sizeof(options));
+        options.flags = XML_CACHE_NODES|XML_ARENA;
+        xid = xmlReopen(id, fname, &options);
+        xmlClose(id);
+        CHECK("xmlReopen", item_value(xid, 10), 1010);
+        CHECK("xmlReopen of the last node", item_value(xid, 199), 1199);
+        if (xid) xmlClose(xid);
+    }
+}
+
+static void test_copy(void)
+{
+    xmlId *id, *copy;
+
+    write_doc(0);
+    id = open_file(XML_CACHE_NODES|XML_ARENA);
+    copy = id ? xmlNodeCopy(id, "/root/items/item[6]") : NULL;
+    CHECK("node copy", copy != NULL, 1);
+    if (id) xmlClose(id);
+    if (copy)
+    {
+        CHECK("node copy after closing the document",
+              xmlNodeGetInt(copy, "value"), 5);
+        xmlClose(copy);
+    }
+}
+
+static void test_no_arena(void)
+{
+    xmlId *id = open_file(XML_CACHE_NODES);
+
+    if (id)
+    {
+        xmlId *xid = xmlNodeGet(id, "/root/last");
+
+        CHECK("no arena", xmlArenaMark(id), 0);
+        CHECK("no arena for a node", xmlArenaMark(xid), 0);
+        xmlArenaRelease(id, 0);
+        CHECK("release without an arena", item_value(id, 3), 3);
+        xmlFree(xid);
+        xmlClose(id);
+    }
+}
+
+#if HAVE_PTHREAD_H
+static void *worker(void *arg)
+{
+    const xmlId *id = ((void**)arg)[0];
+    int *errors = ((void**)arg)[1];
+    int i;
+
+    for (i=0; i<NUM_LOOKUPS/NUM_THREADS; i++)
+    {
+        int item = (i*7) % NUM_ITEMS;
+        xmlId *xid = xmlMarkId(id);
+        char *s;
+
+        if (item_value(id, item) != item) (*errors)++;
+        s = xmlNodeGetString(xid, "/root/last");
+        if (!s || strcmp(s, "end")) (*errors)++;
+        xmlFree(s);
+        xmlFree(xid);
+
+        /* arenas are created and destroyed while the others free theirs */
+        if ((i % 100) == 0)
+        {
+            xmlId *doc = open_file(XML_SCAN_NODES|(i % 200 ? XML_ARENA : 0));
+
+            s = doc ? xmlNodeGetString(doc, "/root/last") : NULL;
+            if (!s || strcmp(s, "end")) (*errors)++;
+            xmlFree(s);
+            if (doc) xmlClose(doc);
+        }
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    pthread_t threads[NUM_THREADS];
+    void *args[NUM_THREADS][2];
+    int errors[NUM_THREADS];
+    xmlId *id;
+    int i;
+
+    id = open_file(XML_LAZY_NODES|XML_ARENA);
+    if (!id) return;
+
+    for (i=0; i<NUM_THREADS; i++)
+    {
+        errors[i] = 0;
+        args[i][0] = id;
+        args[i][1] = &errors[i];
+        pthread_create(&threads[i], NULL, worker, args[i]);
+    }
+    for (i=0; i<NUM_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        CHECK("lookups from a thread", errors[i], 0);
+    }
+    xmlClose(id);
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_arena: document arena tests ===\n\n");
+
+    snprintf(fname, sizeof(fname), "/tmp/test_arena-%i.xml", (int)getpid());
+
+    test_lookups();
+    test_free();
+    test_release();
+    test_modes();
+    test_copy();
+    test_no_arena();
+#if HAVE_PTHREAD_H
+    test_threads();
+#endif
+
+    remove(fname);
+
+    return test_results();
+}
@@ -0,0 +1,263 @@
+/*
+ * test_background.c
+ *
+ * Tests for building the node cache in a background thread with
+ * XML_BACKGROUND_NODES.
+ *
+ * Coverage
+ * --------
+ *  1. Lookups before and after the node cache is ready match XML_CACHE_NODES
+ *  2. xmlWaitIndexed and xmlIsIndexed report the node cache as ready
+ *  3. XML-ids taken while scanning remain valid after the switch over
+ *  4. A build error is reported by xmlWaitIndexed and lookups keep scanning,
+ *     which reports the same error
+ *  5. Closing the document while the node cache is being built
+ *  6. xmlIsIndexed for the other modes
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define ITEMS		20000
+
+static const char *paths[] = {
+    "/config/server/host",
+    "/config/server/port",
+    "/config/server/paths/path[2]",
+    "/config/items/item[0]/value",
+    "/config/items/item[19999]/value",
+    "/config/items/item[20000]/value",
+    "/config/missing/node",
+    NULL
+};
+
+static char *xml = NULL;
+static int xml_len = 0;
+
+static char *create_document(void)
+{
+    const char *head =
+        "<?xml version=\"1.0\"?>\n"
+        "<config>\n"
+        "  <server name=\"main\">\n"
+        "    <host>localhost</host>\n"
+        "    <port>8080</port>\n"
+        "    <paths><path>/a</path><path>/b</path></paths>\n"
+        "  </server>\n"
+        "  <items>\n";
+    const char *tail = "  </items>\n</config>\n";
+    size_t size = strlen(head) + strlen(tail) + ITEMS*64;
+    char *rv = malloc(size);
+
+    if (rv)
+    {
+        char *ptr = rv;
+        int i;
+
+        ptr += sprintf(ptr, "%s", head);
+        for (i=0; i<ITEMS; i++) {
+            ptr += sprintf(ptr, "    <item><value>%i</value></item>\n", i);
+        }
+        ptr += sprintf(ptr, "%s", tail);
+        xml_len = ptr - rv;
+    }
+    return rv;
+}
+
+static xmlId *open_buffer(const char *buf, int len, enum xmlFlags flags)
+{
+    return xmlInitBufferFlags(buf, len, flags);
+}
+
+static int num_items(xmlId *id)
+{
+    xmlId *iid = xmlNodeGet(id, "/config/items");
+    int rv = 0;
+
+    if (iid)
+    {
+        rv = xmlNodeGetNum(iid, "item");
+        xmlFree(iid);
+    }
+    return rv;
+}
+
+static int same_results(xmlId *cid, xmlId *bid)
+{
+    int i, rv = 1;
+
+    for (i=0; paths[i]; i++)
+    {
+        char *cs = xmlNodeGetString(cid, paths[i]);
+        char *bs = xmlNodeGetString(bid, paths[i]);
+
+        if (!((!cs && !bs) || (cs && bs && !strcmp(cs, bs))))
+        {
+            printf("         %s = '%s', expected '%s'\n", paths[i],
+                   bs ? bs : "(null)", cs ? cs : "(null)");
+            rv = 0;
+        }
+        xmlFree(cs);
+        xmlFree(bs);
+    }
+    return rv;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_same_results(void)
+{
+    xmlId *cid = open_buffer(xml, xml_len, XML_CACHE_NODES);
+    xmlId *bid = open_buffer(xml, xml_len, XML_BACKGROUND_NODES);
+
+    CHECK("background document opens", bid != NULL, 1);
+    if (cid && bid)
+    {
+        CHECK("lookups while building match the full cache",
+              same_results(cid, bid), 1);
+        CHECK("item count while building", num_items(bid), ITEMS);
+
+        CHECK("xmlWaitIndexed returns true", xmlWaitIndexed(bid), XML_TRUE);
+        CHECK("xmlIsIndexed after waiting", xmlIsIndexed(bid), XML_TRUE);
+
+        CHECK("lookups after building match the full cache",
+              same_results(cid, bid), 1);
+        CHECK("item count after building", num_items(bid), ITEMS);
+    }
+    if (cid) xmlClose(cid);
+    if (bid) xmlClose(bid);
+}
+
+static void test_switch_over(void)
+{
+    xmlId *bid = open_buffer(xml, xml_len, XML_BACKGROUND_NODES);
+
+    if (bid)
+    {
+        xmlId *sid = xmlNodeGet(bid, "/config/server");
+
+        xmlWaitIndexed(bid);
+        CHECK("node taken before the switch over",
+              xmlNodeGetInt(sid, "port"), 8080);
+        if (sid)
+        {
+            xmlId *pid = xmlNodeGet(sid, "paths");
+            if (pid)
+            {
+                xmlId *xid = xmlMarkId(pid);
+                char str[8] = "";
+
+                if (xmlNodeGetPos(pid, xid, "path", 1)) {
+                    xmlCopyString(xid, str, sizeof(str));
+                }
+                CHECK("node by position after the switch over", str[1], 'b');
+                xmlFree(xid);
+                xmlFree(pid);
+            }
+            xmlFree(sid);
+        }
+        CHECK("root lookup after the switch over",
+              xmlNodeGetInt(bid, "/config/items/item[124]/value"), 123);
+        xmlClose(bid);
+    }
+}
+
+static void test_build_error(void)
+{
+    const char *bad =
+        "<config>\n"
+        "  <good><value>1</value></good>\n"
+        "  <bad><inner><!-- unterminated </inner></bad>\n"
+        "</config>\n";
+    xmlId *id = open_buffer(bad, (int)strlen(bad), XML_BACKGROUND_NODES);
+
+    CHECK("document with an error opens", id != NULL, 1);
+    if (id)
+    {
+        CHECK("xmlWaitIndexed returns false", xmlWaitIndexed(id), XML_FALSE);
+        CHECK("xmlWaitIndexed reports the error",
+              xmlErrorGetNo(id, 1), XML_INVALID_COMMENT);
+        CHECK("xmlIsIndexed returns false", xmlIsIndexed(id), XML_FALSE);
+        CHECK("lookups keep scanning the document",
+              xmlNodeGetInt(id, "/config/good/value"), 0);
+        CHECK("scanning reports the same error",
+              xmlErrorGetNo(id, 1), XML_INVALID_COMMENT);
+        xmlClose(id);
+    }
+}
+
+static void test_close_while_building(void)
+{
+    int i, opened = 0;
+
+    for (i=0; i<16; i++)
+    {
+        xmlId *id = open_buffer(xml, xml_len, XML_BACKGROUND_NODES);
+        if (id)
+        {
+            opened++;
+            xmlClose(id);
+        }
+    }
+    CHECK("documents closed while building", opened, 16);
+}
+
+static void test_other_modes(void)
+{
+    xmlId *id;
+
+    id = open_buffer(xml, xml_len, XML_SCAN_NODES);
+    if (id)
+    {
+        CHECK("scan mode is never indexed", xmlWaitIndexed(id), XML_FALSE);
+        xmlClose(id);
+    }
+
+    id = open_buffer(xml, xml_len, XML_CACHE_NODES);
+    if (id)
+    {
+        CHECK("cache mode is indexed right away", xmlIsIndexed(id), XML_TRUE);
+        xmlClose(id);
+    }
+
+    id = open_buffer(xml, xml_len, XML_CACHE_NODES|XML_BACKGROUND_NODES);
+    if (id)
+    {
+        CHECK("XML_CACHE_NODES takes precedence", xmlIsIndexed(id), XML_TRUE);
+        xmlClose(id);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_background: background node cache tests ===\n\n");
+
+    xml = create_document();
+    if (!xml)
+    {
+        printf("unable to allocate the test document\n");
+        return 1;
+    }
+
+    test_same_results();
+    test_switch_over();
+    test_build_error();
+    test_close_while_building();
+    test_other_modes();
+
+    free(xml);
+
+    return test_results();
+}
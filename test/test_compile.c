@@ -0,0 +1,351 @@
+/*
+ * test_compile.c
+ *
+ * Tests for compiled documents written by xmlCompile.
+ *
+ * Coverage
+ * --------
+ *  1. Lookups, attributes and walking nodes by position on a compiled
+ *     document match the original document
+ *  2. A compiled document is not scanned when it is opened
+ *  3. A compiled document opens with every node cache mode and with other
+ *     flags than it was compiled with
+ *  4. Corrupt and truncated compiled documents are rejected or scanned
+ *  5. xmlCompile fails without a complete node cache or an output file
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+/* offset of the document length in the header of a compiled document */
+#define DOC_LEN_OFFSET	64
+
+static const char *xml =
+    "<?xml version=\"1.0\"?>\n"
+    "<config>\n"
+    "  <server name=\"main\" port=\"8080\">\n"
+    "    <host>localhost</host>\n"
+    "    <paths>\n"
+    "      <path>/a</path>\n"
+    "      <!-- a comment -->\n"
+    "      <path>/b</path>\n"
+    "      <path>/c</path>\n"
+    "    </paths>\n"
+    "  </server>\n"
+    "  <data><![CDATA[<not>a</tag>]]></data>\n"
+    "  <empty/>\n"
+    "</config>\n";
+
+static const char *paths[] = {
+    "/config/server/host",
+    "/config/server/paths/path",
+    "/config/server/paths/path[3]",
+    "/config/data",
+    "/config/empty",
+    "/config/missing/node",
+    NULL
+};
+
+static char fname[1024];
+static char cname[1024+8];
+
+static void write_file(const char *name, const char *buf, size_t len)
+{
+    FILE *f = fopen(name, "wb");
+    if (f)
+    {
+        fwrite(buf, 1, len, f);
+        fclose(f);
+    }
+}
+
+static char *read_file(const char *name, long *len)
+{
+    FILE *f = fopen(name, "rb");
+    char *rv = NULL;
+
+    if (f)
+    {
+        fseek(f, 0, SEEK_END);
+        *len = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        rv = malloc(*len);
+        if (rv && fread(rv, 1, *len, f) != (size_t)*len)
+        {
+            free(rv);
+            rv = NULL;
+        }
+        fclose(f);
+    }
+    return rv;
+}
+
+static int compile(const char *doc, enum xmlFlags flags)
+{
+    xmlId *id;
+    int rv = 0;
+
+    write_file(fname, doc, strlen(doc));
+    id = xmlOpenFlags(fname, flags);
+    if (id)
+    {
+        rv = xmlCompile(id, cname);
+        xmlClose(id);
+    }
+    return rv;
+}
+
+/* returns 1 if the value of the node at path equals str */
+static int node_is(const xmlId *id, const char *path, const char *str)
+{
+    char *s = xmlNodeGetString(id, path);
+    int rv = (s && !strcmp(s, str));
+
+    xmlFree(s);
+    return rv;
+}
+
+static int comment_nodes(enum xmlFlags flags)
+{
+    xmlId *id = xmlOpenFlags(cname, flags);
+    int rv = -1;
+
+    if (id)
+    {
+        xmlId *pid = xmlNodeGet(id, "/config/server/paths");
+        if (pid)
+        {
+            rv = xmlNodeGetNum(pid, "*");
+            xmlFree(pid);
+        }
+        xmlClose(id);
+    }
+    return rv;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_same_results(void)
+{
+    xmlId *oid, *cid;
+    int i;
+
+    CHECK("document compiles", compile(xml, XML_CACHE_NODES), XML_TRUE);
+
+    oid = xmlOpenFlags(fname, XML_CACHE_NODES);
+    cid = xmlOpenFlags(cname, XML_CACHE_NODES);
+    CHECK("compiled document opens", cid != NULL, 1);
+    if (oid && cid)
+    {
+        xmlId *sid, *pid;
+
+        for (i=0; paths[i]; i++)
+        {
+            char *os = xmlNodeGetString(oid, paths[i]);
+            char *cs = xmlNodeGetString(cid, paths[i]);
+            int same = (!os && !cs) || (os && cs && !strcmp(os, cs));
+
+            printf("         %s = '%s'\n", paths[i], cs ? cs : "(null)");
+            CHECK("string value matches the original document", same, 1);
+            xmlFree(os);
+            xmlFree(cs);
+        }
+
+        sid = xmlNodeGet(cid, "/config/server");
+        if (sid)
+        {
+            CHECK("number of attributes", xmlAttributeGetNum(sid), 2);
+            xmlFree(sid);
+        }
+
+        pid = xmlNodeGet(cid, "/config/server/paths");
+        if (pid)
+        {
+            xmlId *xid = xmlMarkId(pid);
+            char str[8];
+
+            CHECK("number of nodes", xmlNodeGetNum(pid, "path"), 3);
+            for (i=0; i<3; i++)
+            {
+                str[1] = 0;
+                if (xmlNodeGetPos(pid, xid, "path", i)) {
+                    xmlCopyString(xid, str, sizeof(str));
+                }
+                CHECK("node by position", str[1], 'a'+i);
+            }
+            CHECK("comment node", comment_nodes(XML_CACHE_NODES), 4);
+            xmlFree(xid);
+            xmlFree(pid);
+        }
+    }
+    if (oid) xmlClose(oid);
+    if (cid) xmlClose(cid);
+}
+
+static void test_not_scanned(void)
+{
+    char *buf, *p;
+    long len;
+    xmlId *id;
+
+    if (!compile(xml, XML_CACHE_NODES)) return;
+
+    /* a closing tag which does not match would abort a scan */
+    buf = read_file(cname, &len);
+    if (!buf) return;
+    p = strstr(buf+len-(long)strlen(xml), "</host>");
+    p[5] = 'x';
+    write_file(cname, buf, len);
+
+    id = xmlOpenFlags(cname, XML_CACHE_NODES);
+    CHECK("compiled document opens without scanning", id != NULL, 1);
+    if (id)
+    {
+        CHECK("node value without scanning",
+              node_is(id, "/config/server/paths/path[2]", "/b"), 1);
+        xmlClose(id);
+    }
+
+    id = xmlOpenFlags(cname, XML_SCAN_NODES);
+    if (id)
+    {
+        CHECK("scan mode scans the compiled document",
+              xmlNodeGetString(id, "/config/server/host") == NULL, 1);
+        xmlClose(id);
+    }
+    free(buf);
+}
+
+static void test_modes(void)
+{
+    static const enum xmlFlags modes[] = {
+        XML_CACHE_NODES, XML_SCAN_NODES, XML_LAZY_NODES, XML_BACKGROUND_NODES
+    };
+    int i;
+
+    if (!compile(xml, XML_CACHE_NODES)) return;
+
+    for (i=0; i<(int)(sizeof(modes)/sizeof(modes[0])); i++)
+    {
+        xmlId *id = xmlOpenFlags(cname, modes[i]);
+        CHECK("compiled document opens", id != NULL, 1);
+        if (id)
+        {
+            CHECK("node value",
+                  node_is(id, "/config/server/host", "localhost"), 1);
+            xmlClose(id);
+        }
+    }
+
+    CHECK("comments are ignored with other flags",
+          comment_nodes(XML_CACHE_NODES|XML_IGNORE_COMMENT), 3);
+
+    CHECK("document compiles without comments",
+          compile(xml, XML_CACHE_NODES|XML_IGNORE_COMMENT), XML_TRUE);
+    CHECK("comments are ignored",
+          comment_nodes(XML_CACHE_NODES|XML_IGNORE_COMMENT), 3);
+    CHECK("comments are nodes with other flags",
+          comment_nodes(XML_CACHE_NODES), 4);
+}
+
+static void test_corrupt(void)
+{
+    long long doc_len;
+    char *buf;
+    long len;
+    xmlId *id;
+
+    if (!compile(xml, XML_CACHE_NODES)) return;
+
+    buf = read_file(cname, &len);
+    if (!buf) return;
+
+    /* the records do not match their hash, the document is scanned */
+    buf[len-(long)strlen(xml)-32] ^= 0x04;
+    write_file(cname, buf, len);
+    id = xmlOpenFlags(cname, XML_CACHE_NODES);
+    CHECK("document with corrupt records opens", id != NULL, 1);
+    if (id)
+    {
+        CHECK("node value from scanning",
+              node_is(id, "/config/server/host", "localhost"), 1);
+        xmlClose(id);
+    }
+
+    write_file(cname, buf, len/2);
+    CHECK("truncated compiled document is rejected",
+          xmlOpenFlags(cname, XML_CACHE_NODES) == NULL, 1);
+
+    /* a document length which overflows the offset of the document */
+    doc_len = 0x7fffffffffffffffLL;
+    memcpy(buf+DOC_LEN_OFFSET, &doc_len, sizeof(doc_len));
+    write_file(cname, buf, len);
+    id = xmlOpenFlags(cname, XML_CACHE_NODES);
+    CHECK("oversized document length is not trusted", id == NULL ||
+          node_is(id, "/config/server/host", "localhost"), 1);
+    if (id) xmlClose(id);
+    free(buf);
+}
+
+static void test_errors(void)
+{
+    xmlId *id;
+
+    write_file(fname, xml, strlen(xml));
+
+    id = xmlOpenFlags(fname, XML_LAZY_NODES);
+    if (id)
+    {
+        CHECK("no compiling without a complete node cache",
+              xmlCompile(id, cname), XML_FALSE);
+        xmlClose(id);
+    }
+
+    id = xmlOpenFlags(fname, XML_CACHE_NODES);
+    if (id)
+    {
+        CHECK("no compiling to a missing directory",
+              xmlCompile(id, "/nonexistent/directory/file.xmlc"), XML_FALSE);
+        CHECK("error for a missing directory",
+              xmlErrorGetNo(id, 1), XML_FILE_NOT_FOUND);
+        xmlClose(id);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_compile: compiled document tests ===\n\n");
+
+    snprintf(fname, sizeof(fname), "/tmp/test_compile-%i.xml", (int)getpid());
+    snprintf(cname, sizeof(cname), "%sc", fname);
+
+    test_same_results();
+    test_not_scanned();
+    test_modes();
+    test_corrupt();
+    test_errors();
+
+    remove(fname);
+    remove(cname);
+
+    return test_results();
+}
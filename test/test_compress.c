@@ -0,0 +1,418 @@
+/*
+ * test_compress.c
+ *
+ * Tests for opening gzip and zstd compressed documents.
+ *
+ * Coverage
+ * --------
+ *  1. A gzip compressed document opens with every node cache mode and
+ *     returns the same contents as the uncompressed document
+ *  2. Concatenated gzip members are decompressed as one document
+ *  3. Documents larger than the buffer size hint of the gzip trailer
+ *  4. Truncated and corrupt compressed documents are rejected
+ *  5. The decompressed document counts against the memory limit, a buffer
+ *     which is not a multiple of the page size is released completely
+ *  6. A zstd compressed document opens with every node cache mode
+ *  7. Concatenated zstd frames are decompressed as one document
+ *  8. zstd frames without the decompressed size in their header
+ *  9. Truncated zstd documents are rejected
+ *
+ * The gzip tests are skipped when the library is built without zlib and
+ * the zstd tests when it is built without zstd.
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+#if HAVE_ZSTD_H
+# include <zstd.h>
+#endif
+
+#include "xml.h"
+#include "api.h"
+#include "test_shared.h"
+
+#if HAVE_ZLIB_H || HAVE_ZSTD_H
+static int item_value(const char *name, enum xmlFlags flags, int item)
+{
+    xmlId *id = xmlOpenFlags(name, flags);
+    int rv = -1;
+
+    if (id)
+    {
+        char path[64];
+
+        snprintf(path, sizeof(path), "/root/item[%i]/value", item);
+        rv = (int)xmlNodeGetInt(id, path);
+        xmlClose(id);
+    }
+    return rv;
+}
+#endif
+
+#if HAVE_ZLIB_H
+static char fname[1024];
+
+/* write the items from first up to last as a gzip member */
+static int write_items(const char *mode, int first, int last, int head, int tail)
+{
+    gzFile f = gzopen(fname, mode);
+    int i;
+
+    if (!f) return 0;
+
+    if (head) gzprintf(f, "<?xml version=\"1.0\"?>\n<root>\n");
+    for (i=first; i<last; i++) {
+        gzprintf(f, "  <item><value>%i</value></item>\n", i);
+    }
+    if (tail) gzprintf(f, "</root>\n");
+    gzclose(f);
+
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_modes(void)
+{
+    static const enum xmlFlags modes[] = {
+        XML_CACHE_NODES, XML_SCAN_NODES, XML_LAZY_NODES, XML_BACKGROUND_NODES
+    };
+    int i;
+
+    if (!write_items("wb", 0, 1000, 1, 1)) return;
+
+    for (i=0; i<(int)(sizeof(modes)/sizeof(modes[0])); i++)
+    {
+        CHECK("compressed document first value", item_value(fname, modes[i], 1), 0);
+        CHECK("compressed document last value",
+              item_value(fname, modes[i], 1000), 999);
+    }
+}
+
+static void test_members(void)
+{
+    if (!write_items("wb", 0, 100, 1, 0)) return;
+    if (!write_items("ab", 100, 200, 0, 0)) return;
+    if (!write_items("ab", 200, 300, 0, 1)) return;
+
+    CHECK("first member", item_value(fname, XML_CACHE_NODES, 1), 0);
+    CHECK("last member", item_value(fname, XML_CACHE_NODES, 300), 299);
+}
+
+static void test_size_hint(void)
+{
+    /* the trailer of the last member only holds the size of that member */
+    if (!write_items("wb", 0, 100000, 1, 0)) return;
+    if (!write_items("ab", 100000, 100001, 0, 1)) return;
+
+    CHECK("document larger than the size hint",
+          item_value(fname, XML_CACHE_NODES, 100001), 100000);
+}
+
+static void test_limit(void)
+{
+    xmlOptions options;
+    xmlId *id;
+
+    /* a few hundred kilobytes which decompress to a few megabytes */
+    if (!write_items("wb", 0, 100000, 1, 1)) return;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = XML_SCAN_NODES;
+    options.limits.max_memory = 1024*1024;
+
+    xmlErrorGetNo(NULL, 1);
+    id = xmlOpenOptions(fname, &options);
+    CHECK("decompressed document exceeds the limit", id == NULL, 1);
+    CHECK("decompression error", xmlErrorGetNo(NULL, 1), XML_OUT_OF_MEMORY);
+    if (id) xmlClose(id);
+
+    options.limits.max_memory = 64*1024*1024;
+    id = xmlOpenOptions(fname, &options);
+    CHECK("decompressed document within the limit", id != NULL, 1);
+    if (id)
+    {
+        CHECK("value within the limit",
+              xmlNodeGetInt(id, "/root/item[100000]/value"), 99999);
+        xmlClose(id);
+    }
+}
+
+static void test_unaligned(void)
+{
+    struct _zeroxml_memory *mem;
+    size_t rlen = 0, buflen = 0;
+    xmlOptions options;
+    xmlId *id, *rid;
+    char *buf, *doc;
+    FILE *f;
+    long len;
+
+    /* decompresses to a length which is not a multiple of the page size */
+    if (!write_items("wb", 0, 200, 1, 1)) return;
+
+    f = fopen(fname, "rb");
+    if (!f) return;
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(len);
+    if (buf && fread(buf, 1, len, f) == (size_t)len)
+    {
+        mem = __zeroxml_memory_create(NULL, 1024*1024);
+        doc = __zeroxml_decompress(mem, buf, (size_t)len, &rlen, &buflen);
+        CHECK("unaligned document is decompressed", doc != NULL, 1);
+        CHECK("decompressed length is not page aligned", rlen % 4096 != 0, 1);
+        if (doc) __zeroxml_buffer_free(mem, doc, buflen);
+        CHECK("the charged buffer is released",
+              __zeroxml_memory_fits(mem, 1024*1024), 1);
+        __zeroxml_memory_destroy(mem);
+    }
+    free(buf);
+    fclose(f);
+
+    memset(&options, 0, sizeof(options));
+    options.flags = XML_CACHE_NODES;
+    options.limits.max_memory = 1024*1024;
+
+    id = xmlOpenOptions(fname, &options);
+    CHECK("unaligned document within the limit", id != NULL, 1);
+    if (id)
+    {
+        rid = xmlReopen(id, fname, &options);
+        CHECK("reopened unaligned document", rid != NULL, 1);
+        if (rid)
+        {
+            CHECK("reopened value", xmlNodeGetInt(rid, "/root/item[200]/value"),
+                  199);
+            xmlClose(rid);
+        }
+        xmlClose(id);
+    }
+
+    id = xmlOpenOptions(fname, &options);
+    CHECK("unaligned document opens again", id != NULL, 1);
+    if (id)
+    {
+        CHECK("value after opening again",
+              xmlNodeGetInt(id, "/root/item[200]/value"), 199);
+        xmlClose(id);
+    }
+}
+
+static void test_corrupt(void)
+{
+    FILE *f;
+    char *buf;
+    long len;
+
+    if (!write_items("wb", 0, 1000, 1, 1)) return;
+
+    f = fopen(fname, "rb");
+    if (!f) return;
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(len);
+    if (buf && fread(buf, 1, len, f) == (size_t)len)
+    {
+        fclose(f);
+
+        f = fopen(fname, "wb");
+        fwrite(buf, 1, len/2, f);
+        fclose(f);
+        CHECK("truncated document is rejected",
+              xmlOpenFlags(fname, XML_CACHE_NODES) == NULL, 1);
+
+        buf[len/2] ^= 0x55;
+        buf[len/2+1] ^= 0x55;
+        f = fopen(fname, "wb");
+        fwrite(buf, 1, len, f);
+        fclose(f);
+        CHECK("corrupt document is rejected",
+              xmlOpenFlags(fname, XML_CACHE_NODES) == NULL, 1);
+    }
+    else {
+        fclose(f);
+    }
+    free(buf);
+}
+#endif
+
+#if HAVE_ZSTD_H
+static char zname[1024];
+
+/* write the items from first up to last as a zstd frame */
+static int write_frame(const char *mode, int first, int last, int head, int tail, int content_size)
+{
+    size_t len = 0, clen;
+    char *doc, *cbuf = NULL;
+    ZSTD_CCtx *cctx;
+    int i, rv = 0;
+
+    doc = malloc(64 + (size_t)(last-first)*40);
+    if (!doc) return 0;
+
+    if (head) len += sprintf(doc+len, "<?xml version=\"1.0\"?>\n<root>\n");
+    for (i=first; i<last; i++) {
+        len += sprintf(doc+len, "  <item><value>%i</value></item>\n", i);
+    }
+    if (tail) len += sprintf(doc+len, "</root>\n");
+
+    clen = ZSTD_compressBound(len);
+    cctx = ZSTD_createCCtx();
+    if (cctx) cbuf = malloc(clen);
+    if (cbuf)
+    {
+        FILE *f;
+
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_contentSizeFlag, content_size);
+        clen = ZSTD_compress2(cctx, cbuf, clen, doc, len);
+        f = ZSTD_isError(clen) ? NULL : fopen(zname, mode);
+        if (f)
+        {
+            rv = (fwrite(cbuf, 1, clen, f) == clen);
+            fclose(f);
+        }
+    }
+    ZSTD_freeCCtx(cctx);
+    free(cbuf);
+    free(doc);
+
+    return rv;
+}
+
+/* cut the file to len bytes less than its size */
+static void truncate_file(const char *name, long len)
+{
+    FILE *f = fopen(name, "rb");
+    char *buf = NULL;
+    long size = 0;
+
+    if (!f) return;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size > len) buf = malloc(size);
+    if (buf && fread(buf, 1, size, f) == (size_t)size)
+    {
+        fclose(f);
+        f = fopen(name, "wb");
+        if (f) fwrite(buf, 1, size-len, f);
+    }
+    if (f) fclose(f);
+    free(buf);
+}
+
+static void test_zstd_modes(void)
+{
+    static const enum xmlFlags modes[] = {
+        XML_CACHE_NODES, XML_SCAN_NODES, XML_LAZY_NODES, XML_BACKGROUND_NODES
+    };
+    int i;
+
+    if (!write_frame("wb", 0, 1000, 1, 1, 1)) return;
+
+    for (i=0; i<(int)(sizeof(modes)/sizeof(modes[0])); i++)
+    {
+        CHECK("zstd document first value", item_value(zname, modes[i], 1), 0);
+        CHECK("zstd document last value",
+              item_value(zname, modes[i], 1000), 999);
+    }
+}
+
+static void test_zstd_frames(void)
+{
+    if (!write_frame("wb", 0, 100, 1, 0, 1)) return;
+    if (!write_frame("ab", 100, 200, 0, 0, 1)) return;
+    if (!write_frame("ab", 200, 300, 0, 1, 1)) return;
+
+    CHECK("first frame", item_value(zname, XML_CACHE_NODES, 1), 0);
+    CHECK("last frame", item_value(zname, XML_CACHE_NODES, 300), 299);
+}
+
+static void test_zstd_unknown_size(void)
+{
+    /* larger than the initial buffer of four times the compressed size */
+    if (!write_frame("wb", 0, 100000, 1, 1, 0)) return;
+
+    CHECK("frame without the decompressed size",
+          item_value(zname, XML_CACHE_NODES, 100000), 99999);
+
+    if (!write_frame("wb", 0, 100, 1, 0, 1)) return;
+    if (!write_frame("ab", 100, 100000, 0, 1, 0)) return;
+
+    CHECK("frames with and without the decompressed size",
+          item_value(zname, XML_CACHE_NODES, 100000), 99999);
+}
+
+static void test_zstd_truncated(void)
+{
+    if (!write_frame("wb", 0, 1000, 1, 1, 1)) return;
+    truncate_file(zname, 16);
+    CHECK("truncated zstd document is rejected",
+          xmlOpenFlags(zname, XML_CACHE_NODES) == NULL, 1);
+
+    if (!write_frame("wb", 0, 100, 1, 0, 1)) return;
+    if (!write_frame("ab", 100, 1000, 0, 1, 0)) return;
+    truncate_file(zname, 4);
+    CHECK("truncated last frame is rejected",
+          xmlOpenFlags(zname, XML_CACHE_NODES) == NULL, 1);
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_compress: compressed document tests ===\n\n");
+
+#if HAVE_ZLIB_H
+    snprintf(fname, sizeof(fname), "/tmp/test_compress-%i.xml.gz",
+             (int)getpid());
+
+    test_modes();
+    test_members();
+    test_size_hint();
+    test_limit();
+    test_unaligned();
+    test_corrupt();
+
+    remove(fname);
+#else
+    printf("  SKIP  built without zlib\n");
+#endif
+
+#if HAVE_ZSTD_H
+    snprintf(zname, sizeof(zname), "/tmp/test_compress-%i.xml.zst",
+             (int)getpid());
+
+    test_zstd_modes();
+    test_zstd_frames();
+    test_zstd_unknown_size();
+    test_zstd_truncated();
+
+    remove(zname);
+#else
+    printf("  SKIP  built without zstd\n");
+#endif
+
+    return test_results();
+}
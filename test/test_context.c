@@ -0,0 +1,319 @@
+/*
+ * test_context.c
+ *
+ * Tests for parser contexts which are reset onto one document after the
+ * other.
+ *
+ * Coverage
+ * --------
+ *  1. Every document of a context is processed as by xmlInitBuffer
+ *  2. A document with an error returns NULL and the context stays usable,
+ *     xmlReset64 processes the documents as xmlReset does
+ *  3. The node cache modes and documents with a different character set
+ *  4. After the first documents a reset and lookups do not allocate memory
+ *  5. A context for every thread
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define NUM_MESSAGES	1000
+#define NUM_THREADS	4
+
+static const char *latin1 =
+    "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
+    "<msg><id>7</id><body>latin</body></msg>\n";
+
+/* the number of allocations of the library */
+static long allocs = 0;
+
+static void *counted_alloc(size_t size, void *context)
+{
+    allocs++;
+    return malloc(size);
+}
+
+static void *counted_resize(void *ptr, size_t size, void *context)
+{
+    allocs++;
+    return realloc(ptr, size);
+}
+
+static void counted_release(void *ptr, void *context)
+{
+    free(ptr);
+}
+
+static int message(char *buf, size_t size, int n)
+{
+    return snprintf(buf, size,
+                    "<?xml version=\"1.0\"?>\n<msg>\n"
+                    "  <id>%i</id>\n  <items><item>%i</item><item>%i</item>"
+                    "</items>\n  <body>message number %i</body>\n</msg>\n",
+                    n, 2*n, 3*n, n);
+}
+
+/* check the values of message n, the number of differences is returned */
+static int check_message(const xmlId *id, int n)
+{
+    char body[64], expected[64];
+    int rv = 0;
+
+    if (!id) return 1;
+
+    if (xmlNodeGetInt(id, "/msg/id") != n) rv++;
+    if (xmlNodeGetInt(id, "/msg/items/item[2]") != 3*n) rv++;
+    xmlNodeCopyString(id, "/msg/body", body, sizeof(body));
+    snprintf(expected, sizeof(expected), "message number %i", n);
+    if (strcmp(body, expected)) rv++;
+
+    return rv;
+}
+
+static xmlContext *open_context(enum xmlFlags flags)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    return xmlContextOpen(&options);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_messages(void)
+{
+    xmlContext *ctx = xmlContextOpen(NULL);
+    int i, errors = 0;
+    char buf[256];
+
+    CHECK("context", ctx != NULL, 1);
+    if (!ctx) return;
+
+    for (i=0; i<NUM_MESSAGES; i++)
+    {
+        int len = message(buf, sizeof(buf), i);
+        xmlId *id = xmlReset(ctx, buf, len);
+        xmlId *ref = xmlInitBuffer(buf, len);
+        char *a = id ? xmlNodeGetString(id, "/msg/body") : NULL;
+        char *b = ref ? xmlNodeGetString(ref, "/msg/body") : NULL;
+
+        errors += check_message(id, i);
+        if (!a || !b || strcmp(a, b)) errors++;
+        xmlFree(a);
+        xmlFree(b);
+        if (ref) xmlClose(ref);
+    }
+    CHECK("documents of a context", errors, 0);
+
+    xmlContextClose(ctx);
+}
+
+static void test_errors(void)
+{
+    const char *bad = "<msg><a></b></msg>";
+    xmlContext *ctx = xmlContextOpen(NULL);
+    char buf[256];
+    xmlId *id;
+    int len;
+
+    if (!ctx) return;
+
+    len = message(buf, sizeof(buf), 1);
+    id = xmlReset(ctx, buf, len);
+    CHECK("first document", check_message(id, 1), 0);
+
+    id = xmlReset(ctx, bad, (int)strlen(bad));
+    CHECK("document with an error", id == NULL, 1);
+    CHECK("error of the document", xmlErrorGetNo(NULL, 1) != XML_NO_ERROR, 1);
+
+    len = message(buf, sizeof(buf), 2);
+    id = xmlReset(ctx, buf, len);
+    CHECK("document after an error", check_message(id, 2), 0);
+
+    CHECK("empty buffer", xmlReset(ctx, buf, 0) == NULL, 1);
+    id = xmlReset(ctx, buf, len);
+    CHECK("document after an empty buffer", check_message(id, 2), 0);
+
+    CHECK("negative size", xmlReset(ctx, buf, -1) == NULL, 1);
+    len = message(buf, sizeof(buf), 3);
+    id = xmlReset64(ctx, buf, (size_t)len);
+    CHECK("document of a size_t size", check_message(id, 3), 0);
+
+    xmlContextClose(ctx);
+
+    /* a context without a document */
+    ctx = xmlContextOpen(NULL);
+    xmlContextClose(ctx);
+    xmlContextClose(NULL);
+}
+
+static void test_modes(void)
+{
+    enum xmlFlags modes[3] = {
+        XML_SCAN_NODES, XML_LAZY_NODES, XML_BACKGROUND_NODES
+    };
+    char buf[256];
+    int m, i;
+
+    for (m=0; m<3; m++)
+    {
+        xmlContext *ctx = open_context(modes[m]);
+        int errors = 0;
+
+        if (!ctx) continue;
+        for (i=0; i<100; i++)
+        {
+            int len = message(buf, sizeof(buf), i);
+            errors += check_message(xmlReset(ctx, buf, len), i);
+        }
+        CHECK("node cache mode", errors, 0);
+        xmlContextClose(ctx);
+    }
+
+    {
+        xmlContext *ctx = xmlContextOpen(NULL);
+        int errors = 0;
+
+        if (!ctx) return;
+        for (i=0; i<100; i++)
+        {
+            xmlId *id;
+
+            if (i % 2)
+            {
+                id = xmlReset(ctx, latin1, (int)strlen(latin1));
+                if (!id || xmlNodeGetInt(id, "/msg/id") != 7) errors++;
+                if (id && strcmp(xmlGetEncoding(id), "ISO-8859-1")) errors++;
+            }
+            else
+            {
+                int len = message(buf, sizeof(buf), i);
+                id = xmlReset(ctx, buf, len);
+                errors += check_message(id, i);
+            }
+        }
+        CHECK("documents with a different character set", errors, 0);
+        xmlContextClose(ctx);
+    }
+}
+
+static void test_allocations(void)
+{
+    xmlAllocator allocator;
+    xmlContext *ctx;
+    char buf[256];
+    int i, errors = 0;
+    long before;
+
+    allocator.alloc = counted_alloc;
+    allocator.resize = counted_resize;
+    allocator.release = counted_release;
+    allocator.context = NULL;
+    xmlSetAllocator(&allocator);
+
+    ctx = xmlContextOpen(NULL);
+    if (ctx)
+    {
+        for (i=0; i<10; i++)
+        {
+            int len = message(buf, sizeof(buf), i);
+            xmlId *id = xmlReset(ctx, buf, len);
+
+            errors += check_message(id, i);
+            if (id) xmlNodeGetString(id, "/msg/body");
+        }
+
+        before = allocs;
+        for (i=0; i<NUM_MESSAGES; i++)
+        {
+            int len = message(buf, sizeof(buf), i);
+            xmlId *id = xmlReset(ctx, buf, len);
+            char *s = id ? xmlNodeGetString(id, "/msg/body") : NULL;
+
+            errors += check_message(id, i);
+            if (!s) errors++;
+        }
+        CHECK("documents with lookups", errors, 0);
+        CHECK("no allocations", allocs - before, 0);
+        xmlContextClose(ctx);
+    }
+    xmlSetAllocator(NULL);
+}
+
+#if HAVE_PTHREAD_H
+static void *worker(void *arg)
+{
+    int *errors = arg;
+    xmlContext *ctx = xmlContextOpen(NULL);
+    char buf[256];
+    int i;
+
+    if (!ctx)
+    {
+        (*errors)++;
+        return NULL;
+    }
+    for (i=0; i<NUM_MESSAGES; i++)
+    {
+        int len = message(buf, sizeof(buf), i);
+        *errors += check_message(xmlReset(ctx, buf, len), i);
+    }
+    xmlContextClose(ctx);
+
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    pthread_t threads[NUM_THREADS];
+    int errors[NUM_THREADS];
+    int i;
+
+    for (i=0; i<NUM_THREADS; i++)
+    {
+        errors[i] = 0;
+        pthread_create(&threads[i], NULL, worker, &errors[i]);
+    }
+    for (i=0; i<NUM_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        CHECK("context of a thread", errors[i], 0);
+    }
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_context: parser context tests ===\n\n");
+
+    test_messages();
+    test_errors();
+    test_modes();
+    test_allocations();
+#if HAVE_PTHREAD_H
+    test_threads();
+#endif
+
+    return test_results();
+}
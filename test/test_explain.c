@@ -0,0 +1,180 @@
+/*
+ * test_explain.c
+ *
+ * Tests for the report of the steps of a path lookup.
+ *
+ * Coverage
+ * --------
+ *  1. xmlNodeGetExplain returns the same node as xmlNodeGet and one step for
+ *     every name of the path
+ *  2. A scan reports the siblings it examined and the subtrees it skipped
+ *  3. The walk stops at a step which is not found
+ *  4. Steps answered by the node cache, XML_LAZY_NODES only scans the first
+ *     time a level is visited
+ *  5. No more than max_steps steps are stored
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define MAX_STEPS	8
+
+static const char *doc =
+    "<?xml version=\"1.0\"?>\n"
+    "<root>\n"
+    "  <items>\n"
+    "    <item><value>1</value></item>\n"
+    "    <item><value>2</value></item>\n"
+    "    <item><value>3</value></item>\n"
+    "    <item><value>4</value></item>\n"
+    "  </items>\n"
+    "  <last>end</last>\n"
+    "</root>\n";
+
+static xmlExplainStep steps[MAX_STEPS];
+
+static xmlId *open_doc(enum xmlFlags flags)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    return xmlInitBufferOptions(doc, (int)strlen(doc), &options);
+}
+
+static void init_explain(xmlExplain *explain, int max_steps)
+{
+    memset(steps, 0, sizeof(steps));
+    explain->max_steps = max_steps;
+    explain->num_steps = -1;
+    explain->steps = steps;
+}
+
+static int step_name(const xmlExplainStep *step, const char *name)
+{
+    return ((int)strlen(name) == step->name_len &&
+            !strncmp(step->name, name, step->name_len));
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_scan(void)
+{
+    xmlId *id = open_doc(XML_SCAN_NODES);
+    xmlExplain explain;
+    xmlId *xid;
+    int i, cached = 0;
+
+    if (!id) return;
+
+    init_explain(&explain, MAX_STEPS);
+    xid = xmlNodeGetExplain(id, "/root/items/item[3]/value", &explain);
+    CHECK("node of the path", xid ? xmlGetInt(xid) : 0, 3);
+    CHECK("steps of the path", explain.num_steps, 4);
+    CHECK("name of a step", step_name(&steps[2], "item"), 1);
+    CHECK("occurrence of a step", steps[2].num, 2);
+    for (i=0; i<explain.num_steps; i++)
+    {
+        if (steps[i].cached) cached++;
+        if (!steps[i].found || !steps[i].bytes_scanned) cached++;
+    }
+    CHECK("every step is scanned", cached, 0);
+    CHECK("siblings examined", steps[2].siblings, 3);
+    CHECK("subtrees skipped", steps[2].subtrees_skipped, 2);
+    CHECK("siblings before the first node", steps[1].siblings, 1);
+    CHECK("scan stops at the node",
+          steps[1].bytes_scanned < strlen(doc) - strlen("<last>end</last>"), 1);
+    xmlFree(xid);
+
+    init_explain(&explain, MAX_STEPS);
+    xid = xmlNodeGetExplain(id, "/root/none/value", &explain);
+    CHECK("path which is not found", xid == NULL, 1);
+    CHECK("walk stops at the missing node", explain.num_steps, 2);
+    CHECK("missing node", steps[1].found, XML_FALSE);
+    CHECK("all siblings examined", steps[1].siblings, 2);
+    xmlFree(xid);
+
+    xmlClose(id);
+}
+
+static void test_cache(void)
+{
+    xmlId *id = open_doc(XML_CACHE_NODES);
+    xmlExplain explain;
+    xmlId *xid;
+
+    if (id)
+    {
+        init_explain(&explain, MAX_STEPS);
+        xid = xmlNodeGetExplain(id, "/root/items/item[2]/value", &explain);
+        CHECK("node from the node cache", xid ? xmlGetInt(xid) : 0, 2);
+        CHECK("step answered by the node cache", steps[2].cached, XML_TRUE);
+        CHECK("nothing scanned", steps[2].bytes_scanned, 0);
+        xmlFree(xid);
+        xmlClose(id);
+    }
+
+    id = open_doc(XML_LAZY_NODES);
+    if (id)
+    {
+        init_explain(&explain, MAX_STEPS);
+        xid = xmlNodeGetExplain(id, "/root/items/item[2]/value", &explain);
+        CHECK("node of a lazy node cache", xid ? xmlGetInt(xid) : 0, 2);
+        CHECK("first visit scans", steps[2].bytes_scanned > 0, 1);
+        xmlFree(xid);
+
+        init_explain(&explain, MAX_STEPS);
+        xid = xmlNodeGetExplain(id, "/root/items/item[4]/value", &explain);
+        CHECK("second visit", xid ? xmlGetInt(xid) : 0, 4);
+        CHECK("second visit uses the node cache", steps[2].cached, XML_TRUE);
+        CHECK("second visit does not scan", steps[2].bytes_scanned, 0);
+        xmlFree(xid);
+        xmlClose(id);
+    }
+}
+
+static void test_max_steps(void)
+{
+    xmlId *id = open_doc(XML_SCAN_NODES);
+    xmlExplain explain;
+    xmlId *xid;
+
+    if (!id) return;
+
+    init_explain(&explain, 2);
+    xid = xmlNodeGetExplain(id, "/root/items/item[4]/value", &explain);
+    CHECK("node of a longer path", xid ? xmlGetInt(xid) : 0, 4);
+    CHECK("steps stored", explain.num_steps, 2);
+    CHECK("entries after max_steps", steps[2].name == NULL, 1);
+    xmlFree(xid);
+
+    xmlClose(id);
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_explain: path lookup report tests ===\n\n");
+
+    test_scan();
+    test_cache();
+    test_max_steps();
+
+    return test_results();
+}
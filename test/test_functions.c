@@ -18,7 +18,8 @@ int main(int argc, char **argv)
     static char buf[BUFLEN+1];
     char *s, *e, *p = buf;
     const char *cs, *c, *b;
-    int i, hl, nl;
+    int i, nl;
+    off_t hl;
     xmlId *rid;
     double d;
     long l;
@@ -0,0 +1,332 @@
+/*
+ * test_index.c
+ *
+ * Tests for the sidecar file of the node cache, XML_INDEX_FILE.
+ *
+ * Coverage
+ * --------
+ *  1. Opening a document writes the sidecar and opening it again uses the
+ *     sidecar instead of writing a new one
+ *  2. Lookups through a node cache from the sidecar match a scanned cache
+ *  3. A sidecar is replaced when the document changed, also when the size
+ *     and the modification time of the file stayed the same
+ *  4. Corrupt and truncated sidecar files are rejected
+ *  5. A sidecar of different flags is not used
+ *  6. xmlOptions.index sets the name of the sidecar, a sidecar which can
+ *     not be written does not prevent opening the document
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <utime.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+static const char *xml =
+    "<?xml version=\"1.0\"?>\n"
+    "<config>\n"
+    "  <server name=\"main\">\n"
+    "    <host>localhost</host>\n"
+    "    <port>8080</port>\n"
+    "    <paths>\n"
+    "      <path>/a</path>\n"
+    "      <!-- a comment -->\n"
+    "      <path>/b</path>\n"
+    "      <path>/c</path>\n"
+    "    </paths>\n"
+    "  </server>\n"
+    "  <data><![CDATA[<not>a</tag>]]></data>\n"
+    "  <empty/>\n"
+    "</config>\n";
+
+static const char *paths[] = {
+    "/config/server/host",
+    "/config/server/port",
+    "/config/server/paths/path",
+    "/config/server/paths/path[2]",
+    "/config/server/paths/path[3]",
+    "/config/data",
+    "/config/empty",
+    "/config/missing/node",
+    NULL
+};
+
+static char fname[1024];
+static char iname[1024+8];
+
+static void write_file(const char *name, const char *buf, size_t len)
+{
+    FILE *f = fopen(name, "wb");
+    if (f)
+    {
+        fwrite(buf, 1, len, f);
+        fclose(f);
+    }
+}
+
+static xmlId *open_index(enum xmlFlags flags, const char *index)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags|XML_INDEX_FILE;
+    options.index = index;
+
+    return xmlOpenOptions(fname, &options);
+}
+
+/* the inode changes when the sidecar is replaced */
+static long sidecar_inode(const char *name)
+{
+    struct stat st;
+    return stat(name, &st) ? -1 : (long)st.st_ino;
+}
+
+static int port_value(enum xmlFlags flags)
+{
+    xmlId *id = open_index(flags, NULL);
+    int rv = -1;
+
+    if (id)
+    {
+        rv = (int)xmlNodeGetInt(id, "/config/server/port");
+        xmlClose(id);
+    }
+    return rv;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_reopen(void)
+{
+    long ino;
+
+    write_file(fname, xml, strlen(xml));
+    remove(iname);
+
+    CHECK("document opens", port_value(XML_CACHE_NODES), 8080);
+    ino = sidecar_inode(iname);
+    CHECK("the sidecar is written", ino != -1, 1);
+
+    CHECK("document opens with the sidecar", port_value(XML_CACHE_NODES), 8080);
+    CHECK("a current sidecar is not replaced", sidecar_inode(iname), ino);
+
+    CHECK("scan mode ignores the sidecar", port_value(XML_SCAN_NODES), 8080);
+    CHECK("scan mode does not touch the sidecar", sidecar_inode(iname), ino);
+}
+
+static void test_same_results(void)
+{
+    xmlId *cid = xmlOpenFlags(fname, XML_CACHE_NODES);
+    xmlId *iid = open_index(XML_CACHE_NODES, NULL);
+    int i;
+
+    CHECK("document with a sidecar opens", iid != NULL, 1);
+    if (cid && iid)
+    {
+        xmlId *pid;
+
+        for (i=0; paths[i]; i++)
+        {
+            char *cs = xmlNodeGetString(cid, paths[i]);
+            char *is = xmlNodeGetString(iid, paths[i]);
+            int same = (!cs && !is) || (cs && is && !strcmp(cs, is));
+
+            printf("         %s = '%s'\n", paths[i], is ? is : "(null)");
+            CHECK("string value matches the scanned cache", same, 1);
+            xmlFree(cs);
+            xmlFree(is);
+        }
+
+        CHECK("node count matches the scanned cache",
+              xmlNodeGetNum(iid, "/config/server/paths/path"),
+              xmlNodeGetNum(cid, "/config/server/paths/path"));
+
+        pid = xmlNodeGet(iid, "/config/server/paths");
+        if (pid)
+        {
+            xmlId *xid = xmlMarkId(pid);
+            char str[8];
+
+            for (i=0; i<3; i++)
+            {
+                str[1] = 0;
+                if (xmlNodeGetPos(pid, xid, "path", i)) {
+                    xmlCopyString(xid, str, sizeof(str));
+                }
+                CHECK("path node by position", str[1], 'a'+i);
+            }
+            xmlFree(xid);
+            xmlFree(pid);
+        }
+    }
+    if (cid) xmlClose(cid);
+    if (iid) xmlClose(iid);
+}
+
+static void test_stale(void)
+{
+    struct utimbuf times;
+    struct stat st;
+    char *buf, *p;
+    long ino;
+
+    ino = sidecar_inode(iname);
+    buf = strdup(xml);
+    p = strstr(buf, "8080");
+
+    /* a different size */
+    write_file(fname, "<config><server><port>1</port></server></config>", 48);
+    CHECK("changed document", port_value(XML_CACHE_NODES), 1);
+    CHECK("the stale sidecar is replaced", sidecar_inode(iname) != ino, 1);
+
+    /* the same size and modification time */
+    write_file(fname, xml, strlen(xml));
+    CHECK("original document", port_value(XML_CACHE_NODES), 8080);
+    stat(fname, &st);
+    ino = sidecar_inode(iname);
+
+    p[0] = '9';
+    write_file(fname, buf, strlen(buf));
+    times.actime = st.st_atime;
+    times.modtime = st.st_mtime;
+    utime(fname, &times);
+
+    CHECK("changed document with the same size and time",
+          port_value(XML_CACHE_NODES), 9080);
+    CHECK("the sidecar is replaced", sidecar_inode(iname) != ino, 1);
+    free(buf);
+}
+
+static void test_corrupt(void)
+{
+    FILE *f;
+    char *buf;
+    long len, ino;
+
+    write_file(fname, xml, strlen(xml));
+    CHECK("document opens", port_value(XML_CACHE_NODES), 8080);
+
+    f = fopen(iname, "rb");
+    if (!f) return;
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(len);
+    if (buf && fread(buf, 1, len, f) == (size_t)len)
+    {
+        fclose(f);
+
+        write_file(iname, buf, len/2);
+        ino = sidecar_inode(iname);
+        CHECK("truncated sidecar is rejected", port_value(XML_CACHE_NODES), 8080);
+        CHECK("truncated sidecar is replaced", sidecar_inode(iname) != ino, 1);
+
+        /* point the data section of the last node elsewhere */
+        buf[len-32] ^= 0x04;
+        write_file(iname, buf, len);
+        CHECK("corrupt sidecar is rejected", port_value(XML_CACHE_NODES), 8080);
+
+        memset(buf, 0, len);
+        write_file(iname, buf, len);
+        CHECK("empty sidecar is rejected", port_value(XML_CACHE_NODES), 8080);
+    }
+    else {
+        fclose(f);
+    }
+    free(buf);
+}
+
+static int comment_nodes(enum xmlFlags flags)
+{
+    xmlId *id = open_index(flags, NULL);
+    int rv = -1;
+
+    if (id)
+    {
+        xmlId *pid = xmlNodeGet(id, "/config/server/paths");
+        if (pid)
+        {
+            rv = xmlNodeGetNum(pid, "*");
+            xmlFree(pid);
+        }
+        xmlClose(id);
+    }
+    return rv;
+}
+
+static void test_flags(void)
+{
+    write_file(fname, xml, strlen(xml));
+    remove(iname);
+
+    CHECK("comments are nodes", comment_nodes(XML_CACHE_NODES), 4);
+    CHECK("comments are nodes with the sidecar",
+          comment_nodes(XML_CACHE_NODES), 4);
+    CHECK("comments are ignored with a sidecar of other flags",
+          comment_nodes(XML_CACHE_NODES|XML_IGNORE_COMMENT), 3);
+    CHECK("comments are ignored with the sidecar",
+          comment_nodes(XML_CACHE_NODES|XML_IGNORE_COMMENT), 3);
+}
+
+static void test_name(void)
+{
+    char name[1024+8];
+    xmlId *id;
+
+    snprintf(name, sizeof(name), "%s.other", fname);
+    remove(name);
+
+    id = open_index(XML_CACHE_NODES, name);
+    CHECK("document opens with a named sidecar", id != NULL, 1);
+    if (id) xmlClose(id);
+    CHECK("the named sidecar is written", sidecar_inode(name) != -1, 1);
+    remove(name);
+
+    id = open_index(XML_CACHE_NODES, "/nonexistent/directory/sidecar.idx");
+    CHECK("document opens if the sidecar can not be written", id != NULL, 1);
+    if (id)
+    {
+        CHECK("node value without a sidecar",
+              xmlNodeGetInt(id, "/config/server/port"), 8080);
+        xmlClose(id);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_index: node cache sidecar file tests ===\n\n");
+
+    snprintf(fname, sizeof(fname), "/tmp/test_index-%i.xml", (int)getpid());
+    snprintf(iname, sizeof(iname), "%s.idx", fname);
+
+    test_reopen();
+    test_same_results();
+    test_stale();
+    test_corrupt();
+    test_flags();
+    test_name();
+
+    remove(fname);
+    remove(iname);
+
+    return test_results();
+}
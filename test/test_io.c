@@ -0,0 +1,234 @@
+/*
+ * test_io.c
+ *
+ * Tests for the I/O strategies of xmlOpenOptions.
+ *
+ * Coverage
+ * --------
+ *  1. Every strategy returns the same document contents
+ *  2. The automatic strategy for files below and above the read threshold
+ *  3. The I/O hints are combined with every node cache mode
+ *  4. Missing and empty files are rejected
+ *  5. A windowed mapping returns the same contents, also for parts of the
+ *     document which were released before
+ *  6. A document larger than a huge page is read into huge pages
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+static const char *sample = SOURCE_DIR"/test/sample.xml";
+static char large[1024];
+
+static int create_large(const char *fname, int items)
+{
+    FILE *f = fopen(fname, "w");
+    int i;
+
+    if (!f) return 0;
+
+    fprintf(f, "<?xml version=\"1.0\"?>\n<root>\n");
+    for (i=0; i<items; i++) {
+        fprintf(f, "  <item><value>%i</value></item>\n", i);
+    }
+    fprintf(f, "</root>\n");
+    fclose(f);
+
+    return 1;
+}
+
+static xmlId *open_io(const char *fname, enum xmlFlags flags, int io, int read_max)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+    options.io.flags = io;
+    options.io.read_max = read_max;
+
+    return xmlOpenOptions(fname, &options);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_strategies(void)
+{
+    static const struct {
+        const char *desc;
+        int io;
+    } strategies[] = {
+        { "automatic",                    XML_IO_AUTO },
+        { "read",                         XML_IO_READ },
+        { "read with huge pages",         XML_IO_READ|XML_IO_HUGE_PAGES },
+        { "mmap",                         XML_IO_MMAP },
+        { "mmap and populate",            XML_IO_MMAP|XML_IO_POPULATE },
+        { "mmap and read ahead",          XML_IO_MMAP|XML_IO_SEQUENTIAL },
+        { "mmap with huge pages",         XML_IO_MMAP|XML_IO_HUGE_PAGES },
+        { NULL, 0 }
+    };
+    int i;
+
+    for (i=0; strategies[i].desc; i++)
+    {
+        xmlId *id = open_io(sample, XML_CACHE_NODES, strategies[i].io, 0);
+
+        printf("         %s\n", strategies[i].desc);
+        CHECK("sample document opens", id != NULL, 1);
+        if (id)
+        {
+            CHECK("integer value",
+                  xmlNodeGetInt(id, "/Configuration/output/frequency-hz"),
+                  48000);
+            CHECK("encoding", !strcmp(xmlGetEncoding(id), "iso-8859-1"), 1);
+            xmlClose(id);
+        }
+    }
+}
+
+static void test_threshold(void)
+{
+    static const enum xmlFlags modes[] = {
+        XML_CACHE_NODES, XML_SCAN_NODES, XML_LAZY_NODES, XML_BACKGROUND_NODES
+    };
+    int i;
+
+    for (i=0; i<(int)(sizeof(modes)/sizeof(modes[0])); i++)
+    {
+        xmlId *id;
+
+        /* well above XML_IO_READ_MAX */
+        id = open_io(large, modes[i], XML_IO_AUTO, 0);
+        CHECK("large document opens", id != NULL, 1);
+        if (id)
+        {
+            CHECK("large document value",
+                  xmlNodeGetInt(id, "/root/item[5000]/value"), 4999);
+            xmlClose(id);
+        }
+
+        /* raise the threshold so the large document is read */
+        id = open_io(large, modes[i], XML_IO_AUTO, 64*1024*1024);
+        CHECK("large document read into memory opens", id != NULL, 1);
+        if (id)
+        {
+            CHECK("large document read into memory value",
+                  xmlNodeGetInt(id, "/root/item[5000]/value"), 4999);
+            xmlClose(id);
+        }
+    }
+}
+
+static void test_window(void)
+{
+    static const enum xmlFlags modes[] = {
+        XML_CACHE_NODES, XML_SCAN_NODES, XML_LAZY_NODES, XML_BACKGROUND_NODES
+    };
+    int i;
+
+    for (i=0; i<(int)(sizeof(modes)/sizeof(modes[0])); i++)
+    {
+        xmlOptions options;
+        xmlId *id;
+
+        memset(&options, 0, sizeof(options));
+        options.flags = modes[i];
+        options.io.flags = XML_IO_WINDOW;
+        options.io.window = 4096;
+
+        id = xmlOpenOptions(large, &options);
+        CHECK("windowed document opens", id != NULL, 1);
+        if (id)
+        {
+            CHECK("windowed document value",
+                  xmlNodeGetInt(id, "/root/item[5000]/value"), 4999);
+            CHECK("windowed document last value",
+                  xmlNodeGetInt(id, "/root/item[10000]/value"), 9999);
+            CHECK("released part of the document is read again",
+                  xmlNodeGetInt(id, "/root/item[1]/value"), 0);
+            CHECK("windowed document validates", xmlValidate(id, NULL), 0);
+            xmlClose(id);
+        }
+    }
+}
+
+static void test_huge_pages(void)
+{
+    char huge[sizeof(large)+8];
+    xmlId *id;
+
+    /* above the size of a huge page */
+    snprintf(huge, sizeof(huge), "%s.huge", large);
+    if (!create_large(huge, 100000)) return;
+
+    id = open_io(huge, XML_CACHE_NODES, XML_IO_READ|XML_IO_HUGE_PAGES, 0);
+    CHECK("document read into huge pages opens", id != NULL, 1);
+    if (id)
+    {
+        CHECK("document read into huge pages value",
+              xmlNodeGetInt(id, "/root/item[100000]/value"), 99999);
+        xmlClose(id);
+    }
+    remove(huge);
+}
+
+static void test_bad_files(void)
+{
+    char empty[sizeof(large)+8];
+    FILE *f;
+
+    CHECK("missing file", open_io("/nonexistent/file.xml",
+                                  XML_CACHE_NODES, XML_IO_READ, 0) == NULL, 1);
+
+    snprintf(empty, sizeof(empty), "%s.empty", large);
+    f = fopen(empty, "w");
+    if (f)
+    {
+        fclose(f);
+        CHECK("empty file is read", open_io(empty, XML_CACHE_NODES,
+                                            XML_IO_READ, 0) == NULL, 1);
+        CHECK("empty file is mapped", open_io(empty, XML_CACHE_NODES,
+                                              XML_IO_MMAP, 0) == NULL, 1);
+        remove(empty);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_io: I/O strategy tests ===\n\n");
+
+    snprintf(large, sizeof(large), "/tmp/test_io-%i.xml", (int)getpid());
+    if (!create_large(large, 10000))
+    {
+        printf("unable to create '%s'\n", large);
+        return 1;
+    }
+
+    test_strategies();
+    test_threshold();
+    test_window();
+    test_huge_pages();
+    test_bad_files();
+
+    remove(large);
+
+    return test_results();
+}
@@ -0,0 +1,158 @@
+/*
+ * test_large.c
+ *
+ * Tests for documents larger than 4GB.
+ *
+ * A sparse file is used so the test does not need gigabytes of disk space:
+ * only the first and the last few bytes of the document are written, the
+ * hole in between reads as zeros and is treated as element data.
+ *
+ * Coverage
+ * --------
+ *  1. A file larger than 4GB opens and nodes before and after the 4GB
+ *     boundary can be found
+ *  2. xmlInitBufferOptions64 processes a buffer larger than 4GB
+ *  3. xmlInitBuffer64 processes a regular buffer
+ *
+ * If the sparse file can not be created the large file tests are skipped.
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifndef WIN32
+# include <sys/mman.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+static const char *head = "<root><first>1</first><data>";
+static const char *tail = "</data><last>2</last></root>";
+static off_t size = ((off_t)4 << 30) + 4096;
+static char large[1024];
+
+static int create_sparse(const char *fname)
+{
+    size_t hlen = strlen(head), tlen = strlen(tail);
+    int rv = 0;
+    int fd;
+
+    if (sizeof(off_t) < 8) return rv;
+
+    fd = open(fname, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+    if (fd < 0) return rv;
+
+    if (write(fd, head, hlen) == (ssize_t)hlen &&
+        ftruncate(fd, size - (off_t)tlen) == 0 &&
+        lseek(fd, 0, SEEK_END) == size - (off_t)tlen &&
+        write(fd, tail, tlen) == (ssize_t)tlen)
+    {
+        rv = 1;
+    }
+    close(fd);
+
+    return rv;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_large_file(void)
+{
+    xmlId *id;
+
+    /* scan mode, the full cache would need to scan the file once more */
+    id = xmlOpenFlags(large, XML_SCAN_NODES);
+    CHECK("file larger than 4GB opens", id != NULL, 1);
+    if (id)
+    {
+        CHECK("node before the 4GB boundary",
+              xmlNodeGetInt(id, "/root/first"), 1);
+        CHECK("node after the 4GB boundary",
+              xmlNodeGetInt(id, "/root/last"), 2);
+        xmlClose(id);
+    }
+}
+
+static void test_large_buffer(void)
+{
+#ifndef WIN32
+    int fd = open(large, O_RDONLY);
+    if (fd >= 0)
+    {
+        char *mm = mmap(0, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0L);
+        if (mm != MAP_FAILED)
+        {
+            xmlOptions options;
+            xmlId *id;
+
+            memset(&options, 0, sizeof(options));
+            options.flags = XML_SCAN_NODES;
+
+            id = xmlInitBufferOptions64(mm, (size_t)size, &options);
+            CHECK("buffer larger than 4GB opens", id != NULL, 1);
+            if (id)
+            {
+                CHECK("buffer node after the 4GB boundary",
+                      xmlNodeGetInt(id, "/root/last"), 2);
+                xmlClose(id);
+            }
+            munmap(mm, (size_t)size);
+        }
+        close(fd);
+    }
+#endif
+}
+
+static void test_buffer64(void)
+{
+    const char *xml = "<root><value>42</value></root>";
+    xmlId *id;
+
+    id = xmlInitBuffer64(xml, strlen(xml));
+    CHECK("xmlInitBuffer64 opens a buffer", id != NULL, 1);
+    if (id)
+    {
+        CHECK("xmlInitBuffer64 node value",
+              xmlNodeGetInt(id, "/root/value"), 42);
+        xmlClose(id);
+    }
+
+    CHECK("an empty buffer is rejected", xmlInitBuffer64(xml, 0) == NULL, 1);
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_large: documents larger than 4GB ===\n\n");
+
+    test_buffer64();
+
+    snprintf(large, sizeof(large), "/tmp/test_large-%i.xml", (int)getpid());
+    if (create_sparse(large))
+    {
+        test_large_file();
+        test_large_buffer();
+    }
+    else {
+        printf("  SKIP  unable to create sparse file '%s'\n", large);
+    }
+    remove(large);
+
+    return test_results();
+}
@@ -0,0 +1,179 @@
+/*
+ * test_lazy.c
+ *
+ * Tests for the on demand node cache of XML_LAZY_NODES.
+ *
+ * Coverage
+ * --------
+ *  1. Lookups return the same results as with XML_CACHE_NODES
+ *  2. Node counts and walking nodes by position match XML_CACHE_NODES
+ *  3. Leading comment and CDATA sections are handled like the full cache
+ *  4. Errors are reported by the first lookup instead of at open time
+ *  5. XML_CACHE_NODES takes precedence over XML_LAZY_NODES
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "test_shared.h"
+
+static const char *xml =
+    "<?xml version=\"1.0\"?>\n"
+    "<!-- leading comment -->\n"
+    "<config>\n"
+    "  <server name=\"main\">\n"
+    "    <host>localhost</host>\n"
+    "    <port>8080</port>\n"
+    "    <paths>\n"
+    "      <path>/a</path>\n"
+    "      <path>/b</path>\n"
+    "      <!-- a comment -->\n"
+    "      <path>/c</path>\n"
+    "    </paths>\n"
+    "  </server>\n"
+    "  <data><![CDATA[<not>a</tag>]]></data>\n"
+    "  <mixed><!-- first --><item>1</item><!-- second --><item>2</item></mixed>\n"
+    "  <empty/>\n"
+    "</config>\n";
+
+static const char *paths[] = {
+    "/config/server/host",
+    "/config/server/port",
+    "/config/server/paths/path",
+    "/config/server/paths/path[2]",
+    "/config/server/paths/path[3]",
+    "/config/data",
+    "/config/mixed/item[2]",
+    "/config/empty",
+    "/config/missing/node",
+    NULL
+};
+
+static xmlId *open_buffer(const char *buf, enum xmlFlags flags)
+{
+    return xmlInitBufferFlags(buf, (int)strlen(buf), flags);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_same_results(void)
+{
+    xmlId *cid = open_buffer(xml, XML_CACHE_NODES);
+    xmlId *lid = open_buffer(xml, XML_LAZY_NODES);
+    int i;
+
+    CHECK("lazy document opens", lid != NULL, 1);
+    if (cid && lid)
+    {
+        for (i=0; paths[i]; i++)
+        {
+            char *cs = xmlNodeGetString(cid, paths[i]);
+            char *ls = xmlNodeGetString(lid, paths[i]);
+            int same = (!cs && !ls) || (cs && ls && !strcmp(cs, ls));
+
+            printf("         %s = '%s'\n", paths[i], ls ? ls : "(null)");
+            CHECK("string value matches the full cache", same, 1);
+            xmlFree(cs);
+            xmlFree(ls);
+        }
+
+        CHECK("path count matches the full cache",
+              xmlNodeGetNum(lid, "/config/server/paths/path"),
+              xmlNodeGetNum(cid, "/config/server/paths/path"));
+        CHECK("child count matches the full cache",
+              xmlNodeGetNum(lid, "/config/mixed/*"),
+              xmlNodeGetNum(cid, "/config/mixed/*"));
+        CHECK("CDATA node child count matches the full cache",
+              xmlNodeGetNum(lid, "/config/data/*"),
+              xmlNodeGetNum(cid, "/config/data/*"));
+    }
+    if (cid) xmlClose(cid);
+    if (lid) xmlClose(lid);
+}
+
+static void test_node_pos(void)
+{
+    xmlId *lid = open_buffer(xml, XML_LAZY_NODES);
+
+    if (lid)
+    {
+        xmlId *pid = xmlNodeGet(lid, "/config/server/paths");
+        if (pid)
+        {
+            xmlId *xid = xmlMarkId(pid);
+            int i, num = xmlNodeGetNum(pid, "path");
+            char str[8];
+
+            CHECK("number of path nodes", num, 3);
+            for (i=0; i<num; i++)
+            {
+                if (xmlNodeGetPos(pid, xid, "path", i)) {
+                    xmlCopyString(xid, str, sizeof(str));
+                }
+                CHECK("path node by position", str[1], 'a'+i);
+            }
+            xmlFree(xid);
+            xmlFree(pid);
+        }
+        xmlClose(lid);
+    }
+}
+
+static void test_deferred_errors(void)
+{
+    const char *bad =
+        "<config>\n"
+        "  <good><value>1</value></good>\n"
+        "  <bad><inner><!-- unterminated </inner></bad>\n"
+        "</config>\n";
+    xmlId *id;
+
+    id = open_buffer(bad, XML_CACHE_NODES);
+    CHECK("full cache rejects the document at open", id == NULL, 1);
+    if (id) xmlClose(id);
+
+    id = open_buffer(bad, XML_LAZY_NODES);
+    CHECK("lazy cache opens the document", id != NULL, 1);
+    if (id)
+    {
+        CHECK("the first lookup fails",
+              xmlNodeGetInt(id, "/config/good/value"), 0);
+        CHECK("the first lookup reports the error",
+              xmlErrorGetNo(id, 1), XML_INVALID_COMMENT);
+        xmlClose(id);
+    }
+}
+
+static void test_precedence(void)
+{
+    xmlId *id = open_buffer(xml, XML_CACHE_NODES|XML_LAZY_NODES);
+
+    if (id)
+    {
+        CHECK("combined flags still work",
+              xmlNodeGetInt(id, "/config/server/port"), 8080);
+        xmlClose(id);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_lazy: on demand node cache tests ===\n\n");
+
+    test_same_results();
+    test_node_pos();
+    test_deferred_errors();
+    test_precedence();
+
+    return test_results();
+}
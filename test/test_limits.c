@@ -0,0 +1,198 @@
+/*
+ * test_limits.c
+ *
+ * Tests for the per-document resource limits set with xmlOptions.
+ *
+ * Coverage
+ * --------
+ *  1. Documents within the limits open and can be queried
+ *  2. Every limit aborts the node cache build with XML_LIMIT_EXCEEDED
+ *  3. In XML_SCAN_NODES mode the limits are enforced for every lookup
+ *  4. xmlValidate honours the limits, also for the length of attribute names
+ *  5. A limit of zero means no limit
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "test_shared.h"
+
+/* four levels deep, seven elements, thirteen tags */
+static const char *xml =
+    "<root>\n"
+    "  <config version=\"1\" name='test'>\n"
+    "    <section>\n"
+    "      <item n=\"1\" a=\"x=y\" b=\"2\">1</item>\n"
+    "      <item n=\"2\">2</item>\n"
+    "      <empty/>\n"
+    "    </section>\n"
+    "    <a_rather_long_element_name>value</a_rather_long_element_name>\n"
+    "  </config>\n"
+    "</root>\n";
+
+/* the attribute name is longer than its element names */
+static const char *attr =
+    "<root>\n"
+    "  <item a_rather_long_attribute_name=\"1\">1</item>\n"
+    "</root>\n";
+
+/* ------------------------------------------------------------------ */
+/* Helper: open the document in cache mode and return the error        */
+/* ------------------------------------------------------------------ */
+static int open_cached(const xmlLimits *limits)
+{
+    xmlOptions options;
+    xmlId *id;
+    int rv;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = XML_CACHE_NODES;
+    options.limits = *limits;
+
+    xmlErrorGetNo(NULL, 1);
+    id = xmlInitBufferOptions(xml, (int)strlen(xml), &options);
+    if (id)
+    {
+        rv = XML_NO_ERROR;
+        xmlClose(id);
+    }
+    else {
+        rv = xmlErrorGetNo(NULL, 1);
+    }
+    return rv;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_within_limits(void)
+{
+    xmlOptions options;
+    xmlId *id;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = XML_CACHE_NODES;
+    options.limits.max_depth = 4;
+    options.limits.max_name_len = 26;
+    options.limits.max_attributes = 3;
+    options.limits.max_nodes = 7;
+    options.limits.max_steps = 13;
+
+    id = xmlInitBufferOptions(xml, (int)strlen(xml), &options);
+    CHECK("document within all limits opens", id != NULL, 1);
+    if (id)
+    {
+        CHECK("node lookup within the limits",
+              xmlNodeGetInt(id, "/root/config/section/item"), 1);
+        xmlClose(id);
+    }
+}
+
+static void test_cache_limits(void)
+{
+    xmlLimits limits;
+
+    memset(&limits, 0, sizeof(limits));
+    limits.max_depth = 3;
+    CHECK("nesting too deep", open_cached(&limits), XML_LIMIT_EXCEEDED);
+
+    memset(&limits, 0, sizeof(limits));
+    limits.max_name_len = 25;
+    CHECK("element name too long", open_cached(&limits), XML_LIMIT_EXCEEDED);
+
+    memset(&limits, 0, sizeof(limits));
+    limits.max_attributes = 2;
+    CHECK("too many attributes", open_cached(&limits), XML_LIMIT_EXCEEDED);
+
+    memset(&limits, 0, sizeof(limits));
+    limits.max_nodes = 6;
+    CHECK("too many elements", open_cached(&limits), XML_LIMIT_EXCEEDED);
+
+    memset(&limits, 0, sizeof(limits));
+    limits.max_steps = 12;
+    CHECK("step budget exhausted", open_cached(&limits), XML_LIMIT_EXCEEDED);
+
+    memset(&limits, 0, sizeof(limits));
+    CHECK("zero means no limit", open_cached(&limits), XML_NO_ERROR);
+}
+
+static void test_scan_limits(void)
+{
+    xmlOptions options;
+    xmlId *id;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = XML_SCAN_NODES;
+    options.limits.max_depth = 3;
+
+    id = xmlInitBufferOptions(xml, (int)strlen(xml), &options);
+    CHECK("scan mode opens without scanning", id != NULL, 1);
+    if (id)
+    {
+        xmlId *xid = xmlNodeGet(id, "/root/config/section/item");
+        CHECK("lookup exceeding the limit fails", xid == NULL, 1);
+        CHECK("lookup reports the limit error",
+              xmlErrorGetNo(id, 1), XML_LIMIT_EXCEEDED);
+        if (xid) xmlFree(xid);
+        xmlClose(id);
+    }
+}
+
+static void test_validate_limits(void)
+{
+    xmlOptions options;
+    xmlErrorInfo errors[4];
+    xmlErrorList list;
+    xmlId *id;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = XML_SCAN_NODES;
+    options.limits.max_attributes = 2;
+
+    list.max_errors = 4;
+    list.errors = errors;
+
+    id = xmlInitBufferOptions(xml, (int)strlen(xml), &options);
+    if (id)
+    {
+        CHECK("validator stops at the first limit error",
+              xmlValidate(id, &list), 1);
+        CHECK("validator reports the limit error",
+              errors[0].err_no, XML_LIMIT_EXCEEDED);
+        CHECK("limit error line", errors[0].line_no, 4);
+        xmlClose(id);
+    }
+
+    options.limits.max_attributes = 0;
+    options.limits.max_name_len = 8;
+    id = xmlInitBufferOptions(attr, (int)strlen(attr), &options);
+    if (id)
+    {
+        CHECK("attribute name too long", xmlValidate(id, &list), 1);
+        CHECK("validator reports the attribute name",
+              errors[0].err_no, XML_LIMIT_EXCEEDED);
+        CHECK("attribute name error line", errors[0].line_no, 2);
+        xmlClose(id);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_limits: per-document resource limit tests ===\n\n");
+
+    test_within_limits();
+    test_cache_limits();
+    test_scan_limits();
+    test_validate_limits();
+
+    return test_results();
+}
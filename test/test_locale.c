@@ -0,0 +1,189 @@
+/*
+ * test_locale.c
+ *
+ * Tests for the locale and character set converters shared by documents.
+ *
+ * Coverage
+ * --------
+ *  1. Many documents opened and closed one after the other compare and
+ *     convert their strings the same way as the first one
+ *  2. Documents with different character sets used alternately by a thread
+ *  3. Documents opened, used and closed from several threads at once
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define NUM_OPENS	2000
+#define NUM_THREADS	4
+
+static const char *utf8 =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<root><text lang=\"fr\">caf\xc3\xa9</text></root>\n";
+
+static const char *latin1 =
+    "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
+    "<root><text lang=\"fr\">caf\xe9</text></root>\n";
+
+/* the results of the first document, the reference for all others */
+typedef struct
+{
+    int compare;
+    int attribute;
+    char string[16];
+} result;
+
+static result reference[2];
+static int converting = 0;
+
+static void use_doc(const char *doc, result *res)
+{
+    xmlId *id = xmlInitBufferFlags(doc, (int)strlen(doc), XML_LOCALIZATION);
+    xmlId *xid = id ? xmlNodeGet(id, "/root/text") : NULL;
+
+    memset(res, 0, sizeof(result));
+    if (xid)
+    {
+        res->compare = xmlCompareString(xid, "caf\xc3\xa9");
+        res->attribute = xmlAttributeCompareString(xid, "lang", "fr");
+        xmlCopyString(xid, res->string, sizeof(res->string));
+    }
+    xmlFree(xid);
+    if (id) xmlClose(id);
+}
+
+static int same(const result *a, const result *b)
+{
+    return (a->compare == b->compare && a->attribute == b->attribute &&
+            !strcmp(a->string, b->string));
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_opens(void)
+{
+    int i, errors = 0;
+
+    use_doc(utf8, &reference[0]);
+    use_doc(latin1, &reference[1]);
+    if (converting)
+    {
+        CHECK("string of the document",
+              strcmp(reference[0].string, "caf\xc3\xa9"), 0);
+        CHECK("string converted from ISO-8859-1",
+              strcmp(reference[1].string, "caf\xc3\xa9"), 0);
+    }
+
+    for (i=0; i<NUM_OPENS; i++)
+    {
+        result res;
+
+        use_doc(utf8, &res);
+        if (!same(&res, &reference[0])) errors++;
+    }
+    CHECK("documents opened one after the other", errors, 0);
+}
+
+static void test_encodings(void)
+{
+    int i, errors = 0;
+    xmlId *a, *b;
+
+    a = xmlInitBufferFlags(utf8, (int)strlen(utf8), XML_LOCALIZATION);
+    b = xmlInitBufferFlags(latin1, (int)strlen(latin1), XML_LOCALIZATION);
+    if (!a || !b) return;
+
+    for (i=0; i<NUM_OPENS; i++)
+    {
+        xmlId *xid = xmlNodeGet((i % 2) ? b : a, "/root/text");
+        char buf[16];
+
+        if (xid)
+        {
+            xmlCopyString(xid, buf, sizeof(buf));
+            if (strcmp(buf, reference[i % 2].string)) errors++;
+            if (xmlCompareString(xid, "caf\xc3\xa9") !=
+                reference[i % 2].compare) errors++;
+        }
+        else {
+            errors++;
+        }
+        xmlFree(xid);
+    }
+    CHECK("character sets used alternately", errors, 0);
+
+    xmlClose(a);
+    xmlClose(b);
+}
+
+#if HAVE_PTHREAD_H
+static void *worker(void *arg)
+{
+    int *errors = arg;
+    int i;
+
+    for (i=0; i<NUM_OPENS/NUM_THREADS; i++)
+    {
+        result res;
+
+        use_doc((i % 3) ? utf8 : latin1, &res);
+        if (!same(&res, &reference[(i % 3) ? 0 : 1])) (*errors)++;
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    pthread_t threads[NUM_THREADS];
+    int errors[NUM_THREADS];
+    int i;
+
+    for (i=0; i<NUM_THREADS; i++)
+    {
+        errors[i] = 0;
+        pthread_create(&threads[i], NULL, worker, &errors[i]);
+    }
+    for (i=0; i<NUM_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        CHECK("documents of a thread", errors[i], 0);
+    }
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_locale: shared locale and converter tests ===\n\n");
+
+    /* converting needs a locale with a character set */
+    setenv("LC_ALL", "C.UTF-8", 1);
+    converting = (setlocale(LC_CTYPE, "") != NULL);
+
+    test_opens();
+    test_encodings();
+#if HAVE_PTHREAD_H
+    test_threads();
+#endif
+
+    return test_results();
+}
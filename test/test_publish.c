@@ -0,0 +1,421 @@
+/*
+ * test_publish.c
+ *
+ * Tests for documents shared between processes with xmlPublish and
+ * xmlOpenShared.
+ *
+ * Coverage
+ * --------
+ *  1. Lookups, attributes and walking nodes by position on an attached
+ *     document match the original document
+ *  2. Several processes attach to the same published document
+ *  3. The published node cache is used in place, the document is not
+ *     scanned
+ *  4. An attached document works with other flags than it was published
+ *     with and with every node cache mode
+ *  5. Publishing again replaces the document for new processes only
+ *  6. xmlUnpublish, missing names and publishing without a node cache
+ *  7. The shared memory object is only readable by its owner
+ *
+ * The tests are skipped when the library is built without shm_open.
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_SHM_OPEN
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/wait.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+#if HAVE_SHM_OPEN
+#define NUM_PROCESSES	4
+
+static const char *xml =
+    "<?xml version=\"1.0\"?>\n"
+    "<config>\n"
+    "  <server name=\"main\" port=\"8080\">\n"
+    "    <host>localhost</host>\n"
+    "    <paths>\n"
+    "      <path>/a</path>\n"
+    "      <!-- a comment -->\n"
+    "      <path>/b</path>\n"
+    "      <path>/c</path>\n"
+    "    </paths>\n"
+    "  </server>\n"
+    "  <data><![CDATA[<not>a</tag>]]></data>\n"
+    "  <empty/>\n"
+    "</config>\n";
+
+static const char *paths[] = {
+    "/config/server/host",
+    "/config/server/paths/path",
+    "/config/server/paths/path[3]",
+    "/config/data",
+    "/config/empty",
+    "/config/missing/node",
+    NULL
+};
+
+static char name[64];
+static char other[64];
+
+static xmlId *open_buffer(const char *buf, enum xmlFlags flags)
+{
+    return xmlInitBufferFlags(buf, (int)strlen(buf), flags);
+}
+
+static xmlId *attach(enum xmlFlags flags)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    return xmlOpenShared(name, &options);
+}
+
+static int publish(const char *doc, enum xmlFlags flags)
+{
+    xmlId *id = open_buffer(doc, flags);
+    int rv = 0;
+
+    if (id)
+    {
+        rv = xmlPublish(id, name);
+        xmlClose(id);
+    }
+    return rv;
+}
+
+/* returns 1 if the value of the node at path equals str */
+static int node_is(const xmlId *id, const char *path, const char *str)
+{
+    char *s = xmlNodeGetString(id, path);
+    int rv = (s && !strcmp(s, str));
+
+    xmlFree(s);
+    return rv;
+}
+
+static int comment_nodes(const xmlId *id)
+{
+    xmlId *pid = xmlNodeGet(id, "/config/server/paths");
+    int rv = -1;
+
+    if (pid)
+    {
+        rv = xmlNodeGetNum(pid, "*");
+        xmlFree(pid);
+    }
+    return rv;
+}
+
+/* the number of lookups of an attached document which give a wrong result */
+static int verify(const xmlId *id)
+{
+    xmlId *pid;
+    int rv = 0;
+    int i;
+
+    if (!node_is(id, "/config/server/host", "localhost")) rv++;
+    if (!node_is(id, "/config/server/paths/path[2]", "/b")) rv++;
+    if (!node_is(id, "/config/data", "<not>a</tag>")) rv++;
+    if (comment_nodes(id) != 4) rv++;
+
+    pid = xmlNodeGet(id, "/config/server/paths");
+    if (pid)
+    {
+        xmlId *xid = xmlMarkId(pid);
+        char str[8];
+
+        for (i=0; i<3; i++)
+        {
+            str[1] = 0;
+            if (xmlNodeGetPos(pid, xid, "path", i)) {
+                xmlCopyString(xid, str, sizeof(str));
+            }
+            if (str[1] != 'a'+i) rv++;
+        }
+        xmlFree(xid);
+        xmlFree(pid);
+    }
+    else {
+        rv++;
+    }
+
+    return rv;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_same_results(void)
+{
+    xmlId *oid, *sid;
+    int i;
+
+    CHECK("document is published", publish(xml, XML_CACHE_NODES), XML_TRUE);
+
+    oid = open_buffer(xml, XML_CACHE_NODES);
+    sid = attach(XML_CACHE_NODES);
+    CHECK("published document attaches", sid != NULL, 1);
+    if (oid && sid)
+    {
+        xmlId *xid;
+
+        for (i=0; paths[i]; i++)
+        {
+            char *os = xmlNodeGetString(oid, paths[i]);
+            char *ss = xmlNodeGetString(sid, paths[i]);
+            int same = (!os && !ss) || (os && ss && !strcmp(os, ss));
+
+            printf("         %s = '%s'\n", paths[i], ss ? ss : "(null)");
+            CHECK("string value matches the original document", same, 1);
+            xmlFree(os);
+            xmlFree(ss);
+        }
+
+        xid = xmlNodeGet(sid, "/config/server");
+        if (xid)
+        {
+            CHECK("number of attributes", xmlAttributeGetNum(xid), 2);
+            xmlFree(xid);
+        }
+
+        CHECK("all lookups match", verify(sid), 0);
+    }
+    if (oid) xmlClose(oid);
+    if (sid) xmlClose(sid);
+}
+
+static void test_processes(void)
+{
+    pid_t pids[NUM_PROCESSES];
+    int i;
+
+    if (!publish(xml, XML_CACHE_NODES)) return;
+
+    fflush(stdout);
+    for (i=0; i<NUM_PROCESSES; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == 0)
+        {
+            xmlId *id = attach(XML_CACHE_NODES);
+            int rv = 1;
+            int j;
+
+            if (id)
+            {
+                rv = 0;
+                for (j=0; j<100 && !rv; j++) {
+                    rv = verify(id);
+                }
+                xmlClose(id);
+            }
+            _exit(rv);
+        }
+    }
+
+    for (i=0; i<NUM_PROCESSES; i++)
+    {
+        int status = -1;
+
+        if (pids[i] > 0) {
+            waitpid(pids[i], &status, 0);
+        }
+        CHECK("process attaches and finds all nodes",
+              WIFEXITED(status) && WEXITSTATUS(status) == 0, 1);
+    }
+}
+
+static void test_in_place(void)
+{
+    struct stat statbuf;
+    char *mm, *p;
+    xmlId *id;
+    int fd;
+
+    if (!publish(xml, XML_CACHE_NODES)) return;
+
+    /* a closing tag which does not match would abort a scan */
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return;
+    if (fstat(fd, &statbuf) == 0)
+    {
+        size_t len = (size_t)statbuf.st_size;
+
+        CHECK("only the owner reads the published document",
+              statbuf.st_mode & 0777, 0600);
+        mm = mmap(0, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0L);
+        if (mm != MAP_FAILED)
+        {
+            p = strstr(mm+len-strlen(xml), "</host>");
+            if (p) p[5] = 'x';
+            munmap(mm, len);
+        }
+    }
+    close(fd);
+
+    id = attach(XML_CACHE_NODES);
+    CHECK("published document attaches without scanning", id != NULL, 1);
+    if (id)
+    {
+        CHECK("node value without scanning",
+              node_is(id, "/config/server/paths/path[2]", "/b"), 1);
+        xmlClose(id);
+    }
+
+    id = attach(XML_SCAN_NODES);
+    if (id)
+    {
+        CHECK("scan mode scans the published document",
+              xmlNodeGetString(id, "/config/server/host") == NULL, 1);
+        xmlClose(id);
+    }
+}
+
+static void test_modes(void)
+{
+    static const enum xmlFlags modes[] = {
+        XML_CACHE_NODES, XML_SCAN_NODES, XML_LAZY_NODES, XML_BACKGROUND_NODES
+    };
+    xmlId *id;
+    int i;
+
+    if (!publish(xml, XML_CACHE_NODES)) return;
+
+    for (i=0; i<(int)(sizeof(modes)/sizeof(modes[0])); i++)
+    {
+        id = attach(modes[i]);
+        CHECK("published document attaches", id != NULL, 1);
+        if (id)
+        {
+            CHECK("node value",
+                  node_is(id, "/config/server/host", "localhost"), 1);
+            xmlClose(id);
+        }
+    }
+
+    id = attach(XML_CACHE_NODES|XML_IGNORE_COMMENT);
+    if (id)
+    {
+        CHECK("comments are ignored with other flags", comment_nodes(id), 3);
+        xmlClose(id);
+    }
+
+    id = xmlOpenShared(name, NULL);
+    if (id)
+    {
+        CHECK("attaches with the default options", verify(id), 0);
+        xmlClose(id);
+    }
+}
+
+static void test_republish(void)
+{
+    const char *changed = "<config><server><host>remote</host></server></config>";
+    xmlId *old, *id;
+
+    if (!publish(xml, XML_CACHE_NODES)) return;
+
+    old = attach(XML_CACHE_NODES);
+    CHECK("document is published again",
+          publish(changed, XML_CACHE_NODES), XML_TRUE);
+    if (old)
+    {
+        CHECK("attached process keeps the previous document",
+              node_is(old, "/config/server/host", "localhost"), 1);
+
+        /* the records of an attached document are published as they are */
+        CHECK("attached document is published",
+              xmlPublish(old, other), XML_TRUE);
+        xmlClose(old);
+    }
+
+    id = attach(XML_CACHE_NODES);
+    if (id)
+    {
+        CHECK("new process gets the new document",
+              node_is(id, "/config/server/host", "remote"), 1);
+        xmlClose(id);
+    }
+
+    id = xmlOpenShared(other, NULL);
+    CHECK("republished document attaches", id != NULL, 1);
+    if (id)
+    {
+        CHECK("all lookups of the republished document match", verify(id), 0);
+        xmlClose(id);
+    }
+    xmlUnpublish(other);
+}
+
+static void test_errors(void)
+{
+    xmlId *id;
+
+    if (!publish(xml, XML_CACHE_NODES)) return;
+
+    CHECK("document is unpublished", xmlUnpublish(name), XML_TRUE);
+    CHECK("unpublished document does not attach",
+          attach(XML_CACHE_NODES) == NULL, 1);
+    CHECK("unpublishing twice fails", xmlUnpublish(name), XML_FALSE);
+    CHECK("missing name does not attach",
+          xmlOpenShared("/zeroxml-missing-name", NULL) == NULL, 1);
+
+    id = open_buffer(xml, XML_LAZY_NODES);
+    if (id)
+    {
+        CHECK("no publishing without a complete node cache",
+              xmlPublish(id, name), XML_FALSE);
+        CHECK("error without a complete node cache",
+              xmlErrorGetNo(id, 1), XML_NODE_NOT_FOUND);
+        xmlClose(id);
+    }
+    CHECK("nothing is published", attach(XML_CACHE_NODES) == NULL, 1);
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_publish: shared document tests ===\n\n");
+
+#if HAVE_SHM_OPEN
+    snprintf(name, sizeof(name), "/test_publish-%i", (int)getpid());
+    snprintf(other, sizeof(other), "/test_publish-%i-other", (int)getpid());
+
+    test_same_results();
+    test_processes();
+    test_in_place();
+    test_modes();
+    test_republish();
+    test_errors();
+
+    xmlUnpublish(name);
+#else
+    printf("  SKIP  built without shm_open\n");
+#endif
+
+    return test_results();
+}
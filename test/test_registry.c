@@ -0,0 +1,224 @@
+/*
+ * test_registry.c
+ *
+ * Tests for the document registry of XML_SHARE_DOCUMENT.
+ *
+ * Coverage
+ * --------
+ *  1. Opens of the same file share one document
+ *  2. Every handle has its own error state
+ *  3. The document stays open until the last handle is closed
+ *  4. A changed file is opened again, open handles keep the previous
+ *     document
+ *  5. Opens with other flags or without XML_SHARE_DOCUMENT are not shared
+ *  6. Threads open and close the same file concurrently
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <utime.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define NUM_THREADS	8
+#define SHARED		(XML_CACHE_NODES|XML_VALIDATING|XML_SHARE_DOCUMENT)
+
+static char fname[1024];
+
+/*
+ * Write the document with a port number. The file keeps its size and its
+ * modification time is set to mtime, so the registry can not notice the
+ * change unless mtime changes.
+ */
+static void write_port(int port, time_t mtime)
+{
+    FILE *f = fopen(fname, "wb");
+    struct utimbuf times;
+
+    if (f)
+    {
+        fprintf(f, "<config>\n"
+                   "  <server><host>localhost</host><port>%i</port></server>\n"
+                   "</config>\n", port);
+        fclose(f);
+    }
+
+    times.actime = mtime;
+    times.modtime = mtime;
+    utime(fname, &times);
+}
+
+static xmlId *open_file(enum xmlFlags flags)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    return xmlOpenOptions(fname, &options);
+}
+
+static int port(const xmlId *id)
+{
+    return id ? (int)xmlNodeGetInt(id, "/config/server/port") : -1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_shared(void)
+{
+    xmlId *a, *b, *c;
+
+    write_port(1000, 1000000);
+    a = open_file(SHARED);
+    CHECK("first open", port(a), 1000);
+
+    /* the previous contents are only visible when the document is shared */
+    write_port(2000, 1000000);
+    b = open_file(SHARED);
+    CHECK("second open shares the document", port(b), 1000);
+    CHECK("separate handles", a != b, 1);
+
+    c = open_file(XML_CACHE_NODES|XML_VALIDATING);
+    CHECK("open without XML_SHARE_DOCUMENT is not shared", port(c), 2000);
+    if (c) xmlClose(c);
+
+    c = open_file(SHARED|XML_IGNORE_COMMENT);
+    CHECK("open with other flags is not shared", port(c), 2000);
+    if (c) xmlClose(c);
+
+    if (a) xmlClose(a);
+    CHECK("document stays open for the other handle", port(b), 1000);
+
+    c = open_file(SHARED);
+    CHECK("open after closing one handle is shared", port(c), 1000);
+    if (c) xmlClose(c);
+    if (b) xmlClose(b);
+
+    c = open_file(SHARED);
+    CHECK("open after closing all handles opens the file", port(c), 2000);
+    if (c) xmlClose(c);
+}
+
+static void test_errors(void)
+{
+    xmlId *a, *b;
+
+    write_port(3000, 2000000);
+    a = open_file(SHARED);
+    b = open_file(SHARED);
+    if (a && b)
+    {
+        CHECK("lookup of a missing node fails",
+              xmlNodeGet(a, "/config/missing") == NULL, 1);
+        CHECK("handle reports the error",
+              xmlErrorGetNo(a, 0), XML_NODE_NOT_FOUND);
+        CHECK("other handle has no error", xmlErrorGetNo(b, 0), XML_NO_ERROR);
+        CHECK("other handle still works", port(b), 3000);
+        CHECK("error is cleared", xmlErrorGetNo(a, 1), XML_NODE_NOT_FOUND);
+        CHECK("no error after clearing", xmlErrorGetNo(a, 0), XML_NO_ERROR);
+    }
+    if (a) xmlClose(a);
+    if (b) xmlClose(b);
+}
+
+static void test_changed(void)
+{
+    xmlId *a, *b, *c;
+
+    write_port(4000, 3000000);
+    a = open_file(SHARED);
+
+    write_port(5000, 3000001);
+    b = open_file(SHARED);
+    CHECK("changed file is opened again", port(b), 5000);
+    CHECK("open handle keeps the previous document", port(a), 4000);
+
+    c = open_file(SHARED);
+    CHECK("changed file is shared again", port(c), 5000);
+
+    if (a) xmlClose(a);
+    CHECK("handles of the new document still work", port(c), 5000);
+    if (b) xmlClose(b);
+    if (c) xmlClose(c);
+}
+
+#if HAVE_PTHREAD_H
+static void *worker(void *arg)
+{
+    int *errors = (int*)arg;
+    int i;
+
+    for (i=0; i<200; i++)
+    {
+        xmlId *id = open_file(SHARED);
+        if (port(id) != 6000) (*errors)++;
+        if (id) xmlClose(id);
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    pthread_t threads[NUM_THREADS];
+    int errors[NUM_THREADS];
+    xmlId *id;
+    int i;
+
+    write_port(6000, 4000000);
+    for (i=0; i<NUM_THREADS; i++)
+    {
+        errors[i] = 0;
+        pthread_create(&threads[i], NULL, worker, &errors[i]);
+    }
+    for (i=0; i<NUM_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        CHECK("thread opens and closes the shared document", errors[i], 0);
+    }
+
+    id = open_file(SHARED|XML_BACKGROUND_NODES);
+    CHECK("shared document with a background node cache", port(id), 6000);
+    if (id) xmlClose(id);
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_registry: shared document registry tests ===\n\n");
+
+    snprintf(fname, sizeof(fname), "/tmp/test_registry-%i.xml", (int)getpid());
+
+    test_shared();
+    test_errors();
+    test_changed();
+#if HAVE_PTHREAD_H
+    test_threads();
+#endif
+
+    remove(fname);
+
+    return test_results();
+}
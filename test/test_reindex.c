@@ -0,0 +1,386 @@
+/*
+ * test_reindex.c
+ *
+ * Tests for opening a new version of a document with xmlReopen.
+ *
+ * Coverage
+ * --------
+ *  1. Changed values, inserted and removed elements give the same nodes
+ *     as opening the new version from scratch
+ *  2. Nodes after the change are found at their new position
+ *  3. Changes outside of an element and other options open the document
+ *     from scratch
+ *  4. The previous XML-id stays valid after the new version is opened
+ *  5. An invalid change is rejected
+ *  6. A series of random changes, each opened from the previous version
+ *  7. Text inserted and removed at the start of the content of an element
+ *     and the content of an empty element
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define NUM_ITEMS	50
+#define NUM_CHANGES	100
+
+static char fname[1024];
+static char tname[1024+8];
+
+/* the value of every item, a value of -1 leaves the item out */
+static int values[NUM_ITEMS];
+
+/* replace the file by renaming a new file into place */
+static void write_doc(const char *head, const char *extra)
+{
+    FILE *f = fopen(tname, "wb");
+    int i;
+
+    if (!f) return;
+
+    fprintf(f, "<?xml version=\"1.0\"?>\n%s\n", head);
+    fprintf(f, "  <!-- items -->\n  <items>\n");
+    for (i=0; i<NUM_ITEMS; i++)
+    {
+        if (values[i] < 0) continue;
+        fprintf(f, "    <item id=\"%i\"><value>%i</value>", i, values[i]);
+        if (values[i] % 3 == 0) {
+            fprintf(f, "<sub><a>%i</a><!-- c --><b/></sub>", values[i]);
+        }
+        fprintf(f, "</item>\n");
+    }
+    fprintf(f, "  </items>\n%s  <last>end</last>\n</root>\n", extra);
+    fclose(f);
+    rename(tname, fname);
+}
+
+/* replace the file by a document of its own */
+static void write_raw(const char *doc)
+{
+    FILE *f = fopen(tname, "wb");
+
+    if (!f) return;
+
+    fputs(doc, f);
+    fclose(f);
+    rename(tname, fname);
+}
+
+static void write_values(void)
+{
+    write_doc("<root>", "");
+}
+
+/*
+ * Compare the nodes of two documents, the number of differences is
+ * returned.
+ */
+static int compare(const xmlId *a, const xmlId *b)
+{
+    int num = xmlNodeGetNum(a, "*");
+    int rv = 0;
+    int i;
+
+    if (num != xmlNodeGetNum(b, "*")) return 1;
+
+    for (i=0; i<num; i++)
+    {
+        xmlId *xa = xmlMarkId(a);
+        xmlId *xb = xmlMarkId(b);
+
+        if (xmlNodeGetPos(a, xa, "*", i) && xmlNodeGetPos(b, xb, "*", i))
+        {
+            char *na = xmlNodeGetName(xa);
+            char *nb = xmlNodeGetName(xb);
+            char *sa = xmlGetString(xa);
+            char *sb = xmlGetString(xb);
+
+            if (!na || !nb || strcmp(na, nb)) rv++;
+            if ((sa || sb) && (!sa || !sb || strcmp(sa, sb))) rv++;
+            if (xmlAttributeGetNum(xa) != xmlAttributeGetNum(xb)) rv++;
+            rv += compare(xa, xb);
+
+            xmlFree(na);
+            xmlFree(nb);
+            xmlFree(sa);
+            xmlFree(sb);
+        }
+        else {
+            rv++;
+        }
+        xmlFree(xa);
+        xmlFree(xb);
+    }
+
+    return rv;
+}
+
+/* the number of differences between id and the file opened from scratch */
+static int differences(const xmlId *id)
+{
+    xmlId *full = xmlOpenFlags(fname, XML_CACHE_NODES);
+    int rv = -1;
+
+    if (id && full) {
+        rv = compare(id, full);
+    }
+    if (full) xmlClose(full);
+
+    return rv;
+}
+
+static xmlId *reopen(xmlId *id)
+{
+    xmlId *rv = xmlReopen(id, fname, NULL);
+
+    xmlClose(id);
+    return rv;
+}
+
+static int item_value(const xmlId *id, int item)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/root/items/item[%i]/value", item+1);
+    return id ? (int)xmlNodeGetInt(id, path) : -1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_changes(void)
+{
+    xmlId *id;
+    int i;
+
+    for (i=0; i<NUM_ITEMS; i++) values[i] = i;
+    write_values();
+    id = xmlOpenFlags(fname, XML_CACHE_NODES);
+    CHECK("first version", item_value(id, 10), 10);
+
+    id = reopen(id);
+    CHECK("unchanged file", differences(id), 0);
+
+    values[10] = 11;
+    write_values();
+    id = reopen(id);
+    CHECK("changed value", item_value(id, 10), 11);
+    CHECK("changed value gives the same nodes", differences(id), 0);
+
+    values[10] = 123456;
+    write_values();
+    id = reopen(id);
+    CHECK("longer value", item_value(id, 10), 123456);
+    CHECK("node after a longer value", item_value(id, 40), 40);
+    CHECK("longer value gives the same nodes", differences(id), 0);
+
+    values[10] = 9;
+    write_values();
+    id = reopen(id);
+    CHECK("value with child nodes", item_value(id, 10), 9);
+    CHECK("added child nodes give the same nodes", differences(id), 0);
+
+    values[20] = -1;
+    write_values();
+    id = reopen(id);
+    CHECK("node after a removed element", item_value(id, 20), 21);
+    CHECK("removed element gives the same nodes", differences(id), 0);
+
+    values[20] = 20;
+    write_values();
+    id = reopen(id);
+    CHECK("inserted element", item_value(id, 20), 20);
+    CHECK("inserted element gives the same nodes", differences(id), 0);
+
+    if (id)
+    {
+        char *s = xmlNodeGetString(id, "/root/last");
+        CHECK("last node", s && !strcmp(s, "end"), 1);
+        xmlFree(s);
+        xmlClose(id);
+    }
+}
+
+static void test_scratch(void)
+{
+    xmlId *id, *xid, *node;
+    xmlOptions options;
+    int i;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = XML_CACHE_NODES|XML_IGNORE_COMMENT;
+
+    for (i=0; i<NUM_ITEMS; i++) values[i] = i;
+    write_values();
+    id = xmlOpenFlags(fname, XML_CACHE_NODES);
+
+    write_doc("<root version=\"2\">", "");
+    id = reopen(id);
+    CHECK("changed root element", differences(id), 0);
+
+    write_doc("<root version=\"2\">", "  <extra>1</extra>\n");
+    id = reopen(id);
+    CHECK("added element in the root element", differences(id), 0);
+    CHECK("node in the added element", xmlNodeGetInt(id, "/root/extra"), 1);
+
+    write_doc("<root version=\"2\">", "");
+    xid = xmlReopen(id, fname, &options);
+    node = xid ? xmlNodeGet(xid, "/root/items/item[4]/sub") : NULL;
+    if (node)
+    {
+        CHECK("other options", xmlNodeGetNum(node, "*"), 2);
+        xmlFree(node);
+    }
+    if (xid) xmlClose(xid);
+    if (id) xmlClose(id);
+
+    id = xmlOpenFlags(fname, XML_LAZY_NODES);
+    values[5] = 55;
+    write_doc("<root version=\"2\">", "");
+    id = reopen(id);
+    CHECK("previous document without node cache", item_value(id, 5), 55);
+    if (id) xmlClose(id);
+}
+
+static void test_previous(void)
+{
+    xmlId *id, *xid, *node;
+    int i;
+
+    for (i=0; i<NUM_ITEMS; i++) values[i] = i;
+    write_values();
+    id = xmlOpenFlags(fname, XML_CACHE_NODES);
+    node = xmlNodeGet(id, "/root/items/item[31]");
+
+    values[5] = 500;
+    write_values();
+    xid = xmlReopen(id, fname, NULL);
+    CHECK("new version", item_value(xid, 5), 500);
+    CHECK("previous version stays valid", item_value(id, 5), 5);
+    if (node)
+    {
+        CHECK("node of the previous version",
+              xmlNodeGetInt(node, "value"), 30);
+        xmlFree(node);
+    }
+    if (id) xmlClose(id);
+
+    CHECK("new version after closing the previous version",
+          item_value(xid, 30), 30);
+
+    /* an unterminated comment */
+    values[5] = -1;
+    write_doc("<root>", "  <bad><!-- unterminated </bad>\n");
+    id = xmlReopen(xid, fname, NULL);
+    CHECK("invalid change is rejected", id == NULL, 1);
+    if (id) xmlClose(id);
+    if (xid) xmlClose(xid);
+}
+
+/* reopen a document as doc, returns 1 if path has the value str or NULL */
+static int reopen_raw(xmlId **id, const char *doc, const char *path, const char *str)
+{
+    char *s;
+    int rv;
+
+    write_raw(doc);
+    *id = reopen(*id);
+    s = *id ? xmlNodeGetString(*id, path) : NULL;
+    rv = ((str ? (s && !strcmp(s, str)) : !s) && differences(*id) == 0);
+    xmlFree(s);
+
+    return rv;
+}
+
+static void test_content(void)
+{
+    xmlId *id;
+
+    write_raw("<r><a>x</a><b>y</b></r>");
+    id = xmlOpenFlags(fname, XML_CACHE_NODES);
+
+    CHECK("text inserted at the start",
+          reopen_raw(&id, "<r><a>zx</a><b>y</b></r>", "/r/a", "zx"), 1);
+    CHECK("text inserted at the start of the next element",
+          reopen_raw(&id, "<r><a>zx</a><b>zy</b></r>", "/r/b", "zy"), 1);
+    CHECK("text removed at the start",
+          reopen_raw(&id, "<r><a>x</a><b>zy</b></r>", "/r/a", "x"), 1);
+    CHECK("text removed at the start of the next element",
+          reopen_raw(&id, "<r><a>x</a><b>y</b></r>", "/r/b", "y"), 1);
+    CHECK("content of an empty element",
+          reopen_raw(&id, "<r><a></a><b>y</b></r>", "/r/a", NULL), 1);
+    CHECK("text in an empty element",
+          reopen_raw(&id, "<r><a>z</a><b>y</b></r>", "/r/a", "z"), 1);
+    CHECK("child node in an empty element",
+          reopen_raw(&id, "<r><a></a><b><c>1</c></b></r>", "/r/b/c", "1"), 1);
+    CHECK("text before a child node",
+          reopen_raw(&id, "<r><a></a><b>z<c>1</c></b></r>", "/r/b/c", "1"), 1);
+    if (id) xmlClose(id);
+}
+
+static void test_random(void)
+{
+    xmlId *id;
+    int errors = 0;
+    int i;
+
+    srand(1);
+    for (i=0; i<NUM_ITEMS; i++) values[i] = i;
+    write_values();
+    id = xmlOpenFlags(fname, XML_CACHE_NODES);
+
+    for (i=0; i<NUM_CHANGES && id; i++)
+    {
+        int item = rand() % NUM_ITEMS;
+
+        switch (rand() % 4)
+        {
+        case 0:
+            values[item] = (values[item] < 0) ? item : -1;
+            break;
+        default:
+            values[item] = rand() % 100000;
+            break;
+        }
+        write_values();
+        id = reopen(id);
+        if (differences(id) != 0) errors++;
+    }
+    CHECK("random changes give the same nodes", errors, 0);
+    if (id) xmlClose(id);
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_reindex: incremental re-index tests ===\n\n");
+
+    snprintf(fname, sizeof(fname), "/tmp/test_reindex-%i.xml", (int)getpid());
+    snprintf(tname, sizeof(tname), "%s.tmp", fname);
+
+    test_changes();
+    test_scratch();
+    test_previous();
+    test_content();
+    test_random();
+
+    remove(fname);
+
+    return test_results();
+}
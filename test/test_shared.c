@@ -344,3 +344,18 @@ int test(xmlId *rid)
 
     return 0;
 }
+
+int tests_run    = 0;
+int tests_passed = 0;
+int tests_failed = 0;
+
+/* print the summary of PASS, FAIL and CHECK, return the exit code */
+int test_results(void)
+{
+    printf("\n--- Results: %d/%d passed", tests_passed, tests_run);
+    if (tests_failed)
+        printf(", %d FAILED", tests_failed);
+    printf(" ---\n");
+
+    return tests_failed ? 1 : 0;
+}
@@ -17,6 +17,28 @@
       exit(-1); \
   } while(0);
 
+extern int tests_run;
+extern int tests_passed;
+extern int tests_failed;
+
+#define PASS(desc) do { \
+    printf("  PASS  %s\n", (desc)); \
+    tests_passed++; tests_run++; \
+} while(0)
+
+#define FAIL(desc, got, expected) do { \
+    printf("  FAIL  %s\n         got %i, expected %i\n", \
+           (desc), (int)(got), (int)(expected)); \
+    tests_failed++; tests_run++; \
+} while(0)
+
+#define CHECK(desc, got, expected) do { \
+    if ((got) == (expected)) PASS(desc); \
+    else FAIL(desc, got, expected); \
+} while(0)
+
+int test_results(void);
+
 #define TESTINT(p, a, b) \
   if (a == b) printf("Testing %-63s: succes\n", p); \
   else printf("Testing %-63s: failed\n\t%i should be %i.\n", p, (int)a, (int)b);
@@ -0,0 +1,239 @@
+/*
+ * test_split.c
+ *
+ * Tests for splitting files of concatenated documents into records.
+ *
+ * Coverage
+ * --------
+ *  1. Documents with a declaration, a DOCTYPE, comments, processing
+ *     instructions, CDATA sections and attribute values holding markup are
+ *     split at the end of their root element
+ *  2. Documents which follow each other directly and empty root elements
+ *  3. A document which is not terminated at the end is returned as it is,
+ *     comments after the last document are ignored
+ *  4. A file of newline delimited documents split in batches
+ *  5. xmlSplitDispatch processes every record once with several threads and
+ *     stops when the callback asks for it
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define NUM_RECORDS	10000
+#define NUM_THREADS	4
+
+static const char *docs =
+    "<?xml version=\"1.0\"?>\n"
+    "<rec><id>1</id><a x=\"1>2\" y='a>b'>t</a><!-- </rec> -->"
+    "<![CDATA[</rec>]]></rec>\n"
+    "<rec><id>2</id><rec>nested</rec><b/></rec><rec><id>3</id></rec>"
+    "<?xml version=\"1.0\"?><!DOCTYPE rec [<!ENTITY e \"x>y\">]>"
+    "<rec><id>4</id><?pi </rec>?>ok</rec>\n"
+    "<rec type=\"empty\"/>\n";
+
+static char fname[1024];
+
+/* the id of the document of a record */
+static long record_id(const xmlId *id)
+{
+    return id ? xmlNodeGetInt(id, "/rec/id") : -1;
+}
+
+static void write_records(void)
+{
+    FILE *f = fopen(fname, "wb");
+    int i;
+
+    if (!f) return;
+
+    for (i=1; i<=NUM_RECORDS; i++) {
+        fprintf(f, "<rec><id>%i</id><user>u%i</user><action>login</action>"
+                   "</rec>\n", i, i % 100);
+    }
+    fclose(f);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_boundaries(void)
+{
+    xmlSplitter *sid = xmlSplitInitBuffer(docs, strlen(docs), NULL);
+    xmlRecord records[8];
+    int i, num, errors = 0;
+
+    CHECK("splitter", sid != NULL, 1);
+    if (!sid) return;
+
+    num = xmlSplitRecords(sid, records, 8);
+    CHECK("number of records", num, 5);
+    CHECK("first record starts at the declaration", records[0].offset, 0);
+    CHECK("first record ends at its root element",
+          memcmp(docs + records[0].length - 9, "]]></rec>", 9), 0);
+    CHECK("directly following record",
+          (int)(records[2].offset - records[1].offset - records[1].length), 0);
+    CHECK("empty root element", records[4].length,
+          strlen("<rec type=\"empty\"/>"));
+
+    for (i=0; i<4; i++)
+    {
+        xmlId *id = xmlSplitGet(sid, &records[i]);
+
+        if (record_id(id) != i+1) errors++;
+        if (id) xmlClose(id);
+    }
+    CHECK("documents of the records", errors, 0);
+    CHECK("after the last record", xmlSplitRecords(sid, records, 8), 0);
+
+    xmlSplitClose(sid);
+}
+
+static void test_unterminated(void)
+{
+    const char *buf = "<rec><id>1</id></rec>\n<rec><id>2</id><a>text";
+    const char *tail = "<rec><id>1</id></rec>\n<!-- end of the log -->\n";
+    xmlSplitter *sid;
+    xmlRecord records[4];
+    xmlId *id;
+
+    sid = xmlSplitInitBuffer(buf, strlen(buf), NULL);
+    if (!sid) return;
+    CHECK("unterminated record", xmlSplitRecords(sid, records, 4), 2);
+    CHECK("unterminated record length", records[1].offset + records[1].length,
+          strlen(buf));
+    id = xmlSplitGet(sid, &records[1]);
+    CHECK("unterminated record is reported", !id || xmlValidate(id, NULL), 1);
+    if (id) xmlClose(id);
+    xmlSplitClose(sid);
+
+    sid = xmlSplitInitBuffer(tail, strlen(tail), NULL);
+    if (!sid) return;
+    CHECK("comment after the last record", xmlSplitRecords(sid, records, 4), 1);
+    xmlSplitClose(sid);
+}
+
+static void test_file(void)
+{
+    xmlSplitter *sid = xmlSplitOpen(fname, NULL);
+    xmlRecord records[100];
+    int num, total = 0, errors = 0;
+
+    CHECK("open the file", sid != NULL, 1);
+    if (!sid) return;
+
+    while ((num = xmlSplitRecords(sid, records, 100)) > 0)
+    {
+        int i;
+
+        for (i=0; i<num; i++)
+        {
+            xmlId *id = xmlSplitGet(sid, &records[i]);
+
+            if (record_id(id) != total+i+1) errors++;
+            if (id) xmlClose(id);
+        }
+        total += num;
+    }
+    CHECK("records of the file", total, NUM_RECORDS);
+    CHECK("documents of the file", errors, 0);
+
+    xmlSplitClose(sid);
+    CHECK("missing file", xmlSplitOpen("/nonexistent/file.xml", NULL) == NULL,
+          1);
+}
+
+#if HAVE_PTHREAD_H
+typedef struct
+{
+    pthread_mutex_t mutex;
+    long sum;
+    int count;
+    int errors;
+    int stop_after;
+} totals;
+
+static int count_record(const xmlId *xid, const xmlRecord *record, void *user)
+{
+    totals *t = user;
+    long id = record_id(xid);
+    int rv;
+
+    pthread_mutex_lock(&t->mutex);
+    if (id <= 0) t->errors++;
+    t->sum += id;
+    t->count++;
+    rv = (t->stop_after && t->count >= t->stop_after);
+    pthread_mutex_unlock(&t->mutex);
+
+    return rv;
+}
+
+static void test_dispatch(void)
+{
+    xmlSplitter *sid = xmlSplitOpen(fname, NULL);
+    totals t;
+    long num;
+
+    if (!sid) return;
+
+    memset(&t, 0, sizeof(t));
+    pthread_mutex_init(&t.mutex, NULL);
+    num = xmlSplitDispatch(sid, NUM_THREADS, count_record, &t);
+    CHECK("dispatched records", num, NUM_RECORDS);
+    CHECK("records passed to the callback", t.count, NUM_RECORDS);
+    CHECK("every record once", t.sum == (long)NUM_RECORDS*(NUM_RECORDS+1)/2, 1);
+    CHECK("documents of the threads", t.errors, 0);
+    xmlSplitClose(sid);
+
+    sid = xmlSplitOpen(fname, NULL);
+    if (sid)
+    {
+        t.sum = t.count = t.errors = 0;
+        t.stop_after = 10;
+        num = xmlSplitDispatch(sid, NUM_THREADS, count_record, &t);
+        CHECK("stop on request", num < NUM_RECORDS, 1);
+        xmlSplitClose(sid);
+    }
+    pthread_mutex_destroy(&t.mutex);
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_split: concatenated document splitter tests ===\n\n");
+
+    snprintf(fname, sizeof(fname), "/tmp/test_split-%i.xml", (int)getpid());
+    write_records();
+
+    test_boundaries();
+    test_unterminated();
+    test_file();
+#if HAVE_PTHREAD_H
+    test_dispatch();
+#endif
+
+    remove(fname);
+
+    return test_results();
+}
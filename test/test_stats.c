@@ -0,0 +1,169 @@
+/*
+ * test_stats.c
+ *
+ * Tests for the statistics of documents and of the process.
+ *
+ * Coverage
+ * --------
+ *  1. Without the STATS build option xmlGetStats returns XML_FALSE and
+ *     statistics of zero
+ *  2. Lookups of XML_SCAN_NODES scan the document and are cache misses
+ *  3. Lookups of XML_CACHE_NODES are cache hits of a node cache which was
+ *     built at open
+ *  4. The statistics of the process cover those of all documents
+ *  5. A parser context only reports its current document
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "test_shared.h"
+
+static const char *doc =
+    "<?xml version=\"1.0\"?>\n"
+    "<root>\n"
+    "  <items>\n"
+    "    <item><value>1</value></item>\n"
+    "    <item><value>2</value></item>\n"
+    "    <item><value>3</value></item>\n"
+    "  </items>\n"
+    "  <last>end</last>\n"
+    "</root>\n";
+
+static xmlId *open_doc(enum xmlFlags flags)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    return xmlInitBufferOptions(doc, (int)strlen(doc), &options);
+}
+
+static int lookups(const xmlId *id)
+{
+    int rv = 0;
+
+    rv += xmlNodeGetInt(id, "/root/items/item[3]/value");
+    rv += xmlNodeGetInt(id, "/root/items/item[1]/value");
+    return rv;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+#if XML_USE_STATS
+static void test_scan(void)
+{
+    xmlId *id = open_doc(XML_SCAN_NODES);
+    xmlStats stats;
+
+    if (!id) return;
+
+    CHECK("lookups", lookups(id), 4);
+    CHECK("statistics of the document", xmlGetStats(id, &stats), XML_TRUE);
+    CHECK("bytes scanned", stats.bytes_scanned > 0, 1);
+    CHECK("searches for the next tag", stats.memchr_calls > 0, 1);
+    CHECK("deepest nesting level", stats.max_depth >= 3, 1);
+    CHECK("cache misses of a scan", stats.cache_misses > 0, 1);
+    CHECK("no node cache", stats.nodes_created, 0);
+    CHECK("one document", stats.documents, 1);
+    CHECK("time to open", stats.open_time >= 0.0, 1);
+
+    xmlClose(id);
+}
+
+static void test_cache(void)
+{
+    xmlId *id = open_doc(XML_CACHE_NODES);
+    xmlStats stats, process;
+
+    if (!id) return;
+
+    xmlGetStats(id, &stats);
+    CHECK("nodes of the node cache", stats.nodes_created > 0, 1);
+    CHECK("allocations of the node cache", stats.allocations > 0, 1);
+    CHECK("bytes of the node cache",
+          stats.bytes_allocated >= stats.allocations, 1);
+    CHECK("scan to build the node cache", stats.bytes_scanned > 0, 1);
+
+    CHECK("lookups", lookups(id), 4);
+    xmlGetStats(id, &stats);
+    CHECK("cache hits of a node cache", stats.cache_hits > 0, 1);
+
+    CHECK("statistics of the process", xmlGetStats(NULL, &process), XML_TRUE);
+    CHECK("documents of the process", process.documents >= 2, 1);
+    CHECK("bytes of the process", process.bytes_scanned >= stats.bytes_scanned,
+          1);
+    CHECK("hits of the process", process.cache_hits >= stats.cache_hits, 1);
+    CHECK("nesting level of the process", process.max_depth >= stats.max_depth,
+          1);
+
+    xmlClose(id);
+}
+
+static void test_context(void)
+{
+    xmlContext *ctx = xmlContextOpen(NULL);
+    xmlStats stats;
+    int i;
+
+    if (!ctx) return;
+
+    for (i=0; i<10; i++)
+    {
+        xmlId *id = xmlReset(ctx, doc, (int)strlen(doc));
+
+        if (id) lookups(id);
+        if (id) xmlGetStats(id, &stats);
+    }
+    CHECK("documents of a context", stats.documents, 1);
+
+    xmlContextClose(ctx);
+}
+#else
+static void test_disabled(void)
+{
+    xmlId *id = open_doc(XML_CACHE_NODES);
+    xmlStats stats;
+
+    if (!id) return;
+
+    lookups(id);
+    memset(&stats, 0xff, sizeof(stats));
+    CHECK("statistics are not collected", xmlGetStats(id, &stats), XML_FALSE);
+    CHECK("statistics of zero", stats.bytes_scanned + stats.documents, 0);
+    CHECK("process statistics", xmlGetStats(NULL, &stats), XML_FALSE);
+
+    xmlClose(id);
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_stats: document statistics tests ===\n\n");
+
+    CHECK("no statistics without a buffer", xmlGetStats(NULL, NULL), XML_FALSE);
+#if XML_USE_STATS
+    test_scan();
+    test_cache();
+    test_context();
+#else
+    test_disabled();
+#endif
+
+    return test_results();
+}
@@ -0,0 +1,159 @@
+/*
+ * test_storage.c
+ *
+ * Tests for XML-ids in storage provided by the caller.
+ *
+ * Coverage
+ * --------
+ *  1. xmlNodeGetInto finds the same node as xmlNodeGet
+ *  2. xmlNodeGetInto on an XML-id in caller storage
+ *  3. A node which does not exist returns NULL and sets the error
+ *  4. xmlMarkIdInto with xmlNodeGetNum and xmlNodeGetPos walks all nodes
+ *  5. A loop of lookups does not allocate from the arena of the document
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define NUM_LOOKUPS	1000
+
+static const char *doc =
+    "<?xml version=\"1.0\"?>\n"
+    "<root>\n"
+    "  <items>\n"
+    "    <item><value>10</value><name>first</name></item>\n"
+    "    <item><value>20</value><name>second</name></item>\n"
+    "    <item><value>30</value><name>third</name></item>\n"
+    "  </items>\n"
+    "</root>\n";
+
+static xmlId *open_doc(enum xmlFlags flags)
+{
+    xmlOptions options;
+
+    memset(&options, 0, sizeof(options));
+    options.flags = flags;
+
+    return xmlInitBufferOptions(doc, (int)strlen(doc), &options);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_get(void)
+{
+    xmlNodeStorage storage, sub;
+    xmlId *id, *xid, *nid, *ref;
+
+    id = open_doc(XML_CACHE_NODES);
+    if (!id) return;
+
+    xid = xmlNodeGetInto(id, "/root/items/item[2]", &storage);
+    ref = xmlNodeGet(id, "/root/items/item[2]");
+    CHECK("node found", xid != NULL, 1);
+    CHECK("XML-id is the storage", (void*)xid == (void*)&storage, 1);
+    if (xid && ref)
+    {
+        char a[64], b[64];
+
+        xmlNodeCopyString(xid, "name", a, sizeof(a));
+        xmlNodeCopyString(ref, "name", b, sizeof(b));
+        CHECK("same node as xmlNodeGet", strcmp(a, b), 0);
+        CHECK("node value", xmlNodeGetInt(xid, "value"), 20);
+
+        nid = xmlNodeGetInto(xid, "name", &sub);
+        CHECK("node of a node in storage", nid != NULL, 1);
+        if (nid)
+        {
+            xmlCopyString(nid, a, sizeof(a));
+            CHECK("value of the node in storage", strcmp(a, "second"), 0);
+        }
+    }
+    xmlFree(ref);
+
+    xid = xmlNodeGetInto(id, "/root/items/missing", &storage);
+    CHECK("missing node", xid == NULL, 1);
+    CHECK("missing node error", xmlErrorGetNo(id, XML_TRUE) != XML_NO_ERROR, 1);
+
+    xmlClose(id);
+}
+
+static void test_mark(void)
+{
+    xmlNodeStorage items, mark, node;
+    xmlId *id, *xid, *xmid;
+    int i, num, sum = 0;
+
+    id = open_doc(XML_CACHE_NODES);
+    if (!id) return;
+
+    xid = xmlNodeGetInto(id, "/root/items", &items);
+    xmid = xid ? xmlMarkIdInto(xid, &mark) : NULL;
+    num = xid ? xmlNodeGetNum(xid, "item") : 0;
+    CHECK("number of nodes", num, 3);
+    for (i=0; i<num; i++)
+    {
+        if (xmlNodeGetPos(xid, xmid, "item", i)) {
+            sum += (int)xmlNodeGetInt(xmid, "value");
+        }
+    }
+    CHECK("walk with a marker in storage", sum, 60);
+
+    xmid = xmlMarkIdInto(id, &mark);
+    xid = xmlNodeGetInto(xmid, "/root/items/item[3]", &node);
+    CHECK("marker of the document", xid ? xmlNodeGetInt(xid, "value") : 0, 30);
+
+    xmlClose(id);
+}
+
+static void test_no_allocations(void)
+{
+    xmlNodeStorage items, mark;
+    xmlId *id;
+    size_t pos;
+    int i, sum = 0;
+
+    id = open_doc(XML_CACHE_NODES|XML_ARENA);
+    if (!id) return;
+
+    pos = xmlArenaMark(id);
+    for (i=0; i<NUM_LOOKUPS; i++)
+    {
+        xmlId *xid = xmlNodeGetInto(id, "/root/items", &items);
+        xmlId *xmid = xid ? xmlMarkIdInto(xid, &mark) : NULL;
+
+        if (xmid && xmlNodeGetPos(xid, xmid, "item", i % 3)) {
+            sum += (int)xmlNodeGetInt(xmid, "value");
+        }
+    }
+    CHECK("lookups", sum, 20*NUM_LOOKUPS - 10);
+    CHECK("no allocations", xmlArenaMark(id) == pos, 1);
+
+    xmlClose(id);
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_storage: caller provided XML-id storage tests ===\n\n");
+
+    test_get();
+    test_mark();
+    test_no_allocations();
+
+    return test_results();
+}
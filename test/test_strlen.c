@@ -0,0 +1,174 @@
+/*
+ * test_strlen.c
+ *
+ * Tests for the exact length of node strings.
+ *
+ * Coverage
+ * --------
+ *  1. xmlGetStringLength matches the string of xmlGetString for plain text,
+ *     text surrounded by spaces, CDATA sections and comments
+ *  2. xmlCopyString with a buffer of xmlGetStringLength plus one copies the
+ *     whole string
+ *  3. xmlCopyString with a smaller buffer truncates the string and sets
+ *     XML_TRUNCATE_RESULT
+ *  4. The string of a large text node is allocated at its exact size
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define LARGE_SIZE	(4*1024*1024)
+
+static const char *doc =
+    "<?xml version=\"1.0\"?>\n"
+    "<root>\n"
+    "  <plain>value</plain>\n"
+    "  <spaces>   some value \n </spaces>\n"
+    "  <cdata><![CDATA[ <b>bold</b> ]]></cdata>\n"
+    "  <comment><!-- note -->text</comment>\n"
+    "  <empty></empty>\n"
+    "</root>\n";
+
+/* the size of the largest allocation */
+static size_t largest = 0;
+
+static void *sized_alloc(size_t size, void *context)
+{
+    if (size > largest) largest = size;
+    return malloc(size);
+}
+
+static void *sized_resize(void *ptr, size_t size, void *context)
+{
+    if (size > largest) largest = size;
+    return realloc(ptr, size);
+}
+
+static void sized_release(void *ptr, void *context)
+{
+    free(ptr);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void check_node(const xmlId *id, const char *path)
+{
+    char desc[128];
+    xmlId *xid = xmlNodeGet(id, path);
+    char *s = xid ? xmlGetString(xid) : NULL;
+    size_t len = xid ? xmlGetStringLength(xid) : 0;
+
+    snprintf(desc, sizeof(desc), "length of %s", path);
+    CHECK(desc, len, s ? strlen(s) : 0);
+
+    if (xid)
+    {
+        char *buf = malloc(len+1);
+
+        xmlErrorGetNo(xid, 1);
+        snprintf(desc, sizeof(desc), "copy of %s", path);
+        CHECK(desc, xmlCopyString(xid, buf, (int)len+1), (int)len);
+        CHECK(desc, s ? strcmp(buf, s) : (int)len, 0);
+        CHECK(desc, xmlErrorGetNo(xid, 1), XML_NO_ERROR);
+        free(buf);
+    }
+    xmlFree(s);
+    xmlFree(xid);
+}
+
+static void test_length(void)
+{
+    xmlId *id = xmlInitBuffer(doc, (int)strlen(doc));
+
+    if (!id) return;
+
+    check_node(id, "/root/plain");
+    check_node(id, "/root/spaces");
+    check_node(id, "/root/cdata");
+    check_node(id, "/root/comment");
+    check_node(id, "/root/empty");
+
+    xmlClose(id);
+}
+
+static void test_truncate(void)
+{
+    xmlId *id = xmlInitBuffer(doc, (int)strlen(doc));
+    xmlId *xid = id ? xmlNodeGet(id, "/root/spaces") : NULL;
+
+    if (xid)
+    {
+        char buf[5];
+
+        xmlErrorGetNo(xid, 1);
+        CHECK("truncated copy", xmlCopyString(xid, buf, sizeof(buf)), 4);
+        CHECK("truncated string", strcmp(buf, "some"), 0);
+        CHECK("truncated error", xmlErrorGetNo(xid, 1), XML_TRUNCATE_RESULT);
+    }
+    xmlFree(xid);
+    if (id) xmlClose(id);
+}
+
+static void test_large(void)
+{
+    xmlAllocator allocator;
+    char *buf = malloc(LARGE_SIZE + 64);
+    xmlId *id, *xid;
+    size_t len;
+    char *s;
+
+    if (!buf) return;
+
+    strcpy(buf, "<root><text>");
+    len = strlen(buf);
+    memset(buf+len, 'x', LARGE_SIZE);
+    strcpy(buf+len+LARGE_SIZE, "</text></root>");
+
+    allocator.alloc = sized_alloc;
+    allocator.resize = sized_resize;
+    allocator.release = sized_release;
+    allocator.context = NULL;
+    xmlSetAllocator(&allocator);
+
+    id = xmlInitBuffer(buf, (int)strlen(buf));
+    xid = id ? xmlNodeGet(id, "/root/text") : NULL;
+    CHECK("large text length", xid ? xmlGetStringLength(xid) : 0, LARGE_SIZE);
+
+    largest = 0;
+    s = xid ? xmlGetString(xid) : NULL;
+    CHECK("large text string", s ? strlen(s) : 0, LARGE_SIZE);
+    CHECK("allocated at the exact size", largest, LARGE_SIZE+1);
+
+    xmlFree(s);
+    xmlFree(xid);
+    if (id) xmlClose(id);
+    xmlSetAllocator(NULL);
+    free(buf);
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_strlen: node string length tests ===\n\n");
+
+    test_length();
+    test_truncate();
+    test_large();
+
+    return test_results();
+}
@@ -0,0 +1,316 @@
+/*
+ * test_trace.c
+ *
+ * Tests for the trace spans of the library.
+ *
+ * Coverage
+ * --------
+ *  1. Without the TRACE build option xmlTraceExport writes nothing
+ *  2. Opening, indexing, path lookups which scan the document, character
+ *     set conversion and closing a document record their spans in the
+ *     Chrome trace_event format
+ *  3. xmlTraceClear discards the spans
+ *  4. The ring buffer of a thread keeps its most recent spans
+ *  5. Every thread records its spans with a thread id of its own, also when
+ *     it reuses the buffer of a thread which exited
+ *  6. Spans can be exported and cleared while other threads record them
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define NUM_LOOKUPS	10000
+#define NUM_THREADS	2
+
+static char fname[1024];
+static char tname[1024];
+
+static const char *doc =
+    "<?xml version=\"1.0\"?>\n"
+    "<root>\n"
+    "  <items>\n"
+    "    <item><value>1</value></item>\n"
+    "    <item><value>2</value></item>\n"
+    "  </items>\n"
+    "  <last>end</last>\n"
+    "</root>\n";
+
+static void write_doc(void)
+{
+    FILE *f = fopen(fname, "wb");
+
+    if (!f) return;
+    fputs(doc, f);
+    fclose(f);
+}
+
+#if XML_USE_TRACE
+static const char *latin1 =
+    "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
+    "<root><text>caf\xe9</text></root>\n";
+static int converting = 0;
+
+/* read the exported trace, the caller frees it */
+static char *read_trace(void)
+{
+    FILE *f = fopen(tname, "rb");
+    char *rv = NULL;
+    long size;
+
+    if (!f) return rv;
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size >= 0 && (rv = malloc(size+1)) != NULL)
+    {
+        size = (long)fread(rv, 1, size, f);
+        rv[size] = 0;
+    }
+    fclose(f);
+
+    return rv;
+}
+
+/* the number of spans with name in the trace */
+static int count_spans(const char *trace, const char *name)
+{
+    char key[64];
+    int rv = 0;
+
+    snprintf(key, sizeof(key), "\"name\":\"%s\"", name);
+    while (trace && (trace = strstr(trace, key)) != NULL)
+    {
+        trace += strlen(key);
+        rv++;
+    }
+    return rv;
+}
+#endif
+
+static void use_doc(enum xmlFlags flags, int lookups)
+{
+    xmlId *id = xmlOpenFlags(fname, flags);
+    int i;
+
+    if (!id) return;
+
+    for (i=0; i<lookups; i++) {
+        xmlNodeGetInt(id, "/root/items/item[1]/value");
+    }
+    xmlFree(xmlNodeGetString(id, "/root/last"));
+    xmlClose(id);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+#if XML_USE_TRACE
+static void test_spans(void)
+{
+    char *trace;
+    int num;
+
+    xmlTraceClear();
+    use_doc(XML_CACHE_NODES, 1);
+    use_doc(XML_SCAN_NODES, 1);
+
+    num = xmlTraceExport(tname);
+    CHECK("spans written", num > 0, 1);
+    trace = read_trace();
+    CHECK("trace_event file", trace && !strncmp(trace, "{\"traceEvents\":[", 16),
+          1);
+    CHECK("complete events", count_spans(trace, "xmlOpen") == 2 &&
+                             strstr(trace, "\"ph\":\"X\"") != NULL, 1);
+    CHECK("spans of the declaration", count_spans(trace, "declaration"), 2);
+    CHECK("span of the node cache", count_spans(trace, "cache"), 1);
+    CHECK("spans of the scanned path steps", count_spans(trace, "path"), 6);
+    CHECK("spans of xmlClose", count_spans(trace, "xmlClose"), 2);
+    free(trace);
+
+    xmlTraceClear();
+    CHECK("spans discarded", xmlTraceExport(tname), 0);
+    trace = read_trace();
+    CHECK("empty trace", trace && strstr(trace, "]") != NULL, 1);
+    free(trace);
+}
+
+static void test_convert(void)
+{
+    xmlId *id;
+    char *trace;
+
+    if (!converting) return;
+
+    xmlTraceClear();
+    id = xmlInitBufferFlags(latin1, (int)strlen(latin1), XML_LOCALIZATION);
+    if (!id) return;
+    xmlFree(xmlNodeGetString(id, "/root/text"));
+    xmlClose(id);
+
+    xmlTraceExport(tname);
+    trace = read_trace();
+    CHECK("span of the conversion", count_spans(trace, "convert") > 0, 1);
+    CHECK("span of xmlInitBuffer", count_spans(trace, "xmlInitBuffer"), 1);
+    free(trace);
+}
+
+static void test_ring(void)
+{
+    int num;
+
+    xmlTraceClear();
+    use_doc(XML_SCAN_NODES, NUM_LOOKUPS);
+
+    num = xmlTraceExport(tname);
+    CHECK("ring buffer is full", num > 0 && num < NUM_LOOKUPS, 1);
+    CHECK("most recent spans", xmlTraceExport(tname), num);
+    {
+        char *trace = read_trace();
+        CHECK("last span kept", count_spans(trace, "xmlClose"), 1);
+        CHECK("first span overwritten", count_spans(trace, "xmlOpen"), 0);
+        free(trace);
+    }
+}
+
+#if HAVE_PTHREAD_H
+static void *worker(void *arg)
+{
+    use_doc(XML_CACHE_NODES, 10);
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    pthread_t threads[NUM_THREADS];
+    char *trace;
+    int i;
+
+    xmlTraceClear();
+    for (i=0; i<NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    for (i=0; i<NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    xmlTraceExport(tname);
+    trace = read_trace();
+    CHECK("spans of every thread", count_spans(trace, "xmlClose"),
+          NUM_THREADS);
+    CHECK("thread ids", trace && strstr(trace, "\"tid\":2") != NULL, 1);
+    free(trace);
+
+    /* the buffers of the threads which exited are reused */
+    xmlTraceClear();
+    for (i=0; i<NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    for (i=0; i<NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    xmlTraceExport(tname);
+    trace = read_trace();
+    CHECK("spans of the new threads", count_spans(trace, "xmlClose"),
+          NUM_THREADS);
+    CHECK("new thread ids", trace && !strstr(trace, "\"tid\":2") &&
+                            strstr(trace, "\"tid\":4") != NULL, 1);
+    free(trace);
+}
+
+static void *recorder(void *arg)
+{
+    int i;
+
+    for (i=0; i<50; i++) {
+        use_doc(XML_SCAN_NODES, 100);
+    }
+    return NULL;
+}
+
+static void test_concurrent(void)
+{
+    pthread_t threads[NUM_THREADS];
+    int i, failed = 0;
+
+    for (i=0; i<NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, recorder, NULL);
+    }
+    for (i=0; i<20; i++)
+    {
+        if (xmlTraceExport(tname) < 0) failed++;
+        if (i == 10) xmlTraceClear();
+    }
+    for (i=0; i<NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK("export while threads record spans", failed, 0);
+}
+#endif
+#else
+static void test_disabled(void)
+{
+    FILE *f;
+
+    use_doc(XML_CACHE_NODES, 1);
+    remove(tname);
+    CHECK("spans are not recorded", xmlTraceExport(tname), 0);
+    f = fopen(tname, "rb");
+    CHECK("no file written", f == NULL, 1);
+    if (f) fclose(f);
+    xmlTraceClear();
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_trace: trace span tests ===\n\n");
+
+    snprintf(fname, sizeof(fname), "/tmp/test_trace-%i.xml", (int)getpid());
+    snprintf(tname, sizeof(tname), "/tmp/test_trace-%i.json", (int)getpid());
+    write_doc();
+
+#if XML_USE_TRACE
+    /* converting needs a locale with a character set, detected at first use */
+    setenv("LC_ALL", "C.UTF-8", 1);
+    converting = (setlocale(LC_CTYPE, "") != NULL);
+
+    test_spans();
+    test_convert();
+    test_ring();
+# if HAVE_PTHREAD_H
+    test_threads();
+    test_concurrent();
+# endif
+#else
+    test_disabled();
+#endif
+
+    remove(fname);
+    remove(tname);
+
+    return test_results();
+}
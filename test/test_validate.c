@@ -0,0 +1,227 @@
+/*
+ * test_validate.c
+ *
+ * Tests for the single pass well-formedness checker xmlValidate().
+ *
+ * Coverage
+ * --------
+ *  1. A well formed document reports no errors
+ *  2. Tag balance: missing closing tag, stray closing tag, unclosed document
+ *  3. Attribute quoting: missing opening and closing quotes
+ *  4. Unterminated comment and CDATA sections
+ *  5. Invalid element names
+ *  6. Multiple errors are collected with their line and column number
+ *  7. The list is never overrun and a NULL list stops at the first error
+ *  8. Line and column numbers far into a document spanning multiple blocks
+ *     of the line number index
+ *
+ * Every document is opened with XML_SCAN_NODES so the node cache does not
+ * reject malformed input before the validator gets to see it.
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define MAX_ERRORS	8
+
+/* ------------------------------------------------------------------ */
+/* Helper: validate a buffer and return the number of errors            */
+/* ------------------------------------------------------------------ */
+static int validate(const char *xml, xmlErrorList *list)
+{
+    xmlId *id = xmlInitBufferFlags(xml, (int)strlen(xml), XML_SCAN_NODES);
+    int rv = -1;
+
+    if (id)
+    {
+        rv = xmlValidate(id, list);
+        xmlClose(id);
+    }
+    return rv;
+}
+
+static int first_error(const char *xml)
+{
+    xmlErrorInfo errors[MAX_ERRORS];
+    xmlErrorList list;
+
+    list.max_errors = MAX_ERRORS;
+    list.errors = errors;
+    if (validate(xml, &list) <= 0) return XML_NO_ERROR;
+    return errors[0].err_no;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_well_formed(void)
+{
+    const char *xml =
+        "<?xml version=\"1.0\"?>\n"
+        "<!DOCTYPE config [\n"
+        "  <!ELEMENT config (item*)>\n"
+        "]>\n"
+        "<config>\n"
+        "  <!-- a comment with <tags> inside -->\n"
+        "  <item n=\"1\" type='a'>value</item>\n"
+        "  <item n=\"2\"/>\n"
+        "  <data><![CDATA[<not a tag>]]></data>\n"
+        "  <?target instruction?>\n"
+        "</config>\n";
+
+    CHECK("well formed document has no errors", validate(xml, NULL), 0);
+}
+
+static void test_tag_balance(void)
+{
+    CHECK("missing closing tag",
+          first_error("<a><b></a>"), XML_ELEMENT_NO_CLOSING_TAG);
+    CHECK("closing tag without an opening tag",
+          first_error("<a></b></a>"), XML_ELEMENT_NO_OPENING_TAG);
+    CHECK("document ends before the root element is closed",
+          first_error("<a><b></b>"), XML_ELEMENT_NO_CLOSING_TAG);
+}
+
+static void test_attribute_quoting(void)
+{
+    CHECK("attribute without an opening quote",
+          first_error("<a n=1></a>"), XML_ATTRIB_NO_OPENING_QUOTE);
+    CHECK("attribute without a closing quote",
+          first_error("<a n=\"1></a>"), XML_ATTRIB_NO_CLOSING_QUOTE);
+    CHECK("attribute without a value",
+          first_error("<a n></a>"), XML_ATTRIB_NO_OPENING_QUOTE);
+}
+
+static void test_sections(void)
+{
+    CHECK("unterminated comment",
+          first_error("<a><!-- comment</a>"), XML_INVALID_COMMENT);
+    CHECK("unterminated CDATA section",
+          first_error("<a><![CDATA[data</a>"), XML_INVALID_COMMENT);
+    CHECK("unterminated processing instruction",
+          first_error("<a><?target</a>"), XML_INVALID_INFO_BLOCK);
+}
+
+static void test_names(void)
+{
+    CHECK("element name starting with a digit",
+          first_error("<a><1b></1b></a>"), XML_INVALID_NAME);
+    CHECK("element name with an invalid character",
+          first_error("<a><b=c></b=c></a>"), XML_INVALID_NAME);
+}
+
+static void test_error_list(void)
+{
+    const char *xml =
+        "<a>\n"
+        "  <b n=1></b>\n"
+        "  <c></d>\n"
+        "</a>\n";
+    xmlErrorInfo errors[MAX_ERRORS];
+    xmlErrorList list;
+    int num;
+
+    list.max_errors = MAX_ERRORS;
+    list.errors = errors;
+    num = validate(xml, &list);
+
+    CHECK("three errors are collected", num, 3);
+    CHECK("list reports three errors", list.num_errors, 3);
+    if (list.num_errors == 3)
+    {
+        CHECK("first error number", errors[0].err_no,
+                                    XML_ATTRIB_NO_OPENING_QUOTE);
+        CHECK("first error line", errors[0].line_no, 2);
+        CHECK("first error column", errors[0].column_no, 7);
+        CHECK("second error number", errors[1].err_no,
+                                     XML_ELEMENT_NO_OPENING_TAG);
+        CHECK("second error line", errors[1].line_no, 3);
+        CHECK("second error column", errors[1].column_no, 5);
+        CHECK("third error number", errors[2].err_no,
+                                    XML_ELEMENT_NO_CLOSING_TAG);
+        CHECK("third error line", errors[2].line_no, 4);
+        CHECK("third error column", errors[2].column_no, 0);
+    }
+}
+
+static void test_list_limits(void)
+{
+    const char *xml = "<a></b></c></d></e></a>";
+    xmlErrorInfo errors[2];
+    xmlErrorList list;
+    xmlId *id;
+
+    list.max_errors = 2;
+    list.errors = errors;
+    CHECK("scanning stops when the list is full", validate(xml, &list), 2);
+    CHECK("list is not overrun", list.num_errors, 2);
+
+    CHECK("a NULL list stops at the first error", validate(xml, NULL), 1);
+
+    id = xmlInitBufferFlags(xml, (int)strlen(xml), XML_SCAN_NODES);
+    if (id)
+    {
+        xmlValidate(id, NULL);
+        CHECK("first error is stored in the XML-id",
+              xmlErrorGetNo(id, 1), XML_ELEMENT_NO_OPENING_TAG);
+        xmlClose(id);
+    }
+}
+
+static void test_line_index(void)
+{
+    const char *line = "  <item n=\"1\">a rather long line of text</item>\n";
+    int lines = 2000, i, num;
+    size_t len = strlen(line);
+    xmlErrorInfo errors[MAX_ERRORS];
+    xmlErrorList list;
+    char *xml;
+
+    xml = malloc(lines*len + 64);
+    if (!xml) return;
+
+    strcpy(xml, "<a>\n");
+    for (i=0; i<lines; i++) {
+        strcat(xml + 4 + (i ? (i-1)*len : 0), line);
+    }
+    strcat(xml + 4 + (lines-1)*len, "  <b n=1/>\n</a>\n");
+
+    list.max_errors = MAX_ERRORS;
+    list.errors = errors;
+    num = validate(xml, &list);
+
+    CHECK("one error in a large document", num, 1);
+    if (num == 1)
+    {
+        CHECK("line number in a large document", errors[0].line_no, lines+2);
+        CHECK("column number in a large document", errors[0].column_no, 7);
+    }
+    free(xml);
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== test_validate: single pass well-formedness tests ===\n\n");
+
+    test_well_formed();
+    test_tag_balance();
+    test_attribute_quoting();
+    test_sections();
+    test_names();
+    test_error_list();
+    test_list_limits();
+    test_line_index();
+
+    return test_results();
+}
@@ -0,0 +1,248 @@
+/*
+ * test_watch.c
+ *
+ * Tests for the hot reload of documents opened with xmlWatchOpen.
+ *
+ * Coverage
+ * --------
+ *  1. A file which is replaced is reloaded by the watching thread
+ *  2. A pinned document stays valid while a new document is published
+ *  3. Contents which can not be opened keep the previous document
+ *  4. xmlWatchReload only reloads a changed file
+ *  5. Readers in other threads always see a complete document while the
+ *     file is replaced over and over
+ *
+ * Exit code: 0 = all tests passed, 1 = one or more tests failed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "xml.h"
+#include "test_shared.h"
+
+#define NUM_THREADS	4
+#define NUM_VERSIONS	20
+
+static char fname[1024];
+static char tname[1024+8];
+
+/*
+ * Replace the file by renaming a new file into place, the way editors and
+ * deployment tools do. The version is stored twice so a reader can tell
+ * whether it sees one complete document.
+ */
+static void write_version(int version)
+{
+    FILE *f = fopen(tname, "wb");
+    if (f)
+    {
+        fprintf(f, "<config>\n"
+                   "  <version>%i</version>\n"
+                   "  <server><port>%i</port></server>\n"
+                   "</config>\n", version, 1000+version);
+        fclose(f);
+        rename(tname, fname);
+    }
+}
+
+static void write_invalid(void)
+{
+    FILE *f = fopen(tname, "wb");
+    if (f)
+    {
+        fprintf(f, "<config>\n"
+                   "  <version>99</version>\n"
+                   "  <bad><!-- unterminated </bad>\n"
+                   "</config>\n");
+        fclose(f);
+        rename(tname, fname);
+    }
+}
+
+static void pause_ms(int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms/1000;
+    ts.tv_nsec = (long)(ms%1000)*1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static int version(xmlWatch *wid)
+{
+    int guard, rv;
+    xmlId *id = xmlWatchAcquire(wid, &guard);
+
+    rv = (int)xmlNodeGetInt(id, "/config/version");
+    xmlWatchRelease(wid, guard);
+
+    return rv;
+}
+
+/* wait up to five seconds for the watching thread to publish a version */
+static int wait_version(xmlWatch *wid, int expected)
+{
+    int i, rv = version(wid);
+
+    for (i=0; i<500 && rv != expected; i++)
+    {
+        pause_ms(10);
+        rv = version(wid);
+    }
+    return rv;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_reload(xmlWatch *wid)
+{
+    CHECK("first version", version(wid), 1);
+
+    write_version(2);
+    CHECK("replaced file is reloaded", wait_version(wid, 2), 2);
+}
+
+static void test_pinned(xmlWatch *wid)
+{
+    int guard;
+    xmlId *id = xmlWatchAcquire(wid, &guard);
+    xmlId *xid;
+
+    CHECK("pinned version", xmlNodeGetInt(id, "/config/version"), 2);
+    xid = xmlNodeGet(id, "/config/server");
+
+    write_version(3);
+    CHECK("new version is published while pinned", wait_version(wid, 3), 3);
+    CHECK("pinned document stays valid",
+          xmlNodeGetInt(id, "/config/version"), 2);
+    if (xid)
+    {
+        CHECK("XML-id of the pinned document stays valid",
+              xmlNodeGetInt(xid, "port"), 1002);
+        xmlFree(xid);
+    }
+    xmlWatchRelease(wid, guard);
+}
+
+static void test_invalid(xmlWatch *wid)
+{
+    write_invalid();
+    pause_ms(100);
+    CHECK("invalid contents are not reloaded", xmlWatchReload(wid), XML_FALSE);
+    CHECK("previous document stays in use", version(wid), 3);
+
+    write_version(4);
+    CHECK("valid contents are reloaded", wait_version(wid, 4), 4);
+    CHECK("unchanged file is not reloaded", xmlWatchReload(wid), XML_FALSE);
+}
+
+#if HAVE_PTHREAD_H
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int done = 0;
+
+static int is_done(void)
+{
+    int rv;
+
+    pthread_mutex_lock(&mutex);
+    rv = done;
+    pthread_mutex_unlock(&mutex);
+
+    return rv;
+}
+
+static void *reader(void *arg)
+{
+    xmlWatch *wid = (xmlWatch*)arg;
+    long errors = 0;
+
+    while (!is_done())
+    {
+        int guard, v, port;
+        xmlId *id = xmlWatchAcquire(wid, &guard);
+
+        v = (int)xmlNodeGetInt(id, "/config/version");
+        port = (int)xmlNodeGetInt(id, "/config/server/port");
+        if (port != 1000+v || v < 4) errors++;
+        xmlWatchRelease(wid, guard);
+    }
+    return (void*)errors;
+}
+
+static void test_readers(xmlWatch *wid)
+{
+    pthread_t threads[NUM_THREADS];
+    int i;
+
+    for (i=0; i<NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, reader, wid);
+    }
+
+    for (i=5; i<5+NUM_VERSIONS; i++)
+    {
+        write_version(i);
+        wait_version(wid, i);
+    }
+    CHECK("last version is published", version(wid), 4+NUM_VERSIONS);
+
+    pthread_mutex_lock(&mutex);
+    done = 1;
+    pthread_mutex_unlock(&mutex);
+    for (i=0; i<NUM_THREADS; i++)
+    {
+        void *errors = NULL;
+
+        pthread_join(threads[i], &errors);
+        CHECK("reader sees complete documents only", (long)errors, 0);
+    }
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    xmlWatch *wid;
+
+    printf("=== test_watch: hot reload tests ===\n\n");
+
+    snprintf(fname, sizeof(fname), "/tmp/test_watch-%i.xml", (int)getpid());
+    snprintf(tname, sizeof(tname), "%s.tmp", fname);
+
+    CHECK("missing file is not watched", xmlWatchOpen(fname, NULL) == NULL, 1);
+
+    write_version(1);
+    wid = xmlWatchOpen(fname, NULL);
+    CHECK("file is watched", wid != NULL, 1);
+    if (wid)
+    {
+        test_reload(wid);
+        test_pinned(wid);
+        test_invalid(wid);
+#if HAVE_PTHREAD_H
+        test_readers(wid);
+#endif
+        xmlWatchClose(wid);
+    }
+
+    remove(fname);
+
+    return test_results();
+}